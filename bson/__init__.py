@@ -15,8 +15,11 @@
 """BSON (Binary JSON) encoding and decoding.
 """
 
+import array
 import calendar
 import datetime
+import mmap
+import os
 import re
 import struct
 import uuid
@@ -24,6 +27,8 @@ import warnings
 
 from bson.binary import Binary
 from bson.code import Code
+from bson.columns import (Column,
+                          TYPECODES)
 from bson.dbref import DBRef
 from bson.errors import (InvalidBSON,
                          InvalidDocument,
@@ -42,6 +47,8 @@ try:
 except ImportError:
     _use_c = False
 
+from bson.raw_bson import RawBSONDocument
+
 
 # This sort of sucks, but seems to be as good as it gets...
 RE_TYPE = type(re.compile(""))
@@ -54,6 +61,11 @@ MIN_INT64 = -9223372036854775808
 EPOCH_AWARE = datetime.datetime.fromtimestamp(0, utc)
 EPOCH_NAIVE = datetime.datetime.utcfromtimestamp(0)
 
+# Custom types (see register_encoder and register_decoder): Python type
+# -> encoder, and (BSON type, binary subtype or None) -> decoder
+_encoders = {}
+_decoders = {}
+
 
 def _get_int(data, as_class=None, tz_aware=False, unsigned=False):
     format = unsigned and "I" or "i"
@@ -102,7 +114,12 @@ def _get_string(data, as_class, tz_aware):
 
 
 def _get_object(data, as_class, tz_aware):
+    # DBRefs are always decoded eagerly
+    if as_class is RawBSONDocument and data[5:10] == b"$ref\x00":
+        as_class = dict
     (object, data) = _bson_to_dict(data, as_class, tz_aware)
+    if isinstance(object, RawBSONDocument):
+        return (object, data)
     if "$ref" in object:
         return (DBRef(object.pop("$ref"), object.pop("$id"),
                       object.pop("$db", None), object), data)
@@ -147,10 +164,11 @@ def _get_boolean(data, as_class, tz_aware):
 
 
 def _get_date(data, as_class, tz_aware):
-    seconds = struct.unpack("<q", data[:8])[0] / 1000.0
+    millis = struct.unpack("<q", data[:8])[0]
     if tz_aware:
-        return (EPOCH_AWARE + datetime.timedelta(seconds=seconds), data[8:])
-    return (EPOCH_NAIVE + datetime.timedelta(seconds=seconds), data[8:])
+        return (EPOCH_AWARE + datetime.timedelta(milliseconds=millis),
+                data[8:])
+    return (EPOCH_NAIVE + datetime.timedelta(milliseconds=millis), data[8:])
 
 
 def _get_code_w_scope(data, as_class, tz_aware):
@@ -185,7 +203,7 @@ def _get_regex(data, as_class, tz_aware):
 
 def _get_ref(data, as_class, tz_aware):
     (collection, data) = _get_c_string(data[4:])
-    (oid, data) = _get_oid(data)
+    (oid, data) = _get_oid(data, as_class, tz_aware)
     return (DBRef(collection, oid), data)
 
 
@@ -225,7 +243,15 @@ _element_getter = {
 def _element_to_dict(data, as_class, tz_aware):
     element_type = data[0]
     (element_name, data) = _get_c_string(data[1:])
+    decoder = None
+    if _decoders:
+        # The subtype follows the binary's length.
+        if element_type == 0x05 and len(data) > 4:
+            decoder = _decoders.get((0x05, data[4]))
+        decoder = decoder or _decoders.get((element_type, None))
     (value, data) = _element_getter[element_type](data, as_class, tz_aware)
+    if decoder is not None:
+        value = decoder(value)
     return (element_name, value, data)
 
 
@@ -243,6 +269,8 @@ def _bson_to_dict(data, as_class, tz_aware):
         raise InvalidBSON("objsize too large")
     if data[obj_size - 1] != 0:
         raise InvalidBSON("bad eoo")
+    if as_class is RawBSONDocument:
+        return (RawBSONDocument(data[:obj_size], tz_aware), data[obj_size:])
     elements = data[4:obj_size - 1]
     return (_elements_to_dict(elements, as_class, tz_aware), data[obj_size:])
 if _use_c:
@@ -261,6 +289,10 @@ def _element_to_bson(key, value, check_keys):
             raise InvalidDocument("key %r must not contain '.'" % key)
 
     name = _make_c_string(key, True)
+    if _encoders:
+        encoder = _encoders.get(type(value))
+        if encoder is not None:
+            return _element_to_bson(key, encoder(value), check_keys)
     if isinstance(value, float):
         return b"\x01" + name + struct.pack("<d", value)
 
@@ -288,6 +320,8 @@ def _element_to_bson(key, value, check_keys):
         return b"\x02" + name + length + cstring
     if isinstance(value, dict):
         return b"\x03" + name + _dict_to_bson(value, check_keys, False)
+    if isinstance(value, RawBSONDocument):
+        return b"\x03" + name + value.raw
     if isinstance(value, (list, tuple)):
         as_dict = SON(zip([str(i) for i in range(len(value))], value))
         return b"\x04" + name + _dict_to_bson(as_dict, check_keys, False)
@@ -342,7 +376,11 @@ def _element_to_bson(key, value, check_keys):
                           type(value))
 
 
-def _dict_to_bson(dict, check_keys, top_level=True):
+def _dict_to_bson(dict, check_keys, top_level=True, size_hint=0):
+    # `size_hint` (the expected size of the encoding) is only used by
+    # the C extension, to allocate its buffer up front.
+    if isinstance(dict, RawBSONDocument):
+        return dict.raw
     try:
         elements = b""
         if top_level and "_id" in dict:
@@ -372,30 +410,343 @@ def _to_dicts(data, as_class=dict, tz_aware=True):
     return decode_all(data, as_class, tz_aware)
 
 
-def decode_all(data, as_class=dict, tz_aware=True):
+def _compile_fields(fields):
+    """Build a tree of the wanted fields from names or dotted paths.
+
+    Each name maps to ``None`` if the whole value is wanted, or to the
+    tree of wanted fields in that embedded document.
+    """
+    tree = {}
+    for field in fields:
+        if not isinstance(field, str):
+            raise TypeError("fields must be instances of str")
+        node = tree
+        parts = field.split(".")
+        for part in parts[:-1]:
+            node = node.setdefault(part, {})
+            if node is None:
+                break
+        else:
+            node[parts[-1]] = None
+    return tree
+
+
+def _project(document, fields, as_class):
+    result = as_class()
+    for (key, value) in document.items():
+        if key in fields:
+            if fields[key] is not None and isinstance(value, as_class):
+                value = _project(value, fields[key], as_class)
+            result[key] = value
+    return result
+
+
+def decode_all(data, as_class=dict, tz_aware=True, offset=0, fields=None):
     """Decode BSON data to multiple documents.
 
     `data` must be a string of concatenated, valid, BSON-encoded
-    documents.
+    documents. Any object supporting the buffer protocol (e.g.
+    :class:`bytearray` or :class:`memoryview`) is also accepted; the C
+    extension decodes it in place without copying.
+
+    If `fields` is given only those fields are decoded: the C extension
+    skips over every other element without creating any objects for it.
+    Dotted paths select fields of embedded documents (but not of
+    documents within arrays, which are kept whole).
 
     :Parameters:
       - `data`: BSON data
       - `as_class` (optional): the class to use for the resulting
-        documents
+        documents - use :class:`~bson.raw_bson.RawBSONDocument` to
+        only decode fields as they are accessed
       - `tz_aware` (optional): if ``True``, return timezone-aware
         :class:`~datetime.datetime` instances
-
+      - `offset` (optional): the position in `data` of the first
+        document
+      - `fields` (optional): an iterable of the names (or dotted paths)
+        of the fields to decode; ignored for
+        :class:`~bson.raw_bson.RawBSONDocument`
+
+    .. versionchanged:: 2.0+
+       Added support for buffers and the `offset` and `fields`
+       parameters.
     .. versionadded:: 1.9
     """
+    if not isinstance(data, bytes):
+        data = bytes(data)
+    if not 0 <= offset <= len(data):
+        raise ValueError("offset out of range")
+    data = data[offset:]
+    if fields is not None:
+        fields = _compile_fields(fields)
     docs = []
     while len(data):
         (doc, data) = _bson_to_dict(data, as_class, tz_aware)
+        if fields is not None and as_class is not RawBSONDocument:
+            doc = _project(doc, fields, as_class)
         docs.append(doc)
     return docs
 if _use_c:
     decode_all = _cbson.decode_all
 
 
+def decode_iter(data, as_class=dict, tz_aware=True, offset=0, fields=None):
+    """Decode BSON data to multiple documents, one at a time.
+
+    Works like :func:`decode_all`, but returns an iterator that only
+    decodes each document when it is reached, so only the current
+    document needs to be kept in memory. The iterator keeps a reference
+    to `data` (and a lock on it, for buffers) until it is discarded.
+
+    :Parameters:
+      - `data`: BSON data
+      - `as_class` (optional): the class to use for the resulting
+        documents
+      - `tz_aware` (optional): if ``True``, return timezone-aware
+        :class:`~datetime.datetime` instances
+      - `offset` (optional): the position in `data` of the first
+        document
+      - `fields` (optional): an iterable of the names (or dotted paths)
+        of the fields to decode
+
+    .. versionadded:: 2.0+
+    """
+    if not isinstance(data, bytes):
+        data = bytes(data)
+    if not 0 <= offset <= len(data):
+        raise ValueError("offset out of range")
+    if fields is not None:
+        fields = _compile_fields(fields)
+    return _decode_iter(memoryview(data)[offset:], as_class, tz_aware, fields)
+if _use_c:
+    decode_iter = _cbson.decode_iter
+
+
+def _decode_iter(data, as_class, tz_aware, fields):
+    position = 0
+    while position < len(data):
+        if len(data) - position < 4:
+            raise InvalidBSON("not enough data for a BSON document")
+        size = struct.unpack_from("<i", data, position)[0]
+        (doc, _) = _bson_to_dict(bytes(data[position:position + max(size, 0)]),
+                                 as_class, tz_aware)
+        if fields is not None and as_class is not RawBSONDocument:
+            doc = _project(doc, fields, as_class)
+        position += size
+        yield doc
+
+
+def decode_file_iter(path, as_class=dict, tz_aware=True, fields=None):
+    """Decode the BSON documents in the file at `path`, one at a time.
+
+    The file is memory-mapped rather than read, and each document is
+    decoded straight out of the mapping when it is reached (as with
+    :func:`decode_iter`), so files much larger than memory can be
+    decoded. Use :class:`~bson.raw_bson.RawBSONDocument` for `as_class`
+    to get each document's BSON without decoding it, e.g. to pass to
+    :meth:`~pymongo.collection.Collection.insert_raw_stream`.
+
+    The file is unmapped once the iterator is exhausted or closed.
+
+    :Parameters:
+      - `path`: the path of a file of concatenated BSON documents, like
+        those written by ``mongodump``
+      - `as_class` (optional): the class to use for the resulting
+        documents
+      - `tz_aware` (optional): if ``True``, return timezone-aware
+        :class:`~datetime.datetime` instances
+      - `fields` (optional): an iterable of the names (or dotted paths)
+        of the fields to decode
+
+    .. versionadded:: 2.0+
+    """
+    with open(path, "rb") as f:
+        # Empty files can't be mapped
+        if not os.fstat(f.fileno()).st_size:
+            return
+        mapping = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    try:
+        if _use_c:
+            docs = _cbson.decode_iter(mapping, as_class, tz_aware, 0, fields)
+        else:
+            if fields is not None:
+                fields = _compile_fields(fields)
+            # Slicing the mapping copies each document out of it.
+            docs = _decode_iter(mapping, as_class, tz_aware, fields)
+        for doc in docs:
+            yield doc
+    finally:
+        # The iterator must release its view of the mapping before the
+        # mapping can be closed.
+        docs = None
+        mapping.close()
+
+
+def _compile_columns(fields):
+    """Build a tree of the fields to decode into columns.
+
+    Like :func:`_compile_fields`, but each name maps to the field as
+    given if the whole value is wanted. Raises :class:`ValueError` if
+    one field is within another.
+    """
+    tree = {}
+    for field in fields:
+        if not isinstance(field, str):
+            raise TypeError("fields must be instances of str")
+        node = tree
+        parts = field.split(".")
+        for part in parts[:-1]:
+            node = node.setdefault(part, {})
+            if not isinstance(node, dict):
+                break
+        if not isinstance(node, dict) or isinstance(node.get(parts[-1]),
+                                                    dict):
+            raise ValueError("field %r overlaps another field" % field)
+        node[parts[-1]] = field
+    return tree
+
+
+def _find_columns(data, tree, found, tz_aware):
+    """Store the type, value and encoding of the elements in `data`
+    wanted by `tree` (see :func:`_compile_columns`) in `found`.
+    """
+    while data:
+        element_type = data[0]
+        (name, rest) = _get_c_string(data[1:])
+        (value, data) = _element_getter[element_type](rest, dict, tz_aware)
+        node = tree.get(name)
+        raw = rest[:len(rest) - len(data)]
+        if isinstance(node, dict):
+            if element_type == 0x03:
+                _find_columns(raw[4:-1], node, found, tz_aware)
+        elif node is not None and node not in found:
+            # Like the C extension, use the first of repeated fields.
+            found[node] = (element_type, value, raw)
+
+
+def _make_column(entries):
+    """Build a :class:`~bson.columns.Column` from the entries found by
+    :func:`_find_columns` (or ``None``) for each document.
+    """
+    mask = array.array("B", [entry is not None and
+                             entry[0] not in (0x06, 0x0A)
+                             for entry in entries])
+    types = set(entry[0] for (entry, present) in zip(entries, mask)
+                if present)
+    if types == set([0x10, 0x12]):
+        types = set([0x12])
+    type = len(types) == 1 and types.pop() or None
+
+    if type not in TYPECODES:
+        return Column(type, [entry[1] if present else None
+                             for (entry, present) in zip(entries, mask)],
+                      mask)
+    values = array.array(TYPECODES[type])
+    for (entry, present) in zip(entries, mask):
+        if not present:
+            values.append(0)
+        elif entry[0] == 0x01:
+            values.append(struct.unpack("<d", entry[2])[0])
+        elif entry[0] == 0x08:
+            values.append(entry[2][0] != 0)
+        elif entry[0] == 0x10:
+            values.append(struct.unpack("<i", entry[2])[0])
+        else:
+            values.append(struct.unpack("<q", entry[2])[0])
+    return Column(type, values, mask)
+
+
+def decode_all_columnar(data, fields, tz_aware=True, offset=0):
+    """Decode some fields of multiple BSON documents into columns.
+
+    Reads `data` like :func:`decode_all`, but returns a dictionary
+    mapping each of `fields` to a :class:`~bson.columns.Column` of its
+    values in every document: numbers, dates and booleans are stored
+    in an :class:`array.array` rather than as a Python object each.
+    The C extension skips every other element without decoding it.
+
+    Dotted paths select fields of embedded documents. If a document
+    repeats a field, only its first value is used.
+
+    :Parameters:
+      - `data`: BSON data
+      - `fields`: an iterable of the names (or dotted paths) of the
+        fields to decode; no field may be within another
+      - `tz_aware` (optional): if ``True``, return timezone-aware
+        :class:`~datetime.datetime` instances in columns of objects
+      - `offset` (optional): the position in `data` of the first
+        document
+
+    .. versionadded:: 2.0+
+    """
+    if not isinstance(data, bytes):
+        data = bytes(data)
+    if not 0 <= offset <= len(data):
+        raise ValueError("offset out of range")
+    fields = list(fields)
+    tree = _compile_columns(fields)
+    entries = dict((field, []) for field in fields)
+    data = data[offset:]
+    while data:
+        if len(data) < 5:
+            raise InvalidBSON("not enough data for a BSON document")
+        obj_size = struct.unpack("<i", data[:4])[0]
+        if len(data) < obj_size:
+            raise InvalidBSON("objsize too large")
+        if obj_size < 5:
+            raise InvalidBSON("objsize too small")
+        if data[obj_size - 1] != 0:
+            raise InvalidBSON("bad eoo")
+        found = {}
+        try:
+            _find_columns(data[4:obj_size - 1], tree, found, tz_aware)
+        except InvalidBSON:
+            raise
+        except Exception as e:
+            raise InvalidBSON(str(e))
+        for (field, column) in entries.items():
+            column.append(found.get(field))
+        data = data[obj_size:]
+    return dict((field, _make_column(column))
+                for (field, column) in entries.items())
+if _use_c:
+    decode_all_columnar = _cbson.decode_all_columnar
+
+
+def validate_all(data, offset=0):
+    """Check the structure of BSON data holding multiple documents.
+
+    `data` is checked the way :func:`decode_all` would read it, without
+    creating any objects: document and element sizes, terminators,
+    element types and UTF-8. The C extension releases the GIL while it
+    checks a large buffer, so several threads can validate replies at
+    once.
+
+    Raises :class:`~bson.errors.InvalidBSON` if `data` is invalid, and
+    returns the number of documents otherwise.
+
+    :Parameters:
+      - `data`: BSON data, as :class:`bytes` or any object supporting
+        the buffer protocol
+      - `offset` (optional): the position in `data` of the first
+        document
+
+    .. versionadded:: 2.0+
+    """
+    if not isinstance(data, bytes):
+        data = bytes(data)
+    if not 0 <= offset <= len(data):
+        raise ValueError("offset out of range")
+    try:
+        return len(decode_all(data, dict, False, offset))
+    except InvalidBSON:
+        raise
+    except Exception as e:
+        raise InvalidBSON(str(e))
+if _use_c:
+    validate_all = _cbson.validate_all
+
+
 def is_valid(bson):
     """Check that the given string represents valid :class:`BSON` data.
 
@@ -504,3 +855,128 @@ def has_c():
         return True
     except ImportError:
         return False
+
+
+def set_regex_caching(enabled):
+    """Enable or disable the cache of decoded regular expressions.
+
+    The C extension keeps the regular expressions it has recently
+    decoded, so documents that hold the same pattern (with the same
+    flags) share one compiled pattern object. Pass ``False`` to compile
+    each regular expression as it is decoded, and to empty the cache.
+    Note that :func:`re.compile` keeps a cache of its own, so even then
+    equal patterns may be the same object. This has no effect without
+    the C extension.
+
+    :Parameters:
+      - `enabled`: whether decoded regular expressions should be cached
+
+    .. versionadded:: 2.0+
+    """
+    if _use_c:
+        _cbson._set_regex_caching(enabled)
+
+
+def register_encoder(python_type, encoder):
+    """Encode instances of `python_type` with `encoder`.
+
+    `encoder` is called with each value whose type is exactly
+    `python_type` (before any of the built-in conversions, and not for
+    instances of subclasses), and must return a value that can be
+    encoded instead: a :class:`str` for a :class:`~decimal.Decimal`,
+    say. Unlike a :class:`~pymongo.son_manipulator.SONManipulator`,
+    this doesn't walk every document in Python, so only values of the
+    registered types cost a Python call. Pass ``None`` as `encoder` to
+    stop encoding `python_type` specially. Registered encoders are
+    process wide.
+
+    :Parameters:
+      - `python_type`: the type to encode
+      - `encoder`: a callable taking an instance of `python_type`, or
+        ``None``
+
+    .. versionadded:: 2.0+
+    """
+    if not isinstance(python_type, type):
+        raise TypeError("python_type must be a type")
+    if encoder is not None and not callable(encoder):
+        raise TypeError("encoder must be callable or None")
+    if _use_c:
+        _cbson._register_encoder(python_type, encoder)
+    if encoder is None:
+        _encoders.pop(python_type, None)
+    else:
+        _encoders[python_type] = encoder
+
+
+def register_decoder(bson_type, decoder, subtype=None):
+    """Decode values of BSON type `bson_type` with `decoder`.
+
+    `decoder` is called with each decoded value of that type (a
+    :class:`str` for type 2, a :class:`~bson.binary.Binary` for most
+    binary subtypes, and so on) and returns the value to put in the
+    document instead. If `subtype` is given, `bson_type` must be 5
+    (binary) and `decoder` is only used for, and takes precedence over
+    any decoder for all binaries for, that subtype. Pass ``None`` as
+    `decoder` to stop decoding the type specially. Registered decoders
+    are process wide, and aren't applied to the columns returned by
+    :func:`decode_all_columnar`.
+
+    :Parameters:
+      - `bson_type`: the BSON type code, from 1 to 255 (``0xFF`` is
+        MinKey)
+      - `decoder`: a callable taking the decoded value, or ``None``
+      - `subtype` (optional): the binary subtype, from 0 to 255
+
+    .. versionadded:: 2.0+
+    """
+    if not isinstance(bson_type, int) or not 1 <= bson_type <= 255:
+        raise ValueError("bson_type must be an int from 1 to 255")
+    if subtype is not None and (bson_type != 5 or
+                                not isinstance(subtype, int) or
+                                not 0 <= subtype <= 255):
+        raise ValueError("subtype must be an int from 0 to 255, and is "
+                         "only allowed for binary (type 5)")
+    if decoder is not None and not callable(decoder):
+        raise TypeError("decoder must be callable or None")
+    if _use_c:
+        _cbson._register_decoder(bson_type,
+                                 subtype is None and -1 or subtype, decoder)
+    if decoder is None:
+        _decoders.pop((bson_type, subtype), None)
+    else:
+        _decoders[(bson_type, subtype)] = decoder
+
+
+def codec_stats(reset=False):
+    """Get the counters the C extension keeps while encoding and decoding.
+
+    Returns a dict with:
+
+      - ``documents_encoded``, ``bytes_encoded``, ``documents_decoded``
+        and ``bytes_decoded``: top-level documents (and their size in
+        bytes) encoded and decoded
+      - ``elements_encoded`` and ``elements_decoded``: dicts mapping each
+        BSON type code seen to the number of elements of that type
+      - ``isinstance_checks`` and ``isinstance_hits``: values whose type
+        could only be found with :func:`isinstance` (instances of
+        subclasses, say), and how many of those checks matched
+      - ``no_decoder``: elements of a type the C extension can't decode
+      - ``reloads``: times the cached Python types were reloaded
+      - ``buffer_grows`` and ``buffer_peak_size``: times a buffer (for
+        encoding documents, or building messages in
+        :mod:`pymongo.message`) had to be grown, and the size of the
+        largest one
+
+    The counters are process wide and aren't synchronized, other than by
+    the GIL. Returns ``None`` without the C extension.
+
+    :Parameters:
+      - `reset` (optional): if ``True``, set every counter back to zero
+        after reading them
+
+    .. versionadded:: 2.0+
+    """
+    if _use_c:
+        return _cbson.stats(reset)
+    return None
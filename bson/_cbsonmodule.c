@@ -23,13 +23,33 @@
 #include "Python.h"
 #include "datetime.h"
 
+#include <time.h>
+#if defined(WIN32) || defined(_MSC_VER)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
 #include "buffer.h"
-#include "time64.h"
 #include "encoding_helpers.h"
 
 #define _CBSON_MODULE
 #include "_cbsonmodule.h"
 
+/* Number of slots in the cache of decoded key names, a power of two */
+#define KEY_CACHE_SIZE 512
+/* Longer key names aren't cached */
+#define KEY_CACHE_MAX_LENGTH 64
+/* Number of slots in the cache of decoded regexes, a power of two */
+#define REGEX_CACHE_SIZE 256
+/* Regexes with a longer pattern and flags than this aren't cached */
+#define REGEX_CACHE_MAX_LENGTH 1024
+/* Deepest nesting validate_all accepts, to bound its recursion */
+#define VALIDATE_MAX_DEPTH 256
+/* Release the GIL to validate more data than this */
+#define VALIDATE_NOGIL_THRESHOLD 65536
+
 struct module_state {
     PyObject* Binary;
     PyObject* Code;
@@ -41,7 +61,24 @@ struct module_state {
     PyObject* MinKey;
     PyObject* MaxKey;
     PyObject* UTC;
+    PyObject* Column;
+    PyObject* Array;
+    PyObject* SON;
+    /* The name of the attribute holding a SON's list of keys */
+    PyObject* SONKeys;
     PyTypeObject* REType;
+    PyObject* key_cache[KEY_CACHE_SIZE];
+    /* The encoded pattern and flags of each cached regex, and the
+     * compiled pattern for them */
+    PyObject* regex_cache_keys[REGEX_CACHE_SIZE];
+    PyObject* regex_cache_values[REGEX_CACHE_SIZE];
+    unsigned char no_regex_cache;
+    /* Registered custom types: a dict of Python type -> encoder, and the
+     * decoder for each BSON type and for each binary subtype */
+    PyObject* encoders;
+    PyObject* decoders[256];
+    PyObject* binary_decoders[256];
+    int decoder_count;
 };
 
 #define GETSTATE(m) ((struct module_state*)PyModule_GetState(m))
@@ -51,77 +88,180 @@ struct module_state {
 /* Maximum number of regex flags */
 #define FLAGS_SIZE 7
 
-#if defined(WIN32) || defined(_MSC_VER)
-/* This macro is basically an implementation of asprintf for win32
- * We get the length of the int as string and malloc a buffer for it,
- * returning -1 if that malloc fails. We then actually print to the
- * buffer to get the string value as an int. Like asprintf, the result
- * must be explicitly free'd when done being used.
- */
 #if defined(_MSC_VER) && (_MSC_VER >= 1400)
-#define INT2STRING(buffer, i)                                           \
-    *(buffer) = malloc(_scprintf("%d", (i)) + 1),                       \
-        (!(buffer) ?                                                    \
-         -1 :                                                           \
-         _snprintf_s(*(buffer),                                         \
-                     _scprintf("%d", (i)) + 1,                          \
-                     _scprintf("%d", (i)) + 1,                          \
-                     "%d",                                              \
-                     (i)))
 #define STRCAT(dest, n, src) strcat_s((dest), (n), (src))
 #else
-#define INT2STRING(buffer, i)                                           \
-    *(buffer) = malloc(_scprintf("%d", (i)) + 1),                       \
-        (!(buffer) ?                                                    \
-         -1 :                                                           \
-         _snprintf(*(buffer),                                           \
-                     _scprintf("%d", (i)) + 1,                          \
-                     "%d",                                              \
-                     (i)))
-#define STRCAT(dest, n, src) strcat((dest), (src))
-#endif
-#else
-#define INT2STRING(buffer, i) asprintf((buffer), "%d", (i))
 #define STRCAT(dest, n, src) strcat((dest), (src))
 #endif
 
-
-static PyObject* elements_to_dict(PyObject* self, const char* string, int max,
-                                  PyObject* as_class, unsigned char tz_aware);
+/* Counters returned by stats(). Protected by the GIL. */
+static struct {
+    unsigned long long documents_encoded;
+    unsigned long long bytes_encoded;
+    unsigned long long documents_decoded;
+    unsigned long long bytes_decoded;
+    /* Indexed by the BSON type byte */
+    unsigned long long elements_encoded[256];
+    unsigned long long elements_decoded[256];
+    /* Encoded values whose type needed PyObject_IsInstance, and how many
+     * of those calls matched */
+    unsigned long long isinstance_checks;
+    unsigned long long isinstance_hits;
+    /* Elements of a type get_value can't decode */
+    unsigned long long no_decoder;
+    unsigned long long reloads;
+} codec_stats;
+
+
+static PyObject* elements_to_dict(PyObject* self, PyObject* owner,
+                                  const char* string, int max,
+                                  PyObject* as_class, unsigned char tz_aware,
+                                  unsigned char validated);
+
+static PyObject* get_value(PyObject* self, PyObject* owner, const char* buffer,
+                           int* position, int type, int max, PyObject* as_class,
+                           unsigned char tz_aware, unsigned char validated);
 
 static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_byte, PyObject* value,
                                     unsigned char check_keys, unsigned char first_attempt);
 
+static int _element_value_size(const char* buffer, int position, int type, int max);
+
+/* An element of a RawBSONDocument. Offsets are relative to the start
+ * of the document's elements. */
+typedef struct {
+    int name;
+    int name_length;
+    int type;
+    int value;
+    PyObject* key;
+    PyObject* decoded;
+} raw_element;
+
+/* A BSON document that is only decoded as its fields are accessed. */
+typedef struct {
+    PyObject_HEAD
+    PyObject* module;
+    /* The object owning the encoded data - we point into its memory. */
+    PyObject* owner;
+    const char* elements;
+    int max;
+    unsigned char tz_aware;
+    /* Number of elements, or -1 until the index has been built. */
+    int count;
+    raw_element* index;
+} RawBSONDocument;
+
+static PyTypeObject RawBSONDocument_Type;
+
+static PyObject* raw_document_new(PyObject* self, PyObject* owner, const char* document,
+                                  int size, unsigned char tz_aware);
+
+/* An ObjectId, stored as its 12 bytes. */
+typedef struct {
+    PyObject_HEAD
+    char oid[12];
+} ObjectId;
+
+static PyTypeObject ObjectId_Type;
+
+static PyObject* objectid_from_bytes(const char* oid);
+
+/* An iterator decoding one document at a time from concatenated BSON. */
+typedef struct {
+    PyObject_HEAD
+    PyObject* module;
+    /* The object owning the encoded data - we point into its memory. */
+    PyObject* owner;
+    const char* string;
+    Py_ssize_t remaining;
+    PyObject* as_class;
+    unsigned char tz_aware;
+    /* A field filter from _compile_fields, or NULL. */
+    PyObject* fields;
+} DecodeIterator;
+
+static PyTypeObject DecodeIterator_Type;
+
 /* Date stuff */
-static PyObject* datetime_from_millis(long long millis) {
-    int microseconds = (millis % 1000) * 1000;
-    Time64_T seconds = millis / 1000;
-    struct TM timeinfo;
-    gmtime64_r(&seconds, &timeinfo);
+#define MILLIS_PER_DAY 86400000LL
+
+/* The tzinfo of `datetime`, a borrowed reference to Py_None if it is
+ * naive. */
+#define DATETIME_TZINFO(datetime)                                       \
+    (((_PyDateTime_BaseTZInfo*)(datetime))->hastzinfo ?                 \
+     ((PyDateTime_DateTime*)(datetime))->tzinfo : Py_None)
+
+/* Convert between a date in the proleptic Gregorian calendar and the
+ * number of days since the epoch, as in Howard Hinnant's
+ * "chrono-Compatible Low-Level Date Algorithms". */
+static long long days_from_civil(long long year, int month, int day) {
+    long long era;
+    int year_of_era, day_of_year, day_of_era;
+
+    year -= month <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    year_of_era = (int)(year - era * 400);
+    day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    day_of_era = (year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+                  day_of_year);
+    return era * 146097 + day_of_era - 719468;
+}
 
-    return PyDateTime_FromDateAndTime(timeinfo.tm_year + 1900,
-                                      timeinfo.tm_mon + 1,
-                                      timeinfo.tm_mday,
-                                      timeinfo.tm_hour,
-                                      timeinfo.tm_min,
-                                      timeinfo.tm_sec,
-                                      microseconds);
+static void civil_from_days(long long days, long long* year,
+                            int* month, int* day) {
+    long long era;
+    int day_of_era, year_of_era, day_of_year, march_month;
+
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    day_of_era = (int)(days - era * 146097);
+    year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+                   day_of_era / 146096) / 365;
+    day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 -
+                                year_of_era / 100);
+    march_month = (5 * day_of_year + 2) / 153;
+    *day = day_of_year - (153 * march_month + 2) / 5 + 1;
+    *month = march_month < 10 ? march_month + 3 : march_month - 9;
+    *year = year_of_era + era * 400 + (*month <= 2);
 }
 
-static long long millis_from_datetime(PyObject* datetime) {
-    struct TM timeinfo;
-    long long millis;
+/* Returns a new datetime with tzinfo `tzinfo` (Py_None for naive) */
+static PyObject* datetime_from_millis(long long millis, PyObject* tzinfo) {
+    long long days = millis / MILLIS_PER_DAY;
+    long long millis_of_day = millis % MILLIS_PER_DAY;
+    long long year;
+    int month, day, seconds;
+
+    if (millis_of_day < 0) {
+        millis_of_day += MILLIS_PER_DAY;
+        days--;
+    }
+    civil_from_days(days, &year, &month, &day);
+    if (year < 1 || year > 9999) {
+        PyErr_Format(PyExc_ValueError, "year %lld is out of range", year);
+        return NULL;
+    }
 
-    timeinfo.tm_year = PyDateTime_GET_YEAR(datetime) - 1900;
-    timeinfo.tm_mon = PyDateTime_GET_MONTH(datetime) - 1;
-    timeinfo.tm_mday = PyDateTime_GET_DAY(datetime);
-    timeinfo.tm_hour = PyDateTime_DATE_GET_HOUR(datetime);
-    timeinfo.tm_min = PyDateTime_DATE_GET_MINUTE(datetime);
-    timeinfo.tm_sec = PyDateTime_DATE_GET_SECOND(datetime);
+    seconds = (int)(millis_of_day / 1000);
+    return PyDateTimeAPI->DateTime_FromDateAndTime((int)year, month, day,
+                                                   seconds / 3600,
+                                                   seconds / 60 % 60,
+                                                   seconds % 60,
+                                                   (int)(millis_of_day % 1000) * 1000,
+                                                   tzinfo,
+                                                   PyDateTimeAPI->DateTimeType);
+}
 
-    millis = timegm64(&timeinfo) * 1000;
-    millis += PyDateTime_DATE_GET_MICROSECOND(datetime) / 1000;
-    return millis;
+static long long millis_from_datetime(PyObject* datetime) {
+    long long seconds = days_from_civil(PyDateTime_GET_YEAR(datetime),
+                                        PyDateTime_GET_MONTH(datetime),
+                                        PyDateTime_GET_DAY(datetime)) * 86400;
+
+    seconds += PyDateTime_DATE_GET_HOUR(datetime) * 3600 +
+        PyDateTime_DATE_GET_MINUTE(datetime) * 60 +
+        PyDateTime_DATE_GET_SECOND(datetime);
+    return seconds * 1000 + PyDateTime_DATE_GET_MICROSECOND(datetime) / 1000;
 }
 
 /* Just make this compatible w/ the old API. */
@@ -133,6 +273,38 @@ static int buffer_write_bytes(PyObject* self, buffer_t buffer, const char* data,
     return 1;
 }
 
+/* The two digit strings "00" through "99", used for array keys. */
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Format the array index `i` (which must be non-negative) as a key,
+ * without allocating. `name` must have room for INDEX_KEY_SIZE bytes.
+ * Returns a pointer into `name` at the start of the NULL terminated key
+ * and sets `length` to its size, including the NULL terminator. */
+#define INDEX_KEY_SIZE 21
+static const char* index_key(char* name, Py_ssize_t i, int* length) {
+    char* start = name + INDEX_KEY_SIZE - 1;
+    *start = 0;
+    while (i >= 100) {
+        Py_ssize_t pair = (i % 100) * 2;
+        i /= 100;
+        *--start = digit_pairs[pair + 1];
+        *--start = digit_pairs[pair];
+    }
+    if (i >= 10) {
+        *--start = digit_pairs[i * 2 + 1];
+        *--start = digit_pairs[i * 2];
+    } else {
+        *--start = (char)('0' + i);
+    }
+    *length = (int)(name + INDEX_KEY_SIZE - start);
+    return start;
+}
+
 /* returns 0 on failure */
 static int write_string(PyObject* self, buffer_t buffer, PyObject* py_string) {
     PyObject* encoded = PyUnicode_AsUTF8String(py_string);
@@ -196,19 +368,32 @@ static int _reload_object(PyObject** object, char* module_name, char* object_nam
 static int _reload_python_objects(PyObject* self) {
     struct module_state *state = GETSTATE(self);
 
+    codec_stats.reloads++;
+
     if (_reload_object(&state->Binary, "bson.binary", "Binary") ||
         _reload_object(&state->Code, "bson.code", "Code") ||
-        _reload_object(&state->ObjectId, "bson.objectid", "ObjectId") ||
         _reload_object(&state->DBRef, "bson.dbref", "DBRef") ||
         _reload_object(&state->Timestamp, "bson.timestamp", "Timestamp") ||
         _reload_object(&state->MinKey, "bson.min_key", "MinKey") ||
         _reload_object(&state->MaxKey, "bson.max_key", "MaxKey") ||
         _reload_object(&state->UTC, "bson.tz_util", "utc") ||
+        _reload_object(&state->Column, "bson.columns", "Column") ||
+        _reload_object(&state->Array, "array", "array") ||
+        _reload_object(&state->SON, "bson.son", "SON") ||
         _reload_object(&state->RECompile, "re", "compile") ||
         _reload_object(&state->UUID, "uuid", "UUID")) {
         return 1;
     }
 
+    Py_XSETREF(state->SONKeys, PyUnicode_InternFromString("_SON__keys"));
+    if (!state->SONKeys) {
+        return 1;
+    }
+
+    /* bson.objectid.ObjectId is our own ObjectId type. */
+    Py_INCREF(&ObjectId_Type);
+    Py_XSETREF(state->ObjectId, (PyObject*)&ObjectId_Type);
+
     /* Reload our REType hack too. */
     state->REType = PyObject_CallFunction(state->RECompile, "O",
                                           PyBytes_FromString(""))->ob_type;
@@ -224,6 +409,49 @@ static int write_element_to_buffer(PyObject* self, buffer_t buffer, int type_byt
     result = _write_element_to_buffer(self, buffer, type_byte, value,
                                       check_keys, first_attempt);
     Py_LeaveRecursiveCall();
+    /* A retry after reloading is counted by the first attempt. */
+    if (result && first_attempt) {
+        codec_stats.elements_encoded[
+            (unsigned char)buffer_get_buffer(buffer)[type_byte]]++;
+    }
+    return result;
+}
+
+/* Is `type` exactly one of the types that _write_element_to_buffer needs
+ * PyObject_IsInstance (or a later check) to find? Such values can be
+ * dispatched by comparing type pointers. */
+static int _is_known_exact_type(struct module_state* state, PyTypeObject* type) {
+    PyObject* cls = (PyObject*)type;
+    return (type == &PyUnicode_Type ||
+            type == &PyBytes_Type ||
+            type == state->REType ||
+            type == PyDateTimeAPI->DateTimeType ||
+            cls == state->ObjectId ||
+            cls == state->Binary ||
+            cls == state->UUID ||
+            cls == state->Code ||
+            cls == state->DBRef ||
+            cls == state->Timestamp ||
+            cls == state->MinKey ||
+            cls == state->MaxKey);
+}
+
+/* Is `value` an instance of `cls`? If `exact` is set, `value` is exactly
+ * of a known type (see _is_known_exact_type), so it can only be an
+ * instance of `cls` if that is its type. */
+static int _is_instance(PyObject* value, PyObject* cls, unsigned char exact) {
+    int result;
+    if ((PyObject*)Py_TYPE(value) == cls) {
+        return 1;
+    }
+    if (exact) {
+        return 0;
+    }
+    codec_stats.isinstance_checks++;
+    result = PyObject_IsInstance(value, cls);
+    if (result == 1) {
+        codec_stats.isinstance_hits++;
+    }
     return result;
 }
 
@@ -235,7 +463,30 @@ static int write_element_to_buffer(PyObject* self, buffer_t buffer, int type_byt
 static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_byte, PyObject* value,
                                     unsigned char check_keys, unsigned char first_attempt) {
     struct module_state *state = GETSTATE(self);
+    unsigned char exact;
+
+    /* A registered encoder converts its type to a value we can encode. */
+    if (state->encoders && PyDict_GET_SIZE(state->encoders)) {
+        PyObject* encoder = PyDict_GetItem(state->encoders,
+                                           (PyObject*)Py_TYPE(value));
+        if (encoder) {
+            PyObject* converted;
+            int result;
+            Py_INCREF(encoder);
+            converted = PyObject_CallFunctionObjArgs(encoder, value, NULL);
+            Py_DECREF(encoder);
+            if (!converted) {
+                return 0;
+            }
+            /* Not a first attempt, so the element is only counted once. */
+            result = write_element_to_buffer(self, buffer, type_byte,
+                                             converted, check_keys, 0);
+            Py_DECREF(converted);
+            return result;
+        }
+    }
 
+    exact = _is_known_exact_type(state, Py_TYPE(value));
     if (PyBool_Check(value)) {
         const long bool = PyLong_AsLong(value);
         const char c = bool ? 0x01 : 0x00;
@@ -274,15 +525,15 @@ static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_by
     } else if (value == Py_None) {
         *(buffer_get_buffer(buffer) + type_byte) = 0x0A;
         return 1;
-    } else if (PyDict_Check(value)) {
+    } else if (PyDict_Check(value) ||
+               PyObject_TypeCheck(value, &RawBSONDocument_Type)) {
         *(buffer_get_buffer(buffer) + type_byte) = 0x03;
         return write_dict(self, buffer, value, check_keys, 0);
     } else if (PyList_Check(value) || PyTuple_Check(value)) {
         int start_position,
             length_location,
-            items,
-            length,
-            i;
+            length;
+        Py_ssize_t i;
         char zero = 0;
 
         *(buffer_get_buffer(buffer) + type_byte) = 0x04;
@@ -295,27 +546,27 @@ static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_by
             return 0;
         }
 
-        items = PySequence_Size(value);
-        for(i = 0; i < items; i++) {
+        /* value is a list or tuple, so its items can be read in place.
+         * Re-check the size on each pass in case encoding an item
+         * changes the list, and hold a reference to the item meanwhile. */
+        for(i = 0; i < PySequence_Fast_GET_SIZE(value); i++) {
             int list_type_byte = buffer_save_space(buffer, 1);
-            char* name;
+            char name[INDEX_KEY_SIZE];
+            const char* key;
+            int key_length;
             PyObject* item_value;
 
             if (list_type_byte == -1) {
                 PyErr_NoMemory();
                 return 0;
             }
-            if (INT2STRING(&name, i) < 0 || !name) {
-                PyErr_NoMemory();
-                return 0;
-            }
-            if (!buffer_write_bytes(self, buffer, name, strlen(name) + 1)) {
-                free(name);
+            key = index_key(name, i, &key_length);
+            if (!buffer_write_bytes(self, buffer, key, key_length)) {
                 return 0;
             }
-            free(name);
 
-            item_value = PySequence_GetItem(value, i);
+            item_value = PySequence_Fast_GET_ITEM(value, i);
+            Py_INCREF(item_value);
             if (!write_element_to_buffer(self, buffer, list_type_byte, item_value, check_keys, 1)) {
                 Py_DECREF(item_value);
                 return 0;
@@ -330,7 +581,7 @@ static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_by
         length = buffer_get_position(buffer) - start_position;
         memcpy(buffer_get_buffer(buffer) + length_location, &length, 4);
         return 1;
-    } else if (PyObject_IsInstance(value, state->Binary)) {
+    } else if (_is_instance(value, state->Binary, exact)) {
         PyObject* subtype_object;
 
         *(buffer_get_buffer(buffer) + type_byte) = 0x05;
@@ -372,7 +623,7 @@ static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_by
             }
         }
         return 1;
-    } else if (PyObject_IsInstance(value, state->UUID)) {
+    } else if (_is_instance(value, state->UUID, exact)) {
         // Just a special case of Binary above, but simpler to do as a separate case
 
         // UUID is always 16 bytes, subtype 3
@@ -399,7 +650,7 @@ static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_by
         }
         Py_DECREF(bytes);
         return 1;
-    } else if (PyObject_IsInstance(value, state->Code)) {
+    } else if (_is_instance(value, state->Code, exact)) {
         int start_position,
             length_location,
             length;
@@ -454,40 +705,36 @@ static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_by
         return write_string(self, buffer, value);
     } else if (PyDateTime_Check(value)) {
         long long millis;
-        PyObject* utcoffset = PyObject_CallMethod(value, "utcoffset", NULL);
-        if (utcoffset != Py_None) {
-            PyObject* result = PyNumber_Subtract(value, utcoffset);
-            Py_DECREF(utcoffset);
-            if (!result) {
-                return 0;
-            }
-            millis = millis_from_datetime(result);
-            Py_DECREF(result);
-        } else {
+        PyObject* tzinfo = DATETIME_TZINFO(value);
+        /* Naive and UTC datetimes can be converted without asking
+         * for their offset. */
+        if (tzinfo == Py_None || tzinfo == state->UTC) {
             millis = millis_from_datetime(value);
-        }
-        *(buffer_get_buffer(buffer) + type_byte) = 0x09;
-        return buffer_write_bytes(self, buffer, (const char*)&millis, 8);
-    } else if (PyObject_IsInstance(value, state->ObjectId)) {
-        PyObject* pystring = PyObject_GetAttrString(value, "_ObjectId__id");
-        if (!pystring) {
-            return 0;
-        }
-        {
-            const char* as_string = PyBytes_AsString(pystring);
-            if (!as_string) {
-                Py_DECREF(pystring);
+        } else {
+            PyObject* utcoffset = PyObject_CallMethod(value, "utcoffset", NULL);
+            if (!utcoffset) {
                 return 0;
             }
-            if (!buffer_write_bytes(self, buffer, as_string, 12)) {
-                Py_DECREF(pystring);
-                return 0;
+            if (utcoffset != Py_None) {
+                PyObject* result = PyNumber_Subtract(value, utcoffset);
+                Py_DECREF(utcoffset);
+                if (!result) {
+                    return 0;
+                }
+                millis = millis_from_datetime(result);
+                Py_DECREF(result);
+            } else {
+                Py_DECREF(utcoffset);
+                millis = millis_from_datetime(value);
             }
-            Py_DECREF(pystring);
-            *(buffer_get_buffer(buffer) + type_byte) = 0x07;
         }
-        return 1;
-    } else if (PyObject_IsInstance(value, state->DBRef)) {
+        *(buffer_get_buffer(buffer) + type_byte) = 0x09;
+        return buffer_write_bytes(self, buffer, (const char*)&millis, 8);
+    } else if (exact ? Py_TYPE(value) == &ObjectId_Type :
+               PyObject_TypeCheck(value, &ObjectId_Type)) {
+        *(buffer_get_buffer(buffer) + type_byte) = 0x07;
+        return buffer_write_bytes(self, buffer, ((ObjectId*)value)->oid, 12);
+    } else if (_is_instance(value, state->DBRef, exact)) {
         PyObject* as_doc = PyObject_CallMethod(value, "as_doc", NULL);
         if (!as_doc) {
             return 0;
@@ -499,7 +746,7 @@ static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_by
         Py_DECREF(as_doc);
         *(buffer_get_buffer(buffer) + type_byte) = 0x03;
         return 1;
-    } else if (PyObject_IsInstance(value, state->Timestamp)) {
+    } else if (_is_instance(value, state->Timestamp, exact)) {
         PyObject* obj;
         long i;
 
@@ -607,10 +854,10 @@ static int _write_element_to_buffer(PyObject* self, buffer_t buffer, int type_by
         }
         *(buffer_get_buffer(buffer) + type_byte) = 0x0B;
         return 1;
-    } else if (PyObject_IsInstance(value, state->MinKey)) {
+    } else if (_is_instance(value, state->MinKey, exact)) {
         *(buffer_get_buffer(buffer) + type_byte) = 0xFF;
         return 1;
-    } else if (PyObject_IsInstance(value, state->MaxKey)) {
+    } else if (_is_instance(value, state->MaxKey, exact)) {
         *(buffer_get_buffer(buffer) + type_byte) = 0x7F;
         return 1;
     } else if (first_attempt) {
@@ -740,14 +987,60 @@ static int decode_and_write_pair(PyObject* self, buffer_t buffer,
     return 1;
 }
 
+/* Write the items of the SON `dict`, in the order of its list of
+ * `keys`, without calling SON's Python-level iterator.
+ *
+ * returns 0 on failure */
+static int write_son_items(PyObject* self, buffer_t buffer, PyObject* dict,
+                           PyObject* keys, unsigned char check_keys,
+                           unsigned char top_level) {
+    Py_ssize_t i;
+
+    /* Encoding a value can run Python code that changes the SON, so
+     * check the size of the list each time and hold on to each key. */
+    for (i = 0; i < PyList_GET_SIZE(keys); i++) {
+        PyObject* key = PyList_GET_ITEM(keys, i);
+        PyObject* value;
+        int result;
+
+        Py_INCREF(key);
+        value = PyDict_GetItem(dict, key);
+        if (!value) {
+            PyErr_SetObject(PyExc_KeyError, key);
+            Py_DECREF(key);
+            return 0;
+        }
+        Py_INCREF(value);
+        result = decode_and_write_pair(self, buffer, key, value,
+                                       check_keys, top_level);
+        Py_DECREF(value);
+        Py_DECREF(key);
+        if (!result) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /* returns 0 on failure */
 static int write_dict(PyObject* self, buffer_t buffer, PyObject* dict, unsigned char check_keys, unsigned char top_level) {
+    struct module_state *state = GETSTATE(self);
     PyObject* key;
     PyObject* iter;
     char zero = 0;
     int length;
     int length_location;
 
+    /* A RawBSONDocument is already encoded - just copy its bytes. */
+    if (PyObject_TypeCheck(dict, &RawBSONDocument_Type)) {
+        RawBSONDocument* raw = (RawBSONDocument*)dict;
+        if (top_level) {
+            codec_stats.documents_encoded++;
+            codec_stats.bytes_encoded += raw->max + 5;
+        }
+        return buffer_write_bytes(self, buffer, raw->elements - 4, raw->max + 5);
+    }
+
     if (!PyDict_Check(dict)) {
         PyObject* errmsg = PyUnicode_FromString("encoder expected a mapping type but got: ");
         PyObject* repr = PyObject_Repr(dict);
@@ -777,6 +1070,26 @@ static int write_dict(PyObject* self, buffer_t buffer, PyObject* dict, unsigned
         }
     }
 
+    /* Queries, sorts and commands are SONs: walk its key list directly.
+     * Subclasses may override iteration, so they use the general path
+     * below. */
+    if (Py_TYPE(dict) == (PyTypeObject*)state->SON) {
+        PyObject* keys = PyObject_GetAttr(dict, state->SONKeys);
+        if (keys && PyList_CheckExact(keys)) {
+            int result = write_son_items(self, buffer, dict, keys,
+                                         check_keys, top_level);
+            Py_DECREF(keys);
+            if (!result) {
+                return 0;
+            }
+            goto done;
+        }
+        Py_XDECREF(keys);
+        PyErr_Clear();
+    }
+
+    /* Exact dicts and OrderedDicts have C iterators, so this only calls
+     * Python code for other subclasses. */
     iter = PyObject_GetIter(dict);
     if (iter == NULL) {
         return 0;
@@ -797,33 +1110,127 @@ static int write_dict(PyObject* self, buffer_t buffer, PyObject* dict, unsigned
         Py_DECREF(key);
     }
     Py_DECREF(iter);
+    if (PyErr_Occurred()) {
+        return 0;
+    }
 
+done:
     /* write null byte and fill in length */
     if (!buffer_write_bytes(self, buffer, &zero, 1)) {
         return 0;
     }
     length = buffer_get_position(buffer) - length_location;
     memcpy(buffer_get_buffer(buffer) + length_location, &length, 4);
+    if (top_level) {
+        codec_stats.documents_encoded++;
+        codec_stats.bytes_encoded += length;
+    }
+    return 1;
+}
+
+/* Raise InvalidDocument for a malformed pre-encoded document. */
+static void _invalid_raw_document(void) {
+    PyObject* InvalidDocument = _error("InvalidDocument");
+    if (InvalidDocument) {
+        PyErr_SetString(InvalidDocument,
+                        "invalid pre-encoded BSON document");
+        Py_DECREF(InvalidDocument);
+    }
+}
+
+/* Check the key names in the encoded document of `size` bytes at
+ * `data`, and in its embedded documents, as write_dict does with
+ * check_keys. Like write_dict, skip embedded DBRefs (documents whose
+ * first key is "$ref"), which are encoded without checks.
+ *
+ * Returns 0 on failure */
+static int _check_raw_keys(const char* data, int size, int depth) {
+    int position = 4;
+
+    if (depth > VALIDATE_MAX_DEPTH) {
+        _invalid_raw_document();
+        return 0;
+    }
+    while (position < size - 1) {
+        int type = (signed char)data[position++];
+        const char* name = data + position;
+        const char* end = memchr(name, 0, size - 1 - position);
+        int value_size;
+
+        if (!end) {
+            _invalid_raw_document();
+            return 0;
+        }
+        if (!check_key_name(name, end - name)) {
+            return 0;
+        }
+        position += end - name + 1;
+        value_size = _element_value_size(data, position, type,
+                                         size - 1 - position);
+        if (value_size < 0) {
+            _invalid_raw_document();
+            return 0;
+        }
+        if ((type == 3 || type == 4) &&
+            (data[position + value_size - 1] ||
+             (!(type == 3 && value_size > 9 &&
+                strcmp(data + position + 5, "$ref") == 0) &&
+              !_check_raw_keys(data + position, value_size, depth + 1)))) {
+            if (!PyErr_Occurred()) {
+                _invalid_raw_document();
+            }
+            return 0;
+        }
+        position += value_size;
+    }
     return 1;
 }
 
+/* Copy the encoded document of `size` bytes at `data` to `buffer`.
+ * Only its length and terminator are checked - and its key names if
+ * `check_keys` is set.
+ *
+ * Returns 0 on failure */
+static int write_raw_document(PyObject* self, buffer_t buffer,
+                              const char* data, Py_ssize_t size,
+                              unsigned char check_keys) {
+    int length;
+
+    if (size < 5 || size > INT_MAX) {
+        _invalid_raw_document();
+        return 0;
+    }
+    memcpy(&length, data, 4);
+    if (length != size || data[size - 1]) {
+        _invalid_raw_document();
+        return 0;
+    }
+    if (check_keys && !_check_raw_keys(data, length, 0)) {
+        return 0;
+    }
+    return buffer_write_bytes(self, buffer, data, length);
+}
+
 static PyObject* _cbson_dict_to_bson(PyObject* self, PyObject* args) {
     PyObject* dict;
     PyObject* result;
     unsigned char check_keys;
+    unsigned char top_level = 1;
+    int size_hint = 0;
     buffer_t buffer;
 
-    if (!PyArg_ParseTuple(args, "Ob", &dict, &check_keys)) {
+    if (!PyArg_ParseTuple(args, "Ob|bi", &dict, &check_keys, &top_level,
+                          &size_hint)) {
         return NULL;
     }
 
-    buffer = buffer_new();
+    buffer = buffer_new_with_capacity(size_hint);
     if (!buffer) {
         PyErr_NoMemory();
         return NULL;
     }
 
-    if (!write_dict(self, buffer, dict, check_keys, 1)) {
+    if (!write_dict(self, buffer, dict, check_keys, top_level)) {
         buffer_free(buffer);
         return NULL;
     }
@@ -835,17 +1242,110 @@ static PyObject* _cbson_dict_to_bson(PyObject* self, PyObject* args) {
     return result;
 }
 
-static PyObject* get_value(PyObject* self, const char* buffer, int* position, int type,
-                           int max, PyObject* as_class, unsigned char tz_aware) {
+/* Compile the regex with the `pattern_length` byte pattern at `element`,
+ * followed by its NULL terminator and its flags.
+ *
+ * Returns a new ref */
+static PyObject* compile_regex(PyObject* self, const char* element,
+                               int pattern_length) {
+    struct module_state *state = GETSTATE(self);
+    PyObject* pattern;
+    PyObject* compiled;
+    const char* flag;
+    int flags = 0;
+
+    pattern = PyUnicode_DecodeUTF8(element, pattern_length, "strict");
+    if (!pattern) {
+        return NULL;
+    }
+    for (flag = element + pattern_length + 1; *flag; flag++) {
+        if (*flag == 'i') {
+            flags |= 2;
+        } else if (*flag == 'l') {
+            flags |= 4;
+        } else if (*flag == 'm') {
+            flags |= 8;
+        } else if (*flag == 's') {
+            flags |= 16;
+        } else if (*flag == 'u') {
+            flags |= 32;
+        } else if (*flag == 'x') {
+            flags |= 64;
+        }
+    }
+    compiled = PyObject_CallFunction(state->RECompile, "Oi", pattern, flags);
+    Py_DECREF(pattern);
+    return compiled;
+}
+
+/* Decode the regex at `element`: a `pattern_length` byte pattern and
+ * `flags_length` bytes of flags, each NULL terminated. Like key names,
+ * recently decoded regexes are kept in a direct-mapped cache, so a
+ * pattern that appears in many documents is only compiled once.
+ *
+ * Returns a new ref */
+static PyObject* decode_regex(PyObject* self, const char* element,
+                              int pattern_length, int flags_length) {
+    struct module_state *state = GETSTATE(self);
+    int length = pattern_length + flags_length + 1;
+    unsigned int hash = 2166136261u;
+    unsigned int slot;
+    PyObject* key;
+    PyObject* compiled;
+    int i;
+
+    if (state->no_regex_cache || length > REGEX_CACHE_MAX_LENGTH) {
+        return compile_regex(self, element, pattern_length);
+    }
+
+    /* FNV-1a */
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)element[i]) * 16777619u;
+    }
+    slot = hash & (REGEX_CACHE_SIZE - 1);
+    key = state->regex_cache_keys[slot];
+    if (key && PyBytes_GET_SIZE(key) == length &&
+        memcmp(PyBytes_AS_STRING(key), element, length) == 0) {
+        Py_INCREF(state->regex_cache_values[slot]);
+        return state->regex_cache_values[slot];
+    }
+
+    compiled = compile_regex(self, element, pattern_length);
+    if (!compiled) {
+        return NULL;
+    }
+    key = PyBytes_FromStringAndSize(element, length);
+    if (!key) {
+        Py_DECREF(compiled);
+        return NULL;
+    }
+    Py_XSETREF(state->regex_cache_keys[slot], key);
+    Py_INCREF(compiled);
+    Py_XSETREF(state->regex_cache_values[slot], compiled);
+    return compiled;
+}
+
+/* Decode the value of type `type` at `*position` in `buffer`, without
+ * applying registered decoders (see get_value). If `validated` is set the
+ * value has been checked by _validate_document, so the bounds checks
+ * are skipped. `owner` is the bytes object holding `buffer`, which
+ * embedded RawBSONDocuments share, or NULL to have them copy their data.
+ *
+ * Returns a new ref */
+static PyObject* _get_value(PyObject* self, PyObject* owner, const char* buffer,
+                            int* position, int type, int max, PyObject* as_class,
+                            unsigned char tz_aware, unsigned char validated) {
     struct module_state *state = GETSTATE(self);
 
     PyObject* value;
     PyObject* error;
+
+    codec_stats.elements_decoded[type & 0xFF]++;
     switch (type) {
     case 1:
         {
             double d;
-            if (max < 8) {
+            if (!validated && max < 8) {
                 goto invalid;
             }
             memcpy(&d, buffer + *position, 8);
@@ -861,7 +1361,7 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
     case 14:
         {
             int value_length = ((int*)(buffer + *position))[0] - 1;
-            if (max < value_length) {
+            if (!validated && max < value_length) {
                 goto invalid;
             }
             *position += 4;
@@ -876,10 +1376,24 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
         {
             int size;
             memcpy(&size, buffer + *position, 4);
-            if (max < size) {
+            if (!validated && max < size) {
                 goto invalid;
             }
-            value = elements_to_dict(self, buffer + *position + 4, size - 5, as_class, tz_aware);
+            if (as_class == (PyObject*)&RawBSONDocument_Type) {
+                /* DBRefs are always decoded eagerly */
+                if (strcmp(buffer + *position + 5, "$ref") != 0) {
+                    value = raw_document_new(self, owner, buffer + *position,
+                                             size, tz_aware);
+                    if (!value) {
+                        return NULL;
+                    }
+                    *position += size;
+                    break;
+                }
+                as_class = (PyObject*)&PyDict_Type;
+            }
+            value = elements_to_dict(self, owner, buffer + *position + 4, size - 5,
+                                     as_class, tz_aware, validated);
             if (!value) {
                 return NULL;
             }
@@ -925,7 +1439,7 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
                 end;
 
             memcpy(&size, buffer + *position, 4);
-            if (max < size) {
+            if (!validated && max < size) {
                 goto invalid;
             }
             end = *position + size - 1;
@@ -941,7 +1455,9 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
                 int type = (int)buffer[(*position)++];
                 int key_size = strlen(buffer + *position);
                 *position += key_size + 1; /* just skip the key, they're in order. */
-                to_append = get_value(self, buffer, position, type, max - key_size, as_class, tz_aware);
+                to_append = get_value(self, owner, buffer, position, type,
+                                      max - key_size, as_class, tz_aware,
+                                      validated);
                 if (!to_append) {
                     return NULL;
                 }
@@ -959,7 +1475,7 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
                 subtype;
 
             memcpy(&length, buffer + *position, 4);
-            if (max < length) {
+            if (!validated && max < length) {
                 goto invalid;
             }
             subtype = (unsigned char)buffer[*position + 4];
@@ -1023,10 +1539,10 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
         }
     case 7:
         {
-            if (max < 12) {
+            if (!validated && max < 12) {
                 goto invalid;
             }
-            value = PyObject_CallFunction(state->ObjectId, "y#", buffer + *position, 12);
+            value = objectid_from_bytes(buffer + *position);
             if (!value) {
                 return NULL;
             }
@@ -1041,89 +1557,29 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
         }
     case 9:
         {
-            PyObject* naive;
-            PyObject* replace;
-            PyObject* args;
-            PyObject* kwargs;
-            if (max < 8) {
+            long long millis;
+            if (!validated && max < 8) {
                 goto invalid;
             }
-            naive = datetime_from_millis(*(long long*)(buffer + *position));
+            memcpy(&millis, buffer + *position, 8);
             *position += 8;
-            if (!tz_aware) { /* In the naive case, we're done here. */
-                value = naive;
-                break;
-            }
-
-            if (!naive) {
-                return NULL;
-            }
-            replace = PyObject_GetAttrString(naive, "replace");
-            Py_DECREF(naive);
-            if (!replace) {
-                return NULL;
-            }
-            args = PyTuple_New(0);
-            if (!args) {
-                Py_DECREF(replace);
-                return NULL;
-            }
-            kwargs = PyDict_New();
-            if (!kwargs) {
-                Py_DECREF(replace);
-                Py_DECREF(args);
-                return NULL;
-            }
-            if (PyDict_SetItemString(kwargs, "tzinfo", state->UTC) == -1) {
-                Py_DECREF(replace);
-                Py_DECREF(args);
-                Py_DECREF(kwargs);
-                return NULL;
-            }
-            value = PyObject_Call(replace, args, kwargs);
-            Py_DECREF(replace);
-            Py_DECREF(args);
-            Py_DECREF(kwargs);
+            value = datetime_from_millis(millis, tz_aware ? state->UTC : Py_None);
             break;
         }
     case 11:
         {
-            PyObject* pattern;
-            int flags_length,
-                flags,
-                i;
             int pattern_length = strlen(buffer + *position);
-            if (max < pattern_length) {
+            int flags_length;
+            if (!validated && max < pattern_length) {
                 goto invalid;
             }
-            pattern = PyUnicode_DecodeUTF8(buffer + *position, pattern_length, "strict");
-            if (!pattern) {
-                return NULL;
-            }
-            *position += pattern_length + 1;
-            flags_length = strlen(buffer + *position);
-            if (max < pattern_length + flags_length) {
+            flags_length = strlen(buffer + *position + pattern_length + 1);
+            if (!validated && max < pattern_length + flags_length) {
                 goto invalid;
             }
-            flags = 0;
-            for (i = 0; i < flags_length; i++) {
-                if (buffer[*position + i] == 'i') {
-                    flags |= 2;
-                } else if (buffer[*position + i] == 'l') {
-                    flags |= 4;
-                } else if (buffer[*position + i] == 'm') {
-                    flags |= 8;
-                } else if (buffer[*position + i] == 's') {
-                    flags |= 16;
-                } else if (buffer[*position + i] == 'u') {
-                    flags |= 32;
-                } else if (buffer[*position + i] == 'x') {
-                    flags |= 64;
-                }
-            }
-            *position += flags_length + 1;
-            value = PyObject_CallFunction(state->RECompile, "Oi", pattern, flags);
-            Py_DECREF(pattern);
+            value = decode_regex(self, buffer + *position, pattern_length,
+                                 flags_length);
+            *position += pattern_length + flags_length + 2;
             break;
         }
     case 12:
@@ -1134,7 +1590,7 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
 
             *position += 4;
             collection_length = strlen(buffer + *position);
-            if (max < collection_length) {
+            if (!validated && max < collection_length) {
                 goto invalid;
             }
             collection = PyUnicode_DecodeUTF8(buffer + *position, collection_length, "strict");
@@ -1142,10 +1598,10 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
                 return NULL;
             }
             *position += collection_length + 1;
-            if (max < collection_length + 12) {
+            if (!validated && max < collection_length + 12) {
                 goto invalid;
             }
-            id = PyObject_CallFunction(state->ObjectId, "s#", buffer + *position, 12);
+            id = objectid_from_bytes(buffer + *position);
             if (!id) {
                 Py_DECREF(collection);
                 return NULL;
@@ -1165,7 +1621,7 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
 
             *position += 8;
             code_length = strlen(buffer + *position);
-            if (max < 8 + code_length) {
+            if (!validated && max < 8 + code_length) {
                 goto invalid;
             }
             code = PyUnicode_DecodeUTF8(buffer + *position, code_length, "strict");
@@ -1175,8 +1631,9 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
             *position += code_length + 1;
 
             memcpy(&scope_size, buffer + *position, 4);
-            scope = elements_to_dict(self, buffer + *position + 4, scope_size - 5,
-                                     (PyObject*)&PyDict_Type, tz_aware);
+            scope = elements_to_dict(self, owner, buffer + *position + 4,
+                                     scope_size - 5, (PyObject*)&PyDict_Type,
+                                     tz_aware, validated);
             if (!scope) {
                 Py_DECREF(code);
                 return NULL;
@@ -1191,7 +1648,7 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
     case 16:
         {
             int i;
-            if (max < 4) {
+            if (!validated && max < 4) {
                 goto invalid;
             }
             memcpy(&i, buffer + *position, 4);
@@ -1205,7 +1662,7 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
     case 17:
         {
             unsigned int time, inc;
-            if (max < 8) {
+            if (!validated && max < 8) {
                 goto invalid;
             }
             memcpy(&inc, buffer + *position, 4);
@@ -1220,7 +1677,7 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
     case 18:
         {
             long long ll;
-            if (max < 8) {
+            if (!validated && max < 8) {
                 goto invalid;
             }
             memcpy(&ll, buffer + *position, 8);
@@ -1244,6 +1701,7 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
     default:
         {
             PyObject* InvalidDocument = _error("InvalidDocument");
+            codec_stats.no_decoder++;
             PyErr_SetString(InvalidDocument, "no c decoder for this type yet");
             Py_DECREF(InvalidDocument);
             return NULL;
@@ -1259,9 +1717,110 @@ static PyObject* get_value(PyObject* self, const char* buffer, int* position, in
     return NULL;
 }
 
-static PyObject* elements_to_dict(PyObject* self, const char* string, int max,
-                                  PyObject* as_class, unsigned char tz_aware) {
+/* Decode a value like _get_value, and pass it through the decoder
+ * registered for its BSON type (or binary subtype), if there is one.
+ *
+ * Returns a new ref */
+static PyObject* get_value(PyObject* self, PyObject* owner, const char* buffer,
+                           int* position, int type, int max, PyObject* as_class,
+                           unsigned char tz_aware, unsigned char validated) {
+    struct module_state *state = GETSTATE(self);
+    PyObject* decoder = NULL;
+    PyObject* value;
+    PyObject* result;
+
+    if (state->decoder_count) {
+        /* The subtype follows the binary's length. */
+        if (type == 5 && max > 4) {
+            decoder = state->binary_decoders[
+                (unsigned char)buffer[*position + 4]];
+        }
+        if (!decoder) {
+            decoder = state->decoders[type & 0xFF];
+        }
+    }
+    value = _get_value(self, owner, buffer, position, type, max, as_class,
+                       tz_aware, validated);
+    if (!decoder || !value) {
+        return value;
+    }
+    /* The decoder may unregister itself. */
+    Py_INCREF(decoder);
+    result = PyObject_CallFunctionObjArgs(decoder, value, NULL);
+    Py_DECREF(decoder);
+    Py_DECREF(value);
+    return result;
+}
+
+/* Decode the key name of `length` bytes at `name`. Recently decoded names
+ * are kept in a small direct-mapped cache, so the repeated keys of a
+ * batch of documents are decoded once and share one interned str.
+ *
+ * Returns a new ref */
+static PyObject* decode_key(PyObject* self, const char* name, int length) {
+    struct module_state *state = GETSTATE(self);
+    PyObject** slot;
+    PyObject* key;
+    unsigned int hash = 2166136261u;
+    int i;
+
+    if (length > KEY_CACHE_MAX_LENGTH) {
+        return PyUnicode_DecodeUTF8(name, length, "strict");
+    }
+
+    /* FNV-1a */
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    slot = &state->key_cache[hash & (KEY_CACHE_SIZE - 1)];
+    if (*slot) {
+        Py_ssize_t cached_length;
+        const char* cached = PyUnicode_AsUTF8AndSize(*slot, &cached_length);
+        if (!cached) {
+            return NULL;
+        }
+        if (cached_length == length && memcmp(cached, name, length) == 0) {
+            Py_INCREF(*slot);
+            return *slot;
+        }
+    }
+
+    key = PyUnicode_DecodeUTF8(name, length, "strict");
+    if (!key) {
+        return NULL;
+    }
+    PyUnicode_InternInPlace(&key);
+    Py_INCREF(key);
+    Py_XSETREF(*slot, key);
+    return key;
+}
+
+/* Find the element named by the `name_length` bytes at `name` in the
+ * field filter `fields` (see _compile_fields), storing the filter for its
+ * sub-fields in `subfields` (Py_None if the whole value is wanted).
+ *
+ * Returns 0 if the element isn't wanted */
+static int _field_lookup(PyObject* fields, const char* name, int name_length,
+                         PyObject** subfields) {
+    Py_ssize_t pos = 0;
+    PyObject* key;
+
+    /* Filters are small, so a scan beats decoding `name` for a lookup. */
+    while (PyDict_Next(fields, &pos, &key, subfields)) {
+        if (PyBytes_GET_SIZE(key) == name_length &&
+            memcmp(PyBytes_AS_STRING(key), name, name_length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static PyObject* _elements_to_dict(PyObject* self, PyObject* owner,
+                                   const char* string, int max,
+                                   PyObject* as_class, unsigned char tz_aware,
+                                   PyObject* fields, unsigned char validated) {
     int position = 0;
+    PyObject* InvalidBSON;
     PyObject* dict = PyObject_CallObject(as_class, NULL);
     if (!dict) {
         return NULL;
@@ -1269,21 +1828,58 @@ static PyObject* elements_to_dict(PyObject* self, const char* string, int max,
     while (position < max) {
         PyObject* name;
         PyObject* value;
+        PyObject* subfields = Py_None;
         int type = (int)string[position++];
         int name_length = strlen(string + position);
-        if (position + name_length >= max) {
-            PyObject* InvalidBSON = _error("InvalidBSON");
-            PyErr_SetNone(InvalidBSON);
-            Py_DECREF(InvalidBSON);
-            return NULL;
+        if (!validated && position + name_length >= max) {
+            goto invalid;
+        }
+        if (fields && !_field_lookup(fields, string + position,
+                                     name_length, &subfields)) {
+            /* Skip the element without decoding anything */
+            int value_size = _element_value_size(string, position + name_length + 1,
+                                                 type, max - position - name_length - 1);
+            if (value_size == -1) {
+                goto invalid;
+            }
+            position += name_length + 1 + value_size;
+            continue;
         }
-        name = PyUnicode_DecodeUTF8(string + position, name_length, "strict");
+        name = decode_key(self, string + position, name_length);
         if (!name) {
+            Py_DECREF(dict);
             return NULL;
         }
         position += name_length + 1;
-        value = get_value(self, string, &position, type, max - position, as_class, tz_aware);
+        if (subfields != Py_None && type == 3) {
+            int size = 0;
+            if (max - position >= 5) {
+                memcpy(&size, string + position, 4);
+            }
+            if (!validated && (size < 5 || size > max - position ||
+                               string[position + size - 1])) {
+                Py_DECREF(name);
+                goto invalid;
+            }
+            if (strcmp(string + position + 5, "$ref") != 0) {
+                /* Apply the filter to the embedded document */
+                value = _elements_to_dict(self, owner, string + position + 4,
+                                          size - 5, as_class, tz_aware,
+                                          subfields, validated);
+                position += size;
+            } else {
+                /* DBRefs are kept whole */
+                value = get_value(self, owner, string, &position, type,
+                                  max - position, as_class, tz_aware,
+                                  validated);
+            }
+        } else {
+            value = get_value(self, owner, string, &position, type,
+                              max - position, as_class, tz_aware, validated);
+        }
         if (!value) {
+            Py_DECREF(name);
+            Py_DECREF(dict);
             return NULL;
         }
 
@@ -1292,136 +1888,2425 @@ static PyObject* elements_to_dict(PyObject* self, const char* string, int max,
         Py_DECREF(value);
     }
     return dict;
-}
+
+    invalid:
+    Py_DECREF(dict);
+    InvalidBSON = _error("InvalidBSON");
+    PyErr_SetNone(InvalidBSON);
+    Py_DECREF(InvalidBSON);
+    return NULL;
+}
+
+static PyObject* elements_to_dict(PyObject* self, PyObject* owner,
+                                  const char* string, int max,
+                                  PyObject* as_class, unsigned char tz_aware,
+                                  unsigned char validated) {
+    return _elements_to_dict(self, owner, string, max, as_class, tz_aware,
+                             NULL, validated);
+}
+
+/* Get the size of the value of type `type` at `position` in `buffer`
+ * without decoding it.
+ *
+ * Returns -1 if the value is invalid or of an unknown type. */
+static int _element_value_size(const char* buffer, int position, int type, int max) {
+    int size;
+    const char* end;
+
+    switch (type) {
+    case 1:
+    case 9:
+    case 17:
+    case 18:
+        size = 8;
+        break;
+    case 2:
+    case 13:
+    case 14:
+        if (max < 4) {
+            return -1;
+        }
+        memcpy(&size, buffer + position, 4);
+        if (size < 1) {
+            return -1;
+        }
+        size += 4;
+        break;
+    case 3:
+    case 4:
+    case 15:
+        if (max < 4) {
+            return -1;
+        }
+        memcpy(&size, buffer + position, 4);
+        if (size < 5) {
+            return -1;
+        }
+        break;
+    case 5:
+        if (max < 4) {
+            return -1;
+        }
+        memcpy(&size, buffer + position, 4);
+        if (size < 0) {
+            return -1;
+        }
+        size += 5;
+        break;
+    case 6:
+    case 10:
+    case -1:
+    case 127:
+        size = 0;
+        break;
+    case 7:
+        size = 12;
+        break;
+    case 8:
+        size = 1;
+        break;
+    case 11:
+        /* pattern and flags are both cstrings */
+        end = memchr(buffer + position, 0, max);
+        if (!end) {
+            return -1;
+        }
+        size = end - (buffer + position) + 1;
+        end = memchr(buffer + position + size, 0, max - size);
+        if (!end) {
+            return -1;
+        }
+        size = end - (buffer + position) + 1;
+        break;
+    case 12:
+        if (max < 4) {
+            return -1;
+        }
+        memcpy(&size, buffer + position, 4);
+        if (size < 1) {
+            return -1;
+        }
+        size += 4 + 12;
+        break;
+    case 16:
+        size = 4;
+        break;
+    default:
+        return -1;
+    }
+    if (size > max) {
+        return -1;
+    }
+    return size;
+}
+
+/* Create a new RawBSONDocument for the encoded `document` of `size` bytes.
+ * If `owner` is NULL the document is copied, otherwise `document` must
+ * point into memory owned by `owner`.
+ *
+ * Returns a new ref */
+static PyObject* raw_document_new(PyObject* self, PyObject* owner, const char* document,
+                                  int size, unsigned char tz_aware) {
+    RawBSONDocument* raw;
+
+    if (owner) {
+        Py_INCREF(owner);
+    } else {
+        owner = PyBytes_FromStringAndSize(document, size);
+        if (!owner) {
+            return NULL;
+        }
+        document = PyBytes_AS_STRING(owner);
+    }
+
+    raw = PyObject_New(RawBSONDocument, &RawBSONDocument_Type);
+    if (!raw) {
+        Py_DECREF(owner);
+        return NULL;
+    }
+    Py_INCREF(self);
+    raw->module = self;
+    raw->owner = owner;
+    raw->elements = document + 4;
+    raw->max = size - 5;
+    raw->tz_aware = tz_aware;
+    raw->count = -1;
+    raw->index = NULL;
+    return (PyObject*)raw;
+}
+
+/* Build the offset index for `raw` if it hasn't been built yet.
+ *
+ * Returns 0 on failure */
+static int raw_document_index(RawBSONDocument* raw) {
+    int position = 0;
+    int count = 0;
+    int allocated = 0;
+    raw_element* index = NULL;
+
+    if (raw->count != -1) {
+        return 1;
+    }
+
+    while (position < raw->max) {
+        int type = (int)raw->elements[position++];
+        int name_length = strlen(raw->elements + position);
+        int value_size;
+
+        if (position + name_length >= raw->max) {
+            goto invalid;
+        }
+        value_size = _element_value_size(raw->elements, position + name_length + 1,
+                                         type, raw->max - position - name_length - 1);
+        if (value_size == -1) {
+            goto invalid;
+        }
+
+        if (count == allocated) {
+            raw_element* grown;
+            allocated = allocated ? allocated * 2 : 8;
+            grown = PyMem_Realloc(index, allocated * sizeof(raw_element));
+            if (!grown) {
+                PyMem_Free(index);
+                PyErr_NoMemory();
+                return 0;
+            }
+            index = grown;
+        }
+        index[count].name = position;
+        index[count].name_length = name_length;
+        index[count].type = type;
+        index[count].value = position + name_length + 1;
+        index[count].key = NULL;
+        index[count].decoded = NULL;
+        count++;
+
+        position += name_length + 1 + value_size;
+    }
+
+    raw->index = index;
+    raw->count = count;
+    return 1;
+
+    invalid:
+    {
+        PyObject* InvalidBSON = _error("InvalidBSON");
+        PyErr_SetNone(InvalidBSON);
+        Py_DECREF(InvalidBSON);
+        PyMem_Free(index);
+        return 0;
+    }
+}
+
+/* Returns a new ref */
+static PyObject* raw_document_key(RawBSONDocument* raw, raw_element* element) {
+    if (!element->key) {
+        element->key = decode_key(raw->module, raw->elements + element->name,
+                                  element->name_length);
+        if (!element->key) {
+            return NULL;
+        }
+    }
+    Py_INCREF(element->key);
+    return element->key;
+}
+
+/* Returns a new ref */
+static PyObject* raw_document_value(RawBSONDocument* raw, raw_element* element) {
+    if (!element->decoded) {
+        int position = element->value;
+        const char* value = raw->elements + position;
+
+        if (element->type == 3 && strcmp(value + 5, "$ref") != 0) {
+            /* Embedded documents stay lazy and share our data */
+            int size;
+            memcpy(&size, value, 4);
+            element->decoded = raw_document_new(raw->module, raw->owner,
+                                                value, size, raw->tz_aware);
+        } else {
+            element->decoded = get_value(raw->module, raw->owner, raw->elements,
+                                         &position, element->type,
+                                         raw->max - position,
+                                         (PyObject*)&RawBSONDocument_Type,
+                                         raw->tz_aware, 0);
+        }
+        if (!element->decoded) {
+            return NULL;
+        }
+    }
+    Py_INCREF(element->decoded);
+    return element->decoded;
+}
+
+/* Find the element named `key`.
+ *
+ * Returns NULL with no exception set if there is no such element. */
+static raw_element* raw_document_find(RawBSONDocument* raw, PyObject* key) {
+    PyObject* encoded;
+    const char* name;
+    Py_ssize_t name_length;
+    int i;
+
+    if (!raw_document_index(raw)) {
+        return NULL;
+    }
+    if (!PyUnicode_Check(key)) {
+        return NULL;
+    }
+    encoded = PyUnicode_AsUTF8String(key);
+    if (!encoded) {
+        return NULL;
+    }
+    name = PyBytes_AS_STRING(encoded);
+    name_length = PyBytes_GET_SIZE(encoded);
+
+    for (i = 0; i < raw->count; i++) {
+        raw_element* element = raw->index + i;
+        if (element->name_length == name_length &&
+            memcmp(raw->elements + element->name, name, name_length) == 0) {
+            Py_DECREF(encoded);
+            return element;
+        }
+    }
+    Py_DECREF(encoded);
+    return NULL;
+}
+
+/* Decode every element of `raw` into a new instance of `as_class`.
+ *
+ * Returns a new ref */
+static PyObject* raw_document_inflate(RawBSONDocument* raw, PyObject* as_class) {
+    PyObject* dict;
+    int i;
+
+    if (!raw_document_index(raw)) {
+        return NULL;
+    }
+    dict = PyObject_CallObject(as_class, NULL);
+    if (!dict) {
+        return NULL;
+    }
+    for (i = 0; i < raw->count; i++) {
+        PyObject* key = raw_document_key(raw, raw->index + i);
+        PyObject* value;
+        if (!key) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+        value = raw_document_value(raw, raw->index + i);
+        if (!value || PyObject_SetItem(dict, key, value) == -1) {
+            Py_DECREF(key);
+            Py_XDECREF(value);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+    return dict;
+}
+
+/* Build a list by calling `getter` for each element of `raw`.
+ *
+ * Returns a new ref */
+static PyObject* raw_document_list(RawBSONDocument* raw,
+                                   PyObject* (*getter)(RawBSONDocument*, raw_element*)) {
+    PyObject* list;
+    int i;
+
+    if (!raw_document_index(raw)) {
+        return NULL;
+    }
+    list = PyList_New(raw->count);
+    if (!list) {
+        return NULL;
+    }
+    for (i = 0; i < raw->count; i++) {
+        PyObject* item = getter(raw, raw->index + i);
+        if (!item) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+/* Returns a new ref */
+static PyObject* raw_document_item(RawBSONDocument* raw, raw_element* element) {
+    PyObject* key = raw_document_key(raw, element);
+    PyObject* value;
+    PyObject* item;
+    if (!key) {
+        return NULL;
+    }
+    value = raw_document_value(raw, element);
+    if (!value) {
+        Py_DECREF(key);
+        return NULL;
+    }
+    item = PyTuple_Pack(2, key, value);
+    Py_DECREF(key);
+    Py_DECREF(value);
+    return item;
+}
+
+static PyObject* RawBSONDocument_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = {"bson", "tz_aware", NULL};
+    PyObject* bson;
+    unsigned char tz_aware = 0;
+    PyObject* module;
+    PyObject* raw;
+    Py_ssize_t total_size;
+    int size;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|b", kwlist, &bson, &tz_aware)) {
+        return NULL;
+    }
+    if (!PyBytes_Check(bson)) {
+        PyErr_SetString(PyExc_TypeError, "argument to RawBSONDocument must be a bytes object");
+        return NULL;
+    }
+    total_size = PyBytes_GET_SIZE(bson);
+    if (total_size < 5) {
+        PyObject* InvalidBSON = _error("InvalidBSON");
+        PyErr_SetString(InvalidBSON,
+                        "not enough data for a BSON document");
+        Py_DECREF(InvalidBSON);
+        return NULL;
+    }
+    memcpy(&size, PyBytes_AS_STRING(bson), 4);
+    if (size != total_size || PyBytes_AS_STRING(bson)[size - 1]) {
+        PyObject* InvalidBSON = _error("InvalidBSON");
+        PyErr_SetString(InvalidBSON,
+                        "invalid document length or eoo");
+        Py_DECREF(InvalidBSON);
+        return NULL;
+    }
+
+    module = PyImport_ImportModule("bson._cbson");
+    if (!module) {
+        return NULL;
+    }
+    raw = raw_document_new(module, bson, PyBytes_AS_STRING(bson), size, tz_aware);
+    Py_DECREF(module);
+    return raw;
+}
+
+static void RawBSONDocument_dealloc(RawBSONDocument* raw) {
+    if (raw->index) {
+        int i;
+        for (i = 0; i < raw->count; i++) {
+            Py_XDECREF(raw->index[i].key);
+            Py_XDECREF(raw->index[i].decoded);
+        }
+        PyMem_Free(raw->index);
+    }
+    Py_DECREF(raw->owner);
+    Py_DECREF(raw->module);
+    PyObject_Del(raw);
+}
+
+static Py_ssize_t RawBSONDocument_length(RawBSONDocument* raw) {
+    if (!raw_document_index(raw)) {
+        return -1;
+    }
+    return raw->count;
+}
+
+static PyObject* RawBSONDocument_subscript(RawBSONDocument* raw, PyObject* key) {
+    raw_element* element = raw_document_find(raw, key);
+    if (!element) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetObject(PyExc_KeyError, key);
+        }
+        return NULL;
+    }
+    return raw_document_value(raw, element);
+}
+
+static int RawBSONDocument_contains(RawBSONDocument* raw, PyObject* key) {
+    raw_element* element = raw_document_find(raw, key);
+    if (!element) {
+        return PyErr_Occurred() ? -1 : 0;
+    }
+    return 1;
+}
+
+static PyObject* RawBSONDocument_iter(RawBSONDocument* raw) {
+    PyObject* keys = raw_document_list(raw, raw_document_key);
+    PyObject* iter;
+    if (!keys) {
+        return NULL;
+    }
+    iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iter;
+}
+
+static PyObject* RawBSONDocument_repr(RawBSONDocument* raw) {
+    PyObject* dict = raw_document_inflate(raw, (PyObject*)&PyDict_Type);
+    PyObject* repr;
+    if (!dict) {
+        return NULL;
+    }
+    repr = PyUnicode_FromFormat("RawBSONDocument(%R)", dict);
+    Py_DECREF(dict);
+    return repr;
+}
+
+static PyObject* RawBSONDocument_richcompare(RawBSONDocument* raw, PyObject* other, int op) {
+    PyObject* dict;
+    PyObject* result;
+
+    if ((op != Py_EQ && op != Py_NE) ||
+        !(PyObject_TypeCheck(other, &RawBSONDocument_Type) || PyDict_Check(other))) {
+        Py_INCREF(Py_NotImplemented);
+        return Py_NotImplemented;
+    }
+    if (PyObject_TypeCheck(other, &RawBSONDocument_Type)) {
+        RawBSONDocument* other_raw = (RawBSONDocument*)other;
+        int equal = raw->max == other_raw->max &&
+            memcmp(raw->elements, other_raw->elements, raw->max) == 0;
+        result = (equal == (op == Py_EQ)) ? Py_True : Py_False;
+        Py_INCREF(result);
+        return result;
+    }
+    dict = raw_document_inflate(raw, (PyObject*)&PyDict_Type);
+    if (!dict) {
+        return NULL;
+    }
+    result = PyObject_RichCompare(dict, other, op);
+    Py_DECREF(dict);
+    return result;
+}
+
+static PyObject* RawBSONDocument_keys(RawBSONDocument* raw) {
+    return raw_document_list(raw, raw_document_key);
+}
+
+static PyObject* RawBSONDocument_values(RawBSONDocument* raw) {
+    return raw_document_list(raw, raw_document_value);
+}
+
+static PyObject* RawBSONDocument_items(RawBSONDocument* raw) {
+    return raw_document_list(raw, raw_document_item);
+}
+
+static PyObject* RawBSONDocument_get(RawBSONDocument* raw, PyObject* args) {
+    PyObject* key;
+    PyObject* default_value = Py_None;
+    raw_element* element;
+
+    if (!PyArg_ParseTuple(args, "O|O", &key, &default_value)) {
+        return NULL;
+    }
+    element = raw_document_find(raw, key);
+    if (!element) {
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        Py_INCREF(default_value);
+        return default_value;
+    }
+    return raw_document_value(raw, element);
+}
+
+static PyObject* RawBSONDocument_decode(RawBSONDocument* raw, PyObject* args) {
+    PyObject* as_class = (PyObject*)&PyDict_Type;
+
+    if (!PyArg_ParseTuple(args, "|O", &as_class)) {
+        return NULL;
+    }
+    return elements_to_dict(raw->module, raw->owner, raw->elements, raw->max,
+                            as_class, raw->tz_aware, 0);
+}
+
+static PyObject* RawBSONDocument_get_raw(RawBSONDocument* raw, void* closure) {
+    const char* document = raw->elements - 4;
+    if (PyBytes_Check(raw->owner) &&
+        PyBytes_AS_STRING(raw->owner) == document &&
+        PyBytes_GET_SIZE(raw->owner) == raw->max + 5) {
+        Py_INCREF(raw->owner);
+        return raw->owner;
+    }
+    return PyBytes_FromStringAndSize(document, raw->max + 5);
+}
+
+static PyMappingMethods RawBSONDocument_as_mapping = {
+    (lenfunc)RawBSONDocument_length,
+    (binaryfunc)RawBSONDocument_subscript,
+    NULL
+};
+
+static PySequenceMethods RawBSONDocument_as_sequence = {
+    0, 0, 0, 0, 0, 0, 0,
+    (objobjproc)RawBSONDocument_contains,
+};
+
+static PyMethodDef RawBSONDocument_methods[] = {
+    {"keys", (PyCFunction)RawBSONDocument_keys, METH_NOARGS,
+     "list of the document's keys, in order."},
+    {"values", (PyCFunction)RawBSONDocument_values, METH_NOARGS,
+     "list of the document's values, in order."},
+    {"items", (PyCFunction)RawBSONDocument_items, METH_NOARGS,
+     "list of the document's (key, value) pairs, in order."},
+    {"get", (PyCFunction)RawBSONDocument_get, METH_VARARGS,
+     "get the value for a key, or a default if the key isn't present."},
+    {"decode", (PyCFunction)RawBSONDocument_decode, METH_VARARGS,
+     "fully decode this document to an instance of as_class."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef RawBSONDocument_getset[] = {
+    {"raw", (getter)RawBSONDocument_get_raw, NULL,
+     "the encoded BSON bytes for this document.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject RawBSONDocument_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "bson._cbson.RawBSONDocument",              /* tp_name */
+    sizeof(RawBSONDocument),                    /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)RawBSONDocument_dealloc,        /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_reserved */
+    (reprfunc)RawBSONDocument_repr,             /* tp_repr */
+    0,                                          /* tp_as_number */
+    &RawBSONDocument_as_sequence,               /* tp_as_sequence */
+    &RawBSONDocument_as_mapping,                /* tp_as_mapping */
+    PyObject_HashNotImplemented,                /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    0,                                          /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                         /* tp_flags */
+    "A BSON document that is decoded lazily as its fields are accessed.",
+    0,                                          /* tp_traverse */
+    0,                                          /* tp_clear */
+    (richcmpfunc)RawBSONDocument_richcompare,   /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    (getiterfunc)RawBSONDocument_iter,          /* tp_iter */
+    0,                                          /* tp_iternext */
+    RawBSONDocument_methods,                    /* tp_methods */
+    0,                                          /* tp_members */
+    RawBSONDocument_getset,                     /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    0,                                          /* tp_init */
+    0,                                          /* tp_alloc */
+    RawBSONDocument_new,                        /* tp_new */
+};
+
+/* The machine part of new ObjectIds, from bson.objectid._machine_bytes,
+ * and the counter for their last three bytes. Protected by the GIL. */
+static char objectid_machine[3];
+static int objectid_inc = 0;
+
+/* Returns a new ObjectId with the 12 bytes at `oid` */
+static PyObject* objectid_from_bytes(const char* oid) {
+    ObjectId* objectid = PyObject_New(ObjectId, &ObjectId_Type);
+    if (!objectid) {
+        return NULL;
+    }
+    memcpy(objectid->oid, oid, 12);
+    return (PyObject*)objectid;
+}
+
+static void objectid_generate(ObjectId* self) {
+    unsigned int now = (unsigned int)time(NULL);
+    int pid = getpid() % 0xFFFF;
+    int inc = objectid_inc;
+
+    objectid_inc = (objectid_inc + 1) % 0xFFFFFF;
+
+    self->oid[0] = (char)(now >> 24);
+    self->oid[1] = (char)(now >> 16);
+    self->oid[2] = (char)(now >> 8);
+    self->oid[3] = (char)now;
+    memcpy(self->oid + 4, objectid_machine, 3);
+    self->oid[7] = (char)(pid >> 8);
+    self->oid[8] = (char)pid;
+    self->oid[9] = (char)(inc >> 16);
+    self->oid[10] = (char)(inc >> 8);
+    self->oid[11] = (char)inc;
+}
+
+static int _hex_value(int c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static void _invalid_id(PyObject* oid) {
+    PyObject* InvalidId = _error("InvalidId");
+    if (InvalidId) {
+        PyErr_Format(InvalidId, "%S is not a valid ObjectId", oid);
+        Py_DECREF(InvalidId);
+    }
+}
+
+static PyObject* ObjectId_new(PyTypeObject* type, PyObject* args, PyObject* kwds) {
+    /* The value is set by __init__ (or __setstate__, when unpickling). */
+    return type->tp_alloc(type, 0);
+}
+
+static int ObjectId_init(ObjectId* self, PyObject* args, PyObject* kwds) {
+    PyObject* oid = Py_None;
+    static char *kwlist[] = {"oid", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &oid)) {
+        return -1;
+    }
+
+    if (oid == Py_None) {
+        objectid_generate(self);
+    } else if (PyObject_TypeCheck(oid, &ObjectId_Type)) {
+        memcpy(self->oid, ((ObjectId*)oid)->oid, 12);
+    } else if (PyBytes_Check(oid)) {
+        if (PyBytes_GET_SIZE(oid) != 12) {
+            _invalid_id(oid);
+            return -1;
+        }
+        memcpy(self->oid, PyBytes_AS_STRING(oid), 12);
+    } else if (PyUnicode_Check(oid)) {
+        Py_ssize_t length;
+        const char* hex = PyUnicode_AsUTF8AndSize(oid, &length);
+        int i;
+        if (!hex) {
+            return -1;
+        }
+        if (length != 24) {
+            _invalid_id(oid);
+            return -1;
+        }
+        for (i = 0; i < 12; i++) {
+            int high = _hex_value((unsigned char)hex[2 * i]);
+            int low = _hex_value((unsigned char)hex[2 * i + 1]);
+            if (high < 0 || low < 0) {
+                _invalid_id(oid);
+                return -1;
+            }
+            self->oid[i] = (char)(high << 4 | low);
+        }
+    } else {
+        PyErr_Format(PyExc_TypeError, "id must be an instance of (bytes, str, "
+                     "ObjectId), not %R", (PyObject*)Py_TYPE(oid));
+        return -1;
+    }
+    return 0;
+}
+
+static void ObjectId_dealloc(ObjectId* self) {
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* ObjectId_from_datetime(PyObject* cls, PyObject* generation_time) {
+    PyObject* utcoffset;
+    long long millis;
+    long long seconds;
+    char oid[12] = {0};
+    PyObject* binary;
+    PyObject* result;
+
+    if (!PyDateTime_Check(generation_time)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "generation_time must be a datetime.datetime");
+        return NULL;
+    }
+    utcoffset = PyObject_CallMethod(generation_time, "utcoffset", NULL);
+    if (!utcoffset) {
+        return NULL;
+    }
+    if (utcoffset != Py_None) {
+        PyObject* utc_time = PyNumber_Subtract(generation_time, utcoffset);
+        Py_DECREF(utcoffset);
+        if (!utc_time) {
+            return NULL;
+        }
+        millis = millis_from_datetime(utc_time);
+        Py_DECREF(utc_time);
+    } else {
+        Py_DECREF(utcoffset);
+        millis = millis_from_datetime(generation_time);
+    }
+
+    seconds = millis / 1000 - (millis % 1000 < 0);
+    if (seconds < INT_MIN || seconds > INT_MAX) {
+        PyErr_SetString(PyExc_OverflowError,
+                        "generation_time is out of range for an ObjectId");
+        return NULL;
+    }
+    oid[0] = (char)(seconds >> 24);
+    oid[1] = (char)(seconds >> 16);
+    oid[2] = (char)(seconds >> 8);
+    oid[3] = (char)seconds;
+    binary = PyBytes_FromStringAndSize(oid, 12);
+    if (!binary) {
+        return NULL;
+    }
+    result = PyObject_CallFunctionObjArgs(cls, binary, NULL);
+    Py_DECREF(binary);
+    return result;
+}
+
+static PyObject* ObjectId_getstate(ObjectId* self) {
+    return PyBytes_FromStringAndSize(self->oid, 12);
+}
+
+static PyObject* ObjectId_reduce(ObjectId* self) {
+    PyObject* binary = PyBytes_FromStringAndSize(self->oid, 12);
+    if (!binary) {
+        return NULL;
+    }
+    return Py_BuildValue("(O(N))", (PyObject*)Py_TYPE(self), binary);
+}
+
+static PyObject* ObjectId_setstate(ObjectId* self, PyObject* value) {
+    PyObject* oid = value;
+
+    /* Pickles made with pymongo 1.9 hold the instance dict. */
+    if (PyDict_Check(value)) {
+        oid = PyDict_GetItemString(value, "_ObjectId__id");
+        if (!oid) {
+            PyErr_SetString(PyExc_KeyError, "_ObjectId__id");
+            return NULL;
+        }
+    }
+    if (!PyBytes_Check(oid) || PyBytes_GET_SIZE(oid) != 12) {
+        _invalid_id(oid);
+        return NULL;
+    }
+    memcpy(self->oid, PyBytes_AS_STRING(oid), 12);
+    Py_RETURN_NONE;
+}
+
+static PyObject* ObjectId_get_binary(ObjectId* self, void* closure) {
+    return PyBytes_FromStringAndSize(self->oid, 12);
+}
+
+static PyObject* ObjectId_get_generation_time(ObjectId* self, void* closure) {
+    const unsigned char* oid = (const unsigned char*)self->oid;
+    int seconds = (int)((unsigned int)oid[0] << 24 | oid[1] << 16 |
+                        oid[2] << 8 | oid[3]);
+    PyObject* utc = NULL;
+    PyObject* result;
+
+    if (_reload_object(&utc, "bson.tz_util", "utc")) {
+        return NULL;
+    }
+    result = datetime_from_millis((long long)seconds * 1000, utc);
+    Py_DECREF(utc);
+    return result;
+}
+
+static PyObject* ObjectId_str(ObjectId* self) {
+    static const char digits[] = "0123456789abcdef";
+    char hex[24];
+    int i;
+
+    for (i = 0; i < 12; i++) {
+        hex[2 * i] = digits[(unsigned char)self->oid[i] >> 4];
+        hex[2 * i + 1] = digits[(unsigned char)self->oid[i] & 0xF];
+    }
+    return PyUnicode_FromStringAndSize(hex, 24);
+}
+
+static PyObject* ObjectId_repr(ObjectId* self) {
+    PyObject* hex = ObjectId_str(self);
+    PyObject* repr;
+    if (!hex) {
+        return NULL;
+    }
+    repr = PyUnicode_FromFormat("ObjectId('%U')", hex);
+    Py_DECREF(hex);
+    return repr;
+}
+
+static PyObject* ObjectId_richcompare(ObjectId* self, PyObject* other, int op) {
+    int equal;
+
+    if ((op != Py_EQ && op != Py_NE) ||
+        !PyObject_TypeCheck(other, &ObjectId_Type)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    equal = memcmp(self->oid, ((ObjectId*)other)->oid, 12) == 0;
+    if (equal == (op == Py_EQ)) {
+        Py_RETURN_TRUE;
+    }
+    Py_RETURN_FALSE;
+}
+
+static Py_hash_t ObjectId_hash(ObjectId* self) {
+    /* FNV-1a */
+    Py_uhash_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < 12; i++) {
+        hash = (hash ^ (unsigned char)self->oid[i]) * 16777619u;
+    }
+    if ((Py_hash_t)hash == -1) {
+        return -2;
+    }
+    return (Py_hash_t)hash;
+}
+
+static PyMethodDef ObjectId_methods[] = {
+    {"from_datetime", (PyCFunction)ObjectId_from_datetime, METH_O | METH_CLASS,
+     "Create a dummy ObjectId instance with a specific generation time.\n\n"
+     "This method is useful for doing range queries on a field\n"
+     "containing :class:`ObjectId` instances.\n\n"
+     ".. warning::\n"
+     "   It is not safe to insert a document containing an ObjectId\n"
+     "   generated using this method. This method deliberately\n"
+     "   eliminates the uniqueness guarantee that ObjectIds\n"
+     "   generally provide. ObjectIds generated with this method\n"
+     "   should be used exclusively in queries.\n\n"
+     "`generation_time` will be converted to UTC. Naive datetime\n"
+     "instances will be treated as though they already contain UTC.\n\n"
+     "An example using this helper to get documents where ``\"_id\"``\n"
+     "was generated before January 1, 2010 would be:\n\n"
+     ">>> gen_time = datetime.datetime(2010, 1, 1)\n"
+     ">>> dummy_id = ObjectId.from_datetime(gen_time)\n"
+     ">>> result = collection.find({\"_id\": {\"$lt\": dummy_id}})\n\n"
+     ":Parameters:\n"
+     "  - `generation_time`: :class:`~datetime.datetime` to be used\n"
+     "    as the generation time for the resulting ObjectId.\n\n"
+     ".. versionchanged:: 1.8\n"
+     "   Properly handle timezone aware values for\n"
+     "   `generation_time`.\n\n"
+     ".. versionadded:: 1.6"},
+    {"__getstate__", (PyCFunction)ObjectId_getstate, METH_NOARGS,
+     "return value of object for pickling."},
+    {"__reduce__", (PyCFunction)ObjectId_reduce, METH_NOARGS,
+     "pickle as a call to the type with the binary value."},
+    {"__setstate__", (PyCFunction)ObjectId_setstate, METH_O,
+     "explicit state set from pickling"},
+    {NULL}
+};
+
+static PyGetSetDef ObjectId_getset[] = {
+    {"binary", (getter)ObjectId_get_binary, NULL,
+     "12-byte binary representation of this ObjectId.", NULL},
+    {"generation_time", (getter)ObjectId_get_generation_time, NULL,
+     "A :class:`datetime.datetime` instance representing the time of\n"
+     "generation for this :class:`ObjectId`.\n\n"
+     "The :class:`datetime.datetime` is timezone aware, and\n"
+     "represents the generation time in UTC. It is precise to the\n"
+     "second.\n\n"
+     ".. versionchanged:: 1.8\n"
+     "   Now return an aware datetime instead of a naive one.\n\n"
+     ".. versionadded:: 1.2", NULL},
+    {NULL}
+};
+
+static PyTypeObject ObjectId_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "bson.objectid.ObjectId",                   /* tp_name */
+    sizeof(ObjectId),                           /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)ObjectId_dealloc,               /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_reserved */
+    (reprfunc)ObjectId_repr,                    /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    (hashfunc)ObjectId_hash,                    /* tp_hash */
+    0,                                          /* tp_call */
+    (reprfunc)ObjectId_str,                     /* tp_str */
+    0,                                          /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,   /* tp_flags */
+    "A MongoDB ObjectId.\n\n"
+    "If `oid` is ``None``, create a new (unique) ObjectId. If `oid`\n"
+    "is an instance of (``bytes``, ``str``, :class:`ObjectId`) validate\n"
+    "it and use that.  Otherwise, a :class:`TypeError` is\n"
+    "raised. If `oid` is invalid,\n"
+    ":class:`~bson.errors.InvalidId` is raised.\n\n"
+    ":Parameters:\n"
+    "  - `oid` (optional): a valid ObjectId (12 byte binary or 24 character\n"
+    "    hex string)\n\n"
+    ".. versionchanged:: 2.0+\n"
+    "   Implemented in C when the C extension is available.\n"
+    ".. versionadded:: 1.2.1\n"
+    "   The `oid` parameter can be a ``str`` instance (that contains\n"
+    "   only hexadecimal digits).\n\n"
+    ".. mongodoc:: objectids",                  /* tp_doc */
+    0,                                          /* tp_traverse */
+    0,                                          /* tp_clear */
+    (richcmpfunc)ObjectId_richcompare,          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    0,                                          /* tp_iter */
+    0,                                          /* tp_iternext */
+    ObjectId_methods,                           /* tp_methods */
+    0,                                          /* tp_members */
+    ObjectId_getset,                            /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    (initproc)ObjectId_init,                    /* tp_init */
+    0,                                          /* tp_alloc */
+    ObjectId_new,                               /* tp_new */
+};
+
+/* Set up the ObjectId type, taking the machine part of new ObjectIds
+ * from bson.objectid.
+ *
+ * Returns non-zero on failure. */
+static int _init_objectid_type(void) {
+    PyObject* machine_bytes = NULL;
+    PyObject* machine;
+
+    if (PyType_Ready(&ObjectId_Type) < 0) {
+        return 1;
+    }
+    if (_reload_object(&machine_bytes, "bson.objectid", "_machine_bytes")) {
+        return 1;
+    }
+    machine = PyObject_CallObject(machine_bytes, NULL);
+    Py_DECREF(machine_bytes);
+    if (!machine) {
+        return 1;
+    }
+    if (!PyBytes_Check(machine) || PyBytes_GET_SIZE(machine) != 3) {
+        PyErr_SetString(PyExc_ValueError, "machine bytes must be 3 bytes");
+        Py_DECREF(machine);
+        return 1;
+    }
+    memcpy(objectid_machine, PyBytes_AS_STRING(machine), 3);
+    Py_DECREF(machine);
+    return 0;
+}
+
+/* Get a pointer to the data of `object`, which must be a bytes object
+ * or support the buffer protocol. `function` is used in the error message.
+ *
+ * Returns a new ref to an object keeping the data alive (and locked,
+ * for buffers), or NULL on failure. */
+static PyObject* _get_data(PyObject* object, const char* function,
+                           const char** data, Py_ssize_t* length) {
+    PyObject* owner;
+    Py_buffer* view;
+
+    if (PyBytes_Check(object)) {
+        Py_INCREF(object);
+        *data = PyBytes_AS_STRING(object);
+        *length = PyBytes_GET_SIZE(object);
+        return object;
+    }
+    if (!PyObject_CheckBuffer(object)) {
+        PyErr_Format(PyExc_TypeError, "argument to %s must be a bytes "
+                     "object or support the buffer protocol", function);
+        return NULL;
+    }
+    owner = PyMemoryView_FromObject(object);
+    if (!owner) {
+        return NULL;
+    }
+    view = PyMemoryView_GET_BUFFER(owner);
+    if (!PyBuffer_IsContiguous(view, 'C')) {
+        PyErr_Format(PyExc_TypeError, "argument to %s must be a "
+                     "contiguous buffer", function);
+        Py_DECREF(owner);
+        return NULL;
+    }
+    *data = view->buf;
+    *length = view->len;
+    return owner;
+}
+
+/* Check that a complete BSON document starts at `string`, and store
+ * its size in `size`.
+ *
+ * Returns 0 on failure */
+static int _check_document(const char* string, Py_ssize_t total_size,
+                           unsigned int* size) {
+    PyObject* InvalidBSON;
+    const char* message;
+
+    if (total_size < 5) {
+        message = "not enough data for a BSON document";
+        goto invalid;
+    }
+    memcpy(size, string, 4);
+    if (total_size < *size) {
+        message = "objsize too large";
+        goto invalid;
+    }
+    if (*size < 5) {
+        message = "objsize too small";
+        goto invalid;
+    }
+    if (string[*size - 1]) {
+        message = "bad eoo";
+        goto invalid;
+    }
+    return 1;
+
+    invalid:
+    InvalidBSON = _error("InvalidBSON");
+    PyErr_SetString(InvalidBSON, message);
+    Py_DECREF(InvalidBSON);
+    return 0;
+}
+
+/* Check that the string value of `size` bytes at `string` (its length,
+ * contents and NULL terminator) is well formed.
+ *
+ * Returns an error message, or NULL if it is valid */
+static const char* _validate_string(const char* string, int size) {
+    int length;
+    memcpy(&length, string, 4);
+    if (length < 1 || length > size - 4 || string[4 + length - 1]) {
+        return "invalid string length";
+    }
+    if (check_string((const unsigned char*)string + 4, length - 1,
+                     1, 0) != VALID) {
+        return "invalid UTF-8 in string";
+    }
+    return NULL;
+}
+
+/* Check the structure of the document at `string`, which must fit in
+ * `max` bytes: sizes, terminators, type bytes and UTF-8. This doesn't
+ * use the Python API, so it can run without the GIL.
+ *
+ * Returns an error message, or NULL if it is valid */
+static const char* _validate_document(const char* string, unsigned int max,
+                                      int depth) {
+    unsigned int size;
+    int position = 4;
+    int end;
+
+    if (max < 5) {
+        return "not enough data for a BSON document";
+    }
+    memcpy(&size, string, 4);
+    if (max < size) {
+        return "objsize too large";
+    }
+    if (size < 5) {
+        return "objsize too small";
+    }
+    if (string[size - 1]) {
+        return "bad eoo";
+    }
+    if (depth > VALIDATE_MAX_DEPTH) {
+        return "documents nested too deeply";
+    }
+
+    end = size - 1;
+    while (position < end) {
+        int type = (signed char)string[position++];
+        const char* name_end = memchr(string + position, 0, end - position);
+        int value_size;
+        const char* error = NULL;
+
+        if (!name_end) {
+            return "bad key name";
+        }
+        if (check_string((const unsigned char*)string + position,
+                         name_end - (string + position), 1, 0) != VALID) {
+            return "invalid UTF-8 in key name";
+        }
+        position = name_end - string + 1;
+
+        value_size = _element_value_size(string, position, type,
+                                         end - position);
+        if (value_size < 0) {
+            return "invalid element";
+        }
+        switch (type) {
+        case 2:
+        case 13:
+        case 14:
+            error = _validate_string(string + position, value_size);
+            break;
+        case 3:
+        case 4:
+            error = _validate_document(string + position, value_size,
+                                       depth + 1);
+            break;
+        case 11:
+            {
+                int pattern_length = strlen(string + position);
+                if (pattern_length > value_size - 2) {
+                    error = "invalid regex";
+                } else if (check_string((const unsigned char*)string + position,
+                                        pattern_length, 1, 0) != VALID ||
+                           check_string((const unsigned char*)string +
+                                        position + pattern_length + 1,
+                                        value_size - pattern_length - 2,
+                                        1, 0) != VALID) {
+                    error = "invalid UTF-8 in regex";
+                }
+                break;
+            }
+        case 12:
+            error = _validate_string(string + position, value_size - 12);
+            break;
+        case 15:
+            {
+                int string_size;
+                if (value_size < 14) {
+                    error = "invalid code with scope";
+                    break;
+                }
+                error = _validate_string(string + position + 4, value_size - 4);
+                if (error) {
+                    break;
+                }
+                memcpy(&string_size, string + position + 4, 4);
+                error = _validate_document(string + position + 8 + string_size,
+                                           value_size - 8 - string_size,
+                                           depth + 1);
+                if (!error) {
+                    unsigned int scope_size;
+                    memcpy(&scope_size, string + position + 8 + string_size, 4);
+                    if (8 + string_size + scope_size != (unsigned int)value_size) {
+                        error = "invalid code with scope";
+                    }
+                }
+                break;
+            }
+        }
+        if (error) {
+            return error;
+        }
+        position += value_size;
+    }
+    return NULL;
+}
+
+/* Decode the document of `size` bytes at `string`, whose memory is owned
+ * by `owner`, keeping only the elements selected by `fields` (all of them
+ * if `fields` is NULL). `fields` has no effect on RawBSONDocuments, and
+ * `validated` (see _get_value) has none on their lazily decoded values.
+ *
+ * Returns a new ref */
+static PyObject* _decode_document(PyObject* self, PyObject* owner,
+                                  const char* string, unsigned int size,
+                                  PyObject* as_class, unsigned char tz_aware,
+                                  PyObject* fields, unsigned char validated) {
+    codec_stats.documents_decoded++;
+    codec_stats.bytes_decoded += size;
+    /* Only share immutable memory: a buffer could change (or be kept
+     * locked) after we return, so raw documents copy from one. */
+    if (owner && !PyBytes_Check(owner)) {
+        owner = NULL;
+    }
+    if (as_class == (PyObject*)&RawBSONDocument_Type) {
+        return raw_document_new(self, owner, string, size, tz_aware);
+    }
+    return _elements_to_dict(self, owner, string + 4, size - 5, as_class,
+                             tz_aware, fields, validated);
+}
 
 static PyObject* _cbson_bson_to_dict(PyObject* self, PyObject* args) {
     unsigned int size;
     Py_ssize_t total_size;
     const char* string;
     PyObject* bson;
+    PyObject* owner;
     PyObject* as_class;
     unsigned char tz_aware;
     PyObject* dict;
     PyObject* remainder;
     PyObject* result;
 
-    if (!PyArg_ParseTuple(args, "OOb", &bson, &as_class, &tz_aware)) {
-        return NULL;
+    if (!PyArg_ParseTuple(args, "OOb", &bson, &as_class, &tz_aware)) {
+        return NULL;
+    }
+
+    owner = _get_data(bson, "_bson_to_dict", &string, &total_size);
+    if (!owner) {
+        return NULL;
+    }
+    if (!_check_document(string, total_size, &size)) {
+        Py_DECREF(owner);
+        return NULL;
+    }
+
+    dict = _decode_document(self, owner, string, size, as_class, tz_aware, NULL, 0);
+    if (!dict) {
+        Py_DECREF(owner);
+        return NULL;
+    }
+    remainder = PyBytes_FromStringAndSize(string + size, total_size - size);
+    Py_DECREF(owner);
+    if (!remainder) {
+        Py_DECREF(dict);
+        return NULL;
+    }
+    result = Py_BuildValue("OO", dict, remainder);
+    Py_DECREF(dict);
+    Py_DECREF(remainder);
+    return result;
+}
+
+/* Decode the concatenated documents in the `total_size` bytes at `string`,
+ * whose memory is owned by `owner`. `fields` is a field filter from
+ * _compile_fields, or NULL to decode every field. If `validated` is set
+ * the documents have been checked by validate_documents (and `owner`
+ * is immutable), so they're decoded without bounds checks.
+ *
+ * Returns a new ref to a list, or NULL on failure */
+static PyObject* decode_documents(PyObject* self, PyObject* owner,
+                                  const char* string, Py_ssize_t total_size,
+                                  PyObject* as_class, unsigned char tz_aware,
+                                  PyObject* fields, unsigned char validated) {
+    unsigned int size;
+    PyObject* dict;
+    PyObject* result = PyList_New(0);
+    if (!result) {
+        return NULL;
+    }
+
+    while (total_size > 0) {
+        if (validated) {
+            memcpy(&size, string, 4);
+        } else if (!_check_document(string, total_size, &size)) {
+            Py_DECREF(result);
+            return NULL;
+        }
+
+        dict = _decode_document(self, owner, string, size, as_class, tz_aware,
+                                fields, validated);
+        if (!dict) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        if (PyList_Append(result, dict) == -1) {
+            Py_DECREF(dict);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(dict);
+        string += size;
+        total_size -= size;
+    }
+
+    return result;
+}
+
+/* Create an iterator over the concatenated documents in the `total_size`
+ * bytes at `string`, whose memory is owned by `owner`. Each document is
+ * decoded as it is reached, as decode_documents would decode it.
+ *
+ * Returns a new ref */
+static PyObject* decode_iterator_new(PyObject* self, PyObject* owner,
+                                     const char* string, Py_ssize_t total_size,
+                                     PyObject* as_class, unsigned char tz_aware,
+                                     PyObject* fields) {
+    DecodeIterator* iterator = PyObject_New(DecodeIterator, &DecodeIterator_Type);
+    if (!iterator) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    iterator->module = self;
+    Py_INCREF(owner);
+    iterator->owner = owner;
+    iterator->string = string;
+    iterator->remaining = total_size;
+    Py_INCREF(as_class);
+    iterator->as_class = as_class;
+    iterator->tz_aware = tz_aware;
+    Py_XINCREF(fields);
+    iterator->fields = fields;
+    return (PyObject*)iterator;
+}
+
+static void DecodeIterator_dealloc(DecodeIterator* iterator) {
+    Py_XDECREF(iterator->fields);
+    Py_DECREF(iterator->as_class);
+    Py_DECREF(iterator->owner);
+    Py_DECREF(iterator->module);
+    PyObject_Del(iterator);
+}
+
+static PyObject* DecodeIterator_next(DecodeIterator* iterator) {
+    unsigned int size;
+    PyObject* dict;
+
+    if (iterator->remaining <= 0) {
+        return NULL;
+    }
+    if (!_check_document(iterator->string, iterator->remaining, &size)) {
+        /* Don't raise again on the next call */
+        iterator->remaining = 0;
+        return NULL;
+    }
+    dict = _decode_document(iterator->module, iterator->owner, iterator->string,
+                            size, iterator->as_class, iterator->tz_aware,
+                            iterator->fields, 0);
+    if (!dict) {
+        iterator->remaining = 0;
+        return NULL;
+    }
+    iterator->string += size;
+    iterator->remaining -= size;
+    return dict;
+}
+
+static PyTypeObject DecodeIterator_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "bson._cbson.DecodeIterator",               /* tp_name */
+    sizeof(DecodeIterator),                     /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)DecodeIterator_dealloc,         /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_reserved */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    0,                                          /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                         /* tp_flags */
+    "An iterator decoding one BSON document at a time.",
+    0,                                          /* tp_traverse */
+    0,                                          /* tp_clear */
+    0,                                          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    PyObject_SelfIter,                          /* tp_iter */
+    (iternextfunc)DecodeIterator_next,          /* tp_iternext */
+};
+
+/* Build a field filter for _elements_to_dict from `fields`, an iterable
+ * of field names or dotted paths. The filter maps the UTF-8 encoded name
+ * of each wanted field to either Py_None (keep the whole value) or the
+ * filter to apply to that embedded document.
+ *
+ * Returns a new ref */
+static PyObject* _compile_fields(PyObject* fields) {
+    PyObject* iterator;
+    PyObject* field;
+    PyObject* filter = PyDict_New();
+    if (!filter) {
+        return NULL;
+    }
+
+    iterator = PyObject_GetIter(fields);
+    if (!iterator) {
+        Py_DECREF(filter);
+        return NULL;
+    }
+    while ((field = PyIter_Next(iterator))) {
+        PyObject* node = filter;
+        const char* path;
+        const char* end;
+        Py_ssize_t length;
+
+        if (!PyUnicode_Check(field)) {
+            PyErr_SetString(PyExc_TypeError, "fields must be instances of str");
+            goto fail;
+        }
+        path = PyUnicode_AsUTF8AndSize(field, &length);
+        if (!path) {
+            goto fail;
+        }
+        end = path + length;
+
+        while (node != Py_None) {
+            const char* dot = memchr(path, '.', end - path);
+            PyObject* key = PyBytes_FromStringAndSize(path, (dot ? dot : end) - path);
+            PyObject* child;
+            if (!key) {
+                goto fail;
+            }
+            child = PyDict_GetItem(node, key);
+            if (!dot) {
+                /* A whole field replaces any filter for its sub-fields */
+                if (PyDict_SetItem(node, key, Py_None) == -1) {
+                    Py_DECREF(key);
+                    goto fail;
+                }
+                Py_DECREF(key);
+                break;
+            }
+            if (!child) {
+                child = PyDict_New();
+                if (!child || PyDict_SetItem(node, key, child) == -1) {
+                    Py_XDECREF(child);
+                    Py_DECREF(key);
+                    goto fail;
+                }
+                Py_DECREF(child);
+            }
+            Py_DECREF(key);
+            node = child;
+            path = dot + 1;
+        }
+        Py_DECREF(field);
+    }
+    Py_DECREF(iterator);
+    if (PyErr_Occurred()) {
+        Py_DECREF(filter);
+        return NULL;
+    }
+    return filter;
+
+    fail:
+    Py_DECREF(field);
+    Py_DECREF(iterator);
+    Py_DECREF(filter);
+    return NULL;
+}
+
+static PyObject* _cbson_decode_all(PyObject* self, PyObject* args) {
+    Py_ssize_t total_size;
+    Py_ssize_t offset = 0;
+    const char* string;
+    PyObject* bson;
+    PyObject* owner;
+    PyObject* result;
+    PyObject* as_class = (PyObject*)&PyDict_Type;
+    unsigned char tz_aware = 1;
+    PyObject* fields = Py_None;
+    PyObject* filter = NULL;
+
+    if (!PyArg_ParseTuple(args, "O|ObnO", &bson, &as_class, &tz_aware,
+                          &offset, &fields)) {
+        return NULL;
+    }
+
+    owner = _get_data(bson, "decode_all", &string, &total_size);
+    if (!owner) {
+        return NULL;
+    }
+    if (offset < 0 || offset > total_size) {
+        PyErr_SetString(PyExc_ValueError, "offset out of range");
+        Py_DECREF(owner);
+        return NULL;
+    }
+
+    if (fields != Py_None) {
+        filter = _compile_fields(fields);
+        if (!filter) {
+            Py_DECREF(owner);
+            return NULL;
+        }
+    }
+
+    result = decode_documents(self, owner, string + offset, total_size - offset,
+                              as_class, tz_aware, filter, 0);
+    Py_XDECREF(filter);
+    Py_DECREF(owner);
+    return result;
+}
+
+static PyObject* _cbson_decode_iter(PyObject* self, PyObject* args) {
+    Py_ssize_t total_size;
+    Py_ssize_t offset = 0;
+    const char* string;
+    PyObject* bson;
+    PyObject* owner;
+    PyObject* result;
+    PyObject* as_class = (PyObject*)&PyDict_Type;
+    unsigned char tz_aware = 1;
+    PyObject* fields = Py_None;
+    PyObject* filter = NULL;
+
+    if (!PyArg_ParseTuple(args, "O|ObnO", &bson, &as_class, &tz_aware,
+                          &offset, &fields)) {
+        return NULL;
+    }
+
+    owner = _get_data(bson, "decode_iter", &string, &total_size);
+    if (!owner) {
+        return NULL;
+    }
+    if (offset < 0 || offset > total_size) {
+        PyErr_SetString(PyExc_ValueError, "offset out of range");
+        Py_DECREF(owner);
+        return NULL;
+    }
+
+    if (fields != Py_None) {
+        filter = _compile_fields(fields);
+        if (!filter) {
+            Py_DECREF(owner);
+            return NULL;
+        }
+    }
+
+    result = decode_iterator_new(self, owner, string + offset,
+                                 total_size - offset, as_class, tz_aware,
+                                 filter);
+    Py_XDECREF(filter);
+    Py_DECREF(owner);
+    return result;
+}
+
+/* A column being built by decode_all_columnar. */
+typedef struct {
+    /* The BSON type of the values so far: 0 while there are none, and
+     * -1 once they differ. */
+    int type;
+    /* The array typecode of `values`, or 0 if the values are kept as
+     * objects in `objects` (a list, or NULL while there are none). */
+    char typecode;
+    buffer_t values;
+    PyObject* objects;
+    /* One byte per document: 1 if it has a value. */
+    buffer_t mask;
+    /* Number of documents with an entry. */
+    Py_ssize_t rows;
+} column_t;
+
+static const char column_zeros[8] = {0};
+
+/* The array typecode for values of BSON type `type`, or 0 if they are
+ * kept as objects. Must match bson.columns.TYPECODES. */
+static char _column_typecode(int type) {
+    switch (type) {
+    case 1:
+        return 'd';
+    case 8:
+        return 'B';
+    case 9:
+    case 18:
+        return 'q';
+    case 16:
+        return 'i';
+    default:
+        return 0;
+    }
+}
+
+static int _typecode_size(char typecode) {
+    switch (typecode) {
+    case 'B':
+        return 1;
+    case 'i':
+        return 4;
+    default:
+        return 8;
+    }
+}
+
+/* Append `size` bytes from `data` to `*buffer`, creating it if needed.
+ *
+ * Returns 0 on failure */
+static int _column_append(buffer_t* buffer, const char* data, int size) {
+    if (!*buffer) {
+        *buffer = buffer_new();
+        if (!*buffer) {
+            PyErr_NoMemory();
+            return 0;
+        }
+    }
+    if (buffer_write(*buffer, data, size)) {
+        PyErr_NoMemory();
+        return 0;
+    }
+    return 1;
+}
+
+static void _column_free(column_t* column) {
+    if (column->values) {
+        buffer_free(column->values);
+    }
+    if (column->mask) {
+        buffer_free(column->mask);
+    }
+    Py_XDECREF(column->objects);
+}
+
+/* Returns a new ref to the value of a typed column in document `row` */
+static PyObject* _column_value(PyObject* self, column_t* column,
+                               Py_ssize_t row, unsigned char tz_aware) {
+    struct module_state *state = GETSTATE(self);
+    const char* data;
+
+    if (!buffer_get_buffer(column->mask)[row]) {
+        Py_RETURN_NONE;
+    }
+    data = buffer_get_buffer(column->values) +
+        row * _typecode_size(column->typecode);
+    switch (column->type) {
+    case 1:
+        {
+            double d;
+            memcpy(&d, data, 8);
+            return PyFloat_FromDouble(d);
+        }
+    case 8:
+        return PyBool_FromLong(*data);
+    case 9:
+        {
+            long long millis;
+            memcpy(&millis, data, 8);
+            return datetime_from_millis(millis, tz_aware ? state->UTC : Py_None);
+        }
+    case 16:
+        {
+            int i;
+            memcpy(&i, data, 4);
+            return PyLong_FromLong(i);
+        }
+    default:
+        {
+            long long ll;
+            memcpy(&ll, data, 8);
+            return PyLong_FromLongLong(ll);
+        }
+    }
+}
+
+/* Switch `column` to keeping its values as objects, decoding any it
+ * holds in an array.
+ *
+ * Returns 0 on failure */
+static int _column_to_objects(PyObject* self, column_t* column,
+                              unsigned char tz_aware) {
+    PyObject* objects;
+    Py_ssize_t row;
+
+    if (column->objects) {
+        return 1;
+    }
+    objects = PyList_New(column->rows);
+    if (!objects) {
+        return 0;
+    }
+    for (row = 0; row < column->rows; row++) {
+        PyObject* value;
+        if (column->typecode) {
+            value = _column_value(self, column, row, tz_aware);
+            if (!value) {
+                Py_DECREF(objects);
+                return 0;
+            }
+        } else {
+            Py_INCREF(Py_None);
+            value = Py_None;
+        }
+        PyList_SET_ITEM(objects, row, value);
+    }
+    if (column->values) {
+        buffer_free(column->values);
+        column->values = NULL;
+    }
+    column->typecode = 0;
+    column->objects = objects;
+    return 1;
+}
+
+/* Convert the int32 values of `column` to int64.
+ *
+ * Returns 0 on failure */
+static int _column_widen(column_t* column) {
+    buffer_t widened = buffer_new_with_capacity((int)column->rows * 8);
+    Py_ssize_t row;
+
+    if (!widened) {
+        PyErr_NoMemory();
+        return 0;
+    }
+    for (row = 0; row < column->rows; row++) {
+        int i;
+        long long ll;
+        memcpy(&i, buffer_get_buffer(column->values) + row * 4, 4);
+        ll = i;
+        if (!_column_append(&widened, (const char*)&ll, 8)) {
+            buffer_free(widened);
+            return 0;
+        }
+    }
+    buffer_free(column->values);
+    column->values = widened;
+    column->typecode = 'q';
+    return 1;
+}
+
+/* Give `column` an entry without a value for the current document.
+ *
+ * Returns 0 on failure */
+static int _column_write_null(column_t* column) {
+    if (column->typecode) {
+        if (!_column_append(&column->values, column_zeros,
+                            _typecode_size(column->typecode))) {
+            return 0;
+        }
+    } else if (column->objects &&
+               PyList_Append(column->objects, Py_None) == -1) {
+        return 0;
+    }
+    if (!_column_append(&column->mask, column_zeros, 1)) {
+        return 0;
+    }
+    column->rows++;
+    return 1;
+}
+
+/* Give `column` an entry for the current document: the value of type
+ * `type` and `size` bytes at `position` in `string`.
+ *
+ * Returns 0 on failure */
+static int _column_write(PyObject* self, column_t* column, int type,
+                         const char* string, int position, int size,
+                         unsigned char tz_aware) {
+    static const char one = 1;
+    /* BSON types as unsigned bytes, like the pure Python version */
+    int column_type = type & 0xFF;
+
+    if (column_type == 6 || column_type == 10) {
+        codec_stats.elements_decoded[column_type]++;
+        return _column_write_null(column);
+    }
+    if (!column->type) {
+        Py_ssize_t row;
+        column->type = column_type;
+        column->typecode = _column_typecode(column_type);
+        if (!column->typecode && !_column_to_objects(self, column, tz_aware)) {
+            return 0;
+        }
+        for (row = 0; column->typecode && row < column->rows; row++) {
+            if (!_column_append(&column->values, column_zeros,
+                                _typecode_size(column->typecode))) {
+                return 0;
+            }
+        }
+    } else if (column->type != column_type) {
+        if (column->type == 16 && column_type == 18) {
+            if (!_column_widen(column)) {
+                return 0;
+            }
+            column->type = 18;
+        } else if (column->type != 18 || column_type != 16) {
+            if (!_column_to_objects(self, column, tz_aware)) {
+                return 0;
+            }
+            column->type = -1;
+        }
     }
 
-    if (!PyBytes_Check(bson)) {
-        PyErr_SetString(PyExc_TypeError, "argument to _bson_to_dict must be a bytes object");
+    if (column->typecode) {
+        const char* data = string + position;
+        char boolean;
+        long long ll;
+        codec_stats.elements_decoded[column_type]++;
+        if (column->typecode == 'B') {
+            boolean = *data != 0;
+            data = &boolean;
+        } else if (column->typecode == 'q' && column_type == 16) {
+            int i;
+            memcpy(&i, data, 4);
+            ll = i;
+            data = (const char*)&ll;
+        }
+        if (!_column_append(&column->values, data,
+                            _typecode_size(column->typecode))) {
+            return 0;
+        }
+    } else {
+        int failed;
+        /* Like the typed columns, a column's values are the BSON values
+         * themselves: registered decoders aren't applied. */
+        PyObject* value = _get_value(self, NULL, string, &position, type, size,
+                                     (PyObject*)&PyDict_Type, tz_aware, 0);
+        if (!value) {
+            return 0;
+        }
+        failed = PyList_Append(column->objects, value) == -1;
+        Py_DECREF(value);
+        if (failed) {
+            return 0;
+        }
+    }
+    if (!_column_append(&column->mask, &one, 1)) {
+        return 0;
+    }
+    column->rows++;
+    return 1;
+}
+
+/* Returns a new ref to an array.array of `typecode` holding the
+ * contents of `buffer` (which may be NULL) */
+static PyObject* _new_array(struct module_state* state, char typecode,
+                            buffer_t buffer) {
+    PyObject* view;
+    PyObject* result;
+    PyObject* array = PyObject_CallFunction(state->Array, "C", typecode);
+    if (!array || !buffer) {
+        return array;
+    }
+    view = PyMemoryView_FromMemory(buffer_get_buffer(buffer),
+                                   buffer_get_position(buffer), PyBUF_READ);
+    if (!view) {
+        Py_DECREF(array);
         return NULL;
     }
-    total_size = PyBytes_Size(bson);
-    if (total_size < 5) {
-        PyObject* InvalidBSON = _error("InvalidBSON");
-        PyErr_SetString(InvalidBSON,
-                        "not enough data for a BSON document");
-        Py_DECREF(InvalidBSON);
+    result = PyObject_CallMethod(array, "frombytes", "O", view);
+    Py_DECREF(view);
+    if (!result) {
+        Py_DECREF(array);
         return NULL;
     }
+    Py_DECREF(result);
+    return array;
+}
 
-    string = PyBytes_AsString(bson);
-    if (!string) {
+/* Returns a new ref to a bson.columns.Column holding `column` */
+static PyObject* _column_finish(PyObject* self, column_t* column,
+                                unsigned char tz_aware) {
+    struct module_state *state = GETSTATE(self);
+    PyObject* values;
+    PyObject* mask;
+    PyObject* type;
+    PyObject* result;
+
+    if (column->typecode) {
+        values = _new_array(state, column->typecode, column->values);
+    } else if (_column_to_objects(self, column, tz_aware)) {
+        values = column->objects;
+        Py_INCREF(values);
+    } else {
+        values = NULL;
+    }
+    if (!values) {
         return NULL;
     }
-    memcpy(&size, string, 4);
-
-    if (total_size < size) {
-        PyObject* InvalidBSON = _error("InvalidBSON");
-        PyErr_SetString(InvalidBSON,
-                        "objsize too large");
-        Py_DECREF(InvalidBSON);
+    mask = _new_array(state, 'B', column->mask);
+    if (!mask) {
+        Py_DECREF(values);
         return NULL;
     }
-
-    if (string[size - 1]) {
-        PyObject* InvalidBSON = _error("InvalidBSON");
-        PyErr_SetString(InvalidBSON,
-                        "bad eoo");
-        Py_DECREF(InvalidBSON);
+    if (column->type > 0) {
+        type = PyLong_FromLong(column->type);
+    } else {
+        Py_INCREF(Py_None);
+        type = Py_None;
+    }
+    if (!type) {
+        Py_DECREF(values);
+        Py_DECREF(mask);
         return NULL;
     }
+    result = PyObject_CallFunctionObjArgs(state->Column, type, values, mask,
+                                          NULL);
+    Py_DECREF(type);
+    Py_DECREF(values);
+    Py_DECREF(mask);
+    return result;
+}
 
-    dict = elements_to_dict(self, string + 4, size - 5, as_class, tz_aware);
-    if (!dict) {
+/* Build a tree of the fields to decode into columns, like
+ * _compile_fields but with the index of the field in `*names` (a new
+ * list of the distinct fields) for each whole value wanted.
+ *
+ * Returns a new ref, or NULL on failure (a ValueError if one field is
+ * within another) */
+static PyObject* _compile_columns(PyObject* fields, PyObject** names) {
+    PyObject* iterator;
+    PyObject* field;
+    PyObject* tree = PyDict_New();
+    if (!tree) {
         return NULL;
     }
-    remainder = PyBytes_FromStringAndSize(string + size, total_size - size);
-    if (!remainder) {
-        Py_DECREF(dict);
+    *names = PyList_New(0);
+    if (!*names) {
+        Py_DECREF(tree);
         return NULL;
     }
-    result = Py_BuildValue("OO", dict, remainder);
-    Py_DECREF(dict);
-    Py_DECREF(remainder);
-    return result;
+
+    iterator = PyObject_GetIter(fields);
+    if (!iterator) {
+        goto fail;
+    }
+    while ((field = PyIter_Next(iterator))) {
+        PyObject* node = tree;
+        const char* path;
+        const char* end;
+        Py_ssize_t length;
+
+        if (!PyUnicode_Check(field)) {
+            PyErr_SetString(PyExc_TypeError, "fields must be instances of str");
+            goto fail_field;
+        }
+        path = PyUnicode_AsUTF8AndSize(field, &length);
+        if (!path) {
+            goto fail_field;
+        }
+        end = path + length;
+
+        while (1) {
+            const char* dot = memchr(path, '.', end - path);
+            PyObject* key = PyBytes_FromStringAndSize(path, (dot ? dot : end) - path);
+            PyObject* child;
+            if (!key) {
+                goto fail_field;
+            }
+            child = PyDict_GetItem(node, key);
+            if (child && PyDict_Check(child) == !dot) {
+                Py_DECREF(key);
+                PyErr_Format(PyExc_ValueError,
+                             "field %R overlaps another field", field);
+                goto fail_field;
+            }
+            if (!dot) {
+                /* A repeated field keeps its first index */
+                if (!child) {
+                    PyObject* index = PyLong_FromSsize_t(PyList_GET_SIZE(*names));
+                    if (!index || PyDict_SetItem(node, key, index) == -1 ||
+                        PyList_Append(*names, field) == -1) {
+                        Py_XDECREF(index);
+                        Py_DECREF(key);
+                        goto fail_field;
+                    }
+                    Py_DECREF(index);
+                }
+                Py_DECREF(key);
+                break;
+            }
+            if (!child) {
+                child = PyDict_New();
+                if (!child || PyDict_SetItem(node, key, child) == -1) {
+                    Py_XDECREF(child);
+                    Py_DECREF(key);
+                    goto fail_field;
+                }
+                Py_DECREF(child);
+            }
+            Py_DECREF(key);
+            node = child;
+            path = dot + 1;
+        }
+        Py_DECREF(field);
+    }
+    Py_DECREF(iterator);
+    if (PyErr_Occurred()) {
+        goto fail;
+    }
+    return tree;
+
+    fail_field:
+    Py_DECREF(field);
+    Py_DECREF(iterator);
+    fail:
+    Py_DECREF(tree);
+    Py_CLEAR(*names);
+    return NULL;
 }
 
-static PyObject* _cbson_decode_all(PyObject* self, PyObject* args) {
-    unsigned int size;
+/* Give the columns for the fields in `tree` (see _compile_columns) an
+ * entry for each of their values in the `max` bytes of elements at
+ * `string`, the elements of document number `row`.
+ *
+ * Returns 0 on failure */
+static int _scan_columns(PyObject* self, const char* string, int max,
+                         PyObject* tree, column_t* columns, Py_ssize_t row,
+                         unsigned char tz_aware) {
+    int position = 0;
+    PyObject* InvalidBSON;
+
+    while (position < max) {
+        PyObject* node;
+        int found;
+        int value_size;
+        int type = (int)string[position++];
+        int name_length = strlen(string + position);
+        if (position + name_length >= max) {
+            goto invalid;
+        }
+        found = _field_lookup(tree, string + position, name_length, &node);
+        position += name_length + 1;
+        value_size = _element_value_size(string, position, type, max - position);
+        if (value_size == -1) {
+            goto invalid;
+        }
+        if (found && PyDict_Check(node)) {
+            if (type == 3) {
+                if (string[position + value_size - 1]) {
+                    goto invalid;
+                }
+                if (!_scan_columns(self, string + position + 4, value_size - 5,
+                                   node, columns, row, tz_aware)) {
+                    return 0;
+                }
+            }
+        } else if (found) {
+            column_t* column = &columns[PyLong_AsSsize_t(node)];
+            /* Only the first of repeated fields is used */
+            if (column->rows == row &&
+                !_column_write(self, column, type, string, position,
+                               value_size, tz_aware)) {
+                return 0;
+            }
+        }
+        position += value_size;
+    }
+    return 1;
+
+    invalid:
+    InvalidBSON = _error("InvalidBSON");
+    PyErr_SetNone(InvalidBSON);
+    Py_DECREF(InvalidBSON);
+    return 0;
+}
+
+static PyObject* _cbson_decode_all_columnar(PyObject* self, PyObject* args) {
     Py_ssize_t total_size;
+    Py_ssize_t offset = 0;
+    Py_ssize_t count;
+    Py_ssize_t row = 0;
+    Py_ssize_t i;
+    unsigned int size;
     const char* string;
     PyObject* bson;
-    PyObject* dict;
-    PyObject* result;
-    PyObject* as_class = (PyObject*)&PyDict_Type;
+    PyObject* fields;
+    PyObject* owner;
+    PyObject* tree;
+    PyObject* names;
+    PyObject* result = NULL;
     unsigned char tz_aware = 1;
+    column_t* columns;
 
-    if (!PyArg_ParseTuple(args, "O|Ob", &bson, &as_class, &tz_aware)) {
+    if (!PyArg_ParseTuple(args, "OO|bn", &bson, &fields, &tz_aware, &offset)) {
         return NULL;
     }
 
-    if (!PyBytes_Check(bson)) {
-        PyErr_SetString(PyExc_TypeError, "argument to decode_all must be a bytes object");
+    owner = _get_data(bson, "decode_all_columnar", &string, &total_size);
+    if (!owner) {
         return NULL;
     }
-    total_size = PyBytes_Size(bson);
-    string = PyBytes_AsString(bson);
-    if (!string) {
+    if (offset < 0 || offset > total_size) {
+        PyErr_SetString(PyExc_ValueError, "offset out of range");
+        Py_DECREF(owner);
         return NULL;
     }
+    tree = _compile_columns(fields, &names);
+    if (!tree) {
+        Py_DECREF(owner);
+        return NULL;
+    }
+    count = PyList_GET_SIZE(names);
+    columns = PyMem_Calloc(count ? count : 1, sizeof(column_t));
+    if (!columns) {
+        PyErr_NoMemory();
+        goto done;
+    }
 
-    result = PyList_New(0);
-
+    string += offset;
+    total_size -= offset;
     while (total_size > 0) {
-        if (total_size < 5) {
-            PyObject* InvalidBSON = _error("InvalidBSON");
-            PyErr_SetString(InvalidBSON,
-                            "not enough data for a BSON document");
-            Py_DECREF(InvalidBSON);
-            return NULL;
+        if (!_check_document(string, total_size, &size) ||
+            !_scan_columns(self, string + 4, size - 5, tree, columns, row,
+                           tz_aware)) {
+            goto done;
+        }
+        row++;
+        codec_stats.documents_decoded++;
+        codec_stats.bytes_decoded += size;
+        for (i = 0; i < count; i++) {
+            if (columns[i].rows < row && !_column_write_null(&columns[i])) {
+                goto done;
+            }
         }
+        string += size;
+        total_size -= size;
+    }
+
+    result = PyDict_New();
+    if (!result) {
+        goto done;
+    }
+    for (i = 0; i < count; i++) {
+        PyObject* column = _column_finish(self, &columns[i], tz_aware);
+        if (!column ||
+            PyDict_SetItem(result, PyList_GET_ITEM(names, i), column) == -1) {
+            Py_XDECREF(column);
+            Py_CLEAR(result);
+            goto done;
+        }
+        Py_DECREF(column);
+    }
+
+    done:
+    if (columns) {
+        for (i = 0; i < count; i++) {
+            _column_free(&columns[i]);
+        }
+        PyMem_Free(columns);
+    }
+    Py_DECREF(names);
+    Py_DECREF(tree);
+    Py_DECREF(owner);
+    return result;
+}
 
+/* Check the structure of the concatenated documents in the `total_size`
+ * bytes at `string`, releasing the GIL if there are many of them. The
+ * caller must keep the memory alive meanwhile.
+ *
+ * Returns the number of documents, or -1 on failure */
+static Py_ssize_t validate_documents(const char* string, Py_ssize_t total_size) {
+    Py_ssize_t count = 0;
+    const char* error = NULL;
+    PyThreadState* thread_state = NULL;
+
+    if (total_size > VALIDATE_NOGIL_THRESHOLD) {
+        thread_state = PyEval_SaveThread();
+    }
+    while (total_size > 0) {
+        unsigned int size;
+        error = _validate_document(string, total_size > INT_MAX ?
+                                   INT_MAX : (unsigned int)total_size, 0);
+        if (error) {
+            break;
+        }
         memcpy(&size, string, 4);
+        string += size;
+        total_size -= size;
+        count++;
+    }
+    if (thread_state) {
+        PyEval_RestoreThread(thread_state);
+    }
 
-        if (total_size < size) {
-            PyObject* InvalidBSON = _error("InvalidBSON");
-            PyErr_SetString(InvalidBSON,
-                            "objsize too large");
+    if (error) {
+        PyObject* InvalidBSON = _error("InvalidBSON");
+        if (InvalidBSON) {
+            PyErr_SetString(InvalidBSON, error);
             Py_DECREF(InvalidBSON);
-            return NULL;
         }
+        return -1;
+    }
+    return count;
+}
 
-        if (string[size - 1]) {
-            PyObject* InvalidBSON = _error("InvalidBSON");
-            PyErr_SetString(InvalidBSON,
-                            "bad eoo");
-            Py_DECREF(InvalidBSON);
+static PyObject* _cbson_validate_all(PyObject* self, PyObject* args) {
+    Py_ssize_t total_size;
+    Py_ssize_t offset = 0;
+    Py_ssize_t count;
+    const char* string;
+    PyObject* bson;
+    PyObject* owner;
+
+    if (!PyArg_ParseTuple(args, "O|n", &bson, &offset)) {
+        return NULL;
+    }
+
+    owner = _get_data(bson, "validate_all", &string, &total_size);
+    if (!owner) {
+        return NULL;
+    }
+    if (offset < 0 || offset > total_size) {
+        PyErr_SetString(PyExc_ValueError, "offset out of range");
+        Py_DECREF(owner);
+        return NULL;
+    }
+
+    /* `owner` keeps the data alive (and buffers locked) meanwhile. */
+    count = validate_documents(string + offset, total_size - offset);
+    Py_DECREF(owner);
+    if (count == -1) {
+        return NULL;
+    }
+    return PyLong_FromSsize_t(count);
+}
+
+static PyObject* _cbson_set_regex_caching(PyObject* self, PyObject* args) {
+    struct module_state *state = GETSTATE(self);
+    unsigned char enabled;
+    int i;
+
+    if (!PyArg_ParseTuple(args, "b", &enabled)) {
+        return NULL;
+    }
+
+    state->no_regex_cache = !enabled;
+    if (!enabled) {
+        for (i = 0; i < REGEX_CACHE_SIZE; i++) {
+            Py_CLEAR(state->regex_cache_keys[i]);
+            Py_CLEAR(state->regex_cache_values[i]);
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* _cbson_register_encoder(PyObject* self, PyObject* args) {
+    struct module_state *state = GETSTATE(self);
+    PyObject* type;
+    PyObject* encoder;
+
+    if (!PyArg_ParseTuple(args, "O!O", &PyType_Type, &type, &encoder)) {
+        return NULL;
+    }
+    if (!state->encoders) {
+        state->encoders = PyDict_New();
+        if (!state->encoders) {
             return NULL;
         }
+    }
+    if (encoder == Py_None) {
+        if (PyDict_GetItem(state->encoders, type) &&
+            PyDict_DelItem(state->encoders, type) == -1) {
+            return NULL;
+        }
+    } else if (PyDict_SetItem(state->encoders, type, encoder) == -1) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
 
-        dict = elements_to_dict(self, string + 4, size - 5, as_class, tz_aware);
-        if (!dict) {
+static PyObject* _cbson_register_decoder(PyObject* self, PyObject* args) {
+    struct module_state *state = GETSTATE(self);
+    int type;
+    int subtype;
+    PyObject* decoder;
+    PyObject** slot;
+
+    if (!PyArg_ParseTuple(args, "iiO", &type, &subtype, &decoder)) {
+        return NULL;
+    }
+    if (type < 0 || type > 255 || subtype < -1 || subtype > 255 ||
+        (subtype != -1 && type != 5)) {
+        PyErr_SetString(PyExc_ValueError, "invalid BSON type or subtype");
+        return NULL;
+    }
+    slot = subtype == -1 ? &state->decoders[type] :
+        &state->binary_decoders[subtype];
+    if (*slot) {
+        state->decoder_count--;
+    }
+    if (decoder == Py_None) {
+        Py_CLEAR(*slot);
+    } else {
+        Py_INCREF(decoder);
+        Py_XSETREF(*slot, decoder);
+        state->decoder_count++;
+    }
+    Py_RETURN_NONE;
+}
+
+/* Set `dict[name]` to `value`.
+ *
+ * Returns 0 on failure */
+static int _set_counter(PyObject* dict, const char* name,
+                        unsigned long long value) {
+    int failed;
+    PyObject* number = PyLong_FromUnsignedLongLong(value);
+    if (!number) {
+        return 0;
+    }
+    failed = PyDict_SetItemString(dict, name, number) == -1;
+    Py_DECREF(number);
+    return !failed;
+}
+
+/* Get the non-zero counters in `counters` as a dict of
+ * BSON type -> count.
+ *
+ * Returns a new ref, or NULL on failure */
+static PyObject* _type_counters(unsigned long long* counters) {
+    int i;
+    PyObject* dict = PyDict_New();
+    if (!dict) {
+        return NULL;
+    }
+    for (i = 0; i < 256; i++) {
+        PyObject* type;
+        PyObject* count;
+        int failed;
+        if (!counters[i]) {
+            continue;
+        }
+        type = PyLong_FromLong(i);
+        count = PyLong_FromUnsignedLongLong(counters[i]);
+        failed = !type || !count || PyDict_SetItem(dict, type, count) == -1;
+        Py_XDECREF(type);
+        Py_XDECREF(count);
+        if (failed) {
+            Py_DECREF(dict);
             return NULL;
         }
-        PyList_Append(result, dict);
-        Py_DECREF(dict);
-        string += size;
-        total_size -= size;
     }
+    return dict;
+}
+
+static PyObject* _cbson_stats(PyObject* self, PyObject* args) {
+    unsigned char reset = 0;
+    buffer_stats_t buffers;
+    PyObject* result;
+    PyObject* encoded;
+    PyObject* decoded;
+
+    if (!PyArg_ParseTuple(args, "|b", &reset)) {
+        return NULL;
+    }
+
+    result = PyDict_New();
+    if (!result) {
+        return NULL;
+    }
+    buffer_get_stats(&buffers, 0);
+    if (!_set_counter(result, "documents_encoded",
+                      codec_stats.documents_encoded) ||
+        !_set_counter(result, "bytes_encoded", codec_stats.bytes_encoded) ||
+        !_set_counter(result, "documents_decoded",
+                      codec_stats.documents_decoded) ||
+        !_set_counter(result, "bytes_decoded", codec_stats.bytes_decoded) ||
+        !_set_counter(result, "isinstance_checks",
+                      codec_stats.isinstance_checks) ||
+        !_set_counter(result, "isinstance_hits",
+                      codec_stats.isinstance_hits) ||
+        !_set_counter(result, "no_decoder", codec_stats.no_decoder) ||
+        !_set_counter(result, "reloads", codec_stats.reloads) ||
+        !_set_counter(result, "buffer_grows", buffers.grows) ||
+        !_set_counter(result, "buffer_peak_size", buffers.peak_size)) {
+        Py_DECREF(result);
+        return NULL;
+    }
+
+    encoded = _type_counters(codec_stats.elements_encoded);
+    if (!encoded || PyDict_SetItemString(result, "elements_encoded",
+                                         encoded) == -1) {
+        Py_XDECREF(encoded);
+        Py_DECREF(result);
+        return NULL;
+    }
+    Py_DECREF(encoded);
+    decoded = _type_counters(codec_stats.elements_decoded);
+    if (!decoded || PyDict_SetItemString(result, "elements_decoded",
+                                         decoded) == -1) {
+        Py_XDECREF(decoded);
+        Py_DECREF(result);
+        return NULL;
+    }
+    Py_DECREF(decoded);
 
+    if (reset) {
+        memset(&codec_stats, 0, sizeof(codec_stats));
+        buffer_get_stats(&buffers, 1);
+    }
     return result;
 }
 
@@ -1432,11 +4317,26 @@ static PyMethodDef _CBSONMethods[] = {
      "convert a BSON string to a SON object."},
     {"decode_all", _cbson_decode_all, METH_VARARGS,
      "convert binary data to a sequence of documents."},
+    {"decode_iter", _cbson_decode_iter, METH_VARARGS,
+     "iterate over the documents in binary data, decoding one at a time."},
+    {"decode_all_columnar", _cbson_decode_all_columnar, METH_VARARGS,
+     "decode some fields of binary data holding documents into columns."},
+    {"validate_all", _cbson_validate_all, METH_VARARGS,
+     "check the structure of binary data holding a sequence of documents."},
+    {"_set_regex_caching", _cbson_set_regex_caching, METH_VARARGS,
+     "enable or disable the cache of decoded regexes."},
+    {"_register_encoder", _cbson_register_encoder, METH_VARARGS,
+     "set (or with None, remove) the encoder for a Python type."},
+    {"_register_decoder", _cbson_register_decoder, METH_VARARGS,
+     "set (or with None, remove) the decoder for a BSON type or binary subtype."},
+    {"stats", _cbson_stats, METH_VARARGS,
+     "get (and optionally reset) the encoding and decoding counters."},
     {NULL, NULL, 0, NULL}
 };
 
 static int _cbson_traverse(PyObject *m, visitproc visit, void *arg) {
     struct module_state *state = GETSTATE(m);
+    int i;
 
     Py_VISIT(state->Binary);
     Py_VISIT(state->Code);
@@ -1448,12 +4348,29 @@ static int _cbson_traverse(PyObject *m, visitproc visit, void *arg) {
     Py_VISIT(state->MinKey);
     Py_VISIT(state->MaxKey);
     Py_VISIT(state->UTC);
+    Py_VISIT(state->Column);
+    Py_VISIT(state->Array);
+    Py_VISIT(state->SON);
+    Py_VISIT(state->SONKeys);
     Py_VISIT(state->REType);
+    for (i = 0; i < KEY_CACHE_SIZE; i++) {
+        Py_VISIT(state->key_cache[i]);
+    }
+    for (i = 0; i < REGEX_CACHE_SIZE; i++) {
+        Py_VISIT(state->regex_cache_keys[i]);
+        Py_VISIT(state->regex_cache_values[i]);
+    }
+    Py_VISIT(state->encoders);
+    for (i = 0; i < 256; i++) {
+        Py_VISIT(state->decoders[i]);
+        Py_VISIT(state->binary_decoders[i]);
+    }
     return 0;
 }
 
 static int _cbson_clear(PyObject *m) {
     struct module_state *state = GETSTATE(m);
+    int i;
 
     Py_CLEAR(state->Binary);
     Py_CLEAR(state->Code);
@@ -1465,7 +4382,24 @@ static int _cbson_clear(PyObject *m) {
     Py_CLEAR(state->MinKey);
     Py_CLEAR(state->MaxKey);
     Py_CLEAR(state->UTC);
+    Py_CLEAR(state->Column);
+    Py_CLEAR(state->Array);
+    Py_CLEAR(state->SON);
+    Py_CLEAR(state->SONKeys);
     Py_CLEAR(state->REType);
+    for (i = 0; i < KEY_CACHE_SIZE; i++) {
+        Py_CLEAR(state->key_cache[i]);
+    }
+    for (i = 0; i < REGEX_CACHE_SIZE; i++) {
+        Py_CLEAR(state->regex_cache_keys[i]);
+        Py_CLEAR(state->regex_cache_values[i]);
+    }
+    Py_CLEAR(state->encoders);
+    for (i = 0; i < 256; i++) {
+        Py_CLEAR(state->decoders[i]);
+        Py_CLEAR(state->binary_decoders[i]);
+    }
+    state->decoder_count = 0;
     return 0;
 }
 
@@ -1496,18 +4430,48 @@ PyInit__cbson(void)
         return NULL;
     }
 
+    if (_init_objectid_type()) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
     /* Import several python objects */
     if (_reload_python_objects(module)) {
         Py_DECREF(module);
         return NULL;
     }
 
+    if (PyType_Ready(&RawBSONDocument_Type) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    Py_INCREF(&RawBSONDocument_Type);
+    PyModule_AddObject(module, "RawBSONDocument", (PyObject*)&RawBSONDocument_Type);
+    Py_INCREF(&ObjectId_Type);
+    PyModule_AddObject(module, "ObjectId", (PyObject*)&ObjectId_Type);
+    if (PyType_Ready(&DecodeIterator_Type) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
     /* Export C API */
     static void *_cbson_API[_cbson_API_POINTER_COUNT];
     _cbson_API[_cbson_buffer_write_bytes_INDEX] = (void *) buffer_write_bytes;
     _cbson_API[_cbson_write_dict_INDEX] = (void *) write_dict;
     _cbson_API[_cbson_write_pair_INDEX] = (void *) write_pair;
     _cbson_API[_cbson_decode_and_write_pair_INDEX] = (void *) decode_and_write_pair;
+    _cbson_API[_cbson_decode_documents_INDEX] = (void *) decode_documents;
+    _cbson_API[_cbson_buffer_new_INDEX] = (void *) buffer_new;
+    _cbson_API[_cbson_buffer_free_INDEX] = (void *) buffer_free;
+    _cbson_API[_cbson_buffer_new_with_capacity_INDEX] = (void *) buffer_new_with_capacity;
+    _cbson_API[_cbson_decode_iterator_new_INDEX] = (void *) decode_iterator_new;
+    _cbson_API[_cbson_write_raw_document_INDEX] = (void *) write_raw_document;
+    _cbson_API[_cbson_buffer_save_space_INDEX] = (void *) buffer_save_space;
+    _cbson_API[_cbson_buffer_truncate_INDEX] = (void *) buffer_truncate;
+    _cbson_API[_cbson_buffer_get_position_INDEX] = (void *) buffer_get_position;
+    _cbson_API[_cbson_buffer_get_buffer_INDEX] = (void *) buffer_get_buffer;
+    _cbson_API[_cbson_buffer_get_stats_INDEX] = (void *) buffer_get_stats;
+    _cbson_API[_cbson_validate_documents_INDEX] = (void *) validate_documents;
 
     PyObject *c_api_object = PyCapsule_New((void *) _cbson_API, "_cbson._C_API", NULL);
     if (c_api_object != NULL) {
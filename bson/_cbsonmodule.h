@@ -34,8 +34,56 @@
 #define _cbson_decode_and_write_pair_RETURN int
 #define _cbson_decode_and_write_pair_PROTO (PyObject* self, buffer_t buffer, PyObject* key, PyObject* value, unsigned char check_keys, unsigned char top_level)
 
+#define _cbson_decode_documents_INDEX 4
+#define _cbson_decode_documents_RETURN PyObject*
+#define _cbson_decode_documents_PROTO (PyObject* self, PyObject* owner, const char* string, Py_ssize_t total_size, PyObject* as_class, unsigned char tz_aware, PyObject* fields, unsigned char validated)
+
+#define _cbson_buffer_new_INDEX 5
+#define _cbson_buffer_new_RETURN buffer_t
+#define _cbson_buffer_new_PROTO (void)
+
+#define _cbson_buffer_free_INDEX 6
+#define _cbson_buffer_free_RETURN int
+#define _cbson_buffer_free_PROTO (buffer_t buffer)
+
+#define _cbson_buffer_new_with_capacity_INDEX 7
+#define _cbson_buffer_new_with_capacity_RETURN buffer_t
+#define _cbson_buffer_new_with_capacity_PROTO (int capacity)
+
+#define _cbson_decode_iterator_new_INDEX 8
+#define _cbson_decode_iterator_new_RETURN PyObject*
+#define _cbson_decode_iterator_new_PROTO (PyObject* self, PyObject* owner, const char* string, Py_ssize_t total_size, PyObject* as_class, unsigned char tz_aware, PyObject* fields)
+
+#define _cbson_write_raw_document_INDEX 9
+#define _cbson_write_raw_document_RETURN int
+#define _cbson_write_raw_document_PROTO (PyObject* self, buffer_t buffer, const char* data, Py_ssize_t size, unsigned char check_keys)
+
+#define _cbson_buffer_save_space_INDEX 10
+#define _cbson_buffer_save_space_RETURN buffer_position
+#define _cbson_buffer_save_space_PROTO (buffer_t buffer, int size)
+
+#define _cbson_buffer_truncate_INDEX 11
+#define _cbson_buffer_truncate_RETURN void
+#define _cbson_buffer_truncate_PROTO (buffer_t buffer, buffer_position position)
+
+#define _cbson_buffer_get_position_INDEX 12
+#define _cbson_buffer_get_position_RETURN buffer_position
+#define _cbson_buffer_get_position_PROTO (buffer_t buffer)
+
+#define _cbson_buffer_get_buffer_INDEX 13
+#define _cbson_buffer_get_buffer_RETURN char*
+#define _cbson_buffer_get_buffer_PROTO (buffer_t buffer)
+
+#define _cbson_buffer_get_stats_INDEX 14
+#define _cbson_buffer_get_stats_RETURN void
+#define _cbson_buffer_get_stats_PROTO (buffer_stats_t* result, int reset)
+
+#define _cbson_validate_documents_INDEX 15
+#define _cbson_validate_documents_RETURN Py_ssize_t
+#define _cbson_validate_documents_PROTO (const char* string, Py_ssize_t total_size)
+
 /* Total number of C API pointers */
-#define _cbson_API_POINTER_COUNT 4
+#define _cbson_API_POINTER_COUNT 16
 
 #ifdef _CBSON_MODULE
 /* This section is used when compiling _cbsonmodule */
@@ -48,6 +96,14 @@ static _cbson_write_pair_RETURN write_pair _cbson_write_pair_PROTO;
 
 static _cbson_decode_and_write_pair_RETURN decode_and_write_pair _cbson_decode_and_write_pair_PROTO;
 
+static _cbson_decode_documents_RETURN decode_documents _cbson_decode_documents_PROTO;
+
+static _cbson_decode_iterator_new_RETURN decode_iterator_new _cbson_decode_iterator_new_PROTO;
+
+static _cbson_write_raw_document_RETURN write_raw_document _cbson_write_raw_document_PROTO;
+
+static _cbson_validate_documents_RETURN validate_documents _cbson_validate_documents_PROTO;
+
 #else
 /* This section is used in modules that use _cbsonmodule's API */
 
@@ -61,6 +117,32 @@ static void **_cbson_API;
 
 #define decode_and_write_pair (*(_cbson_decode_and_write_pair_RETURN (*)_cbson_decode_and_write_pair_PROTO) _cbson_API[_cbson_decode_and_write_pair_INDEX])
 
+#define decode_documents (*(_cbson_decode_documents_RETURN (*)_cbson_decode_documents_PROTO) _cbson_API[_cbson_decode_documents_INDEX])
+
+#define decode_iterator_new (*(_cbson_decode_iterator_new_RETURN (*)_cbson_decode_iterator_new_PROTO) _cbson_API[_cbson_decode_iterator_new_INDEX])
+
+#define write_raw_document (*(_cbson_write_raw_document_RETURN (*)_cbson_write_raw_document_PROTO) _cbson_API[_cbson_write_raw_document_INDEX])
+
+#define validate_documents (*(_cbson_validate_documents_RETURN (*)_cbson_validate_documents_PROTO) _cbson_API[_cbson_validate_documents_INDEX])
+
+/* Only _cbson links buffer.c: every buffer function is called through
+ * its C API, so that all buffers come from (and go back to) one pool */
+#define buffer_new (*(_cbson_buffer_new_RETURN (*)_cbson_buffer_new_PROTO) _cbson_API[_cbson_buffer_new_INDEX])
+
+#define buffer_free (*(_cbson_buffer_free_RETURN (*)_cbson_buffer_free_PROTO) _cbson_API[_cbson_buffer_free_INDEX])
+
+#define buffer_new_with_capacity (*(_cbson_buffer_new_with_capacity_RETURN (*)_cbson_buffer_new_with_capacity_PROTO) _cbson_API[_cbson_buffer_new_with_capacity_INDEX])
+
+#define buffer_save_space (*(_cbson_buffer_save_space_RETURN (*)_cbson_buffer_save_space_PROTO) _cbson_API[_cbson_buffer_save_space_INDEX])
+
+#define buffer_truncate (*(_cbson_buffer_truncate_RETURN (*)_cbson_buffer_truncate_PROTO) _cbson_API[_cbson_buffer_truncate_INDEX])
+
+#define buffer_get_position (*(_cbson_buffer_get_position_RETURN (*)_cbson_buffer_get_position_PROTO) _cbson_API[_cbson_buffer_get_position_INDEX])
+
+#define buffer_get_buffer (*(_cbson_buffer_get_buffer_RETURN (*)_cbson_buffer_get_buffer_PROTO) _cbson_API[_cbson_buffer_get_buffer_INDEX])
+
+#define buffer_get_stats (*(_cbson_buffer_get_stats_RETURN (*)_cbson_buffer_get_stats_PROTO) _cbson_API[_cbson_buffer_get_stats_INDEX])
+
 #define _cbson_IMPORT _cbson_API = (void **)PyCapsule_Import("_cbson._C_API", 0)
 
 #endif
@@ -21,28 +21,76 @@
 
 #define INITIAL_BUFFER_SIZE 256
 
+/* Maximum number of freed buffers kept for reuse */
+#define BUFFER_POOL_SIZE 4
+/* Maximum total size of the buffers kept for reuse */
+#define BUFFER_POOL_MAX_BYTES (16 * 1024 * 1024)
+
 struct buffer {
     char* buffer;
     int size;
     int position;
 };
 
+/* Freed buffers, kept with their memory so that the next buffer_new
+ * doesn't have to allocate (and grow) a buffer again. Protected by the
+ * GIL. */
+static buffer_t pool[BUFFER_POOL_SIZE];
+static int pool_count = 0;
+static int pool_bytes = 0;
+/* Moving average of the space used in recently freed buffers. Buffers
+ * much larger than this aren't kept, so one huge message doesn't pin
+ * its memory for good. */
+static int recent_usage = INITIAL_BUFFER_SIZE;
+
+/* Protected by the GIL, like the pool. */
+static buffer_stats_t stats = {0, 0};
+
 /* Allocate and return a new buffer.
  * Return NULL on allocation failure. */
 buffer_t buffer_new(void) {
+    return buffer_new_with_capacity(INITIAL_BUFFER_SIZE);
+}
+
+/* Allocate and return a new buffer with room for at least `capacity` bytes.
+ * Return NULL on allocation failure. */
+buffer_t buffer_new_with_capacity(int capacity) {
     buffer_t buffer;
+    int i;
+
+    if (capacity < INITIAL_BUFFER_SIZE) {
+        capacity = INITIAL_BUFFER_SIZE;
+    }
+
+    /* Take the most recently freed buffer that is large enough. */
+    for (i = pool_count - 1; i >= 0; i--) {
+        if (pool[i]->size >= capacity) {
+            buffer = pool[i];
+            pool[i] = pool[--pool_count];
+            pool_bytes -= buffer->size;
+            buffer->position = 0;
+            if (buffer->size > stats.peak_size) {
+                stats.peak_size = buffer->size;
+            }
+            return buffer;
+        }
+    }
+
     buffer = (buffer_t)malloc(sizeof(struct buffer));
     if (buffer == NULL) {
         return NULL;
     }
 
-    buffer->size = INITIAL_BUFFER_SIZE;
+    buffer->size = capacity;
     buffer->position = 0;
-    buffer->buffer = (char*)malloc(sizeof(char) * INITIAL_BUFFER_SIZE);
+    buffer->buffer = (char*)malloc(sizeof(char) * capacity);
     if (buffer->buffer == NULL) {
         free(buffer);
         return NULL;
     }
+    if (capacity > stats.peak_size) {
+        stats.peak_size = capacity;
+    }
 
     return buffer;
 }
@@ -53,6 +101,17 @@ int buffer_free(buffer_t buffer) {
     if (buffer == NULL) {
         return 1;
     }
+
+    recent_usage += (buffer->position - recent_usage) / 8;
+    if (pool_count < BUFFER_POOL_SIZE &&
+        (buffer->size <= INITIAL_BUFFER_SIZE ||
+         buffer->size / 4 <= recent_usage) &&
+        buffer->size <= BUFFER_POOL_MAX_BYTES - pool_bytes) {
+        pool[pool_count++] = buffer;
+        pool_bytes += buffer->size;
+        return 0;
+    }
+
     free(buffer->buffer);
     free(buffer);
     return 0;
@@ -78,11 +137,15 @@ static int buffer_grow(buffer_t buffer, int min_length) {
     }
     buffer->buffer = (char*)realloc(buffer->buffer, sizeof(char) * size);
     if (buffer->buffer == NULL) {
-        free(old_buffer);
-        free(buffer);
+        /* realloc leaves the old memory alone when it fails */
+        buffer->buffer = old_buffer;
         return 1;
     }
     buffer->size = size;
+    stats.grows++;
+    if (size > stats.peak_size) {
+        stats.peak_size = size;
+    }
     return 0;
 }
 
@@ -124,7 +187,6 @@ int buffer_write(buffer_t buffer, const char* data, int size) {
 int buffer_write_at_position(buffer_t buffer, buffer_position position,
                              const char* data, int size) {
     if (position + size > buffer->size) {
-        buffer_free(buffer);
         return 1;
     }
 
@@ -132,6 +194,14 @@ int buffer_write_at_position(buffer_t buffer, buffer_position position,
     return 0;
 }
 
+/* Move the position of `buffer` back to `position`, discarding anything
+ * written after it. */
+void buffer_truncate(buffer_t buffer, buffer_position position) {
+    if (position >= 0 && position < buffer->position) {
+        buffer->position = position;
+    }
+}
+
 
 int buffer_get_position(buffer_t buffer) {
     return buffer->position;
@@ -140,3 +210,11 @@ int buffer_get_position(buffer_t buffer) {
 char* buffer_get_buffer(buffer_t buffer) {
     return buffer->buffer;
 }
+
+void buffer_get_stats(buffer_stats_t* result, int reset) {
+    *result = stats;
+    if (reset) {
+        stats.grows = 0;
+        stats.peak_size = 0;
+    }
+}
@@ -18,7 +18,13 @@
 #define BUFFER_H
 
 /* Note: if any of these functions return a failure condition then the buffer
- * has already been freed. */
+ * is left as it was (other than for the bytes written to it so far), so the
+ * caller still has to free it.
+ *
+ * Freed buffers are pooled for reuse by buffer_new, so these functions must
+ * be called with the GIL held. Only _cbson is built with buffer.c: other
+ * extensions call these functions through the _cbson C API, so that every
+ * buffer is taken from and returned to the same pool. */
 
 /* A buffer */
 typedef struct buffer* buffer_t;
@@ -29,7 +35,12 @@ typedef int buffer_position;
  * Return NULL on allocation failure. */
 buffer_t buffer_new(void);
 
-/* Free the memory allocated for `buffer`.
+/* Allocate and return a new buffer with room for at least `capacity` bytes,
+ * so that writing that much doesn't have to grow it.
+ * Return NULL on allocation failure. */
+buffer_t buffer_new_with_capacity(int capacity);
+
+/* Free the memory allocated for `buffer`, or keep it for reuse.
  * Return non-zero on failure. */
 int buffer_free(buffer_t buffer);
 
@@ -46,6 +57,21 @@ int buffer_write(buffer_t buffer, const char* data, int size);
  * Return non-zero if buffer isn't large enough for write. */
 int buffer_write_at_position(buffer_t buffer, buffer_position position, const char* data, int size);
 
+/* Move the position of `buffer` back to `position`, discarding anything
+ * written after it. */
+void buffer_truncate(buffer_t buffer, buffer_position position);
+
+/* Counters for the buffers written by this extension. */
+typedef struct {
+    /* Number of times a buffer had to be grown */
+    unsigned long long grows;
+    /* Size of the largest buffer */
+    int peak_size;
+} buffer_stats_t;
+
+/* Copy the counters into `result`, and reset them if `reset` is set. */
+void buffer_get_stats(buffer_stats_t* result, int reset);
+
 /* Getters for the internals of a buffer_t.
  * Should try to avoid using these as much as possible
  * since they break the abstraction. */
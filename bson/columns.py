@@ -0,0 +1,136 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Tools for working with BSON documents decoded into columns.
+
+:func:`bson.decode_all_columnar` and
+:meth:`~pymongo.cursor.Cursor.to_columns` decode the chosen fields of
+many documents into a :class:`Column` each, storing numbers, dates and
+booleans in :class:`array.array` instances::
+
+  >>> import bson
+  >>> from bson import BSON
+  >>> data = BSON.encode({"x": 1.5}) + BSON.encode({"y": 2})
+  >>> bson.decode_all_columnar(data, ["x"])["x"]
+  Column(type=1, values=array('d', [1.5, 0.0]), mask=array('B', [1, 0]))
+
+.. versionadded:: 2.0+
+"""
+
+import array
+import collections
+import datetime
+
+from bson.tz_util import utc
+
+EPOCH_AWARE = datetime.datetime.fromtimestamp(0, utc)
+EPOCH_NAIVE = datetime.datetime.utcfromtimestamp(0)
+
+# The array typecode used for each BSON type stored in an array.
+TYPECODES = {
+    0x01: "d",  # double
+    0x08: "B",  # boolean
+    0x09: "q",  # UTC datetime, as milliseconds since the epoch
+    0x10: "i",  # int32
+    0x12: "q"}  # int64
+
+
+class Column(collections.namedtuple("Column", ["type", "values", "mask"])):
+    """The values of one field in a sequence of documents.
+
+    `type` is the BSON type code shared by every value in the column
+    (int32 values are widened to int64 in a column that also holds
+    int64s), or ``None`` if the values have different types or there
+    are none.
+
+    `values` holds one entry per document: an :class:`array.array`
+    with the typecode from :data:`TYPECODES` if `type` is one of its
+    keys (datetimes are stored as milliseconds since the epoch), and a
+    :class:`list` of decoded values otherwise. Documents without a
+    value for the field (or with a null value) have ``0`` (or ``None``)
+    as their entry, and ``0`` in the :class:`array.array` `mask` -
+    every other entry of `mask` is ``1``.
+    """
+    __slots__ = ()
+
+
+def to_objects(column, tz_aware=True):
+    """Get the values of `column` as a list of Python objects.
+
+    Entries without a value are ``None``.
+
+    :Parameters:
+      - `column`: a :class:`Column`
+      - `tz_aware` (optional): if ``True``, return timezone-aware
+        :class:`~datetime.datetime` instances
+    """
+    if isinstance(column.values, list):
+        return list(column.values)
+    if column.type == 0x08:
+        convert = bool
+    elif column.type == 0x09:
+        epoch = tz_aware and EPOCH_AWARE or EPOCH_NAIVE
+        convert = lambda millis: (epoch +
+                                  datetime.timedelta(milliseconds=millis))
+    else:
+        convert = lambda value: value
+    return [convert(value) if present else None
+            for (value, present) in zip(column.values, column.mask)]
+
+
+def extend(column, other, tz_aware=True):
+    """Append the values of the :class:`Column` `other` to `column`.
+
+    Returns a :class:`Column` with the values of both, converting them
+    as needed to a type that can hold both (see :class:`Column`).
+    `column` itself may be modified.
+
+    :Parameters:
+      - `column`: a :class:`Column`
+      - `other`: a :class:`Column` to append
+      - `tz_aware` (optional): if ``True``, return timezone-aware
+        :class:`~datetime.datetime` instances when values have to be
+        converted to objects
+    """
+    type = column.type
+    if 1 not in column.mask:
+        type = other.type
+    elif 1 in other.mask:
+        if {type, other.type} == {0x10, 0x12}:
+            type = 0x12
+        elif type != other.type:
+            type = None
+
+    if type in TYPECODES:
+        typecode = TYPECODES[type]
+        values = _typed(column.values, typecode)
+        values.extend(_typed(other.values, typecode))
+    else:
+        values = to_objects(column, tz_aware)
+        values.extend(to_objects(other, tz_aware))
+    mask = column.mask
+    mask.extend(other.mask)
+    return Column(type, values, mask)
+
+
+def _typed(values, typecode):
+    """Get `values` as an array with `typecode`.
+
+    `values` is an array, or a list of ``None`` values.
+    """
+    if isinstance(values, list):
+        return array.array(typecode, [0]) * len(values)
+    if values.typecode != typecode:
+        return array.array(typecode, values)
+    return values
@@ -16,6 +16,17 @@
 
 #include "encoding_helpers.h"
 
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define USE_SSE2_SCAN
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define USE_NEON_SCAN
+#endif
+
 /*
  * Portions Copyright 2001 Unicode, Inc.
  *
@@ -77,6 +88,7 @@ static unsigned char isLegalUTF8(const unsigned char* source, int length) {
         switch (*source) {
             /* no fall-through in this inner switch */
             case 0xE0: if (a < 0xA0) return 0; break;
+            case 0xED: if (a > 0x9F) return 0; break;
             case 0xF0: if (a < 0x90) return 0; break;
             case 0xF4: if (a > 0x8F) return 0; break;
             default:  if (a < 0x80) return 0;
@@ -87,29 +99,92 @@ static unsigned char isLegalUTF8(const unsigned char* source, int length) {
     return 1;
 }
 
+/*
+ * Return the length of the run of ASCII bytes at the start of `string`,
+ * stopping early at a NULL byte if `check_null` is set. Whole blocks are
+ * tested at a time; the last partial block is handled a byte at a time.
+ *
+ * SSE2 is part of the x86-64 baseline and NEON of the AArch64 baseline,
+ * so neither needs a runtime check. Everything else gets the
+ * word-at-a-time version.
+ */
+static int ascii_run_length(const unsigned char* string, const int length,
+                            const char check_null) {
+    int position = 0;
+#if defined(USE_SSE2_SCAN)
+    const __m128i zero = _mm_setzero_si128();
+    while (position + 16 <= length) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(string + position));
+        int mask = _mm_movemask_epi8(block);
+        if (check_null) {
+            mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero));
+        }
+        if (mask) {
+            break;
+        }
+        position += 16;
+    }
+#elif defined(USE_NEON_SCAN)
+    while (position + 16 <= length) {
+        uint8x16_t block = vld1q_u8(string + position);
+        if (vmaxvq_u8(block) >= 0x80 || (check_null && vminvq_u8(block) == 0)) {
+            break;
+        }
+        position += 16;
+    }
+#else
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    while (position + 8 <= length) {
+        uint64_t word;
+        memcpy(&word, string + position, 8);
+        if (word & highs) {
+            break;
+        }
+        /* Classic "has a zero byte" test; exact once the high bits are
+         * known to be clear. */
+        if (check_null && ((word - ones) & ~word & highs)) {
+            break;
+        }
+        position += 8;
+    }
+#endif
+    while (position < length && string[position] < 0x80 &&
+           (!check_null || string[position])) {
+        position++;
+    }
+    return position;
+}
+
 result_t check_string(const unsigned char* string, const int length,
                       const char check_utf8, const char check_null) {
     int position = 0;
-    /* By default we go character by character. Will be different for checking
-     * UTF-8 */
-    int sequence_length = 1;
+    int sequence_length;
 
-    if (!check_utf8 && !check_null) {
+    if (!check_utf8) {
+        if (check_null && memchr(string, 0, length)) {
+            return HAS_NULL;
+        }
         return VALID;
     }
 
     while (position < length) {
-        if (check_null && *(string + position) == 0) {
+        /* Skip ASCII in bulk, falling back to the UTF-8 state machine
+         * only at the first byte that needs a closer look. */
+        position += ascii_run_length(string + position, length - position,
+                                     check_null);
+        if (position == length) {
+            break;
+        }
+        if (string[position] == 0) {
             return HAS_NULL;
         }
-        if (check_utf8) {
-            sequence_length = trailingBytesForUTF8[*(string + position)] + 1;
-            if ((position + sequence_length) > length) {
-                return NOT_UTF_8;
-            }
-            if (!isLegalUTF8(string + position, sequence_length)) {
-                return NOT_UTF_8;
-            }
+        sequence_length = trailingBytesForUTF8[*(string + position)] + 1;
+        if ((position + sequence_length) > length) {
+            return NOT_UTF_8;
+        }
+        if (!isLegalUTF8(string + position, sequence_length)) {
+            return NOT_UTF_8;
         }
         position += sequence_length;
     }
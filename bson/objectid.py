@@ -219,3 +219,9 @@ class ObjectId(object):
         .. versionadded:: 1.1
         """
         return hash(self.__id)
+
+try:
+    from bson import _cbson
+    ObjectId = _cbson.ObjectId
+except ImportError:
+    pass
@@ -0,0 +1,145 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Tools for representing raw BSON documents.
+
+A :class:`RawBSONDocument` keeps a reference to its encoded BSON and
+only decodes a field when that field is accessed. Pass it as the
+`as_class` to :func:`bson.decode_all`, :meth:`bson.BSON.decode` or
+:meth:`~pymongo.collection.Collection.find` to avoid decoding fields
+that are never read::
+
+  >>> from bson import BSON
+  >>> from bson.raw_bson import RawBSONDocument
+  >>> doc = BSON.encode({"a": 1, "b": {"c": 2}}).decode(RawBSONDocument)
+  >>> doc["b"]["c"]
+  2
+
+Embedded documents are also returned as :class:`RawBSONDocument`
+instances which, with the C extension, point into the encoded BSON of
+the document they're in rather than copying it -- including documents
+inside arrays. A :class:`RawBSONDocument` is read-only, and can be
+encoded again (e.g. inserted into another collection) without being
+decoded.
+
+.. versionadded:: 2.0+
+"""
+
+import collections.abc
+
+import bson
+from bson.errors import InvalidBSON
+
+
+class RawBSONDocument(object):
+    """A read-only BSON document that is decoded on access.
+
+    If the C extension is available each field is decoded the first
+    time it is accessed. Otherwise the whole document is decoded the
+    first time any field is accessed.
+    """
+
+    __slots__ = ("__raw", "__tz_aware", "__inflated")
+
+    def __init__(self, bson, tz_aware=False):
+        """Create a new :class:`RawBSONDocument`.
+
+        :Parameters:
+          - `bson`: a single encoded BSON document, as :class:`bytes`
+          - `tz_aware` (optional): if ``True``, return timezone-aware
+            :class:`~datetime.datetime` instances
+        """
+        if not isinstance(bson, bytes):
+            raise TypeError("argument to RawBSONDocument must be a "
+                            "bytes object")
+        if len(bson) < 5:
+            raise InvalidBSON("not enough data for a BSON document")
+        if (int.from_bytes(bson[:4], "little") != len(bson) or
+            bson[-1] != 0):
+            raise InvalidBSON("invalid document length or eoo")
+        self.__raw = bson
+        self.__tz_aware = tz_aware
+        self.__inflated = None
+
+    @property
+    def raw(self):
+        """The encoded BSON bytes for this document.
+        """
+        return self.__raw
+
+    def __inflate(self):
+        if self.__inflated is None:
+            inflated = {}
+            data = self.__raw[4:-1]
+            while data:
+                (key, value, data) = bson._element_to_dict(data,
+                                                           RawBSONDocument,
+                                                           self.__tz_aware)
+                inflated[key] = value
+            self.__inflated = inflated
+        return self.__inflated
+
+    def decode(self, as_class=dict):
+        """Fully decode this document to an instance of `as_class`.
+        """
+        (document, _) = bson._bson_to_dict(self.__raw, as_class,
+                                           self.__tz_aware)
+        return document
+
+    def __getitem__(self, key):
+        return self.__inflate()[key]
+
+    def __contains__(self, key):
+        return key in self.__inflate()
+
+    def __iter__(self):
+        return iter(list(self.__inflate()))
+
+    def __len__(self):
+        return len(self.__inflate())
+
+    def keys(self):
+        return list(self.__inflate().keys())
+
+    def values(self):
+        return list(self.__inflate().values())
+
+    def items(self):
+        return list(self.__inflate().items())
+
+    def get(self, key, default=None):
+        return self.__inflate().get(key, default)
+
+    def __eq__(self, other):
+        if isinstance(other, RawBSONDocument):
+            return self.__raw == other.raw
+        if isinstance(other, dict):
+            return self.__inflate() == other
+        return NotImplemented
+
+    def __ne__(self, other):
+        result = self.__eq__(other)
+        if result is NotImplemented:
+            return result
+        return not result
+
+    __hash__ = None
+
+    def __repr__(self):
+        return "RawBSONDocument(%r)" % (self.__inflate(),)
+
+if bson._use_c:
+    RawBSONDocument = bson._cbson.RawBSONDocument
+
+collections.abc.Mapping.register(RawBSONDocument)
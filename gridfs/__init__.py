@@ -86,10 +86,10 @@ class GridFS(object):
         >>> finally:
         >>>     f.close()
 
-        `data` can be either an instance of :class:`str` or a
+        `data` can be either an instance of :class:`bytes` or a
         file-like object providing a :meth:`read` method. If an
         `encoding` keyword argument is passed, `data` can also be a
-        :class:`unicode` instance, which will be encoded as `encoding`
+        :class:`str` instance, which will be encoded as `encoding`
         before being written. Any keyword arguments will be passed
         through to the created file - see
         :meth:`~gridfs.grid_file.GridIn` for possible
@@ -116,7 +116,7 @@ class GridFS(object):
             grid_file.close()
         return grid_file._id
 
-    def get(self, file_id):
+    def get(self, file_id, prefetch=0):
         """Get a file from GridFS by ``"_id"``.
 
         Returns an instance of :class:`~gridfs.grid_file.GridOut`,
@@ -124,10 +124,14 @@ class GridFS(object):
 
         :Parameters:
           - `file_id`: ``"_id"`` of the file to get
+          - `prefetch` (optional): the number of chunks to read ahead
+            (see :class:`~gridfs.grid_file.GridOut`)
 
+        .. versionchanged:: 2.0+
+           Added the `prefetch` parameter.
         .. versionadded:: 1.6
         """
-        return GridOut(self.__collection, file_id)
+        return GridOut(self.__collection, file_id, prefetch=prefetch)
 
     def get_version(self, filename=None, version=-1, **kwargs):
         """Get a file from GridFS by ``"filename"`` or metadata fields.
@@ -180,7 +184,7 @@ class GridFS(object):
         else:
             cursor.limit(-1).skip(version).sort("uploadDate", ASCENDING)
         try:
-            grid_file = cursor.next()
+            grid_file = next(cursor)
             return GridOut(self.__collection, grid_file["_id"])
         except StopIteration:
             raise NoFile("no version %d for filename %r" % (version, filename))
@@ -17,10 +17,7 @@
 import datetime
 import math
 import os
-try:
-    from cStringIO import StringIO
-except ImportError:
-    from StringIO import StringIO
+from io import BytesIO
 
 from bson.binary import Binary
 from bson.objectid import ObjectId
@@ -46,6 +43,9 @@ except AttributeError:
 """Default chunk size, in bytes."""
 DEFAULT_CHUNK_SIZE = 256 * 1024
 
+"""Default number of chunks written by each insert."""
+DEFAULT_CHUNKS_PER_INSERT = 16
+
 
 def _create_property(field_name, docstring,
                       read_only=False, closed_only=False):
@@ -107,12 +107,20 @@ class GridIn(object):
             chunks, in bytes (default: 256 kb)
 
           - ``"encoding"``: encoding used for this file - any
-            :class:`unicode` that is written to the file will be
-            converted to a :class:`str` with this encoding
+            :class:`str` that is written to the file will be
+            converted to :class:`bytes` with this encoding
+
+        The ``"chunks_per_insert"`` keyword argument isn't stored in the
+        file document: it's the number of chunks to send to the server
+        in each insert (default: 16). Chunks are buffered until that
+        many have been written, so fewer round trips are made.
 
         :Parameters:
           - `root_collection`: root collection to write to
           - `**kwargs` (optional): file level options (see above)
+
+        .. versionchanged:: 2.0+
+           Added the ``"chunks_per_insert"`` keyword argument.
         """
         if not isinstance(root_collection, Collection):
             raise TypeError("root_collection must be an "
@@ -123,6 +131,12 @@ class GridIn(object):
             kwargs["contentType"] = kwargs.pop("content_type")
         if "chunk_size" in kwargs:
             kwargs["chunkSize"] = kwargs.pop("chunk_size")
+        chunks_per_insert = kwargs.pop("chunks_per_insert",
+                                       DEFAULT_CHUNKS_PER_INSERT)
+        if not isinstance(chunks_per_insert, int):
+            raise TypeError("chunks_per_insert must be an instance of int")
+        if chunks_per_insert < 1:
+            raise ValueError("chunks_per_insert must be at least 1")
 
         # Defaults
         kwargs["_id"] = kwargs.get("_id", ObjectId())
@@ -134,9 +148,11 @@ class GridIn(object):
         object.__setattr__(self, "_coll", root_collection)
         object.__setattr__(self, "_chunks", root_collection.chunks)
         object.__setattr__(self, "_file", kwargs)
-        object.__setattr__(self, "_buffer", StringIO())
+        object.__setattr__(self, "_buffer", BytesIO())
         object.__setattr__(self, "_position", 0)
         object.__setattr__(self, "_chunk_number", 0)
+        object.__setattr__(self, "_pending", [])
+        object.__setattr__(self, "_chunks_per_insert", chunks_per_insert)
         object.__setattr__(self, "_closed", False)
 
     @property
@@ -182,21 +198,31 @@ class GridIn(object):
                  "n": self._chunk_number,
                  "data": Binary(data)}
 
-        self._chunks.insert(chunk)
+        self._pending.append(chunk)
+        if len(self._pending) >= self._chunks_per_insert:
+            self.__flush_chunks()
         self._chunk_number += 1
         self._position += len(data)
 
+    def __flush_chunks(self):
+        """Insert the chunks waiting to be sent, in one batch.
+        """
+        if self._pending:
+            self._chunks.insert(self._pending)
+            self._pending = []
+
     def __flush_buffer(self):
         """Flush the buffer contents out to a chunk.
         """
         self.__flush_data(self._buffer.getvalue())
         self._buffer.close()
-        self._buffer = StringIO()
+        self._buffer = BytesIO()
 
     def __flush(self):
         """Flush the file to the database.
         """
         self.__flush_buffer()
+        self.__flush_chunks()
 
         md5 = self._coll.database.command("filemd5", self._id,
                                           root=self._coll.name)["md5"]
@@ -223,23 +249,22 @@ class GridIn(object):
     def write(self, data):
         """Write data to the file. There is no return value.
 
-        `data` can be either a string of bytes or a file-like object
+        `data` can be either :class:`bytes` or a file-like object
         (implementing :meth:`read`). If the file has an
         :attr:`encoding` attribute, `data` can also be a
-        :class:`unicode` instance, which will be encoded as
+        :class:`str` instance, which will be encoded as
         :attr:`encoding` before being written.
 
         Due to buffering, the data may not actually be written to the
         database until the :meth:`close` method is called. Raises
         :class:`ValueError` if this file is already closed. Raises
         :class:`TypeError` if `data` is not an instance of
-        :class:`str`, a file-like object, or an instance of
-        :class:`unicode` (only allowed if the file has an
+        :class:`bytes`, a file-like object, or an instance of
+        :class:`str` (only allowed if the file has an
         :attr:`encoding` attribute).
 
         :Parameters:
-          - `data`: string of bytes or file-like object to be written
-            to the file
+          - `data`: bytes or file-like object to be written to the file
 
         .. versionadded:: 1.9
            The ability to write :class:`unicode`, if the file has an
@@ -261,18 +286,19 @@ class GridIn(object):
             self._buffer.write(to_write)
         # string
         except AttributeError:
-            if not isinstance(data, basestring):
-                raise TypeError("can only write strings or file-like objects")
+            if not isinstance(data, (bytes, str)):
+                raise TypeError("can only write bytes, strings or file-like "
+                                "objects")
 
-            if isinstance(data, unicode):
+            if isinstance(data, str):
                 try:
                     data = data.encode(self.encoding)
                 except AttributeError:
                     raise TypeError("must specify an encoding for file in "
-                                    "order to write unicode")
+                                    "order to write str")
 
             data_len = len(data)
-            data = StringIO(data)
+            data = BytesIO(data)
             while True:
                 space = self.chunk_size - self._buffer.tell()
                 to_write = data.read(space)
@@ -313,7 +339,8 @@ class GridIn(object):
 class GridOut(object):
     """Class to read data out of GridFS.
     """
-    def __init__(self, root_collection, file_id=None, file_document=None):
+    def __init__(self, root_collection, file_id=None, file_document=None,
+                 prefetch=0):
         """Read a file from GridFS
 
         Application developers should generally not need to
@@ -325,11 +352,19 @@ class GridOut(object):
         :class:`TypeError` if `root_collection` is not an instance of
         :class:`~pymongo.collection.Collection`.
 
+        If `prefetch` is more than 0, sequential reads use one cursor
+        over the file's chunks, which fetches `prefetch` chunks from the
+        server at a time, rather than querying for each chunk. A
+        :meth:`seek` elsewhere in the file starts a new cursor.
+
         :Parameters:
           - `root_collection`: root collection to read from
           - `file_id`: value of ``"_id"`` for the file to read
           - `file_document`: file document from `root_collection.files`
+          - `prefetch` (optional): the number of chunks to read ahead
 
+        .. versionchanged:: 2.0+
+           Added the `prefetch` parameter.
         .. versionadded:: 1.9
            The `file_document` parameter.
         """
@@ -346,8 +381,18 @@ class GridOut(object):
             raise NoFile("no file in gridfs collection %r with _id %r" %
                          (files, file_id))
 
-        self.__buffer = ""
+        if not isinstance(prefetch, int):
+            raise TypeError("prefetch must be an instance of int")
+        if prefetch < 0:
+            raise ValueError("prefetch must be >= 0")
+
+        self.__buffer = b""
         self.__position = 0
+        self.__prefetch = prefetch
+        # The cursor reading ahead, and the number of the chunk it
+        # returns next
+        self.__cursor = None
+        self.__cursor_chunk = 0
 
     _id = _create_property("_id", "The ``'_id'`` value for this file.", True)
     name = _create_property("filename", "Name of this file.", True)
@@ -372,32 +417,57 @@ class GridOut(object):
             return self._file[name]
         raise AttributeError("GridOut object has no attribute '%s'" % name)
 
+    def _get_chunk(self, chunk_number):
+        """Get chunk number `chunk_number` of this file.
+
+        Raises :class:`~gridfs.errors.CorruptGridFile` if it's missing.
+        """
+        if not self.__prefetch:
+            chunk = self.__chunks.find_one({"files_id": self._id,
+                                            "n": chunk_number})
+        else:
+            if self.__cursor is None or self.__cursor_chunk != chunk_number:
+                spec = {"files_id": self._id, "n": {"$gte": chunk_number}}
+                self.__cursor = self.__chunks.find(spec).sort(
+                    "n", ASCENDING).batch_size(self.__prefetch)
+                self.__cursor_chunk = chunk_number
+            try:
+                chunk = next(self.__cursor)
+            except StopIteration:
+                chunk = None
+            if chunk and chunk["n"] != chunk_number:
+                chunk = None
+            if chunk:
+                self.__cursor_chunk += 1
+            else:
+                self.__cursor = None
+        if not chunk:
+            raise CorruptGridFile("no chunk #%d" % chunk_number)
+        return chunk
+
     def read(self, size=-1):
         """Read at most `size` bytes from the file (less if there
         isn't enough data).
 
-        The bytes are returned as an instance of :class:`str`. If
+        The bytes are returned as an instance of :class:`bytes`. If
         `size` is negative or omitted all data is read.
 
         :Parameters:
           - `size` (optional): the number of bytes to read
         """
         if size == 0:
-            return ""
+            return b""
 
         remainder = int(self.length) - self.__position
         if size < 0 or size > remainder:
             size = remainder
 
         received = len(self.__buffer)
-        chunk_number = (received + self.__position) / self.chunk_size
+        chunk_number = (received + self.__position) // self.chunk_size
         chunks = []
 
         while received < size:
-            chunk = self.__chunks.find_one({"files_id": self._id,
-                                            "n": chunk_number})
-            if not chunk:
-                raise CorruptGridFile("no chunk #%d" % chunk_number)
+            chunk = self._get_chunk(chunk_number)
 
             if received:
                 chunk_data = chunk["data"]
@@ -408,12 +478,53 @@ class GridOut(object):
             chunks.append(chunk_data)
             chunk_number += 1
 
-        data = "".join([self.__buffer] + chunks)
+        data = b"".join([self.__buffer] + chunks)
         self.__position += size
         to_return = data[:size]
         self.__buffer = data[size:]
         return to_return
 
+    def readinto(self, buffer):
+        """Read up to ``len(buffer)`` bytes from the file into `buffer`.
+
+        `buffer` can be any writable object supporting the buffer
+        protocol, such as a :class:`bytearray` or :class:`memoryview`.
+        Chunks are copied straight into it, without building an
+        intermediate string. Returns the number of bytes read, which is
+        0 at the end of the file.
+
+        :Parameters:
+          - `buffer`: the buffer to fill
+
+        .. versionadded:: 2.0+
+        """
+        view = memoryview(buffer)
+        size = min(len(view), int(self.length) - self.__position)
+        if size <= 0:
+            return 0
+
+        received = min(size, len(self.__buffer))
+        view[:received] = self.__buffer[:received]
+        self.__buffer = self.__buffer[received:]
+        chunk_number = (self.__position + received) // self.chunk_size
+
+        while received < size:
+            chunk_data = self._get_chunk(chunk_number)["data"]
+            offset = (self.__position + received) % self.chunk_size
+            count = min(size - received, len(chunk_data) - offset)
+            if count <= 0:
+                raise CorruptGridFile("chunk #%d is too short" % chunk_number)
+            view[received:received + count] = memoryview(
+                chunk_data)[offset:offset + count]
+            received += count
+            if offset + count < len(chunk_data):
+                # Keep the rest of the chunk for the next read
+                self.__buffer = chunk_data[offset + count:]
+            chunk_number += 1
+
+        self.__position += size
+        return size
+
     def readline(self, size=-1):
         """Read one line or up to `size` bytes from the file.
 
@@ -422,13 +533,13 @@ class GridOut(object):
 
         .. versionadded:: 1.9
         """
-        bytes = ""
-        while len(bytes) != size:
+        line = b""
+        while len(line) != size:
             byte = self.read(1)
-            bytes += byte
-            if byte == "" or byte == "\n":
+            line += byte
+            if byte == b"" or byte == b"\n":
                 break
-        return bytes
+        return line
 
     def tell(self):
         """Return the current position of this file.
@@ -460,20 +571,23 @@ class GridOut(object):
             raise IOError(22, "Invalid value for `pos` - must be positive")
 
         self.__position = new_pos
-        self.__buffer = ""
+        self.__buffer = b""
 
     def __iter__(self):
         """Return an iterator over all of this file's data.
 
         The iterator will return chunk-sized instances of
-        :class:`str`. This can be useful when serving files using a
+        :class:`bytes`. This can be useful when serving files using a
         webserver that handles such an iterator efficiently.
         """
         return GridOutIterator(self, self.__chunks)
 
     def close(self):
-        """Make GridOut more generically file-like."""
-        pass
+        """Make GridOut more generically file-like.
+
+        Stops reading ahead, if `prefetch` was used.
+        """
+        self.__cursor = None
 
     def __enter__(self):
         """Makes it possible to use :class:`GridOut` files
@@ -490,8 +604,7 @@ class GridOut(object):
 
 class GridOutIterator(object):
     def __init__(self, grid_out, chunks):
-        self.__id = grid_out._id
-        self.__chunks = chunks
+        self.__grid_out = grid_out
         self.__current_chunk = 0
         self.__max_chunk = math.ceil(float(grid_out.length) /
                                      grid_out.chunk_size)
@@ -499,15 +612,12 @@ class GridOutIterator(object):
     def __iter__(self):
         return self
 
-    def next(self):
+    def __next__(self):
         if self.__current_chunk >= self.__max_chunk:
             raise StopIteration
-        chunk = self.__chunks.find_one({"files_id": self.__id,
-                                        "n": self.__current_chunk})
-        if not chunk:
-            raise CorruptGridFile("no chunk #%d" % self.__current_chunk)
+        chunk = self.__grid_out._get_chunk(self.__current_chunk)
         self.__current_chunk += 1
-        return str(chunk["data"])
+        return bytes(chunk["data"])
 
 
 class GridFile(object):
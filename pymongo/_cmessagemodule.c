@@ -31,6 +31,9 @@ struct module_state {
 
 #define GETSTATE(m) ((struct module_state*)PyModule_GetState(m))
 
+/* Opcode of a message wrapping a compressed message */
+#define OP_COMPRESSED 2012
+
 /* Get an error class from the pymongo.errors module.
  *
  * Returns a new ref */
@@ -45,6 +48,21 @@ static PyObject* _error(char* name) {
     return error;
 }
 
+/* Counters returned by stats(). Protected by the GIL. */
+static struct {
+    /* Byte strings built to be sent, each holding one or more messages */
+    unsigned long long messages;
+    unsigned long long message_bytes;
+    unsigned long long replies;
+    unsigned long long reply_bytes;
+} message_stats;
+
+/* Count the finished message(s) in `buffer`. */
+static void _count_message(buffer_t buffer) {
+    message_stats.messages++;
+    message_stats.message_bytes += buffer_get_position(buffer);
+}
+
 /* add a lastError message on the end of the buffer.
  * returns 0 on failure */
 static int add_last_error(PyObject* self, buffer_t buffer, int request_id, PyObject* args) {
@@ -110,44 +128,42 @@ static int add_last_error(PyObject* self, buffer_t buffer, int request_id, PyObj
     return 1;
 }
 
-static PyObject* _cbson_insert_message(PyObject* self, PyObject* args) {
-    /* NOTE just using a random number as the request_id */
+/* Write the document `doc` to be inserted to `buffer`. A bytes object
+ * (e.g. BSON) is already encoded, and is copied as is.
+ *
+ * Returns 0 on failure */
+static int _write_insert_document(PyObject* self, buffer_t buffer,
+                                  PyObject* doc, unsigned char check_keys) {
     struct module_state *state = GETSTATE(self);
 
-    int request_id = rand();
-    char* collection_name = NULL;
-    int collection_name_length;
-    PyObject* docs;
-    PyObject* doc;
-    PyObject* iterator;
-    int before, cur_size, max_size = 0;
-    unsigned char check_keys;
-    unsigned char safe;
-    PyObject* last_error_args;
-    buffer_t buffer;
-    int length_location, message_length;
-    PyObject* result;
-
-    if (!PyArg_ParseTuple(args, "et#ObbO",
-                          "utf-8",
-                          &collection_name,
-                          &collection_name_length,
-                          &docs, &check_keys, &safe, &last_error_args)) {
-        return NULL;
+    if (PyBytes_Check(doc)) {
+        return write_raw_document(state->_cbson, buffer,
+                                  PyBytes_AS_STRING(doc),
+                                  PyBytes_GET_SIZE(doc), check_keys);
     }
+    return write_dict(state->_cbson, buffer, doc, check_keys, 1);
+}
 
-    buffer = buffer_new();
+/* Start an OP_INSERT message with id `request_id` in a new buffer with
+ * room for `capacity` bytes, storing the position of the message length
+ * in `length_location`.
+ *
+ * Returns NULL on failure */
+static buffer_t _start_insert_message(PyObject* self, int request_id,
+                                      const char* collection_name,
+                                      int collection_name_length,
+                                      int capacity, int* length_location) {
+    struct module_state *state = GETSTATE(self);
+    buffer_t buffer = buffer_new_with_capacity(capacity);
     if (!buffer) {
         PyErr_NoMemory();
-        PyMem_Free(collection_name);
         return NULL;
     }
 
-    // save space for message length
-    length_location = buffer_save_space(buffer, 4);
-    if (length_location == -1) {
-        PyMem_Free(collection_name);
+    *length_location = buffer_save_space(buffer, 4);
+    if (*length_location == -1) {
         PyErr_NoMemory();
+        buffer_free(buffer);
         return NULL;
     }
     if (!buffer_write_bytes(state->_cbson, buffer, (const char*)&request_id, 4) ||
@@ -159,16 +175,88 @@ static PyObject* _cbson_insert_message(PyObject* self, PyObject* args) {
         !buffer_write_bytes(state->_cbson, buffer,
                             collection_name,
                             collection_name_length + 1)) {
-        PyMem_Free(collection_name);
         buffer_free(buffer);
         return NULL;
     }
+    return buffer;
+}
+
+/* Finish the insert message in `buffer` and append it (as a
+ * (request_id, data) tuple) to the list `messages`. Frees `buffer`.
+ *
+ * Returns 0 on failure */
+static int _finish_insert_message(PyObject* self, buffer_t buffer,
+                                  int length_location, int request_id,
+                                  unsigned char safe, PyObject* last_error_args,
+                                  PyObject* messages) {
+    int message_length = buffer_get_position(buffer) - length_location;
+    PyObject* message;
+    int result;
+
+    memcpy(buffer_get_buffer(buffer) + length_location, &message_length, 4);
+    if (safe) {
+        if (!add_last_error(self, buffer, request_id, last_error_args)) {
+            buffer_free(buffer);
+            return 0;
+        }
+    }
+
+    _count_message(buffer);
+    message = Py_BuildValue("iy#", request_id,
+                            buffer_get_buffer(buffer),
+                            buffer_get_position(buffer));
+    buffer_free(buffer);
+    if (!message) {
+        return 0;
+    }
+    result = PyList_Append(messages, message);
+    Py_DECREF(message);
+    return result != -1;
+}
+
+static PyObject* _cbson_insert_message(PyObject* self, PyObject* args) {
+    /* NOTE just using a random number as the request_id */
+    int request_id = rand();
+    char* collection_name = NULL;
+    int collection_name_length;
+    PyObject* docs;
+    PyObject* doc;
+    PyObject* iterator;
+    int before, cur_size, max_size = 0;
+    unsigned char check_keys;
+    unsigned char safe;
+    PyObject* last_error_args;
+    int size_hint = 0;
+    buffer_t buffer;
+    int length_location, message_length;
+    PyObject* result;
+
+    if (!PyArg_ParseTuple(args, "et#ObbO|i",
+                          "utf-8",
+                          &collection_name,
+                          &collection_name_length,
+                          &docs, &check_keys, &safe, &last_error_args,
+                          &size_hint)) {
+        return NULL;
+    }
 
+    buffer = _start_insert_message(self, request_id, collection_name,
+                                   collection_name_length, size_hint,
+                                   &length_location);
     PyMem_Free(collection_name);
+    if (!buffer) {
+        return NULL;
+    }
 
     iterator = PyObject_GetIter(docs);
     if (iterator == NULL) {
-        PyObject* InvalidOperation = _error("InvalidOperation");
+        PyObject* InvalidOperation;
+        PyErr_Clear();
+        InvalidOperation = _error("InvalidOperation");
+        if (!InvalidOperation) {
+            buffer_free(buffer);
+            return NULL;
+        }
         PyErr_SetString(InvalidOperation, "input is not iterable");
         Py_DECREF(InvalidOperation);
         buffer_free(buffer);
@@ -176,7 +264,7 @@ static PyObject* _cbson_insert_message(PyObject* self, PyObject* args) {
     }
     while ((doc = PyIter_Next(iterator)) != NULL) {
         before = buffer_get_position(buffer);
-        if (!write_dict(state->_cbson, buffer, doc, check_keys, 1)) {
+        if (!_write_insert_document(self, buffer, doc, check_keys)) {
             Py_DECREF(doc);
             Py_DECREF(iterator);
             buffer_free(buffer);
@@ -207,6 +295,7 @@ static PyObject* _cbson_insert_message(PyObject* self, PyObject* args) {
     }
 
     /* objectify buffer */
+    _count_message(buffer);
     result = Py_BuildValue("iy#i", request_id,
                            buffer_get_buffer(buffer),
                            buffer_get_position(buffer),
@@ -215,6 +304,168 @@ static PyObject* _cbson_insert_message(PyObject* self, PyObject* args) {
     return result;
 }
 
+/* Raise InvalidDocument for a document of `size` bytes, larger than
+ * the server's `max_bson_size`. */
+static void _raise_document_too_large(int size, int max_bson_size) {
+    PyObject* InvalidDocument;
+    PyObject* errors = PyImport_ImportModule("bson.errors");
+    if (!errors) {
+        return;
+    }
+    InvalidDocument = PyObject_GetAttrString(errors, "InvalidDocument");
+    Py_DECREF(errors);
+    if (InvalidDocument) {
+        PyErr_Format(InvalidDocument, "BSON document too large (%d bytes)"
+                     " - the connected server supports BSON document"
+                     " sizes up to %d bytes.", size, max_bson_size);
+        Py_DECREF(InvalidDocument);
+    }
+}
+
+static PyObject* _cbson_insert_batches(PyObject* self, PyObject* args) {
+    /* NOTE just using a random number as the request_id */
+    struct module_state *state = GETSTATE(self);
+
+    int request_id = rand();
+    char* collection_name = NULL;
+    int collection_name_length;
+    PyObject* docs;
+    PyObject* doc;
+    PyObject* iterator;
+    unsigned char check_keys;
+    unsigned char safe;
+    PyObject* last_error_args;
+    int max_bson_size;
+    int max_message_size;
+    int size_hint = 0;
+    int count = 0;
+    int before, cur_size;
+    buffer_t buffer;
+    int length_location;
+    PyObject* messages;
+
+    if (!PyArg_ParseTuple(args, "et#ObbOii|i",
+                          "utf-8",
+                          &collection_name,
+                          &collection_name_length,
+                          &docs, &check_keys, &safe, &last_error_args,
+                          &max_bson_size, &max_message_size, &size_hint)) {
+        return NULL;
+    }
+
+    iterator = PyObject_GetIter(docs);
+    if (iterator == NULL) {
+        PyObject* InvalidOperation;
+        PyErr_Clear();
+        InvalidOperation = _error("InvalidOperation");
+        if (!InvalidOperation) {
+            PyMem_Free(collection_name);
+            return NULL;
+        }
+        PyErr_SetString(InvalidOperation, "input is not iterable");
+        Py_DECREF(InvalidOperation);
+        PyMem_Free(collection_name);
+        return NULL;
+    }
+
+    messages = PyList_New(0);
+    if (!messages) {
+        Py_DECREF(iterator);
+        PyMem_Free(collection_name);
+        return NULL;
+    }
+
+    if (size_hint > max_message_size) {
+        size_hint = max_message_size;
+    }
+    buffer = _start_insert_message(self, request_id, collection_name,
+                                   collection_name_length, size_hint,
+                                   &length_location);
+    if (!buffer) {
+        goto fail;
+    }
+
+    while ((doc = PyIter_Next(iterator)) != NULL) {
+        before = buffer_get_position(buffer);
+        if (!_write_insert_document(self, buffer, doc, check_keys)) {
+            Py_DECREF(doc);
+            buffer_free(buffer);
+            goto fail;
+        }
+        Py_DECREF(doc);
+        cur_size = buffer_get_position(buffer) - before;
+
+        if (cur_size > max_bson_size) {
+            buffer_free(buffer);
+            _raise_document_too_large(cur_size, max_bson_size);
+            goto fail;
+        }
+
+        if (count && buffer_get_position(buffer) - length_location > max_message_size) {
+            /* This document doesn't fit: move it to a new message and
+             * send the others without it. The next message will likely
+             * be about as large as this one. */
+            buffer_t next;
+            int next_length_location;
+            int next_request_id = rand();
+
+            next = _start_insert_message(self, next_request_id, collection_name,
+                                         collection_name_length,
+                                         buffer_get_position(buffer),
+                                         &next_length_location);
+            if (!next) {
+                buffer_free(buffer);
+                goto fail;
+            }
+            if (!buffer_write_bytes(state->_cbson, next,
+                                    buffer_get_buffer(buffer) + before,
+                                    cur_size)) {
+                buffer_free(next);
+                buffer_free(buffer);
+                goto fail;
+            }
+            buffer_truncate(buffer, before);
+            if (!_finish_insert_message(self, buffer, length_location,
+                                        request_id, safe, last_error_args,
+                                        messages)) {
+                buffer_free(next);
+                goto fail;
+            }
+            buffer = next;
+            length_location = next_length_location;
+            request_id = next_request_id;
+            count = 0;
+        }
+        count++;
+    }
+    if (PyErr_Occurred()) {
+        buffer_free(buffer);
+        goto fail;
+    }
+
+    if (!count) {
+        PyObject* InvalidOperation = _error("InvalidOperation");
+        PyErr_SetString(InvalidOperation, "cannot do an empty bulk insert");
+        Py_DECREF(InvalidOperation);
+        buffer_free(buffer);
+        goto fail;
+    }
+    if (!_finish_insert_message(self, buffer, length_location, request_id,
+                                safe, last_error_args, messages)) {
+        goto fail;
+    }
+
+    Py_DECREF(iterator);
+    PyMem_Free(collection_name);
+    return messages;
+
+    fail:
+    Py_DECREF(iterator);
+    Py_DECREF(messages);
+    PyMem_Free(collection_name);
+    return NULL;
+}
+
 static PyObject* _cbson_update_message(PyObject* self, PyObject* args) {
     /* NOTE just using a random number as the request_id */
     struct module_state *state = GETSTATE(self);
@@ -261,6 +512,7 @@ static PyObject* _cbson_update_message(PyObject* self, PyObject* args) {
     length_location = buffer_save_space(buffer, 4);
     if (length_location == -1) {
         PyMem_Free(collection_name);
+        buffer_free(buffer);
         PyErr_NoMemory();
         return NULL;
     }
@@ -309,6 +561,7 @@ static PyObject* _cbson_update_message(PyObject* self, PyObject* args) {
     }
 
     /* objectify buffer */
+    _count_message(buffer);
     result = Py_BuildValue("iy#i", request_id,
                            buffer_get_buffer(buffer),
                            buffer_get_position(buffer),
@@ -354,6 +607,7 @@ static PyObject* _cbson_query_message(PyObject* self, PyObject* args) {
     length_location = buffer_save_space(buffer, 4);
     if (length_location == -1) {
         PyMem_Free(collection_name);
+        buffer_free(buffer);
         PyErr_NoMemory();
         return NULL;
     }
@@ -394,6 +648,7 @@ static PyObject* _cbson_query_message(PyObject* self, PyObject* args) {
     memcpy(buffer_get_buffer(buffer) + length_location, &message_length, 4);
 
     /* objectify buffer */
+    _count_message(buffer);
     result = Py_BuildValue("iy#i", request_id,
                            buffer_get_buffer(buffer),
                            buffer_get_position(buffer),
@@ -434,6 +689,7 @@ static PyObject* _cbson_get_more_message(PyObject* self, PyObject* args) {
     length_location = buffer_save_space(buffer, 4);
     if (length_location == -1) {
         PyMem_Free(collection_name);
+        buffer_free(buffer);
         PyErr_NoMemory();
         return NULL;
     }
@@ -458,6 +714,7 @@ static PyObject* _cbson_get_more_message(PyObject* self, PyObject* args) {
     memcpy(buffer_get_buffer(buffer) + length_location, &message_length, 4);
 
     /* objectify buffer */
+    _count_message(buffer);
     result = Py_BuildValue("iy#", request_id,
                            buffer_get_buffer(buffer),
                            buffer_get_position(buffer));
@@ -465,79 +722,998 @@ static PyObject* _cbson_get_more_message(PyObject* self, PyObject* args) {
     return result;
 }
 
-static PyMethodDef _CMessageMethods[] = {
-    {"_insert_message", _cbson_insert_message, METH_VARARGS,
-     "create an insert message to be sent to MongoDB"},
-    {"_update_message", _cbson_update_message, METH_VARARGS,
-     "create an update message to be sent to MongoDB"},
-    {"_query_message", _cbson_query_message, METH_VARARGS,
-     "create a query message to be sent to MongoDB"},
-    {"_get_more_message", _cbson_get_more_message, METH_VARARGS,
-     "create a get more message to be sent to MongoDB"},
-    {NULL, NULL, 0, NULL}
-};
-
-static int _cmessage_traverse(PyObject *m, visitproc visit, void *arg) {
-    struct module_state *state = GETSTATE(m);
-
-    Py_VISIT(state->_cbson);
-    return 0;
-}
-
-static int _cmessage_clear(PyObject *m) {
-    struct module_state *state = GETSTATE(m);
-
-    Py_CLEAR(state->_cbson);
-    return 0;
-}
+static PyObject* _cbson_delete_message(PyObject* self, PyObject* args) {
+    /* NOTE just using a random number as the request_id */
+    struct module_state *state = GETSTATE(self);
 
-static struct PyModuleDef moduledef = {
-        PyModuleDef_HEAD_INIT,
-        "_cmessage",
-        NULL,
-        sizeof(struct module_state),
-        _CMessageMethods,
-        NULL,
-        _cmessage_traverse,
-        _cmessage_clear,
-        NULL
-};
+    int request_id = rand();
+    char* collection_name = NULL;
+    int collection_name_length;
+    int before, max_size;
+    PyObject* spec;
+    unsigned char safe;
+    PyObject* last_error_args;
+    buffer_t buffer;
+    int length_location, message_length;
+    PyObject* result;
 
-PyMODINIT_FUNC
-PyInit__cmessage(void)
-{
-    PyObject *module = PyModule_Create(&moduledef);
-    if (module == NULL) {
+    if (!PyArg_ParseTuple(args, "et#ObO",
+                          "utf-8",
+                          &collection_name,
+                          &collection_name_length,
+                          &spec, &safe, &last_error_args)) {
         return NULL;
     }
 
-    struct module_state *state = GETSTATE(module);
-
-    // Store a reference to the _cbson module since it's needed to call some
-    // of its functions
-    state->_cbson = PyImport_ImportModule("bson._cbson");
-    if (state->_cbson == NULL) {
-        Py_DECREF(module);
+    buffer = buffer_new();
+    if (!buffer) {
+        PyErr_NoMemory();
+        PyMem_Free(collection_name);
         return NULL;
     }
 
-    // Import C API of _cbson
-    // The header file accesses _cbson_API to call the functions
-    PyObject *c_api_object = PyObject_GetAttrString(state->_cbson, "_C_API");
-    if (c_api_object == NULL) {
-        Py_DECREF(module);
-        Py_DECREF(state->_cbson);
+    // save space for message length
+    length_location = buffer_save_space(buffer, 4);
+    if (length_location == -1) {
+        PyMem_Free(collection_name);
+        buffer_free(buffer);
+        PyErr_NoMemory();
         return NULL;
     }
-    if (PyCapsule_CheckExact(c_api_object)) {
-        _cbson_API = PyCapsule_GetPointer(c_api_object, "_cbson._C_API");
+    if (!buffer_write_bytes(state->_cbson, buffer, (const char*)&request_id, 4) ||
+        !buffer_write_bytes(state->_cbson, buffer,
+                            "\x00\x00\x00\x00"
+                            "\xd6\x07\x00\x00"
+                            "\x00\x00\x00\x00",
+                            12) ||
+        !buffer_write_bytes(state->_cbson, buffer,
+                            collection_name,
+                            collection_name_length + 1) ||
+        !buffer_write_bytes(state->_cbson, buffer,
+                            "\x00\x00\x00\x00", 4)) {
+        PyMem_Free(collection_name);
+        buffer_free(buffer);
+        return NULL;
     }
 
-    Py_DECREF(c_api_object);
+    PyMem_Free(collection_name);
 
-    if (_cbson_API == NULL) {
-        Py_DECREF(module);
-        Py_DECREF(state->_cbson);
+    before = buffer_get_position(buffer);
+    if (!write_dict(state->_cbson, buffer, spec, 0, 1)) {
+        buffer_free(buffer);
+        return NULL;
+    }
+    max_size = buffer_get_position(buffer) - before;
+
+    message_length = buffer_get_position(buffer) - length_location;
+    memcpy(buffer_get_buffer(buffer) + length_location, &message_length, 4);
+
+    if (safe) {
+        if (!add_last_error(self, buffer, request_id, last_error_args)) {
+            buffer_free(buffer);
+            return NULL;
+        }
+    }
+
+    /* objectify buffer */
+    _count_message(buffer);
+    result = Py_BuildValue("iy#i", request_id,
+                           buffer_get_buffer(buffer),
+                           buffer_get_position(buffer),
+                           max_size);
+    buffer_free(buffer);
+    return result;
+}
+
+static PyObject* _cbson_kill_cursors_message(PyObject* self, PyObject* args) {
+    /* NOTE just using a random number as the request_id */
+    struct module_state *state = GETSTATE(self);
+
+    int request_id = rand();
+    PyObject* cursor_ids;
+    PyObject* sequence;
+    int count;
+    int i;
+    buffer_t buffer;
+    int length_location, message_length;
+    PyObject* result;
+
+    if (!PyArg_ParseTuple(args, "O", &cursor_ids)) {
+        return NULL;
+    }
+
+    sequence = PySequence_Fast(cursor_ids, "cursor_ids must be a sequence");
+    if (!sequence) {
+        return NULL;
+    }
+    count = (int)PySequence_Fast_GET_SIZE(sequence);
+
+    buffer = buffer_new();
+    if (!buffer) {
+        PyErr_NoMemory();
+        Py_DECREF(sequence);
+        return NULL;
+    }
+
+    // save space for message length
+    length_location = buffer_save_space(buffer, 4);
+    if (length_location == -1) {
+        Py_DECREF(sequence);
+        buffer_free(buffer);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    if (!buffer_write_bytes(state->_cbson, buffer, (const char*)&request_id, 4) ||
+        !buffer_write_bytes(state->_cbson, buffer,
+                            "\x00\x00\x00\x00"
+                            "\xd7\x07\x00\x00"
+                            "\x00\x00\x00\x00",
+                            12) ||
+        !buffer_write_bytes(state->_cbson, buffer, (const char*)&count, 4)) {
+        Py_DECREF(sequence);
+        buffer_free(buffer);
+        return NULL;
+    }
+
+    for (i = 0; i < count; i++) {
+        long long cursor_id = PyLong_AsLongLong(PySequence_Fast_GET_ITEM(sequence, i));
+        if (cursor_id == -1 && PyErr_Occurred()) {
+            Py_DECREF(sequence);
+            buffer_free(buffer);
+            return NULL;
+        }
+        if (!buffer_write_bytes(state->_cbson, buffer, (const char*)&cursor_id, 8)) {
+            Py_DECREF(sequence);
+            buffer_free(buffer);
+            return NULL;
+        }
+    }
+    Py_DECREF(sequence);
+
+    message_length = buffer_get_position(buffer) - length_location;
+    memcpy(buffer_get_buffer(buffer) + length_location, &message_length, 4);
+
+    /* objectify buffer */
+    _count_message(buffer);
+    result = Py_BuildValue("iy#", request_id,
+                           buffer_get_buffer(buffer),
+                           buffer_get_position(buffer));
+    buffer_free(buffer);
+    return result;
+}
+
+/* Messages for many write operations, packed back to back in one buffer
+ * so they can be sent together. Consecutive inserts into the same
+ * collection share an OP_INSERT message. */
+typedef struct {
+    PyObject_HEAD
+    PyObject* module;
+    /* NULL until the first operation is added. */
+    buffer_t buffer;
+    int max_bson_size;
+    int max_message_size;
+    /* Number of operations (documents, for inserts) in the buffer. */
+    int count;
+    /* Request id and start of the last message. */
+    int request_id;
+    int message_start;
+    /* Collection of the last message if it is an OP_INSERT that more
+     * documents can be added to, else NULL. */
+    PyObject* insert_collection;
+} BulkBuffer;
+
+static PyTypeObject BulkBuffer_Type;
+
+/* Write the length of the last message in `bulk`. */
+static void _bulk_buffer_end(BulkBuffer* bulk) {
+    int length = buffer_get_position(bulk->buffer) - bulk->message_start;
+    memcpy(buffer_get_buffer(bulk->buffer) + bulk->message_start, &length, 4);
+}
+
+/* Roll `bulk` back to its state before a failed operation. Steals the
+ * reference to `insert_collection`. */
+static void _bulk_buffer_undo(BulkBuffer* bulk, int position, int count,
+                              int request_id, int message_start,
+                              PyObject* insert_collection) {
+    buffer_truncate(bulk->buffer, position);
+    bulk->count = count;
+    bulk->request_id = request_id;
+    bulk->message_start = message_start;
+    Py_XSETREF(bulk->insert_collection, insert_collection);
+    if (position > message_start) {
+        /* Documents may have been added to (or split from) the last
+         * message: give it back its old length. */
+        _bulk_buffer_end(bulk);
+    }
+}
+
+/* Start a message for `operation` in `bulk`, with the standard header
+ * followed by the ZERO field and `collection_name`.
+ *
+ * Returns 0 on failure */
+static int _bulk_buffer_start(BulkBuffer* bulk, int operation,
+                              const char* collection_name,
+                              int collection_name_length) {
+    struct module_state *state = GETSTATE(bulk->module);
+    int request_id = rand();
+    int start = buffer_save_space(bulk->buffer, 4);
+
+    if (start == -1) {
+        PyErr_NoMemory();
+        return 0;
+    }
+    if (!buffer_write_bytes(state->_cbson, bulk->buffer,
+                            (const char*)&request_id, 4) ||
+        !buffer_write_bytes(state->_cbson, bulk->buffer,
+                            "\x00\x00\x00\x00", 4) ||
+        !buffer_write_bytes(state->_cbson, bulk->buffer,
+                            (const char*)&operation, 4) ||
+        !buffer_write_bytes(state->_cbson, bulk->buffer,
+                            "\x00\x00\x00\x00", 4) ||
+        !buffer_write_bytes(state->_cbson, bulk->buffer,
+                            collection_name, collection_name_length + 1)) {
+        return 0;
+    }
+    bulk->request_id = request_id;
+    bulk->message_start = start;
+    return 1;
+}
+
+/* Make sure `bulk` has a buffer.
+ *
+ * Returns 0 on failure */
+static int _bulk_buffer_ready(BulkBuffer* bulk) {
+    if (!bulk->buffer) {
+        bulk->buffer = buffer_new();
+        if (!bulk->buffer) {
+            PyErr_NoMemory();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static PyObject* BulkBuffer_insert(BulkBuffer* bulk, PyObject* args) {
+    PyObject* collection;
+    PyObject* docs;
+    PyObject* doc;
+    PyObject* iterator;
+    unsigned char check_keys;
+    const char* collection_name;
+    int collection_name_length;
+    int header_size;
+    int count = 0;
+    int position, old_count, old_request_id, old_message_start;
+    PyObject* old_insert_collection;
+
+    if (!PyArg_ParseTuple(args, "UOb", &collection, &docs, &check_keys)) {
+        return NULL;
+    }
+    collection_name = PyUnicode_AsUTF8(collection);
+    if (!collection_name) {
+        return NULL;
+    }
+    collection_name_length = strlen(collection_name);
+    header_size = 16 + 4 + collection_name_length + 1;
+
+    iterator = PyObject_GetIter(docs);
+    if (!iterator) {
+        PyObject* InvalidOperation;
+        PyErr_Clear();
+        InvalidOperation = _error("InvalidOperation");
+        if (InvalidOperation) {
+            PyErr_SetString(InvalidOperation, "input is not iterable");
+            Py_DECREF(InvalidOperation);
+        }
+        return NULL;
+    }
+    if (!_bulk_buffer_ready(bulk)) {
+        Py_DECREF(iterator);
+        return NULL;
+    }
+
+    position = buffer_get_position(bulk->buffer);
+    old_count = bulk->count;
+    old_request_id = bulk->request_id;
+    old_message_start = bulk->message_start;
+    old_insert_collection = bulk->insert_collection;
+    Py_XINCREF(old_insert_collection);
+
+    if (bulk->insert_collection &&
+        PyUnicode_Compare(bulk->insert_collection, collection) != 0) {
+        if (PyErr_Occurred()) {
+            goto fail;
+        }
+        Py_CLEAR(bulk->insert_collection);
+    }
+
+    while ((doc = PyIter_Next(iterator)) != NULL) {
+        int before;
+        int size;
+
+        if (!bulk->insert_collection) {
+            if (!_bulk_buffer_start(bulk, 2002, collection_name,
+                                    collection_name_length)) {
+                Py_DECREF(doc);
+                goto fail;
+            }
+            Py_INCREF(collection);
+            bulk->insert_collection = collection;
+        }
+
+        before = buffer_get_position(bulk->buffer);
+        if (!_write_insert_document(bulk->module, bulk->buffer, doc,
+                                    check_keys)) {
+            Py_DECREF(doc);
+            goto fail;
+        }
+        Py_DECREF(doc);
+        size = buffer_get_position(bulk->buffer) - before;
+        if (size > bulk->max_bson_size) {
+            _raise_document_too_large(size, bulk->max_bson_size);
+            goto fail;
+        }
+
+        if (before > bulk->message_start + header_size &&
+            buffer_get_position(bulk->buffer) - bulk->message_start >
+            bulk->max_message_size) {
+            /* This document doesn't fit: end the message before it and
+             * move it into a new one. */
+            char* data;
+            int request_id = rand();
+            int length = before - bulk->message_start;
+            if (buffer_save_space(bulk->buffer, header_size) == -1) {
+                PyErr_NoMemory();
+                goto fail;
+            }
+            data = buffer_get_buffer(bulk->buffer);
+            memcpy(data + bulk->message_start, &length, 4);
+            memmove(data + before + header_size, data + before, size);
+            memcpy(data + before, data + bulk->message_start, header_size);
+            memcpy(data + before + 4, &request_id, 4);
+            bulk->request_id = request_id;
+            bulk->message_start = before;
+        }
+        _bulk_buffer_end(bulk);
+        count++;
+    }
+    if (PyErr_Occurred()) {
+        goto fail;
+    }
+    if (!count) {
+        PyObject* InvalidOperation = _error("InvalidOperation");
+        if (InvalidOperation) {
+            PyErr_SetString(InvalidOperation, "cannot do an empty bulk insert");
+            Py_DECREF(InvalidOperation);
+        }
+        goto fail;
+    }
+
+    Py_DECREF(iterator);
+    Py_XDECREF(old_insert_collection);
+    bulk->count += count;
+    Py_RETURN_NONE;
+
+    fail:
+    Py_DECREF(iterator);
+    _bulk_buffer_undo(bulk, position, old_count, old_request_id,
+                      old_message_start, old_insert_collection);
+    return NULL;
+}
+
+/* Add an update or delete message to `bulk`: `prefix` (`prefix_size`
+ * bytes) follows the collection name, then the `count` documents in
+ * `docs`.
+ *
+ * Returns 0 on failure */
+static int _bulk_buffer_add(BulkBuffer* bulk, int operation,
+                            PyObject* collection, const char* prefix,
+                            int prefix_size, PyObject** docs, int count) {
+    struct module_state *state = GETSTATE(bulk->module);
+    const char* collection_name;
+    int position, old_count, old_request_id, old_message_start;
+    PyObject* old_insert_collection;
+    int i;
+
+    collection_name = PyUnicode_AsUTF8(collection);
+    if (!collection_name || !_bulk_buffer_ready(bulk)) {
+        return 0;
+    }
+
+    position = buffer_get_position(bulk->buffer);
+    old_count = bulk->count;
+    old_request_id = bulk->request_id;
+    old_message_start = bulk->message_start;
+    old_insert_collection = bulk->insert_collection;
+    bulk->insert_collection = NULL;
+
+    if (!_bulk_buffer_start(bulk, operation, collection_name,
+                            strlen(collection_name)) ||
+        !buffer_write_bytes(state->_cbson, bulk->buffer, prefix,
+                            prefix_size)) {
+        goto fail;
+    }
+    for (i = 0; i < count; i++) {
+        int before = buffer_get_position(bulk->buffer);
+        int size;
+        if (!write_dict(state->_cbson, bulk->buffer, docs[i], 0, 1)) {
+            goto fail;
+        }
+        size = buffer_get_position(bulk->buffer) - before;
+        if (size > bulk->max_bson_size) {
+            _raise_document_too_large(size, bulk->max_bson_size);
+            goto fail;
+        }
+    }
+    _bulk_buffer_end(bulk);
+
+    Py_XDECREF(old_insert_collection);
+    bulk->count++;
+    return 1;
+
+    fail:
+    _bulk_buffer_undo(bulk, position, old_count, old_request_id,
+                      old_message_start, old_insert_collection);
+    return 0;
+}
+
+static PyObject* BulkBuffer_update(BulkBuffer* bulk, PyObject* args) {
+    PyObject* collection;
+    unsigned char upsert;
+    unsigned char multi;
+    PyObject* docs[2];
+    int options = 0;
+
+    if (!PyArg_ParseTuple(args, "UbbOO", &collection, &upsert, &multi,
+                          &docs[0], &docs[1])) {
+        return NULL;
+    }
+    if (upsert) {
+        options += 1;
+    }
+    if (multi) {
+        options += 2;
+    }
+    if (!_bulk_buffer_add(bulk, 2001, collection, (const char*)&options, 4,
+                          docs, 2)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* BulkBuffer_delete(BulkBuffer* bulk, PyObject* args) {
+    PyObject* collection;
+    PyObject* spec;
+
+    if (!PyArg_ParseTuple(args, "UO", &collection, &spec)) {
+        return NULL;
+    }
+    if (!_bulk_buffer_add(bulk, 2006, collection, "\x00\x00\x00\x00", 4,
+                          &spec, 1)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* BulkBuffer_finish(BulkBuffer* bulk, PyObject* args) {
+    unsigned char safe;
+    PyObject* last_error_args;
+    int request_id = bulk->request_id;
+    PyObject* result;
+
+    if (!PyArg_ParseTuple(args, "bO", &safe, &last_error_args)) {
+        return NULL;
+    }
+    if (!bulk->count) {
+        Py_RETURN_NONE;
+    }
+
+    if (safe) {
+        int position = buffer_get_position(bulk->buffer);
+        request_id = rand();
+        if (!add_last_error(bulk->module, bulk->buffer, request_id,
+                            last_error_args)) {
+            /* Keep the operations: only drop the lastError message */
+            Py_XINCREF(bulk->insert_collection);
+            _bulk_buffer_undo(bulk, position, bulk->count, bulk->request_id,
+                              bulk->message_start, bulk->insert_collection);
+            return NULL;
+        }
+    }
+
+    result = Py_BuildValue("iN", request_id,
+                           PyBytes_FromStringAndSize(buffer_get_buffer(bulk->buffer),
+                                                     buffer_get_position(bulk->buffer)));
+    if (result) {
+        _count_message(bulk->buffer);
+        buffer_free(bulk->buffer);
+        bulk->buffer = NULL;
+        bulk->count = 0;
+        Py_CLEAR(bulk->insert_collection);
+    }
+    return result;
+}
+
+static PyObject* BulkBuffer_get_count(BulkBuffer* bulk, void* closure) {
+    return PyLong_FromLong(bulk->count);
+}
+
+static Py_ssize_t BulkBuffer_length(BulkBuffer* bulk) {
+    return bulk->buffer ? buffer_get_position(bulk->buffer) : 0;
+}
+
+static void BulkBuffer_dealloc(BulkBuffer* bulk) {
+    if (bulk->buffer) {
+        buffer_free(bulk->buffer);
+    }
+    Py_XDECREF(bulk->insert_collection);
+    Py_DECREF(bulk->module);
+    PyObject_Del(bulk);
+}
+
+static PyMethodDef BulkBuffer_methods[] = {
+    {"insert", (PyCFunction)BulkBuffer_insert, METH_VARARGS,
+     "add an insert of documents."},
+    {"update", (PyCFunction)BulkBuffer_update, METH_VARARGS,
+     "add an update."},
+    {"delete", (PyCFunction)BulkBuffer_delete, METH_VARARGS,
+     "add a delete."},
+    {"finish", (PyCFunction)BulkBuffer_finish, METH_VARARGS,
+     "take the buffered messages as a (request_id, data) pair."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef BulkBuffer_getset[] = {
+    {"count", (getter)BulkBuffer_get_count, NULL,
+     "the number of buffered operations.", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PySequenceMethods BulkBuffer_as_sequence = {
+    (lenfunc)BulkBuffer_length,                 /* sq_length */
+};
+
+static PyTypeObject BulkBuffer_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "pymongo._cmessage.BulkBuffer",             /* tp_name */
+    sizeof(BulkBuffer),                         /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)BulkBuffer_dealloc,             /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_reserved */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    &BulkBuffer_as_sequence,                    /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    0,                                          /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                         /* tp_flags */
+    "Write operations buffered to be sent together.",
+    0,                                          /* tp_traverse */
+    0,                                          /* tp_clear */
+    0,                                          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    0,                                          /* tp_iter */
+    0,                                          /* tp_iternext */
+    BulkBuffer_methods,                         /* tp_methods */
+    0,                                          /* tp_members */
+    BulkBuffer_getset,                          /* tp_getset */
+};
+
+static PyObject* _cbson_bulk_buffer(PyObject* self, PyObject* args) {
+    BulkBuffer* bulk;
+    int max_bson_size;
+    int max_message_size;
+
+    if (!PyArg_ParseTuple(args, "ii", &max_bson_size, &max_message_size)) {
+        return NULL;
+    }
+    bulk = PyObject_New(BulkBuffer, &BulkBuffer_Type);
+    if (!bulk) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    bulk->module = self;
+    bulk->buffer = NULL;
+    bulk->max_bson_size = max_bson_size;
+    bulk->max_message_size = max_message_size;
+    bulk->count = 0;
+    bulk->request_id = 0;
+    bulk->message_start = 0;
+    bulk->insert_collection = NULL;
+    return (PyObject*)bulk;
+}
+
+/* Raise the error described by a reply with the QueryFailure flag set.
+ * `string` and `size` give the documents following the reply header. */
+static void _raise_query_failure(PyObject* self, const char* string,
+                                 Py_ssize_t size) {
+    struct module_state *state = GETSTATE(self);
+    PyObject* error_class;
+    PyObject* documents;
+    PyObject* error_object;
+    PyObject* message;
+    const char* error_name = "OperationFailure";
+
+    documents = decode_documents(state->_cbson, NULL, string, size,
+                                 (PyObject*)&PyDict_Type, 0, NULL, 0);
+    if (!documents) {
+        return;
+    }
+    if (!PyList_GET_SIZE(documents) ||
+        !(message = PyDict_GetItemString(PyList_GET_ITEM(documents, 0),
+                                         "$err"))) {
+        Py_DECREF(documents);
+        PyErr_SetString(PyExc_KeyError, "$err");
+        return;
+    }
+
+    error_object = PyUnicode_FromString("not master");
+    if (!error_object) {
+        Py_DECREF(documents);
+        return;
+    }
+    if (PyUnicode_Check(message) &&
+        PyUnicode_Tailmatch(message, error_object, 0, PY_SSIZE_T_MAX, -1) == 1) {
+        error_name = "AutoReconnect";
+        message = PyUnicode_FromString("master has changed");
+    } else {
+        message = PyUnicode_FromFormat("database error: %S", message);
+    }
+    Py_DECREF(error_object);
+    Py_DECREF(documents);
+    if (!message) {
+        return;
+    }
+
+    error_class = _error((char*)error_name);
+    if (error_class) {
+        PyErr_SetObject(error_class, message);
+        Py_DECREF(error_class);
+    }
+    Py_DECREF(message);
+}
+
+static PyObject* _cbson_unpack_response(PyObject* self, PyObject* args) {
+    struct module_state *state = GETSTATE(self);
+
+    PyObject* response;
+    PyObject* cursor_id = Py_None;
+    PyObject* as_class = (PyObject*)&PyDict_Type;
+    unsigned char tz_aware = 0;
+    unsigned char lazy = 0;
+    unsigned char validate = 0;
+    unsigned char validated = 0;
+    Py_buffer view;
+    const char* string;
+    int flags;
+    long long reply_cursor_id;
+    int starting_from;
+    int number_returned;
+    PyObject* data;
+    PyObject* result;
+
+    if (!PyArg_ParseTuple(args, "O|OObbb", &response, &cursor_id,
+                          &as_class, &tz_aware, &lazy, &validate)) {
+        return NULL;
+    }
+    if (PyObject_GetBuffer(response, &view, PyBUF_SIMPLE) == -1) {
+        return NULL;
+    }
+    if (view.len < 20) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "response is too short");
+        return NULL;
+    }
+    string = view.buf;
+    message_stats.replies++;
+    message_stats.reply_bytes += view.len;
+
+    memcpy(&flags, string, 4);
+    if (flags & 1) {
+        PyObject* error;
+        PyBuffer_Release(&view);
+        error = _error("OperationFailure");
+        if (error) {
+            PyErr_Format(error, "cursor id '%S' not valid at server",
+                         cursor_id);
+            Py_DECREF(error);
+        }
+        return NULL;
+    }
+    if (flags & 2) {
+        _raise_query_failure(self, string + 20, view.len - 20);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    memcpy(&reply_cursor_id, string + 4, 8);
+    memcpy(&starting_from, string + 12, 4);
+    memcpy(&number_returned, string + 16, 4);
+
+    if (lazy) {
+        /* The iterator keeps pointing into the response, so hold a lock
+         * on any buffer that isn't immutable bytes. */
+        PyObject* owner;
+        if (PyBytes_Check(response)) {
+            Py_INCREF(response);
+            owner = response;
+        } else {
+            owner = PyMemoryView_FromObject(response);
+        }
+        data = NULL;
+        if (owner) {
+            data = decode_iterator_new(state->_cbson, owner, string + 20,
+                                       view.len - 20, as_class, tz_aware,
+                                       NULL);
+            Py_DECREF(owner);
+        }
+        PyBuffer_Release(&view);
+        if (!data) {
+            return NULL;
+        }
+        return Py_BuildValue("{sLsisisN}",
+                             "cursor_id", reply_cursor_id,
+                             "starting_from", starting_from,
+                             "number_returned", number_returned,
+                             "data", data);
+    }
+
+    if (validate) {
+        Py_ssize_t count = validate_documents(string + 20, view.len - 20);
+        if (count == -1) {
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+        /* Only immutable data is sure to be as it was validated. */
+        validated = PyBytes_Check(response);
+    }
+    data = decode_documents(state->_cbson, response, string + 20,
+                            view.len - 20, as_class, tz_aware, NULL,
+                            validated);
+    PyBuffer_Release(&view);
+    if (!data) {
+        return NULL;
+    }
+    if (PyList_GET_SIZE(data) != number_returned) {
+        Py_DECREF(data);
+        PyErr_SetString(PyExc_AssertionError,
+                        "number_returned doesn't match the reply");
+        return NULL;
+    }
+
+    result = Py_BuildValue("{sLsisisN}",
+                           "cursor_id", reply_cursor_id,
+                           "starting_from", starting_from,
+                           "number_returned", number_returned,
+                           "data", data);
+    return result;
+}
+
+/* Fill the `length` bytes at `buffer` from `sock`, with its recv_into
+ * method.
+ *
+ * Returns 0 on failure */
+static int _receive_into(PyObject* sock, char* buffer, Py_ssize_t length) {
+    Py_ssize_t received = 0;
+
+    while (received < length) {
+        PyObject* result;
+        Py_ssize_t chunk;
+        PyObject* view = PyMemoryView_FromMemory(buffer + received,
+                                                 length - received,
+                                                 PyBUF_WRITE);
+        if (!view) {
+            return 0;
+        }
+        result = PyObject_CallMethod(sock, "recv_into", "O", view);
+        Py_DECREF(view);
+        if (!result) {
+            return 0;
+        }
+        chunk = PyLong_AsSsize_t(result);
+        Py_DECREF(result);
+        if (chunk == -1 && PyErr_Occurred()) {
+            return 0;
+        }
+        if (chunk <= 0) {
+            PyObject* error = _error("ConnectionFailure");
+            if (error) {
+                PyErr_SetString(error, "connection closed");
+                Py_DECREF(error);
+            }
+            return 0;
+        }
+        received += chunk;
+    }
+    return 1;
+}
+
+static PyObject* _cbson_receive_message(PyObject* self, PyObject* args) {
+    PyObject* sock;
+    int operation;
+    int request_id;
+    char header[16];
+    int length;
+    int response_to;
+    int response_operation;
+    PyObject* data;
+
+    if (!PyArg_ParseTuple(args, "Oii", &sock, &operation, &request_id)) {
+        return NULL;
+    }
+    if (!_receive_into(sock, header, 16)) {
+        return NULL;
+    }
+    memcpy(&length, header, 4);
+    memcpy(&response_to, header + 8, 4);
+    memcpy(&response_operation, header + 12, 4);
+    if (response_to != request_id) {
+        PyErr_Format(PyExc_AssertionError, "ids don't match %d %d",
+                     request_id, response_to);
+        return NULL;
+    }
+    if (response_operation != operation &&
+        response_operation != OP_COMPRESSED) {
+        PyErr_SetNone(PyExc_AssertionError);
+        return NULL;
+    }
+    if (length < 16) {
+        PyObject* error = _error("ConnectionFailure");
+        if (error) {
+            PyErr_SetString(error, "invalid message length");
+            Py_DECREF(error);
+        }
+        return NULL;
+    }
+
+    /* Read the body straight into the bytes object we return: it
+     * isn't visible to anything else until it is complete. */
+    data = PyBytes_FromStringAndSize(NULL, length - 16);
+    if (!data) {
+        return NULL;
+    }
+    if (!_receive_into(sock, PyBytes_AS_STRING(data), length - 16)) {
+        Py_DECREF(data);
+        return NULL;
+    }
+    if (response_operation != operation) {
+        PyObject* compression = PyImport_ImportModule("pymongo.compression");
+        PyObject* body;
+        if (!compression) {
+            Py_DECREF(data);
+            return NULL;
+        }
+        body = PyObject_CallMethod(compression, "decompress", "Oi",
+                                   data, operation);
+        Py_DECREF(compression);
+        Py_DECREF(data);
+        return body;
+    }
+    return data;
+}
+
+static PyObject* _cbson_stats(PyObject* self, PyObject* args) {
+    unsigned char reset = 0;
+    buffer_stats_t buffers;
+    PyObject* result;
+
+    if (!PyArg_ParseTuple(args, "|b", &reset)) {
+        return NULL;
+    }
+    buffer_get_stats(&buffers, 0);
+    result = Py_BuildValue("{sKsKsKsKsKsi}",
+                           "messages", message_stats.messages,
+                           "message_bytes", message_stats.message_bytes,
+                           "replies", message_stats.replies,
+                           "reply_bytes", message_stats.reply_bytes,
+                           "buffer_grows", buffers.grows,
+                           "buffer_peak_size", buffers.peak_size);
+    if (result && reset) {
+        memset(&message_stats, 0, sizeof(message_stats));
+        buffer_get_stats(&buffers, 1);
+    }
+    return result;
+}
+
+static PyMethodDef _CMessageMethods[] = {
+    {"_insert_message", _cbson_insert_message, METH_VARARGS,
+     "create an insert message to be sent to MongoDB"},
+    {"_insert_batches", _cbson_insert_batches, METH_VARARGS,
+     "create insert messages, split to fit the server's message size limit"},
+    {"_update_message", _cbson_update_message, METH_VARARGS,
+     "create an update message to be sent to MongoDB"},
+    {"_query_message", _cbson_query_message, METH_VARARGS,
+     "create a query message to be sent to MongoDB"},
+    {"_get_more_message", _cbson_get_more_message, METH_VARARGS,
+     "create a get more message to be sent to MongoDB"},
+    {"_delete_message", _cbson_delete_message, METH_VARARGS,
+     "create a delete message to be sent to MongoDB"},
+    {"_kill_cursors_message", _cbson_kill_cursors_message, METH_VARARGS,
+     "create a kill cursors message to be sent to MongoDB"},
+    {"_unpack_response", _cbson_unpack_response, METH_VARARGS,
+     "unpack a response from the database"},
+    {"_receive_message", _cbson_receive_message, METH_VARARGS,
+     "receive the reply to a message from a socket"},
+    {"_bulk_buffer", _cbson_bulk_buffer, METH_VARARGS,
+     "create a buffer for write operations to be sent together"},
+    {"stats", _cbson_stats, METH_VARARGS,
+     "get (and optionally reset) the message counters"},
+    {NULL, NULL, 0, NULL}
+};
+
+static int _cmessage_traverse(PyObject *m, visitproc visit, void *arg) {
+    struct module_state *state = GETSTATE(m);
+
+    Py_VISIT(state->_cbson);
+    return 0;
+}
+
+static int _cmessage_clear(PyObject *m) {
+    struct module_state *state = GETSTATE(m);
+
+    Py_CLEAR(state->_cbson);
+    return 0;
+}
+
+static struct PyModuleDef moduledef = {
+        PyModuleDef_HEAD_INIT,
+        "_cmessage",
+        NULL,
+        sizeof(struct module_state),
+        _CMessageMethods,
+        NULL,
+        _cmessage_traverse,
+        _cmessage_clear,
+        NULL
+};
+
+PyMODINIT_FUNC
+PyInit__cmessage(void)
+{
+    PyObject *module = PyModule_Create(&moduledef);
+    if (module == NULL) {
+        return NULL;
+    }
+
+    struct module_state *state = GETSTATE(module);
+
+    // Store a reference to the _cbson module since it's needed to call some
+    // of its functions
+    state->_cbson = PyImport_ImportModule("bson._cbson");
+    if (state->_cbson == NULL) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    // Import C API of _cbson
+    // The header file accesses _cbson_API to call the functions
+    PyObject *c_api_object = PyObject_GetAttrString(state->_cbson, "_C_API");
+    if (c_api_object == NULL) {
+        Py_DECREF(module);
+        Py_DECREF(state->_cbson);
+        return NULL;
+    }
+    if (PyCapsule_CheckExact(c_api_object)) {
+        _cbson_API = PyCapsule_GetPointer(c_api_object, "_cbson._C_API");
+    }
+
+    Py_DECREF(c_api_object);
+
+    if (_cbson_API == NULL) {
+        Py_DECREF(module);
+        Py_DECREF(state->_cbson);
+        return NULL;
+    }
+
+    if (PyType_Ready(&BulkBuffer_Type) < 0) {
+        Py_DECREF(module);
         return NULL;
     }
 
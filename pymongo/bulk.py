@@ -0,0 +1,189 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Buffer many write operations and send them to the database together.
+
+A :class:`BulkWriter` packs inserts, updates and removes back to back
+in one buffer, and sends the whole buffer with a single call to the
+socket once it holds enough operations. With `safe` a single
+`getLastError` command follows each batch, rather than one for every
+operation::
+
+  >>> with db.test.bulk_writer(safe=True) as writer:
+  ...     for i in range(10000):
+  ...         writer.insert({"i": i})
+  ...     writer.update({"i": 0}, {"$set": {"first": True}})
+
+.. versionadded:: 2.0+
+"""
+
+from pymongo import (helpers,
+                     message)
+
+DEFAULT_MAX_BYTES = 4 * 1024 * 1024
+"""Default size of the buffered messages that triggers a flush."""
+
+DEFAULT_MAX_OPS = 1000
+"""Default number of buffered operations that triggers a flush."""
+
+
+class BulkWriter(object):
+    """Buffers write operations on a collection.
+
+    Operations are sent in the order they were added, once the buffer
+    holds `max_ops` operations (counting each inserted document) or
+    `max_bytes` bytes of messages, when :meth:`flush` is called, or when
+    the writer is used as a context manager and the ``with`` block ends
+    without an exception.
+
+    With `safe`, the *lastError* checked after each batch only reports
+    the last error in the batch: operations after a failed one are
+    still applied.
+    """
+
+    def __init__(self, collection, safe=False, max_bytes=DEFAULT_MAX_BYTES,
+                 max_ops=DEFAULT_MAX_OPS, check_keys=True, **kwargs):
+        """Create a new :class:`BulkWriter` for `collection`.
+
+        Use :meth:`~pymongo.collection.Collection.bulk_writer` rather
+        than calling this directly.
+
+        :Parameters:
+          - `collection`: the :class:`~pymongo.collection.Collection`
+            to write to
+          - `safe` (optional): check each batch for errors with
+            `getLastError`, raising
+            :class:`~pymongo.errors.OperationFailure` if one occurred
+          - `max_bytes` (optional): flush once the buffered messages
+            are this large
+          - `max_ops` (optional): flush once this many operations are
+            buffered
+          - `check_keys` (optional): check inserted document keys, as
+            :meth:`~pymongo.collection.Collection.insert` does
+          - `**kwargs` (optional): any additional arguments imply
+            ``safe=True``, and will be used as options for the
+            `getLastError` command
+        """
+        if collection.safe or kwargs:
+            safe = True
+            if not kwargs:
+                kwargs.update(collection.get_lasterror_options())
+
+        connection = collection.database.connection
+        self.__collection = collection
+        self.__safe = safe
+        self.__last_error_args = kwargs
+        self.__max_bytes = max_bytes
+        self.__max_ops = max_ops
+        self.__check_keys = check_keys
+        self.__buffer = message.bulk_buffer(connection.max_bson_size,
+                                            connection.max_message_size)
+
+    @property
+    def pending(self):
+        """The number of operations waiting to be sent.
+        """
+        return self.__buffer.count
+
+    def insert(self, doc_or_docs, manipulate=True):
+        """Add an insert of a document or documents.
+
+        Works like :meth:`~pymongo.collection.Collection.insert`
+        (including for pre-encoded documents), returning the ``"_id"``
+        (or list of ``"_id"`` values) of the document(s) before they
+        are sent.
+        """
+        docs = doc_or_docs
+        return_one = False
+        if isinstance(docs, (dict, bytes)):
+            return_one = True
+            docs = [docs]
+
+        if manipulate:
+            database = self.__collection.database
+            docs = [doc if isinstance(doc, bytes) else
+                    database._fix_incoming(doc, self.__collection)
+                    for doc in docs]
+        else:
+            docs = list(docs)
+
+        self.__buffer.insert(self.__collection.full_name, docs,
+                             self.__check_keys)
+        self.__maybe_flush()
+
+        ids = [helpers._get_id(doc) for doc in docs]
+        if return_one:
+            return ids[0]
+        return ids
+
+    def update(self, spec, document, upsert=False, manipulate=False,
+               multi=False):
+        """Add an update.
+
+        Takes the same arguments as
+        :meth:`~pymongo.collection.Collection.update`, but for `safe`
+        and the `getLastError` options which are set on the writer.
+        """
+        if not isinstance(spec, dict):
+            raise TypeError("spec must be an instance of dict")
+        if not isinstance(document, dict):
+            raise TypeError("document must be an instance of dict")
+        if not isinstance(upsert, bool):
+            raise TypeError("upsert must be an instance of bool")
+
+        if manipulate:
+            document = self.__collection.database._fix_incoming(
+                document, self.__collection)
+
+        self.__buffer.update(self.__collection.full_name, upsert, multi,
+                             spec, document)
+        self.__maybe_flush()
+
+    def remove(self, spec_or_id=None):
+        """Add a remove.
+
+        Works like :meth:`~pymongo.collection.Collection.remove`.
+        """
+        if spec_or_id is None:
+            spec_or_id = {}
+        if not isinstance(spec_or_id, dict):
+            spec_or_id = {"_id": spec_or_id}
+
+        self.__buffer.delete(self.__collection.full_name, spec_or_id)
+        self.__maybe_flush()
+
+    def __maybe_flush(self):
+        if (self.__buffer.count >= self.__max_ops or
+            len(self.__buffer) >= self.__max_bytes):
+            self.flush()
+
+    def flush(self):
+        """Send all the buffered operations.
+
+        If the writer is `safe` returns the response to the *lastError*
+        command sent after them. Otherwise, or if there was nothing to
+        send, returns ``None``.
+        """
+        batch = self.__buffer.finish(self.__safe, self.__last_error_args)
+        if batch is None:
+            return None
+        connection = self.__collection.database.connection
+        return connection._send_message(batch, self.__safe)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        if exc_type is None:
+            self.flush()
@@ -16,11 +16,14 @@
 
 import warnings
 
+import bson
 from bson.code import Code
+from bson.raw_bson import RawBSONDocument
 from bson.son import SON
 from pymongo import (common,
                      helpers,
                      message)
+from pymongo.bulk import BulkWriter
 from pymongo.cursor import Cursor
 from pymongo.errors import InvalidName, InvalidOperation
 
@@ -102,6 +105,9 @@ class Collection(common.BaseObject):
         self.__database = database
         self.__name = name
         self.__full_name = "%s.%s" % (self.__database.name, self.__name)
+        # Size of the last insert message we sent, used to size the
+        # buffer for the next one.
+        self.__insert_size_hint = 0
         if create or options is not None:
             self.__create(options)
 
@@ -244,6 +250,13 @@ class Collection(common.BaseObject):
         command. For example, to wait for replication to 3 nodes, pass
         ``w=3``.
 
+        Documents that are already encoded (:class:`~bson.BSON` or
+        other :class:`bytes` instances) are copied into the message
+        without being decoded: only their length and terminator are
+        checked, and their key names if `check_keys` is ``True``.
+        They aren't manipulated, and only have an ``"_id"`` if they
+        were encoded with one.
+
         :Parameters:
           - `doc_or_docs`: a document or list of documents to be
             inserted
@@ -257,6 +270,10 @@ class Collection(common.BaseObject):
             ``safe=True``, and will be used as options for the
             `getLastError` command
 
+        .. versionchanged:: 2.0+
+           Bulk inserts larger than the server's maximum message size
+           are split into several messages. Accept pre-encoded
+           documents.
         .. versionadded:: 1.8
            Support for passing `getLastError` options as keyword
            arguments.
@@ -267,25 +284,122 @@ class Collection(common.BaseObject):
         """
         docs = doc_or_docs
         return_one = False
-        if isinstance(docs, dict):
+        if isinstance(docs, (dict, bytes)):
             return_one = True
             docs = [docs]
 
         if manipulate:
-            docs = [self.__database._fix_incoming(doc, self) for doc in docs]
+            # pre-encoded documents are sent as they are
+            docs = [doc if isinstance(doc, bytes) else
+                    self.__database._fix_incoming(doc, self) for doc in docs]
 
         if self.safe or kwargs:
             safe = True
             if not kwargs:
                 kwargs.update(self.get_lasterror_options())
 
-        self.__database.connection._send_message(
-            message.insert(self.__full_name, docs,
-                           check_keys, safe, kwargs), safe)
+        connection = self.__database.connection
+        for batch in message.insert_batches(self.__full_name, docs,
+                                            check_keys, safe, kwargs,
+                                            connection.max_bson_size,
+                                            connection.max_message_size,
+                                            self.__insert_size_hint):
+            self.__insert_size_hint = len(batch[1])
+            connection._send_message(batch, safe)
 
-        ids = [doc.get("_id", None) for doc in docs]
+        ids = [helpers._get_id(doc) for doc in docs]
         return return_one and ids[0] or ids
 
+    def insert_raw_stream(self, raw_docs, safe=False, check_keys=False,
+                          **kwargs):
+        """Insert a stream of already encoded documents.
+
+        `raw_docs` can be any iterable of BSON documents: :class:`bytes`
+        (e.g. :class:`~bson.BSON`), buffers such as :class:`memoryview`,
+        or :class:`~bson.raw_bson.RawBSONDocument` instances, like those
+        :func:`~bson.decode_file_iter` yields. The documents are packed
+        into as few insert messages as fit within the server's maximum
+        message size, and each message is sent once it is full, so the
+        stream is never all in memory at once::
+
+          >>> db.test.insert_raw_stream(
+          ...     bson.decode_file_iter("dump/db/test.bson", RawBSONDocument))
+
+        The documents aren't decoded or manipulated, so they only have
+        an ``"_id"`` if they were encoded with one.
+
+        :Parameters:
+          - `raw_docs`: an iterable of encoded documents
+          - `safe` (optional): check that each message's inserts
+            succeeded?
+          - `check_keys` (optional): check if keys start with '$' or
+            contain '.', raising :class:`~pymongo.errors.InvalidName`
+            in either case (which means decoding each document)
+          - `**kwargs` (optional): any additional arguments imply
+            ``safe=True``, and will be used as options for the
+            `getLastError` command
+
+        Returns the number of documents inserted.
+
+        .. versionadded:: 2.0+
+        """
+        if self.safe or kwargs:
+            safe = True
+            if not kwargs:
+                kwargs.update(self.get_lasterror_options())
+
+        connection = self.__database.connection
+        # The header, flags and collection name of each message
+        empty = 16 + 4 + len(bson._make_c_string(self.__full_name))
+        max_size = connection.max_message_size
+
+        def send(batch, size):
+            # The batch fits in a single message
+            for message_batch in message.insert_batches(
+                    self.__full_name, batch, check_keys, safe, kwargs,
+                    connection.max_bson_size, max_size, size):
+                connection._send_message(message_batch, safe)
+
+        count = 0
+        batch = []
+        size = empty
+        for doc in raw_docs:
+            if isinstance(doc, RawBSONDocument):
+                doc = doc.raw
+            elif not isinstance(doc, bytes):
+                doc = bytes(doc)
+            if batch and size + len(doc) > max_size:
+                send(batch, size)
+                batch = []
+                size = empty
+            batch.append(doc)
+            size += len(doc)
+            count += 1
+        if batch:
+            send(batch, size)
+        return count
+
+    def bulk_writer(self, safe=False, **kwargs):
+        """Get a :class:`~pymongo.bulk.BulkWriter` for this collection.
+
+        The writer buffers inserts, updates and removes and sends many
+        of them at once, with a single `getLastError` command per batch
+        if `safe` is ``True``. Pending operations are sent when the
+        writer is used in a ``with`` statement and the block ends, or
+        when :meth:`~pymongo.bulk.BulkWriter.flush` is called.
+
+        :Parameters:
+          - `safe` (optional): check each batch of operations for
+            errors?
+          - `**kwargs` (optional): `max_bytes`, `max_ops` and
+            `check_keys` for :class:`~pymongo.bulk.BulkWriter`; any
+            other arguments imply ``safe=True``, and will be used as
+            options for the `getLastError` command
+
+        .. versionadded:: 2.0+
+        """
+        return BulkWriter(self, safe, **kwargs)
+
     def update(self, spec, document, upsert=False, manipulate=False,
                safe=False, multi=False, **kwargs):
         """Update a document(s) in this collection.
@@ -554,6 +668,13 @@ class Collection(common.BaseObject):
             results if some shards are down instead of returning an error.
           - `manipulate`: (optional): If True (the default), apply any
             outgoing SON manipulators before returning.
+          - `batches_ahead` (optional): if more than 0, send each
+            getmore as soon as the previous batch arrives, and read and
+            decode up to this many batches in a background thread while
+            the results are being used. Ignored if `tailable` is True.
+            If a getmore sent in the background fails, its error is
+            raised when that batch is reached and the cursor's later
+            getmores are sent without reading ahead.
           - `network_timeout` (optional): specify a timeout to use for
             this query, which will override the
             :class:`~pymongo.connection.Connection`-level default
@@ -564,6 +685,9 @@ class Collection(common.BaseObject):
         .. note:: The `max_scan` parameter requires server
            version **>= 1.5.1**
 
+        .. versionadded:: 2.0+
+           The `batches_ahead` parameter.
+
         .. versionadded:: 1.11+
            The `await_data`, `partial`, and `manipulate` parameters.
 
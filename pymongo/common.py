@@ -15,6 +15,8 @@
 
 """Functions and classes common to multiple pymongo modules."""
 
+from pymongo.compression import (validate_compressors,
+                                 validate_zlib_level)
 from pymongo.errors import ConfigurationError
 
 
@@ -73,6 +75,13 @@ VALIDATORS = {
     'j': validate_boolean,
     'journal': validate_boolean,
     'maxpoolsize': validate_integer,
+    'maxconnections': validate_integer,
+    'minpoolsize': validate_integer,
+    'waitqueuetimeoutms': validate_integer,
+    'waitqueuemultiple': validate_integer,
+    'compressors': validate_compressors,
+    'zlibcompressionlevel': validate_zlib_level,
+    'compressionthreshold': validate_integer,
 }
 
 
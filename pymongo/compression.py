@@ -0,0 +1,207 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Compress messages sent to and received from the database.
+
+A :class:`~pymongo.connection.Connection` created with the
+`compressors` option offers those compressors to the server when it
+connects, and wraps each message it sends (of at least
+`compressionthreshold` bytes) in an ``OP_COMPRESSED`` message using
+the first one the server supports. The server compresses its replies to
+compressed messages with the same compressor::
+
+  >>> Connection("mongodb://host/?compressors=snappy,zlib")
+
+Servers that don't support compression ignore the offer, so the
+connection carries on without compressing. ``zlib`` is always
+available, and ``snappy`` if the `python-snappy
+<http://pypi.python.org/pypi/python-snappy>`_ package is installed.
+
+.. versionadded:: 2.0+
+"""
+
+import struct
+import zlib
+
+from pymongo.errors import (ConfigurationError,
+                            ConnectionFailure)
+
+try:
+    import snappy
+    _have_snappy = True
+except ImportError:
+    _have_snappy = False
+
+OP_COMPRESSED = 2012
+
+DEFAULT_THRESHOLD = 1024
+"""Default size (in bytes) below which messages aren't compressed."""
+
+# The id of each compressor in OP_COMPRESSED messages
+_IDS = {"snappy": 1, "zlib": 2}
+
+# Commands that are never compressed: the handshake, and the commands
+# that handle credentials
+_UNCOMPRESSED_COMMANDS = frozenset(["ismaster", "getnonce", "authenticate",
+                                    "saslstart", "saslcontinue",
+                                    "createuser", "updateuser",
+                                    "copydbgetnonce", "copydbsaslstart",
+                                    "copydb"])
+
+
+def available():
+    """The names of the compressors that can be used here.
+    """
+    if _have_snappy:
+        return ["snappy", "zlib"]
+    return ["zlib"]
+
+
+def validate_compressors(option, value):
+    """Validates a list (or comma separated string) of compressor names.
+    """
+    if isinstance(value, str):
+        value = [name for name in value.split(",") if name]
+    if not isinstance(value, (list, tuple)):
+        raise TypeError("Wrong type for %s, value must be a list or comma "
+                        "separated string of compressor names" % (option,))
+    names = []
+    for name in value:
+        name = name.strip().lower()
+        if name not in _IDS:
+            raise ConfigurationError("%s is not a known compressor" % (name,))
+        if name not in available():
+            raise ConfigurationError("the %s compressor isn't available - "
+                                     "python-snappy must be installed to "
+                                     "use it" % (name,))
+        names.append(name)
+    return names
+
+
+def validate_zlib_level(option, value):
+    """Validates a zlib compression level, from -1 to 9.
+    """
+    if isinstance(value, str):
+        try:
+            value = int(value)
+        except ValueError:
+            raise ConfigurationError("The value of '%s' must be "
+                                     "an integer." % (option,))
+    if not isinstance(value, int):
+        raise TypeError("Wrong type for %s, value must be an integer" %
+                        (option,))
+    if not -1 <= value <= 9:
+        raise ConfigurationError("%s must be between -1 and 9" % (option,))
+    return value
+
+
+class Compressor(object):
+    """Compresses the messages sent on a connection.
+
+    :Parameters:
+      - `name`: the compressor to use, ``"snappy"`` or ``"zlib"``
+      - `zlib_level` (optional): the zlib compression level,
+        -1 for zlib's default
+      - `threshold` (optional): don't compress messages smaller than this
+        many bytes
+    """
+
+    def __init__(self, name, zlib_level=-1, threshold=DEFAULT_THRESHOLD):
+        self.name = name
+        self.zlib_level = zlib_level
+        self.threshold = threshold
+        self.__id = _IDS[name]
+
+    def compress(self, data):
+        """Compress the messages in `data`.
+
+        `data` holds one or more messages, each with its header. Returns
+        the messages with each large enough one (other than commands
+        that mustn't be compressed) wrapped in an ``OP_COMPRESSED``
+        message.
+        """
+        view = memoryview(data)
+        parts = []
+        compressed_any = False
+        position = 0
+        while position < len(data):
+            (length, request_id, response_to,
+             operation) = struct.unpack_from("<iiii", data, position)
+            if (length < self.threshold or
+                not _may_compress(data, position, operation)):
+                parts.append(view[position:position + length])
+            else:
+                body = view[position + 16:position + length]
+                if self.__id == 1:
+                    compressed = snappy.compress(bytes(body))
+                else:
+                    compressed = zlib.compress(body, self.zlib_level)
+                compressed_any = True
+                parts.append(struct.pack("<iiiiiiB", 25 + len(compressed),
+                                         request_id, response_to,
+                                         OP_COMPRESSED, operation,
+                                         length - 16, self.__id))
+                parts.append(compressed)
+            position += length
+        if not compressed_any:
+            return data
+        return b"".join(parts)
+
+
+def _may_compress(data, position, operation):
+    """Can the message with `operation` at `position` in `data` be
+    compressed?
+    """
+    if operation != 2004:
+        return True
+    # A query: the collection name follows the header and flags.
+    end = data.index(b"\x00", position + 20)
+    if data[end - 5:end] != b".$cmd":
+        return True
+    # The command is the first key of the query document, after the
+    # skip and limit, and the document's size and the key's type.
+    start = end + 1 + 8 + 4 + 1
+    name = data[start:data.index(b"\x00", start)]
+    return (bytes(name).decode("utf-8", "replace").lower() not in
+            _UNCOMPRESSED_COMMANDS)
+
+
+def decompress(data, operation):
+    """Decompress the body `data` of an ``OP_COMPRESSED`` message,
+    which wraps a message with `operation`.
+
+    Returns the body of the wrapped message.
+    """
+    if len(data) < 9:
+        raise ConnectionFailure("invalid compressed message")
+    (original, size, compressor) = struct.unpack_from("<iiB", data)
+    if original != operation:
+        raise ConnectionFailure("compressed message has operation %d, "
+                                "expected %d" % (original, operation))
+    compressed = memoryview(data)[9:]
+    try:
+        if compressor == 0:
+            body = compressed.tobytes()
+        elif compressor == 1 and _have_snappy:
+            body = snappy.uncompress(compressed.tobytes())
+        elif compressor == 2:
+            body = zlib.decompress(compressed, 15, max(size, 1))
+        else:
+            raise ConnectionFailure("unsupported compressor %d" %
+                                    (compressor,))
+    except zlib.error as e:
+        raise ConnectionFailure("invalid compressed message: %s" % (e,))
+    if len(body) != size:
+        raise ConnectionFailure("compressed message has the wrong size")
+    return body
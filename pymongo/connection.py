@@ -37,12 +37,12 @@ import datetime
 import os
 import select
 import socket
-import struct
 import threading
 import time
 import warnings
 
 from pymongo import (common,
+                     compression,
                      database,
                      helpers,
                      message,
@@ -58,16 +58,36 @@ from pymongo.errors import (AutoReconnect,
 
 
 _CONNECT_TIMEOUT = 20.0
+# Check that the server hasn't closed a socket before using it again
+# after it has been idle for this many seconds.
+_IDLE_CHECK_INTERVAL = 1.0
 
 
 def _closed(sock):
     """Return True if we know socket has been closed, False otherwise.
+
+    Only meant for idle sockets: nothing should be waiting to be read
+    from one, so if it's readable the server has closed it (or sent
+    something we can't use).
     """
-    rd, _, _ = select.select([sock], [], [], 0)
     try:
-        return len(rd) and sock.recv() == ""
-    except:
+        rd, _, _ = select.select([sock], [], [], 0)
+    except (select.error, socket.error, ValueError):
         return True
+    return len(rd) > 0
+
+
+def _integer_option(name, options, kwargs):
+    """Get the value of a non-negative integer option from the URI
+    `options` or the keyword arguments `kwargs`, or None if it isn't set.
+    """
+    value = options.get(name, kwargs.get(name))
+    if value is None:
+        return None
+    value = common.validate_integer(name, value)
+    if value < 0:
+        raise ValueError("%s must be >= 0" % (name,))
+    return value
 
 
 def _partition_node(node):
@@ -85,28 +105,71 @@ def _partition_node(node):
 
 
 class _Pool(threading.local):
-    """A simple connection pool.
+    """A connection pool.
 
     Uses thread-local socket per thread. By calling return_socket() a
     thread can return a socket to the pool.
+
+    Threads take idle sockets from (and return them to) a list without
+    locking. A lock is only taken to open or close a socket, which keeps
+    count of the open sockets: if there are `max_connections` a thread
+    waits (for up to `wait_queue_timeout` seconds, and with at most
+    `max_waiters` other threads) for a socket to be returned instead of
+    opening another one.
     """
 
     # Non thread-locals
-    __slots__ = ["sockets", "socket_factory", "pool_size", "pid"]
+    __slots__ = ["sockets", "checked_in", "pool_size", "network_timeout",
+                 "max_connections", "wait_queue_timeout", "max_waiters",
+                 "pid", "generation", "open", "waiters", "condition",
+                 "counters"]
 
-    # thread-local default
+    # thread-local defaults
     sock = None
+    last_used = 0
 
-    def __init__(self, pool_size, network_timeout):
-        self.pid = os.getpid()
+    def __init__(self, pool_size, network_timeout, max_connections=None,
+                 wait_queue_timeout=None, max_waiters=None):
         self.pool_size = pool_size
         self.network_timeout = network_timeout
+        self.max_connections = max_connections
+        self.wait_queue_timeout = wait_queue_timeout
+        self.max_waiters = max_waiters
+        # threading.local calls __init__ again in each thread.
         if not hasattr(self, "sockets"):
-            self.sockets = []
+            self.condition = threading.Condition()
+            self.counters = dict.fromkeys(["checkouts", "creations",
+                                           "waits", "wait_time",
+                                           "liveness_checks",
+                                           "dead_sockets"], 0)
+            self.generation = 0
+            self.waiters = 0
+            self.reset()
+
+    def reset(self):
+        """Close the idle sockets, and keep the sockets threads have
+        checked out from going back into the pool.
+        """
+        self.pid = os.getpid()
+        with self.condition:
+            self.generation += 1
+            self.open = 0
+            self.condition.notify_all()
+        sockets = getattr(self, "sockets", [])
+        self.sockets = []
+        # When each idle socket was returned, and whether it has been
+        # used (and so authenticated)
+        self.checked_in = {}
+        if self.sock is not None and self.sock[0] == self.pid:
+            sockets.append(self.sock[2])
+        self.sock = None
+        for sock in sockets:
+            sock.close()
 
     def connect(self, host, port):
         """Connect to Mongo and return a new (connected) socket.
         """
+        self.counters["creations"] += 1
         try:
             # Prefer IPv4. If there is demand for an option
             # to specify one or the other we can add it later.
@@ -125,39 +188,171 @@ class _Pool(threading.local):
             s.settimeout(self.network_timeout)
             return s
 
+    def warm(self, host, port, count):
+        """Open sockets to `host`:`port` until `count` (but no more than
+        the pool keeps) are idle.
+        """
+        while len(self.sockets) < min(count, self.pool_size):
+            with self.condition:
+                if (self.max_connections and
+                    self.open >= self.max_connections):
+                    return
+                self.open += 1
+            sock = self.__open(host, port)
+            self.checked_in[sock] = (time.time(), False)
+            self.sockets.append(sock)
+
     def get_socket(self, host, port):
+        """Get the socket for this thread.
+
+        Returns a (socket, from_pool) pair: `from_pool` is False if the
+        socket hasn't been used yet.
+        """
         # We use the pid here to avoid issues with fork / multiprocessing.
         # See test.test_connection:TestConnection.test_fork for an example of
         # what could go wrong otherwise
         pid = os.getpid()
 
         if pid != self.pid:
+            # Another thread may have held the lock when we forked.
+            self.condition = threading.Condition()
+            self.waiters = 0
             self.sock = None
             self.sockets = []
-            self.pid = pid
+            self.reset()
 
+        now = time.time()
         if self.sock is not None and self.sock[0] == pid:
-            return (self.sock[1], True)
-
-        try:
-            self.sock = (pid, self.sockets.pop())
-            return (self.sock[1], True)
-        except IndexError:
-            self.sock = (pid, self.connect(host, port))
-            return (self.sock[1], False)
+            (_, generation, sock) = self.sock
+            if generation != self.generation:
+                # The pool was reset since this socket was checked out.
+                self.sock = None
+                sock.close()
+            elif (now - self.last_used < _IDLE_CHECK_INTERVAL or
+                  not self.__dead(sock)):
+                self.last_used = now
+                return (sock, True)
+            else:
+                self.sock = None
 
+        idle = self.__take_idle(now) or self.__reserve()
+        if idle is None:
+            (sock, used) = (self.__open(host, port), False)
+        else:
+            (sock, used) = idle
+        self.counters["checkouts"] += 1
+        self.sock = (pid, self.generation, sock)
+        self.last_used = now
+        return (sock, used)
 
     def return_socket(self):
         if self.sock is not None and self.sock[0] == os.getpid():
-            # There's a race condition here, but we deliberately
-            # ignore it.  It means that if the pool_size is 10 we
-            # might actually keep slightly more than that.
-            if len(self.sockets) < self.pool_size:
-                self.sockets.append(self.sock[1])
+            (_, generation, sock) = self.sock
+            if generation != self.generation:
+                sock.close()
+            # Keep the socket for a waiting thread, even if that means
+            # keeping more than pool_size.
+            elif len(self.sockets) < self.pool_size or self.waiters:
+                self.checked_in[sock] = (time.time(), True)
+                self.sockets.append(sock)
+                if self.waiters:
+                    with self.condition:
+                        self.condition.notify()
             else:
-                self.sock[1].close()
+                self.__close(sock)
         self.sock = None
 
+    def stats(self):
+        """Get the pool's counters, and the number of sockets that are
+        open, idle and waited for.
+        """
+        stats = self.counters.copy()
+        stats.update(open=self.open, idle=len(self.sockets),
+                     waiters=self.waiters)
+        return stats
+
+    def __take_idle(self, now):
+        """Take an idle socket, skipping any that have been closed.
+
+        Returns a (socket, used) pair, or None if there are no idle
+        sockets.
+        """
+        while True:
+            try:
+                sock = self.sockets.pop()
+            except IndexError:
+                return None
+            (since, used) = self.checked_in.pop(sock, (0, True))
+            if now - since < _IDLE_CHECK_INTERVAL or not self.__dead(sock):
+                return (sock, used)
+
+    def __reserve(self):
+        """Make room to open a socket.
+
+        If `max_connections` sockets are open, wait for a thread to
+        return or close one.
+
+        Returns None once a socket can be opened, or an idle
+        (socket, used) pair to use instead.
+        """
+        with self.condition:
+            if self.max_connections and self.open >= self.max_connections:
+                if (self.max_waiters is not None and
+                    self.waiters >= self.max_waiters):
+                    raise ConnectionFailure("too many threads are waiting "
+                                            "for a socket from the pool")
+                start = time.time()
+                self.waiters += 1
+                try:
+                    while self.open >= self.max_connections:
+                        idle = self.__take_idle(time.time())
+                        if idle is not None:
+                            return idle
+                        timeout = None
+                        if self.wait_queue_timeout is not None:
+                            timeout = (start + self.wait_queue_timeout -
+                                       time.time())
+                            if timeout <= 0:
+                                raise ConnectionFailure("timed out waiting "
+                                                        "for a socket from "
+                                                        "the pool")
+                        self.counters["waits"] += 1
+                        self.condition.wait(timeout)
+                finally:
+                    self.waiters -= 1
+                    self.counters["wait_time"] += time.time() - start
+            self.open += 1
+        return None
+
+    def __open(self, host, port):
+        """Open a socket to `host`:`port`, after __reserve() made room.
+        """
+        try:
+            return self.connect(host, port)
+        except:
+            self.__closed()
+            raise
+
+    def __close(self, sock):
+        sock.close()
+        self.__closed()
+
+    def __closed(self):
+        with self.condition:
+            if self.open > 0:
+                self.open -= 1
+            self.condition.notify()
+
+    def __dead(self, sock):
+        """Close `sock` and return True if the server has closed it.
+        """
+        self.counters["liveness_checks"] += 1
+        if not _closed(sock):
+            return False
+        self.counters["dead_sockets"] += 1
+        self.__close(sock)
+        return True
+
 
 class Connection(common.BaseObject):
     """Connection to MongoDB.
@@ -167,6 +362,7 @@ class Connection(common.BaseObject):
     PORT = 27017
 
     __max_bson_size = 4 * 1024 * 1024
+    __max_message_size = 2 * __max_bson_size
 
     def __init__(self, host=None, port=None, max_pool_size=10,
                  network_timeout=None, document_class=dict,
@@ -202,8 +398,8 @@ class Connection(common.BaseObject):
             it must be enclosed in '[' and ']' characters following
             the RFC2732 URL syntax (e.g. '[::1]' for localhost)
           - `port` (optional): port number on which to connect
-          - `max_pool_size` (optional): The maximum size limit for
-            the connection pool.
+          - `max_pool_size` (optional): The maximum number of idle
+            sockets the connection pool keeps.
           - `network_timeout` (optional): timeout (in seconds) to use
             for socket operations - default is no timeout
           - `document_class` (optional): default class to use for
@@ -235,8 +431,35 @@ class Connection(common.BaseObject):
             will verify that the replica set it connects to matches this name.
             Implies that the hosts specified are a seed list and the driver should
             attempt to find all members of the set.
+          - `maxconnections`: The most sockets the pool may have open at
+            once - threads that need another one wait for a socket to be
+            returned to the pool (see :meth:`end_request`). Default is no
+            limit.
+          - `waitqueuetimeoutms`: How long (in milliseconds) a thread
+            waits for a socket before
+            :class:`~pymongo.errors.ConnectionFailure` is raised. Default
+            is to wait forever.
+          - `waitqueuemultiple`: Raise
+            :class:`~pymongo.errors.ConnectionFailure` instead of waiting
+            if this many times `maxconnections` threads are already
+            waiting. Default is no limit.
+          - `minpoolsize`: Open this many sockets when connecting, rather
+            than as they are first needed. Default is 0.
+          - `compressors`: A list (or comma separated string) of the
+            compressors to offer the server, ``"snappy"`` and/or
+            ``"zlib"``, in order of preference. Messages are compressed
+            with the first one the server supports. Default is no
+            compression. See :mod:`~pymongo.compression`.
+          - `zlibcompressionlevel`: The zlib compression level, from -1
+            (zlib's default) to 9.
+          - `compressionthreshold`: Don't compress messages smaller than
+            this many bytes. Default is 1024.
 
         .. seealso:: :meth:`end_request`
+        .. versionchanged:: 2.0+
+           Added the `maxconnections`, `waitqueuetimeoutms`,
+           `waitqueuemultiple`, `minpoolsize`, `compressors`,
+           `zlibcompressionlevel` and `compressionthreshold` options.
         .. versionchanged:: 2.0
            `slave_okay` is a pure keyword argument. Added support for safe,
            and getlasterror options as keyword arguments.
@@ -311,8 +534,34 @@ class Connection(common.BaseObject):
 
         self.__repl = options.get('replicaset', kwargs.get('replicaset'))
         self.__network_timeout = network_timeout
-        self.__pool = _Pool(self.__max_pool_size, self.__network_timeout)
-        self.__last_checkout = time.time()
+        max_connections = _integer_option("maxconnections", options, kwargs)
+        wait_queue_timeout = _integer_option("waitqueuetimeoutms", options,
+                                          kwargs)
+        if wait_queue_timeout is not None:
+            wait_queue_timeout /= 1000.0
+        max_waiters = _integer_option("waitqueuemultiple", options, kwargs)
+        if max_waiters is not None and max_connections:
+            max_waiters *= max_connections
+        self.__pool = _Pool(self.__max_pool_size, self.__network_timeout,
+                            max_connections, wait_queue_timeout, max_waiters)
+        self.__min_pool_size = _integer_option("minpoolsize", options, kwargs)
+        # Held while looking for a node, so threads don't all do it at once
+        self.__find_lock = threading.RLock()
+
+        self.__compressors = options.get("compressors",
+                                         kwargs.get("compressors")) or []
+        self.__compressors = compression.validate_compressors(
+            "compressors", self.__compressors)
+        self.__zlib_level = options.get("zlibcompressionlevel",
+                                        kwargs.get("zlibcompressionlevel", -1))
+        self.__zlib_level = compression.validate_zlib_level(
+            "zlibcompressionlevel", self.__zlib_level)
+        self.__compression_threshold = _integer_option(
+            "compressionthreshold", options, kwargs)
+        if self.__compression_threshold is None:
+            self.__compression_threshold = compression.DEFAULT_THRESHOLD
+        # The compressor negotiated with the current node, if any
+        self.__compressor = None
 
         self.__document_class = document_class
         self.__tz_aware = tz_aware
@@ -323,6 +572,13 @@ class Connection(common.BaseObject):
 
         if _connect:
             self.__find_node()
+            if self.__min_pool_size:
+                try:
+                    self.__pool.warm(self.__host, self.__port,
+                                     self.__min_pool_size)
+                except socket.error:
+                    # Sockets will be opened as they are needed instead.
+                    pass
 
         if db and username is None:
             warnings.warn("must provide a username and password "
@@ -472,6 +728,38 @@ class Connection(common.BaseObject):
         """
         return self.__max_pool_size
 
+    def pool_stats(self):
+        """Get statistics about this connection's pool of sockets.
+
+        Returns a dict with the number of sockets handed to threads
+        (``checkouts``) and opened (``creations``), the number of times
+        threads waited for a socket because ``maxconnections`` were
+        open (``waits``) and the seconds they spent waiting
+        (``wait_time``), the number of idle sockets checked before
+        being used again (``liveness_checks``) and of those found
+        closed by the server (``dead_sockets``), and the number of
+        sockets currently ``open`` and ``idle`` and of threads waiting
+        for one (``waiters``). The counters aren't reset by
+        :meth:`disconnect`, and may miss a few updates when many threads
+        use the pool at once.
+
+        .. versionadded:: 2.0+
+        """
+        return self.__pool.stats()
+
+    @property
+    def compressor(self):
+        """The name of the compressor used for messages to the connected
+        node, or ``None`` if they aren't compressed.
+
+        See the `compressors` option to :meth:`Connection`.
+
+        .. versionadded:: 2.0+
+        """
+        if self.__compressor:
+            return self.__compressor.name
+        return None
+
     @property
     def nodes(self):
         """List of all known nodes.
@@ -516,6 +804,16 @@ class Connection(common.BaseObject):
         """
         return self.__max_bson_size
 
+    @property
+    def max_message_size(self):
+        """Return the maximum size message the connected server accepts
+        in bytes. Defaults to twice :attr:`max_bson_size` if the server
+        doesn't report it.
+
+        .. versionadded:: 2.0+
+        """
+        return self.__max_message_size
+
     def __try_node(self, node):
         """Try to connect to this node and see if it works
         for our connection type.
@@ -525,12 +823,24 @@ class Connection(common.BaseObject):
         """
         self.disconnect()
         self.__host, self.__port = node
-        response = self.admin.command("ismaster")
+        if self.__compressors:
+            response = self.admin.command("ismaster",
+                                          compression=self.__compressors)
+        else:
+            response = self.admin.command("ismaster")
 
         self.end_request()
 
         if "maxBsonObjectSize" in response:
             self.__max_bson_size = response["maxBsonObjectSize"]
+        self.__max_message_size = response.get("maxMessageSizeBytes",
+                                               2 * self.__max_bson_size)
+        # Use the first of our compressors the server also supports.
+        for name in self.__compressors:
+            if name in response.get("compression", []):
+                self.__compressor = compression.Compressor(
+                    name, self.__zlib_level, self.__compression_threshold)
+                break
 
         # Replica Set?
         if len(self.__nodes) > 1 or self.__repl:
@@ -606,17 +916,21 @@ class Connection(common.BaseObject):
     def __socket(self):
         """Get a socket from the pool.
 
-        If it's been > 1 second since the last time we checked out a
-        socket, we also check to see if the socket has been closed -
+        The pool checks that the server hasn't closed a socket that has
+        been idle for more than a second before handing it out again -
         this let's us avoid seeing *some*
         :class:`~pymongo.errors.AutoReconnect` exceptions on server
-        hiccups, etc. We only do this if it's been > 1 second since
-        the last socket checkout, to keep performance reasonable - we
-        can't avoid those completely anyway.
+        hiccups, etc. We can't avoid those completely anyway.
+
+        If we aren't connected to a node only one thread looks for one,
+        while the others wait to use the node it finds.
         """
         host, port = (self.__host, self.__port)
         if host is None or port is None:
-            host, port = self.__find_node()
+            with self.__find_lock:
+                host, port = (self.__host, self.__port)
+                if host is None or port is None:
+                    host, port = self.__find_node()
 
         try:
             sock, from_pool = self.__pool.get_socket(host, port)
@@ -624,12 +938,6 @@ class Connection(common.BaseObject):
             self.disconnect()
             raise AutoReconnect("could not connect to "
                                 "%s:%d: %s" % (host, port, str(why)))
-        t = time.time()
-        if t - self.__last_checkout > 1:
-            if _closed(sock):
-                self.disconnect()
-                sock, from_pool = self.__pool.get_socket(host, port)
-        self.__last_checkout = t
         if self.__auth_credentials and not from_pool:
             self.__authenticate_socket()
         return sock
@@ -647,9 +955,10 @@ class Connection(common.BaseObject):
         .. seealso:: :meth:`end_request`
         .. versionadded:: 1.3
         """
-        self.__pool = _Pool(self.__max_pool_size, self.__network_timeout)
+        self.__pool.reset()
         self.__host = None
         self.__port = None
+        self.__compressor = None
 
     def set_cursor_manager(self, manager_class):
         """Set this connection's cursor manager.
@@ -738,6 +1047,8 @@ class Connection(common.BaseObject):
         sock = self.__socket()
         try:
             (request_id, data) = self.__check_bson_size(message)
+            if self.__compressor:
+                data = self.__compressor.compress(data)
             sock.sendall(data)
             # Safe mode. We pack the message together with a lastError
             # message and send both. We then get the response (to the
@@ -752,38 +1063,19 @@ class Connection(common.BaseObject):
             self.disconnect()
             raise AutoReconnect(str(e))
 
-    def __receive_data_on_socket(self, length, sock):
-        """Lowest level receive operation.
-
-        Takes length to receive and repeatedly calls recv until able to
-        return a buffer of that length, raising ConnectionFailure on error.
-        """
-        message = b""
-        while len(message) < length:
-            chunk = sock.recv(length - len(message))
-            if chunk == b"":
-                raise ConnectionFailure("connection closed")
-            message += chunk
-        return message
-
     def __receive_message_on_socket(self, operation, request_id, sock):
         """Receive a message in response to `request_id` on `sock`.
 
         Returns the response data with the header removed.
         """
-        header = self.__receive_data_on_socket(16, sock)
-        length = struct.unpack("<i", header[:4])[0]
-        assert request_id == struct.unpack("<i", header[8:12])[0], \
-            "ids don't match %r %r" % (request_id,
-                                       struct.unpack("<i", header[8:12])[0])
-        assert operation == struct.unpack("<i", header[12:])[0]
-
-        return self.__receive_data_on_socket(length - 16, sock)
+        return helpers._receive_message(sock, operation, request_id)
 
     def __send_and_receive(self, message, sock):
         """Send a message on the given socket and return the response data.
         """
         (request_id, data) = self.__check_bson_size(message)
+        if self.__compressor:
+            data = self.__compressor.compress(data)
         sock.sendall(data)
         return self.__receive_message_on_socket(1, request_id, sock)
 
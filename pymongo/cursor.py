@@ -14,6 +14,10 @@
 
 """Cursor class to iterate over Mongo query results."""
 
+import queue
+import threading
+
+import bson.columns
 from bson.code import Code
 from bson.son import SON
 from pymongo import (helpers,
@@ -31,6 +35,135 @@ _QUERY_OPTIONS = {
     "partial": 128}
 
 
+def _fetch(connection, message, kwargs, cursor_id, as_class, tz_aware,
+           columns, lazy):
+    """Send a query or getmore `message` and unpack the reply.
+
+    Returns a (connection_id, response) pair, where `response` is as
+    returned by :func:`~pymongo.helpers._unpack_response` - with the
+    documents decoded into `columns`, if it isn't None. Otherwise, unless
+    they're decoded `lazy`, the documents are validated first (without
+    the GIL, for a large reply) and then decoded without bounds checks.
+    """
+    response = connection._send_message_with_response(message, **kwargs)
+
+    if isinstance(response, tuple):
+        (connection_id, response) = response
+    else:
+        connection_id = None
+
+    try:
+        unpacked = helpers._unpack_response(response, cursor_id, as_class,
+                                            tz_aware, lazy or
+                                            columns is not None, not lazy)
+    except AutoReconnect:
+        connection.disconnect()
+        raise
+    if columns is not None:
+        unpacked["data"] = bson.decode_all_columnar(response, columns,
+                                                    tz_aware, 20)
+    return (connection_id, unpacked)
+
+
+class _Prefetcher(object):
+    """Sends a cursor's getmore messages from a background thread.
+
+    Each reply is read, validated (without the GIL, if it's large) and
+    decoded by the thread, which keeps up to `batches` of them ready for
+    the cursor, sending the next getmore as soon as there's room. The
+    thread doesn't refer to the cursor, so an abandoned cursor can still
+    be collected (and stop its prefetcher).
+    """
+
+    def __init__(self, connection, full_name, cursor_id, retrieved, limit,
+                 batch_size, kwargs, as_class, tz_aware, columns, batches):
+        self.__connection = connection
+        self.__full_name = full_name
+        self.__retrieved = retrieved
+        self.__limit = limit
+        self.__batch_size = batch_size
+        self.__kwargs = kwargs
+        self.__as_class = as_class
+        self.__tz_aware = tz_aware
+        self.__columns = columns
+        self.__queue = queue.Queue(batches)
+        self.__stopped = False
+        # The id of the server's cursor after the last reply - 0 once
+        # the server has closed it
+        self.cursor_id = cursor_id
+
+        self.__thread = threading.Thread(target=self.__run)
+        self.__thread.daemon = True
+        self.__thread.start()
+
+    def __run(self):
+        connection_id = self.__kwargs.get("_connection_to_use")
+        try:
+            while not self.__stopped:
+                if self.__limit:
+                    limit = self.__limit - self.__retrieved
+                    if self.__batch_size:
+                        limit = min(limit, self.__batch_size)
+                else:
+                    limit = self.__batch_size
+                try:
+                    result = _fetch(self.__connection,
+                                    message.get_more(self.__full_name, limit,
+                                                     self.cursor_id),
+                                    self.__kwargs, self.cursor_id,
+                                    self.__as_class, self.__tz_aware,
+                                    self.__columns, False)
+                except Exception as e:
+                    self.__queue.put((None, e))
+                    return
+                (connection_id, response) = result
+                self.cursor_id = response["cursor_id"]
+                self.__retrieved += response["number_returned"]
+                self.__queue.put((result, None))
+                if not self.cursor_id or (self.__limit and
+                                          self.__limit <= self.__retrieved):
+                    return
+        finally:
+            # Return the socket this thread used to its pool.
+            if connection_id is None:
+                self.__connection.end_request()
+            elif connection_id == -1:
+                self.__connection.master.end_request()
+            else:
+                self.__connection.slaves[connection_id].end_request()
+
+    def next(self):
+        """Get the next (connection_id, response) pair, waiting for it
+        if it hasn't arrived yet.
+
+        Raises the error the thread got, if it failed.
+        """
+        (result, error) = self.__queue.get()
+        if error is not None:
+            raise error
+        return result
+
+    def stop(self, wait=True):
+        """Stop fetching, and wait for a getmore in progress to finish.
+
+        Returns the id of the server's cursor, which is 0 if the server
+        has already closed it. If `wait` is ``False`` this returns
+        ``None`` straight away, and a getmore in progress finishes (and
+        its reply is dropped) in the background.
+        """
+        self.__stopped = True
+        # Make room for a reply the thread is waiting to add.
+        while True:
+            try:
+                self.__queue.get_nowait()
+            except queue.Empty:
+                break
+        if not wait:
+            return None
+        self.__thread.join()
+        return self.cursor_id
+
+
 # TODO might be cool to be able to do find().include("foo") or
 # find().exclude(["bar", "baz"]) or find().slice("a", 1, 2) as an
 # alternative to the fields specifier.
@@ -42,7 +175,8 @@ class Cursor(object):
                  timeout=True, snapshot=False, tailable=False, sort=None,
                  max_scan=None, as_class=None, slave_okay=False,
                  await_data=False, partial=False, manipulate=True,
-                 _must_use_master=False, _is_command=False, **kwargs):
+                 batches_ahead=0, _must_use_master=False, _is_command=False,
+                 **kwargs):
         """Create a new cursor.
 
         Should not be called directly by application developers - see
@@ -73,6 +207,10 @@ class Cursor(object):
             raise TypeError("await_data must be an instance of bool")
         if not isinstance(partial, bool):
             raise TypeError("partial must be an instance of bool")
+        if not isinstance(batches_ahead, int):
+            raise TypeError("batches_ahead must be an instance of int")
+        if batches_ahead < 0:
+            raise ValueError("batches_ahead must be >= 0")
 
         if fields is not None:
             if not fields:
@@ -110,15 +248,24 @@ class Cursor(object):
         self.__as_class = as_class
         self.__slave_okay = slave_okay
         self.__manipulate = manipulate
+        self.__batches_ahead = batches_ahead
         self.__tz_aware = collection.database.connection.tz_aware
         self.__must_use_master = _must_use_master
         self.__is_command = _is_command
         self.__query_flags = 0
 
-        self.__data = []
+        # documents from the last reply are decoded as they're reached
+        self.__data = iter(())
+        self.__pending = 0
+        # the fields to decode into columns, for to_columns
+        self.__columns = None
         self.__connection_id = None
         self.__retrieved = 0
         self.__killed = False
+        # sends getmores in the background, if batches_ahead is set
+        self.__prefetcher = None
+        # set once the prefetcher fails: later getmores are sent inline
+        self.__prefetch_failed = False
 
         # this is for passing network_timeout through if it's specified
         # need to use kwargs as None is a legit value for network_timeout
@@ -135,7 +282,8 @@ class Cursor(object):
 
     def __del__(self):
         if self.__id and not self.__killed:
-            self.__die()
+            # Don't hold up the collector waiting on a getmore in flight.
+            self.__die(wait=False)
 
     def rewind(self):
         """Rewind this cursor to it's unevaluated state.
@@ -146,7 +294,10 @@ class Cursor(object):
         be sent to the server, even if the resultant data has already been
         retrieved by this cursor.
         """
-        self.__data = []
+        self.__stop_prefetching()
+        self.__prefetch_failed = False
+        self.__data = iter(())
+        self.__pending = 0
         self.__id = None
         self.__connection_id = None
         self.__retrieved = 0
@@ -175,15 +326,33 @@ class Cursor(object):
         copy.__await_data = self.__await_data
         copy.__partial = self.__partial
         copy.__manipulate = self.__manipulate
+        copy.__batches_ahead = self.__batches_ahead
         copy.__must_use_master = self.__must_use_master
         copy.__is_command = self.__is_command
         copy.__query_flags = self.__query_flags
         copy.__kwargs = self.__kwargs
         return copy
 
-    def __die(self):
+    def __stop_prefetching(self, wait=True):
+        """Stop sending getmores in the background.
+
+        If `wait` is ``False`` a getmore in progress isn't waited for, so
+        the cursor's id may be one the server has since closed.
+        """
+        if self.__prefetcher is not None:
+            if not self.__prefetcher.stop(wait) and wait:
+                # The server closed the cursor while we read ahead.
+                self.__id = 0
+            self.__prefetcher = None
+
+    def __die(self, wait=True):
         """Closes this cursor.
+
+        If `wait` is ``False`` a getmore the prefetcher has in progress
+        isn't waited for: the cursor is killed on the server regardless
+        (which is harmless if the server has closed it already).
         """
+        self.__stop_prefetching(wait)
         if self.__id and not self.__killed:
             connection = self.__collection.database.connection
             if self.__connection_id is not None:
@@ -493,6 +662,44 @@ class Cursor(object):
                                                   self.__collection.name,
                                                   **options)["values"]
 
+    def to_columns(self, fields):
+        """Decode `fields` of every result of this cursor into columns.
+
+        Returns a dictionary mapping each of `fields` to a
+        :class:`~bson.columns.Column`, as :func:`bson.decode_all_columnar`
+        would for all the results. Each batch is decoded straight into
+        columns, without creating a document for every result. Unless
+        this cursor already selects fields only `fields` are requested,
+        and SON manipulators are not applied.
+
+        Raises :class:`~pymongo.errors.InvalidOperation` if this
+        :class:`Cursor` has already been used.
+
+        :Parameters:
+          - `fields`: an iterable of the names (or dotted paths) of the
+            fields to decode
+
+        .. versionadded:: 2.0+
+        """
+        fields = list(fields)
+        self.__check_okay_to_chain()
+        columns = bson.decode_all_columnar(b"", fields)
+        if self.__fields is None:
+            self.__fields = helpers._fields_list_to_dict(fields)
+
+        self.__columns = fields
+        try:
+            while not self.__empty and self._refresh():
+                for (field, column) in self.__data.items():
+                    columns[field] = bson.columns.extend(columns[field],
+                                                         column,
+                                                         self.__tz_aware)
+                self.__data = iter(())
+                self.__pending = 0
+        finally:
+            self.__columns = None
+        return columns
+
     def explain(self):
         """Returns an explain plan record for this cursor.
 
@@ -562,32 +769,28 @@ class Cursor(object):
         self.__spec["$where"] = code
         return self
 
-    def __send_message(self, message):
-        """Send a query or getmore message and handles the response.
+    def __send_kwargs(self):
+        """Get the keyword arguments for sending this cursor's messages.
         """
-        db = self.__collection.database
         kwargs = {"_must_use_master": self.__must_use_master}
         if self.__connection_id is not None:
             kwargs["_connection_to_use"] = self.__connection_id
         kwargs.update(self.__kwargs)
+        return kwargs
 
-        response = db.connection._send_message_with_response(message,
-                                                             **kwargs)
-
-        if isinstance(response, tuple):
-            (connection_id, response) = response
-        else:
-            connection_id = None
-
-        self.__connection_id = connection_id
-
-        try:
-            response = helpers._unpack_response(response, self.__id,
-                                                self.__as_class,
-                                                self.__tz_aware)
-        except AutoReconnect:
-            db.connection.disconnect()
-            raise
+    def __send_message(self, message):
+        """Send a query or getmore message and handles the response.
+        """
+        self.__handle_response(_fetch(self.__collection.database.connection,
+                                      message, self.__send_kwargs(),
+                                      self.__id, self.__as_class,
+                                      self.__tz_aware, self.__columns, True))
+
+    def __handle_response(self, result):
+        """Handle the (connection_id, response) pair for a query or
+        getmore.
+        """
+        (self.__connection_id, response) = result
         self.__id = response["cursor_id"]
 
         # starting from doesn't get set on getmore's for tailable cursors
@@ -595,20 +798,42 @@ class Cursor(object):
             assert response["starting_from"] == self.__retrieved
 
         self.__retrieved += response["number_returned"]
+        self.__pending = response["number_returned"]
         self.__data = response["data"]
+        if self.__columns is None:
+            # documents decoded in the background come as a list
+            self.__data = iter(self.__data)
+        else:
+            for column in self.__data.values():
+                if len(column.mask) != self.__pending:
+                    raise AssertionError("number_returned doesn't match "
+                                         "the reply")
 
         if self.__limit and self.__id and self.__limit <= self.__retrieved:
             self.__die()
+        elif not self.__id:
+            self.__stop_prefetching()
+        elif (self.__batches_ahead and self.__id and not self.__tailable and
+              self.__prefetcher is None and not self.__prefetch_failed):
+            # Tailable cursors can return empty batches indefinitely, so
+            # they aren't read ahead.
+            self.__prefetcher = _Prefetcher(
+                self.__collection.database.connection,
+                self.__collection.full_name, self.__id, self.__retrieved,
+                self.__limit, self.__batch_size, self.__send_kwargs(),
+                self.__as_class, self.__tz_aware, self.__columns,
+                self.__batches_ahead)
 
     def _refresh(self):
         """Refreshes the cursor with more data from Mongo.
 
-        Returns the length of self.__data after refresh. Will exit early if
-        self.__data is already non-empty. Raises OperationFailure when the
-        cursor cannot be refreshed due to an error on the query.
+        Returns the number of documents left in self.__data after refresh.
+        Will exit early if self.__data is already non-empty. Raises
+        OperationFailure when the cursor cannot be refreshed due to an
+        error on the query.
         """
-        if len(self.__data) or self.__killed:
-            return len(self.__data)
+        if self.__pending or self.__killed:
+            return self.__pending
 
         if self.__id is None:  # Query
             self.__send_message(
@@ -618,6 +843,16 @@ class Cursor(object):
                               self.__query_spec(), self.__fields))
             if not self.__id:
                 self.__killed = True
+        elif self.__id and self.__prefetcher is not None:
+            try:
+                result = self.__prefetcher.next()
+            except:
+                # The thread has stopped: carry on without it, sending
+                # any later getmores inline.
+                self.__prefetcher = None
+                self.__prefetch_failed = True
+                raise
+            self.__handle_response(result)
         elif self.__id:  # Get More
             if self.__limit:
                 limit = self.__limit - self.__retrieved
@@ -630,7 +865,7 @@ class Cursor(object):
                 message.get_more(self.__collection.full_name,
                                  limit, self.__id))
 
-        return len(self.__data)
+        return self.__pending
 
     @property
     def alive(self):
@@ -643,7 +878,7 @@ class Cursor(object):
 
         .. versionadded:: 1.5
         """
-        return bool(len(self.__data) or (not self.__killed))
+        return bool(self.__pending or (not self.__killed))
 
     def __iter__(self):
         return self
@@ -652,11 +887,20 @@ class Cursor(object):
         if self.__empty:
             raise StopIteration
         db = self.__collection.database
-        if len(self.__data) or self._refresh():
+        if self.__pending or self._refresh():
+            self.__pending -= 1
+            doc = next(self.__data, None)
+            if not self.__pending:
+                if next(self.__data, None) is not None:
+                    doc = None
+                # let go of the reply as soon as it's used up
+                self.__data = iter(())
+            if doc is None:
+                raise AssertionError("number_returned doesn't match the reply")
             if self.__manipulate:
-                return db._fix_outgoing(self.__data.pop(0), self.__collection)
+                return db._fix_outgoing(doc, self.__collection)
             else:
-                return self.__data.pop(0)
+                return doc
         else:
             raise StopIteration
 
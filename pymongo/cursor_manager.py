@@ -24,7 +24,9 @@ import weakref
 class CursorManager(object):
     """The default cursor manager.
 
-    This manager will kill cursors one at a time as they are closed.
+    This manager will kill cursors as soon as they are closed. Cursor ids
+    that couldn't be killed (e.g. because the connection was down) are
+    kept and killed with the next closed cursor, in the same message.
     """
 
     def __init__(self, connection):
@@ -34,6 +36,7 @@ class CursorManager(object):
           - `connection`: a Mongo Connection
         """
         self.__connection = weakref.ref(connection)
+        self._dying_cursors = []
 
     def close(self, cursor_id):
         """Close a cursor by killing it immediately.
@@ -46,7 +49,25 @@ class CursorManager(object):
         if not isinstance(cursor_id, int):
             raise TypeError("cursor_id must be an instance of int")
 
-        self.__connection().kill_cursors([cursor_id])
+        self._dying_cursors.append(cursor_id)
+        self.flush()
+
+    def flush(self):
+        """Kill every cursor waiting to be killed, in a single message.
+
+        .. versionadded:: 2.0+
+        """
+        if not self._dying_cursors:
+            return
+        connection = self.__connection()
+        if connection is None:
+            return
+        (cursor_ids, self._dying_cursors) = (self._dying_cursors, [])
+        try:
+            connection.kill_cursors(cursor_ids)
+        except:
+            self._dying_cursors = cursor_ids + self._dying_cursors
+            raise
 
 
 class BatchCursorManager(CursorManager):
@@ -59,16 +80,17 @@ class BatchCursorManager(CursorManager):
         :Parameters:
           - `connection`: a Mongo Connection
         """
-        self.__dying_cursors = []
         self.__max_dying_cursors = 20
-        self.__connection = weakref.ref(connection)
 
         CursorManager.__init__(self, connection)
 
     def __del__(self):
         """Cleanup - be sure to kill any outstanding cursors.
         """
-        self.__connection().kill_cursors(self.__dying_cursors)
+        try:
+            self.flush()
+        except Exception:
+            pass
 
     def close(self, cursor_id):
         """Close a cursor by killing it in a batch.
@@ -81,8 +103,7 @@ class BatchCursorManager(CursorManager):
         if not isinstance(cursor_id, int):
             raise TypeError("cursor_id must be an instance of int")
 
-        self.__dying_cursors.append(cursor_id)
+        self._dying_cursors.append(cursor_id)
 
-        if len(self.__dying_cursors) > self.__max_dying_cursors:
-            self.__connection().kill_cursors(self.__dying_cursors)
-            self.__dying_cursors = []
+        if len(self._dying_cursors) > self.__max_dying_cursors:
+            self.flush()
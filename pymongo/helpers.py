@@ -18,11 +18,20 @@ import hashlib
 import struct
 
 import bson
+from bson.errors import InvalidBSON
+from bson.raw_bson import RawBSONDocument
 from bson.son import SON
 import pymongo
+from pymongo import compression
 from pymongo.errors import (AutoReconnect,
+                            ConnectionFailure,
                             OperationFailure,
                             TimeoutError)
+try:
+    from pymongo import _cmessage
+    _use_c = True
+except ImportError:
+    _use_c = False
 
 
 def _index_list(key_or_list, direction=None):
@@ -67,7 +76,21 @@ def _index_document(index_list):
     return index
 
 
-def _unpack_response(response, cursor_id=None, as_class=dict, tz_aware=False):
+def _get_id(doc):
+    """Get the ``"_id"`` of a document being inserted, or ``None``.
+
+    `doc` may be pre-encoded (an instance of :class:`bytes`).
+    """
+    if isinstance(doc, bytes):
+        try:
+            return RawBSONDocument(doc).get("_id")
+        except InvalidBSON:
+            return None
+    return doc.get("_id", None)
+
+
+def _unpack_response(response, cursor_id=None, as_class=dict, tz_aware=False,
+                     lazy=False, validate=False):
     """Unpack a response from the database.
 
     Check the response for errors and unpack, returning a dictionary
@@ -79,6 +102,14 @@ def _unpack_response(response, cursor_id=None, as_class=dict, tz_aware=False):
         used for raising an informative exception when we get cursor id not
         valid at server response
       - `as_class` (optional): class to use for resulting documents
+      - `tz_aware` (optional): return timezone-aware datetimes
+      - `lazy` (optional): return the documents as an iterator
+        (from :func:`bson.decode_iter`) that decodes each one as it is
+        reached - the caller must check `number_returned` itself
+      - `validate` (optional): check the documents with
+        :func:`bson.validate_all` (which releases the GIL for a large
+        reply) before decoding them, so that decoding a :class:`bytes`
+        response can skip its own bounds checks - ignored if `lazy`
     """
     response_flag = struct.unpack("<i", response[:4])[0]
     if response_flag & 1:
@@ -98,9 +129,53 @@ def _unpack_response(response, cursor_id=None, as_class=dict, tz_aware=False):
     result["cursor_id"] = struct.unpack("<q", response[4:12])[0]
     result["starting_from"] = struct.unpack("<i", response[12:16])[0]
     result["number_returned"] = struct.unpack("<i", response[16:20])[0]
-    result["data"] = bson.decode_all(response[20:], as_class, tz_aware)
+    if lazy:
+        result["data"] = bson.decode_iter(response, as_class, tz_aware, 20)
+        return result
+    if validate:
+        bson.validate_all(response, 20)
+    result["data"] = bson.decode_all(response, as_class, tz_aware, 20)
     assert len(result["data"]) == result["number_returned"]
     return result
+if _use_c:
+    _unpack_response = _cmessage._unpack_response
+
+
+def _receive_message(sock, operation, request_id):
+    """Receive the reply to `request_id` on `sock`.
+
+    Each part of the message is read into memory of its final size with
+    `recv_into`, so nothing is copied or concatenated. Raises
+    ConnectionFailure if the connection is closed.
+
+    Returns the reply with the message header removed (and decompressed,
+    if the server compressed it).
+    """
+    header = bytearray(16)
+    _receive_into(sock, memoryview(header))
+    (length, _, response_to, response_operation) = struct.unpack("<iiii",
+                                                                 header)
+    assert request_id == response_to, \
+        "ids don't match %r %r" % (request_id, response_to)
+    assert response_operation in (operation, compression.OP_COMPRESSED)
+    if length < 16:
+        raise ConnectionFailure("invalid message length")
+
+    data = bytearray(length - 16)
+    _receive_into(sock, memoryview(data))
+    if response_operation != operation:
+        return compression.decompress(data, operation)
+    return data
+if _use_c:
+    _receive_message = _cmessage._receive_message
+
+
+def _receive_into(sock, view):
+    while len(view):
+        received = sock.recv_into(view)
+        if not received:
+            raise ConnectionFailure("connection closed")
+        view = view[received:]
 
 
 def _check_command_response(response, reset, msg="%s", allowable_errors=[]):
@@ -86,6 +86,14 @@ class MasterSlaveConnection(BaseObject):
     def tz_aware(self):
         return True
 
+    @property
+    def max_bson_size(self):
+        return self.__master.max_bson_size
+
+    @property
+    def max_message_size(self):
+        return self.__master.max_message_size
+
     def disconnect(self):
         """Disconnect from MongoDB.
 
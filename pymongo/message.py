@@ -32,6 +32,7 @@ try:
     _use_c = True
 except ImportError:
     _use_c = False
+from bson.errors import InvalidDocument
 from pymongo.errors import InvalidOperation
 
 
@@ -62,13 +63,38 @@ def __pack_message(operation, data):
     return (request_id, message + data)
 
 
-def insert(collection_name, docs, check_keys, safe, last_error_args):
+def _encode_document(doc, check_keys):
+    """Encode a document to be inserted.
+
+    A :class:`bytes` object (e.g. :class:`~bson.BSON`) is already
+    encoded: only its length and terminator are checked, and its key
+    names if `check_keys` is ``True``.
+    """
+    if not isinstance(doc, bytes):
+        return bson.BSON.encode(doc, check_keys)
+    if (len(doc) < 5 or struct.unpack("<i", doc[:4])[0] != len(doc) or
+        doc[-1] != 0):
+        raise InvalidDocument("invalid pre-encoded BSON document")
+    if check_keys:
+        try:
+            (decoded, _) = bson._bson_to_dict(doc, dict, False)
+        except Exception:
+            raise InvalidDocument("invalid pre-encoded BSON document")
+        bson.BSON.encode(decoded, True)
+    return doc
+
+
+def insert(collection_name, docs, check_keys, safe, last_error_args,
+           size_hint=0):
     """Get an **insert** message.
+
+    `size_hint` is the expected size of the message. It is only used
+    by the C extension, to allocate its buffer up front.
     """
     max_bson_size = 0
     data = __ZERO
     data += bson._make_c_string(collection_name)
-    encoded = [bson.BSON.encode(doc, check_keys) for doc in docs]
+    encoded = [_encode_document(doc, check_keys) for doc in docs]
     if not encoded:
         raise InvalidOperation("cannot do an empty bulk insert")
     max_bson_size = max(map(len, encoded))
@@ -84,6 +110,183 @@ if _use_c:
     insert = _cmessage._insert_message
 
 
+def __insert_message(data, safe, last_error_args):
+    """Pack an **insert** message, with a lastError message if `safe`.
+    """
+    (request_id, insert_message) = __pack_message(2002, data)
+    if safe:
+        (request_id, error_message, _) = __last_error(last_error_args)
+        return (request_id, insert_message + error_message)
+    return (request_id, insert_message)
+
+
+def insert_batches(collection_name, docs, check_keys, safe, last_error_args,
+                   max_bson_size, max_message_size, size_hint=0):
+    """Get a list of **insert** messages for `docs`.
+
+    The documents are split between as many messages as needed to keep
+    each one within `max_message_size` bytes (a single document larger
+    than that is still sent on its own). Each message has its own
+    request id and, if `safe`, its own lastError message.
+
+    `size_hint` is the expected size of the first message. Like the
+    `size_hint` for :func:`insert` it is only used by the C extension.
+    """
+    try:
+        docs = iter(docs)
+    except TypeError:
+        raise InvalidOperation("input is not iterable")
+    prefix = __ZERO + bson._make_c_string(collection_name)
+    messages = []
+    batch = []
+    size = 16 + len(prefix)
+    for doc in docs:
+        encoded = _encode_document(doc, check_keys)
+        if len(encoded) > max_bson_size:
+            raise InvalidDocument("BSON document too large (%d bytes)"
+                                  " - the connected server supports"
+                                  " BSON document sizes up to %d"
+                                  " bytes." % (len(encoded), max_bson_size))
+        if batch and size + len(encoded) > max_message_size:
+            messages.append(__insert_message(prefix + b"".join(batch),
+                                             safe, last_error_args))
+            batch = []
+            size = 16 + len(prefix)
+        batch.append(encoded)
+        size += len(encoded)
+    if not batch:
+        raise InvalidOperation("cannot do an empty bulk insert")
+    messages.append(__insert_message(prefix + b"".join(batch),
+                                     safe, last_error_args))
+    return messages
+if _use_c:
+    insert_batches = _cmessage._insert_batches
+
+
+def _bulk_message(operation, collection_name, data):
+    """Pack a message for `operation` on `collection_name`, with `data`
+    following the collection name.
+    """
+    return __pack_message(operation, __ZERO +
+                          bson._make_c_string(collection_name) + data)
+
+
+def _bulk_last_error(args):
+    """Get a (request_id, data) lastError message.
+    """
+    return __last_error(args)[:2]
+
+
+class _BulkBuffer(object):
+    """Write messages packed back to back, to be sent together.
+
+    Consecutive inserts into the same collection share a message, split
+    to keep each message within `max_message_size` bytes.
+    """
+
+    def __init__(self, max_bson_size, max_message_size):
+        self.__max_bson_size = max_bson_size
+        self.__max_message_size = max_message_size
+        self.__messages = []
+        self.__count = 0
+        # (collection name, encoded documents, size) of the last
+        # message, if it is an insert
+        self.__insert = None
+
+    @property
+    def count(self):
+        return self.__count
+
+    def __len__(self):
+        size = sum(len(data) for (_, data) in self.__messages)
+        if self.__insert:
+            size += self.__insert[2]
+        return size
+
+    def __close_insert(self):
+        if self.__insert:
+            (collection_name, encoded, _) = self.__insert
+            self.__messages.append(_bulk_message(2002, collection_name,
+                                                 b"".join(encoded)))
+            self.__insert = None
+
+    def __encode(self, doc, check_keys=False, insert=False):
+        if insert:
+            encoded = _encode_document(doc, check_keys)
+        else:
+            encoded = bson.BSON.encode(doc, check_keys)
+        if len(encoded) > self.__max_bson_size:
+            raise InvalidDocument("BSON document too large (%d bytes)"
+                                  " - the connected server supports"
+                                  " BSON document sizes up to %d"
+                                  " bytes." % (len(encoded),
+                                               self.__max_bson_size))
+        return encoded
+
+    def insert(self, collection_name, docs, check_keys):
+        try:
+            docs = iter(docs)
+        except TypeError:
+            raise InvalidOperation("input is not iterable")
+        encoded = [self.__encode(doc, check_keys, True) for doc in docs]
+        if not encoded:
+            raise InvalidOperation("cannot do an empty bulk insert")
+        if self.__insert and self.__insert[0] != collection_name:
+            self.__close_insert()
+        header_size = 16 + len(bson._make_c_string(collection_name)) + 4
+        for doc in encoded:
+            if (self.__insert and self.__insert[1] and
+                self.__insert[2] + len(doc) > self.__max_message_size):
+                self.__close_insert()
+            if not self.__insert:
+                self.__insert = (collection_name, [], header_size)
+            self.__insert[1].append(doc)
+            self.__insert = (collection_name, self.__insert[1],
+                             self.__insert[2] + len(doc))
+        self.__count += len(encoded)
+
+    def update(self, collection_name, upsert, multi, spec, doc):
+        data = (struct.pack("<i", upsert + 2 * multi) +
+                self.__encode(spec) + self.__encode(doc))
+        self.__close_insert()
+        self.__messages.append(_bulk_message(2001, collection_name, data))
+        self.__count += 1
+
+    def delete(self, collection_name, spec):
+        data = struct.pack("<i", 0) + self.__encode(spec)
+        self.__close_insert()
+        self.__messages.append(_bulk_message(2006, collection_name, data))
+        self.__count += 1
+
+    def finish(self, safe, last_error_args):
+        if not self.__count:
+            return None
+        last_error = safe and [_bulk_last_error(last_error_args)] or []
+        self.__close_insert()
+        messages = self.__messages + last_error
+        self.__messages = []
+        self.__count = 0
+        return (messages[-1][0], b"".join(data for (_, data) in messages))
+
+
+def bulk_buffer(max_bson_size, max_message_size):
+    """Get a buffer to pack many **insert**, **update** and **delete**
+    messages into, to send them together.
+
+    Operations are added with the buffer's ``insert(collection_name,
+    docs, check_keys)``, ``update(collection_name, upsert, multi, spec,
+    doc)`` and ``delete(collection_name, spec)`` methods. Its ``count``
+    is the number of documents inserted plus the number of updates and
+    deletes, and its length is the size of the buffered messages.
+    ``finish(safe, last_error_args)`` empties it, returning all the
+    messages (and a single trailing lastError message, if `safe`) as a
+    ``(request_id, data)`` pair, or ``None`` if it is empty.
+    """
+    return _BulkBuffer(max_bson_size, max_message_size)
+if _use_c:
+    bulk_buffer = _cmessage._bulk_buffer
+
+
 def update(collection_name, upsert, multi, spec, doc, safe, last_error_args):
     """Get an **update** message.
     """
@@ -158,6 +361,8 @@ def delete(collection_name, spec, safe, last_error_args):
     else:
         (request_id, remove_message) = __pack_message(2006, data)
         return (request_id, remove_message, len(encoded))
+if _use_c:
+    delete = _cmessage._delete_message
 
 
 def kill_cursors(cursor_ids):
@@ -168,3 +373,27 @@ def kill_cursors(cursor_ids):
     for cursor_id in cursor_ids:
         data += struct.pack("<q", cursor_id)
     return __pack_message(2007, data)
+if _use_c:
+    kill_cursors = _cmessage._kill_cursors_message
+
+
+def stats(reset=False):
+    """Get the counters the C extension keeps while building messages.
+
+    Returns a dict with the number of byte strings built to be sent
+    (``messages``, each holding one or more messages) and their total
+    size (``message_bytes``), the number and size of the replies
+    unpacked (``replies`` and ``reply_bytes``), and ``buffer_grows`` and
+    ``buffer_peak_size`` as in :func:`bson.codec_stats` (the buffers are
+    shared with :mod:`bson`, so these count the buffers of both
+    extensions). Returns ``None`` without the C extension.
+
+    :Parameters:
+      - `reset` (optional): if ``True``, set every counter back to zero
+        after reading them
+
+    .. versionadded:: 2.0+
+    """
+    if _use_c:
+        return _cmessage.stats(reset)
+    return None
@@ -27,6 +27,10 @@ class SONManipulator(object):
     """A base son manipulator.
 
     This manipulator just saves and restores objects without changing them.
+
+    To store values of custom types, :func:`bson.register_encoder` and
+    :func:`bson.register_decoder` are cheaper than a manipulator that
+    walks every document.
     """
 
     def will_copy(self):
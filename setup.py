@@ -124,13 +124,11 @@ c_ext = Feature(
     ext_modules=[Extension('bson._cbson',
                            include_dirs=['bson'],
                            sources=['bson/_cbsonmodule.c',
-                                    'bson/time64.c',
                                     'bson/buffer.c',
                                     'bson/encoding_helpers.c']),
                  Extension('pymongo._cmessage',
                            include_dirs=['bson'],
-                           sources=['pymongo/_cmessagemodule.c',
-                                    'bson/buffer.c'])])
+                           sources=['pymongo/_cmessagemodule.c'])])
 
 if "--no_ext" in sys.argv:
     sys.argv = [x for x in sys.argv if x != "--no_ext"]
@@ -19,7 +19,11 @@
 import unittest
 import datetime
 import re
+import os
+import struct
 import sys
+import tempfile
+import threading
 try:
     import uuid
     should_test_uuid = True
@@ -37,9 +41,11 @@ from bson.binary import Binary
 from bson.code import Code
 from bson.objectid import ObjectId
 from bson.dbref import DBRef
+from bson.raw_bson import RawBSONDocument
 from bson.son import SON
 from bson.timestamp import Timestamp
-from bson.errors import (InvalidDocument,
+from bson.errors import (InvalidBSON,
+                         InvalidDocument,
                          InvalidStringData)
 from bson.max_key import MaxKey
 from bson.min_key import MinKey
@@ -86,6 +92,168 @@ class TestBSON(unittest.TestCase):
                                     b"\x77\x6F\x72\x6C\x64\x00\x00\x05\x00\x00"
                                     b"\x00\x00"))
 
+    def test_decode_all_buffer(self):
+        data = BSON.encode({"a": 1}) + BSON.encode({"b": "c"})
+        expected = [{"a": 1}, {"b": "c"}]
+        self.assertEqual(expected, decode_all(bytearray(data)))
+        self.assertEqual(expected, decode_all(memoryview(data)))
+        self.assertEqual(expected[1:], decode_all(data, dict, True, 12))
+        self.assertEqual([], decode_all(data, dict, True, len(data)))
+        self.assertEqual(expected[1:],
+                         decode_all(b"\x00" * 20 + data, dict, True, 32))
+        self.assertRaises(ValueError, decode_all, data, dict, True, -1)
+        self.assertRaises(ValueError, decode_all, data, dict, True, 100)
+        self.assertRaises(InvalidBSON, decode_all, data, dict, True, 1)
+        self.assertRaises(TypeError, decode_all, "not bytes")
+
+    def test_decode_all_fields(self):
+        doc = SON([("_id", 1),
+                   ("a", SON([("b", 2), ("c", {"d": 3, "e": 4})])),
+                   ("f", [{"g": 5}]),
+                   ("r", DBRef("coll", 6)),
+                   ("z", re.compile("x"))])
+        data = BSON.encode(doc) + BSON.encode({"x": 1})
+
+        def decode(fields):
+            return decode_all(data, SON, True, 0, fields)
+
+        self.assertEqual([{}, {}], decode([]))
+        self.assertEqual([{"_id": 1}, {}], decode(["_id"]))
+        self.assertEqual([{"a": {"c": {"e": 4}}, "f": [{"g": 5}]}, {}],
+                         decode(["a.c.e", "f.g"]))
+        self.assertEqual([{"a": doc["a"]}, {}], decode(["a.b", "a"]))
+        self.assertEqual([{"a": doc["a"]}, {}], decode(["a", "a.b"]))
+        self.assertEqual([{"r": doc["r"]}, {"x": 1}],
+                         decode_all(data, dict, True, 0, ["r.$id", "x"]))
+        self.assertEqual(["_id", "z"], list(decode(["z", "_id"])[0]))
+        self.assertRaises(TypeError, decode, [1])
+        self.assertRaises(TypeError, decode, 1)
+
+    def test_decode_iter(self):
+        docs = [{"a": 1}, {"b": "c"}, {"d": [{"e": 2}]}]
+        data = b"".join(BSON.encode(doc) for doc in docs)
+        self.assertEqual(docs, list(bson.decode_iter(data)))
+        self.assertEqual(docs, list(bson.decode_iter(bytearray(data))))
+        self.assertEqual(docs[1:], list(bson.decode_iter(memoryview(data),
+                                                         dict, True, 12)))
+        self.assertEqual([{}, {"d": [{"e": 2}]}],
+                         list(bson.decode_iter(data, SON, True, 12, ["d"])))
+        self.assertEqual([], list(bson.decode_iter(data, dict, True,
+                                                   len(data))))
+        self.assertRaises(ValueError, bson.decode_iter, data, dict, True, -1)
+        self.assertRaises(TypeError, bson.decode_iter, "not bytes")
+
+        iterator = bson.decode_iter(data + b"\x05\x00\x00\x00\x01")
+        self.assertTrue(iter(iterator) is iterator)
+        self.assertEqual(docs, [next(iterator) for _ in docs])
+        self.assertRaises(InvalidBSON, next, iterator)
+        self.assertRaises(StopIteration, next, iterator)
+
+        # Documents are decoded as they are reached.
+        iterator = bson.decode_iter(data[:-1])
+        self.assertEqual(docs[0], next(iterator))
+        self.assertEqual(docs[1], next(iterator))
+        self.assertRaises(InvalidBSON, next, iterator)
+
+    def test_decode_file_iter(self):
+        docs = [{"a": 1}, {"b": "c"}, {"d": [{"e": 2}]}]
+        (fd, path) = tempfile.mkstemp()
+        try:
+            os.close(fd)
+            self.assertEqual([], list(bson.decode_file_iter(path)))
+
+            with open(path, "wb") as f:
+                for doc in docs:
+                    f.write(BSON.encode(doc))
+            self.assertEqual(docs, list(bson.decode_file_iter(path)))
+            self.assertEqual([{}, {}, {"d": [{"e": 2}]}],
+                             list(bson.decode_file_iter(path, SON, True,
+                                                        ["d"])))
+            raw = list(bson.decode_file_iter(path, RawBSONDocument))
+            self.assertEqual([BSON.encode(doc) for doc in docs],
+                             [doc.raw for doc in raw])
+
+            # Closing the iterator early releases the file.
+            iterator = bson.decode_file_iter(path)
+            self.assertEqual(docs[0], next(iterator))
+            iterator.close()
+            self.assertRaises(StopIteration, next, iterator)
+
+            with open(path, "ab") as f:
+                f.write(b"\x05\x00\x00\x00\x01")
+            iterator = bson.decode_file_iter(path)
+            self.assertEqual(docs, [next(iterator) for _ in docs])
+            self.assertRaises(InvalidBSON, next, iterator)
+
+            self.assertRaises(IOError, list,
+                              bson.decode_file_iter(path + ".missing"))
+        finally:
+            os.remove(path)
+
+    def test_validate_all(self):
+        doc = SON([("s", "\u00e9"), ("d", {"a": [1, 2.5, None]}),
+                   ("r", re.compile("\u00e9", re.I)),
+                   ("c", Code("x", {"y": 1})), ("b", Binary(b"\x00")),
+                   ("o", ObjectId()), ("t", Timestamp(1, 2)),
+                   ("z", DBRef("coll", 1)), ("m", MinKey())])
+        data = BSON.encode(doc) + BSON.encode({})
+        self.assertEqual(2, bson.validate_all(data))
+        self.assertEqual(2, bson.validate_all(bytearray(data)))
+        self.assertEqual(1, bson.validate_all(memoryview(data),
+                                              len(data) - 5))
+        self.assertEqual(0, bson.validate_all(b""))
+        self.assertEqual(2000, bson.validate_all(data * 1000))
+        self.assertRaises(ValueError, bson.validate_all, data, -1)
+        self.assertRaises(ValueError, bson.validate_all, data, len(data) + 1)
+        self.assertRaises(TypeError, bson.validate_all, "not bytes")
+
+        for bad in [b"\x05\x00\x00\x00", b"\x04\x00\x00\x00\x00",
+                    b"\x05\x00\x00\x00\x01",
+                    b"\x07\x00\x00\x00\x02a\x00\x78\x56\x34\x12",
+                    b"\x09\x00\x00\x00\x10a\x00\x05\x00",
+                    b"\x0c\x00\x00\x00\x02a\x00\x01\x00\x00\x00\x01\x00",
+                    b"\x0e\x00\x00\x00\x02a\x00\x02\x00\x00\x00\xff\x00\x00",
+                    b"\x0c\x00\x00\x00\x0ba\xff\x00b\x00\x00\x00",
+                    b"\x0c\x00\x00\x00\x0ba\x00\xed\xa0\x00\x00\x00",
+                    b"\x0b\x00\x00\x00\x03a\x00\x05\x00\x00\x00\x00",
+                    BSON.encode({"a": 1})[:-1] + b"\x01",
+                    data[:-1]]:
+            self.assertRaises(InvalidBSON, bson.validate_all, bad)
+            self.assertRaises(InvalidBSON, bson.validate_all, data + bad)
+            self.assertFalse(is_valid(bad))
+
+        deep = b"\x05\x00\x00\x00\x00"
+        for _ in range(300):
+            deep = (struct.pack("<i", len(deep) + 8) + b"\x03a\x00" +
+                    deep + b"\x00")
+        self.assertRaises((InvalidBSON, RecursionError),
+                          bson.validate_all, deep)
+
+    def test_validate_all_threads(self):
+        data = BSON.encode({"x": "y" * 1000, "z": list(range(100))}) * 1000
+        results = []
+
+        def validate():
+            results.append(bson.validate_all(data))
+
+        threads = [threading.Thread(target=validate) for _ in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual([1000] * 4, results)
+
+    def test_decoded_keys_are_shared(self):
+        if not bson.has_c():
+            raise SkipTest()
+        long_key = "k" * 100
+        docs = decode_all(BSON.encode({"key": 1, long_key: 2, "é": 3}) * 2)
+        self.assertEqual(docs[0], docs[1])
+        (first, second) = [sorted(doc) for doc in docs]
+        self.assertTrue(first[0] is second[0])
+        self.assertTrue(first[2] is second[2])
+        self.assertEqual(long_key, first[1])
+
     def test_data_timestamp(self):
         self.assertEqual({"test": Timestamp(4, 20)},
                          BSON(b"\x13\x00\x00\x00\x11\x74\x65\x73\x74\x00\x14"
@@ -209,6 +377,21 @@ class TestBSON(unittest.TestCase):
         dt2 = BSON.encode({"date": dt1}).decode()["date"]
         self.assertEqual(dt1, dt2)
 
+    def test_datetime_millis(self):
+        epoch = datetime.datetime(1970, 1, 1)
+        for millis in (0, 1, -1, 999, -999, -1000, -1001, 86399999,
+                       -86400001, 951782400000, 951868799999, 4107456000000,
+                       -2203891200000, -62135596800000, 253402300799999):
+            data = BSON(b"\x10\x00\x00\x00\x09d\x00" +
+                        struct.pack("<q", millis) + b"\x00")
+            expected = epoch + datetime.timedelta(milliseconds=millis)
+            self.assertEqual(expected, data.decode()["d"])
+            aware = data.decode(tz_aware=True)["d"]
+            self.assertEqual(expected.replace(tzinfo=utc), aware)
+            self.assertTrue(aware.tzinfo is utc)
+            self.assertEqual(data, BSON.encode({"d": expected}))
+            self.assertEqual(data, BSON.encode({"d": aware}))
+
     def test_aware_datetime(self):
         aware = datetime.datetime(1993, 4, 4, 2,
                                   tzinfo=FixedOffset(555, "SomeZone"))
@@ -251,10 +434,42 @@ class TestBSON(unittest.TestCase):
         self.assertRaises(OverflowError, BSON.encode,
                           {"x": -9223372036854775809})
 
+    def test_objectid(self):
+        oid = ObjectId()
+        decoded = BSON.encode({"_id": oid}).decode()["_id"]
+        self.assertEqual(oid, decoded)
+        self.assertTrue(type(decoded) is ObjectId)
+        self.assertEqual(b"\x16\x00\x00\x00\x07_id\x00" + oid.binary + b"\x00",
+                         BSON.encode({"_id": oid}))
+
+        # DBPointer
+        oid = ObjectId(b"\xff" * 12)
+        element = (b"\x0Cp\x00" + struct.pack("<i", 5) + b"coll\x00" +
+                   oid.binary)
+        data = struct.pack("<i", len(element) + 5) + element + b"\x00"
+        self.assertEqual({"p": DBRef("coll", oid)}, BSON(data).decode())
+
     def test_tuple(self):
         self.assertEqual({"tuple": [1, 2]},
                           BSON.encode({"tuple": (1, 2)}).decode())
 
+    def test_size_hint(self):
+        doc = SON([("a", "x" * 1000), ("_id", 1)])
+        encoded = BSON.encode(doc)
+        for hint in (0, 1, len(encoded), 10 * len(encoded)):
+            self.assertEqual(encoded, bson._dict_to_bson(doc, False, True,
+                                                         hint))
+        self.assertEqual(b"\x02a", bson._dict_to_bson(doc, False, False)[4:6])
+
+    def test_array_keys(self):
+        items = list(range(12345))
+        encoded = BSON.encode({"a": items})
+        self.assertEqual({"a": items}, encoded.decode())
+        for i in (0, 9, 10, 99, 100, 101, 999, 1000, 12344):
+            self.assertTrue(b"\x10" + str(i).encode() + b"\x00" +
+                            struct.pack("<i", i) in encoded)
+        self.assertEqual({"a": []}, BSON.encode({"a": ()}).decode())
+
     def test_uuid(self):
         if not should_test_uuid:
             raise SkipTest()
@@ -272,6 +487,72 @@ class TestBSON(unittest.TestCase):
         regex = re.compile('revisi\xf3n')
         BSON.encode({"regex": regex}).decode()
 
+    def test_regex_cache(self):
+        data = BSON.encode({"a": re.compile("ab+c"),
+                            "b": re.compile("ab+c", re.I),
+                            "c": re.compile("ab+c", re.I | re.M),
+                            "d": re.compile("ab")})
+        first = data.decode()
+        re.purge()
+        second = data.decode()
+        self.assertEqual("ab+c", first["c"].pattern)
+        self.assertEqual(re.I | re.M, first["c"].flags & (re.I | re.M))
+        self.assertEqual(4, len(set(id(r) for r in first.values())))
+        if not bson.has_c():
+            raise SkipTest()
+        for key in first:
+            self.assertTrue(first[key] is second[key])
+
+        bson.set_regex_caching(False)
+        try:
+            re.purge()
+            self.assertFalse(first["a"] is data.decode()["a"])
+        finally:
+            bson.set_regex_caching(True)
+
+    def test_codec_stats(self):
+        if not bson.has_c():
+            self.assertEqual(None, bson.codec_stats())
+            raise SkipTest()
+
+        class MyCode(Code):
+            pass
+
+        bson.codec_stats(True)
+        data = BSON.encode({"a": 1, "b": ["x", 2 ** 40], "c": {"d": 1.5}})
+        stats = bson.codec_stats(True)
+        self.assertEqual(1, stats["documents_encoded"])
+        self.assertEqual(len(data), stats["bytes_encoded"])
+        self.assertEqual({0x01: 1, 0x02: 1, 0x03: 1, 0x04: 1, 0x10: 1,
+                          0x12: 1}, stats["elements_encoded"])
+        self.assertEqual(0, stats["isinstance_checks"])
+        self.assertEqual(0, stats["documents_decoded"])
+
+        bson.decode_all(data + data)
+        stats = bson.codec_stats()
+        self.assertEqual(2, stats["documents_decoded"])
+        self.assertEqual(2 * len(data), stats["bytes_decoded"])
+        self.assertEqual({0x01: 2, 0x02: 2, 0x03: 2, 0x04: 2, 0x10: 2,
+                          0x12: 2}, stats["elements_decoded"])
+        self.assertEqual(0, stats["documents_encoded"])
+        self.assertEqual({}, stats["elements_encoded"])
+
+        BSON.encode({"code": MyCode("x")})
+        stats = bson.codec_stats()
+        self.assertTrue(stats["isinstance_checks"] > 0)
+        self.assertEqual(1, stats["isinstance_hits"])
+        self.assertEqual({0x0F: 1}, stats["elements_encoded"])
+
+        self.assertRaises(InvalidDocument, BSON(b"\x08\x00\x00\x00\x20"
+                                                b"a\x00\x00").decode)
+        self.assertEqual(1, bson.codec_stats()["no_decoder"])
+
+        BSON.encode({"a": "x" * 10000})
+        stats = bson.codec_stats(True)
+        self.assertTrue(stats["buffer_grows"] > 0)
+        self.assertTrue(stats["buffer_peak_size"] > 10000)
+        self.assertEqual(0, bson.codec_stats()["buffer_grows"])
+
     def test_non_string_keys(self):
         self.assertRaises(InvalidDocument, BSON.encode, {8.9: "test"})
 
@@ -305,6 +586,28 @@ class TestBSON(unittest.TestCase):
         self.assertRaises(InvalidDocument, BSON.encode,
                           {"a": re.compile("ab\x00c")})
 
+    def test_long_key_and_pattern_validation(self):
+        # Offsets on and around block boundaries of the ASCII fast path.
+        for length in (0, 1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 100):
+            prefix = "a" * length
+            doc = {prefix + "é€" + prefix: 1}
+            self.assertEqual(doc, BSON.encode(doc).decode())
+            self.assertRaises(InvalidDocument, BSON.encode,
+                              {prefix + "\x00" + prefix: 1})
+            self.assertRaises(InvalidDocument, BSON.encode,
+                              {prefix + "é\x00": 1})
+
+            pattern = prefix.encode() + b"\xc3\xa9" + prefix.encode()
+            doc = {"r": re.compile(pattern)}
+            self.assertEqual(pattern,
+                             BSON.encode(doc).decode()["r"].pattern.encode())
+            self.assertRaises(InvalidStringData, BSON.encode,
+                              {"r": re.compile(prefix.encode() + b"\xff")})
+            self.assertRaises(InvalidStringData, BSON.encode,
+                              {"r": re.compile(prefix.encode() + b"\xc3")})
+            self.assertRaises(InvalidDocument, BSON.encode,
+                              {"r": re.compile(prefix.encode() + b"\x00")})
+
     def test_move_id(self):
         self.assertEqual(b"\x19\x00\x00\x00\x02_id\x00\x02\x00\x00\x00a\x00"
                          b"\x02a\x00\x02\x00\x00\x00a\x00\x00",
@@ -362,6 +665,134 @@ class TestBSON(unittest.TestCase):
             self.assertEqual(type(value), orig_type)
             self.assertEqual(value, orig_type(value))
 
+    def test_bson_type_subclasses(self):
+        class _myobjectid(ObjectId):
+            pass
+
+        class _mybinary(Binary):
+            pass
+
+        class _mycode(Code):
+            pass
+
+        class _mytimestamp(Timestamp):
+            pass
+
+        oid = ObjectId()
+        d = {"a": _myobjectid(oid), "b": _mybinary(b"xyz", 5),
+             "c": _mycode("return 1", {"x": 1}), "d": _mytimestamp(4, 2)}
+        expected = {"a": oid, "b": Binary(b"xyz", 5),
+                    "c": Code("return 1", {"x": 1}), "d": Timestamp(4, 2)}
+        self.assertEqual(BSON.encode(expected), BSON.encode(d))
+        self.assertEqual(expected, BSON.encode(d).decode())
+
+    def test_son_order(self):
+        items = [("z", 1), ("a", SON([("y", 2), ("b", 3)])), ("m", [4])]
+        expected = (b"\x10z\x00\x01\x00\x00\x00"
+                    b"\x03a\x00\x13\x00\x00\x00"
+                    b"\x10y\x00\x02\x00\x00\x00"
+                    b"\x10b\x00\x03\x00\x00\x00\x00"
+                    b"\x04m\x00\x0c\x00\x00\x00"
+                    b"\x100\x00\x04\x00\x00\x00\x00")
+        expected = struct.pack("<i", len(expected) + 5) + expected + b"\x00"
+        self.assertEqual(expected, BSON.encode(SON(items)))
+
+        son = SON(items)
+        del son["z"]
+        son["z"] = 1
+        self.assertEqual(["a", "m", "z"],
+                         list(BSON.encode(son).decode(as_class=SON).keys()))
+
+        # Subclasses of SON are iterated in their own order
+        class ReversedSON(SON):
+            def keys(self):
+                return reversed(list(SON.keys(self)))
+
+            def items(self):
+                return [(key, self[key]) for key in self.keys()]
+        self.assertEqual(["m", "a", "z"],
+                         list(BSON.encode(ReversedSON(items))
+                              .decode(as_class=SON).keys()))
+
+        self.assertRaises(InvalidDocument, BSON.encode,
+                          SON([("a", 1), (1, 2)]))
+        self.assertRaises(InvalidDocument, BSON.encode, SON([("$a", 1)]),
+                          True)
+
+    def test_custom_types(self):
+        class Money(object):
+            def __init__(self, cents):
+                self.cents = cents
+
+            def __eq__(self, other):
+                return isinstance(other, Money) and other.cents == self.cents
+
+        bson.register_encoder(Money, lambda m: Binary(struct.pack("<q",
+                                                                  m.cents),
+                                                      0x80))
+        bson.register_decoder(5, lambda b: Money(struct.unpack("<q", b)[0]),
+                              0x80)
+        bson.register_decoder(16, lambda i: i * 10)
+        try:
+            doc = {"price": Money(250), "items": [Money(1), 2],
+                   "other": Binary(b"x", 0x81), "n": 3}
+            encoded = BSON.encode(doc)
+            self.assertEqual(BSON.encode({"price": Binary(struct.pack(
+                "<q", 250), 0x80), "items": [Binary(struct.pack("<q", 1),
+                                                    0x80), 2],
+                                          "other": Binary(b"x", 0x81),
+                                          "n": 3}), encoded)
+            self.assertEqual({"price": Money(250), "items": [Money(1), 20],
+                              "other": Binary(b"x", 0x81), "n": 30},
+                             encoded.decode())
+            self.assertEqual(Money(250),
+                             RawBSONDocument(encoded)["price"])
+
+            # Only the exact type is encoded specially
+            class MoreMoney(Money):
+                pass
+            self.assertRaises(InvalidDocument, BSON.encode,
+                              {"x": MoreMoney(1)})
+
+            # Columns hold the BSON values themselves
+            self.assertEqual([3], bson.decode_all_columnar(
+                encoded, ["n"])["n"].values.tolist())
+        finally:
+            bson.register_encoder(Money, None)
+            bson.register_decoder(5, None, 0x80)
+            bson.register_decoder(16, None)
+
+        self.assertRaises(InvalidDocument, BSON.encode, {"x": Money(1)})
+        self.assertEqual(3, encoded.decode()["n"])
+        bson.register_decoder(16, None)
+
+        self.assertRaises(TypeError, bson.register_encoder, "int", str)
+        self.assertRaises(TypeError, bson.register_encoder, int, 5)
+        self.assertRaises(ValueError, bson.register_decoder, 0, str)
+        self.assertRaises(ValueError, bson.register_decoder, 256, str)
+        self.assertRaises(ValueError, bson.register_decoder, 2, str, 0)
+        self.assertRaises(ValueError, bson.register_decoder, 5, str, 256)
+        self.assertRaises(TypeError, bson.register_decoder, 2, 5)
+
+    def test_custom_type_errors(self):
+        def fail(value):
+            raise ZeroDivisionError()
+
+        class Thing(object):
+            pass
+
+        bson.register_encoder(Thing, fail)
+        bson.register_decoder(2, fail)
+        try:
+            self.assertRaises(ZeroDivisionError, BSON.encode,
+                              {"x": Thing()})
+            self.assertRaises(ZeroDivisionError,
+                              BSON.encode({"x": "y"}).decode)
+        finally:
+            bson.register_encoder(Thing, None)
+            bson.register_decoder(2, None)
+        self.assertEqual({"x": "y"}, BSON.encode({"x": "y"}).decode())
+
     def test_ordered_dict(self):
         try:
             from collections import OrderedDict
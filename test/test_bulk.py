@@ -0,0 +1,154 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Test the bulk module."""
+
+import struct
+import unittest
+import sys
+sys.path[0:0] = [""]
+
+from bson import BSON
+from bson.errors import InvalidDocument
+from pymongo.bulk import BulkWriter
+
+
+class FakeConnection(object):
+
+    max_bson_size = 4 * 1024 * 1024
+    max_message_size = 8 * 1024 * 1024
+
+    def __init__(self):
+        self.sent = []
+
+    def _send_message(self, message, with_last_error=False):
+        (request_id, data) = message
+        operations = []
+        while data:
+            (length, _, _, operation) = struct.unpack("<iiii", data[:16])
+            operations.append(operation)
+            data = data[length:]
+        self.sent.append((operations, with_last_error))
+        if with_last_error:
+            return {"ok": 1, "err": None}
+
+
+class FakeDatabase(object):
+
+    def __init__(self):
+        self.connection = FakeConnection()
+
+    def _fix_incoming(self, doc, collection):
+        doc.setdefault("_id", len(self.connection.sent))
+        return doc
+
+
+class FakeCollection(object):
+
+    full_name = "db.test"
+
+    def __init__(self, safe=False):
+        self.database = FakeDatabase()
+        self.safe = safe
+
+    def get_lasterror_options(self):
+        return {}
+
+
+class TestBulkWriter(unittest.TestCase):
+
+    def test_flush(self):
+        collection = FakeCollection()
+        sent = collection.database.connection.sent
+        writer = BulkWriter(collection)
+        self.assertEqual(None, writer.flush())
+
+        self.assertEqual(0, writer.insert({"x": 1}))
+        self.assertEqual([1, 2], writer.insert([{"_id": 1}, {"_id": 2}]))
+        self.assertEqual([None], writer.insert([{}], manipulate=False))
+        writer.update({"_id": 1}, {"$set": {"x": 2}})
+        writer.remove(2)
+        self.assertEqual(6, writer.pending)
+        self.assertEqual([], sent)
+
+        self.assertEqual(None, writer.flush())
+        self.assertEqual(0, writer.pending)
+        self.assertEqual([([2002, 2001, 2006], False)], sent)
+
+    def test_pre_encoded(self):
+        collection = FakeCollection()
+        writer = BulkWriter(collection)
+        self.assertEqual(5, writer.insert(BSON.encode({"_id": 5})))
+        self.assertEqual([None, 0],
+                         writer.insert([BSON.encode({"x": 1}), {"y": 2}]))
+        self.assertRaises(InvalidDocument, writer.insert, b"\x05\x00")
+        self.assertRaises(InvalidDocument, writer.insert,
+                          BSON.encode({"$x": 1}))
+        self.assertEqual(3, writer.pending)
+
+    def test_thresholds(self):
+        collection = FakeCollection()
+        sent = collection.database.connection.sent
+        writer = BulkWriter(collection, max_ops=10)
+        for i in range(25):
+            writer.insert({"i": i})
+        self.assertEqual(2, len(sent))
+        self.assertEqual(5, writer.pending)
+
+        writer = BulkWriter(collection, max_bytes=1000)
+        for i in range(25):
+            writer.update({"i": i}, {"$inc": {"n": 1}})
+        self.assertEqual(3, len(sent))
+        self.assertEqual(25 - writer.pending, len(sent[2][0]))
+
+    def test_safe(self):
+        collection = FakeCollection(safe=True)
+        sent = collection.database.connection.sent
+        with BulkWriter(collection) as writer:
+            writer.remove()
+            writer.remove({"x": 1})
+        self.assertEqual([([2006, 2006, 2004], True)], sent)
+
+        collection = FakeCollection()
+        sent = collection.database.connection.sent
+        writer = BulkWriter(collection, w=2)
+        writer.insert({})
+        self.assertEqual({"ok": 1, "err": None}, writer.flush())
+        self.assertEqual([([2002, 2004], True)], sent)
+
+    def test_errors(self):
+        collection = FakeCollection()
+        sent = collection.database.connection.sent
+        writer = BulkWriter(collection)
+        self.assertRaises(TypeError, writer.update, [], {})
+        self.assertRaises(TypeError, writer.update, {}, [])
+        self.assertRaises(TypeError, writer.update, {}, {}, 1)
+        self.assertRaises(InvalidDocument, writer.insert, {"$x": 1})
+
+        try:
+            with writer:
+                writer.insert({"x": 1})
+                raise ValueError()
+        except ValueError:
+            pass
+        self.assertEqual([], sent)
+        self.assertEqual(1, writer.pending)
+
+        writer = BulkWriter(collection, check_keys=False)
+        writer.insert({"$x": 1})
+        self.assertEqual(1, writer.pending)
+
+
+if __name__ == "__main__":
+    unittest.main()
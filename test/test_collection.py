@@ -27,9 +27,11 @@ from nose.plugins.skip import SkipTest
 
 sys.path[0:0] = [""]
 
+from bson import BSON
 from bson.binary import Binary
 from bson.code import Code
 from bson.objectid import ObjectId
+from bson.raw_bson import RawBSONDocument
 from bson.son import SON
 from pymongo import ASCENDING, DESCENDING
 from pymongo.collection import Collection
@@ -480,6 +482,57 @@ class TestCollection(unittest.TestCase):
 
         self.assertRaises(InvalidOperation, db.test.insert, [])
 
+    def test_insert_pre_encoded(self):
+        db = self.db
+        db.drop_collection("test")
+        oid = ObjectId()
+        self.assertEqual(oid, db.test.insert(BSON.encode({"_id": oid,
+                                                          "x": 1})))
+        ids = db.test.insert([BSON.encode({"_id": 2}), {"_id": 3}],
+                             safe=True)
+        self.assertEqual([2, 3], ids)
+        self.assertEqual(3, db.test.count())
+        self.assertEqual(1, db.test.find_one(oid)["x"])
+
+        self.assertRaises(InvalidDocument, db.test.insert,
+                          BSON.encode({"$x": 1}))
+        db.test.insert(BSON.encode({"_id": 4, "$x": 1}), check_keys=False)
+
+    def test_insert_raw_stream(self):
+        db = self.db
+        db.drop_collection("test")
+        docs = [BSON.encode({"_id": i, "s": "x" * 1024}) for i in range(3000)]
+        raw_docs = [memoryview(docs[0]), RawBSONDocument(docs[1])] + docs[2:]
+        self.assertEqual(3000, db.test.insert_raw_stream(iter(raw_docs),
+                                                         safe=True))
+        self.assertEqual(3000, db.test.count())
+        self.assertEqual("x" * 1024, db.test.find_one(1)["s"])
+
+        self.assertEqual(0, db.test.insert_raw_stream([]))
+        self.assertRaises(OperationFailure, db.test.insert_raw_stream,
+                          docs[:1], safe=True)
+        self.assertRaises(InvalidDocument, db.test.insert_raw_stream,
+                          [docs[0][:-1]])
+        self.assertRaises(InvalidDocument, db.test.insert_raw_stream,
+                          [BSON.encode({"$x": 1})], check_keys=True)
+
+    def test_bulk_writer(self):
+        db = self.db
+        db.drop_collection("test")
+        with db.test.bulk_writer(safe=True, max_ops=100) as writer:
+            for i in range(250):
+                writer.insert({"i": i})
+            writer.update({"i": 0}, {"$set": {"first": True}})
+            writer.remove({"i": {"$gte": 200}})
+        self.assertEqual(0, writer.pending)
+        self.assertEqual(200, db.test.count())
+        self.assertTrue(db.test.find_one({"i": 0})["first"])
+
+        writer = db.test.bulk_writer(safe=True)
+        writer.insert({"_id": 1})
+        writer.insert({"_id": 1})
+        self.assertRaises(OperationFailure, writer.flush)
+
     def test_insert_iterables(self):
         db = self.db
 
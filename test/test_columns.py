@@ -0,0 +1,196 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Tests for the columns module and columnar decoding."""
+
+import array
+import datetime
+import struct
+import unittest
+import sys
+sys.path[0:0] = [""]
+
+import bson
+from bson import BSON
+from bson.code import Code
+from bson.columns import (Column,
+                          extend,
+                          to_objects)
+from bson.dbref import DBRef
+from bson.errors import InvalidBSON
+from bson.min_key import MinKey
+from bson.tz_util import utc
+
+
+def encode(docs):
+    return b"".join(BSON.encode(doc) for doc in docs)
+
+
+class TestDecodeAllColumnar(unittest.TestCase):
+
+    def setUp(self):
+        self.date = datetime.datetime(2010, 1, 2, 3, 4, 5, 6000)
+        self.millis = 1262401445006
+        self.docs = [{"i": 1, "f": 1.5, "b": True, "d": self.date,
+                      "s": "a", "e": {"x": 1, "y": {"z": 2.5}}},
+                     {"i": 2, "f": None, "b": False, "s": "b",
+                      "e": {"x": 2}},
+                     {"g": 5, "e": 3}]
+        self.data = encode(self.docs)
+
+    def column(self, type, typecode, values, mask):
+        if typecode:
+            values = array.array(typecode, values)
+        return Column(type, values, array.array("B", mask))
+
+    def test_types(self):
+        columns = bson.decode_all_columnar(self.data, ["i", "f", "b", "d",
+                                                       "s", "q"])
+        self.assertEqual({"i": self.column(16, "i", [1, 2, 0], [1, 1, 0]),
+                          "f": self.column(1, "d", [1.5, 0, 0], [1, 0, 0]),
+                          "b": self.column(8, "B", [1, 0, 0], [1, 1, 0]),
+                          "d": self.column(9, "q", [self.millis, 0, 0],
+                                           [1, 0, 0]),
+                          "s": self.column(2, None, ["a", "b", None],
+                                           [1, 1, 0]),
+                          "q": self.column(None, None, [None] * 3,
+                                           [0, 0, 0])},
+                         columns)
+
+    def test_embedded(self):
+        columns = bson.decode_all_columnar(self.data, ["e.x", "e.y.z"])
+        self.assertEqual(self.column(16, "i", [1, 2, 0], [1, 1, 0]),
+                         columns["e.x"])
+        self.assertEqual(self.column(1, "d", [2.5, 0, 0], [1, 0, 0]),
+                         columns["e.y.z"])
+
+        columns = bson.decode_all_columnar(self.data, ["e"])
+        self.assertEqual(self.column(None, None, [{"x": 1, "y": {"z": 2.5}},
+                                                  {"x": 2}, 3],
+                                     [1, 1, 1]),
+                         columns["e"])
+
+    def test_mixed_types(self):
+        docs = [{"a": 1, "b": 1, "c": 1}, {"a": 2 ** 40, "b": 1.5},
+                {"a": 3, "b": None, "c": 2 ** 40}]
+        columns = bson.decode_all_columnar(encode(docs), ["a", "b", "c"])
+        self.assertEqual(self.column(18, "q", [1, 2 ** 40, 3], [1, 1, 1]),
+                         columns["a"])
+        self.assertEqual(self.column(None, None, [1, 1.5, None], [1, 1, 0]),
+                         columns["b"])
+        self.assertEqual(self.column(18, "q", [1, 0, 2 ** 40], [1, 0, 1]),
+                         columns["c"])
+
+        docs = [{"d": self.date}, {"d": "x"}, {"d": MinKey()}]
+        columns = bson.decode_all_columnar(encode(docs), ["d"], False)
+        self.assertEqual(self.column(None, None, [self.date, "x", MinKey()],
+                                     [1, 1, 1]), columns["d"])
+        columns = bson.decode_all_columnar(encode(docs[2:]), ["d"])
+        self.assertEqual(255, columns["d"].type)
+
+        columns = bson.decode_all_columnar(encode(docs[:2]), ["d"], True)
+        self.assertEqual(utc, columns["d"].values[0].tzinfo)
+
+    def test_objects(self):
+        docs = [{"c": Code("x"), "r": DBRef("coll", 1)}, {"r": 5}]
+        columns = bson.decode_all_columnar(encode(docs), ["c", "r"])
+        self.assertEqual(self.column(15, None, [Code("x"), None], [1, 0]),
+                         columns["c"])
+        self.assertEqual([DBRef("coll", 1), 5], columns["r"].values)
+        self.assertEqual([1], bson.decode_all_columnar(encode(docs[:1]),
+                                                       ["r.$id"])["r.$id"]
+                         .values.tolist())
+
+        # Only the first of repeated fields is used
+        elements = b"\x10r\x00\x05\x00\x00\x00\x10r\x00\x06\x00\x00\x00"
+        data = struct.pack("<i", len(elements) + 5) + elements + b"\x00"
+        self.assertEqual(self.column(16, "i", [5], [1]),
+                         bson.decode_all_columnar(data, ["r"])["r"])
+
+    def test_buffers(self):
+        for data in (bytearray(self.data), memoryview(self.data)):
+            self.assertEqual(bson.decode_all_columnar(self.data, ["i"]),
+                             bson.decode_all_columnar(data, ["i"]))
+        offset = len(BSON.encode(self.docs[0]))
+        self.assertEqual(self.column(16, "i", [2, 0], [1, 0]),
+                         bson.decode_all_columnar(self.data, ["i"], True,
+                                                  offset)["i"])
+        self.assertEqual({"i": self.column(None, None, [], [])},
+                         bson.decode_all_columnar(b"", ["i", "i"]))
+        self.assertEqual({}, bson.decode_all_columnar(self.data, []))
+
+    def test_errors(self):
+        decode = bson.decode_all_columnar
+        self.assertRaises(ValueError, decode, self.data, ["e", "e.x"])
+        self.assertRaises(ValueError, decode, self.data, ["e.x.y", "e.x"])
+        self.assertRaises(TypeError, decode, self.data, [1])
+        self.assertRaises(TypeError, decode, self.data, 1)
+        self.assertRaises(TypeError, decode, "not bytes", ["i"])
+        self.assertRaises(ValueError, decode, self.data, ["i"], True, -1)
+        self.assertRaises(InvalidBSON, decode, self.data[:-1], ["i"])
+        self.assertRaises(InvalidBSON, decode, self.data + b"\x05\x00",
+                          ["i"])
+        self.assertRaises(InvalidBSON, decode,
+                          b"\x0c\x00\x00\x00\x01x\x00\x00\x00\x00\x00\x00",
+                          ["x"])
+
+
+class TestColumns(unittest.TestCase):
+
+    def column(self, docs, field="a"):
+        return bson.decode_all_columnar(encode(docs), [field])[field]
+
+    def test_to_objects(self):
+        date = datetime.datetime(2010, 1, 2)
+        self.assertEqual([1, None, 0], to_objects(self.column([{"a": 1}, {},
+                                                              {"a": 0}])))
+        self.assertEqual([True, False, None],
+                         to_objects(self.column([{"a": True}, {"a": False},
+                                                 {}])))
+        self.assertEqual([date.replace(tzinfo=utc), None],
+                         to_objects(self.column([{"a": date}, {}])))
+        self.assertEqual([date], to_objects(self.column([{"a": date}]),
+                                            False))
+        self.assertEqual(["x", None], to_objects(self.column([{"a": "x"},
+                                                             {}])))
+
+    def test_extend(self):
+        empty = self.column([])
+        nulls = self.column([{}])
+        ints = self.column([{"a": 1}, {}])
+        longs = self.column([{"a": 2 ** 40}])
+        doubles = self.column([{"a": 1.5}])
+        strings = self.column([{"a": "x"}])
+
+        self.assertEqual(ints, extend(self.column([]), ints))
+        self.assertEqual(self.column([{}, {"a": 1}, {}]),
+                         extend(self.column([{}]), ints))
+        self.assertEqual(self.column([{"a": 1}, {}, {}]),
+                         extend(self.column([{"a": 1}, {}]), nulls))
+        self.assertEqual(self.column([{"a": 1}, {}, {"a": 2 ** 40}]),
+                         extend(self.column([{"a": 1}, {}]), longs))
+        self.assertEqual(self.column([{"a": 2 ** 40}, {"a": 1}, {}]),
+                         extend(self.column([{"a": 2 ** 40}]), ints))
+        self.assertEqual(self.column([{"a": 1.5}, {"a": "x"}]),
+                         extend(self.column([{"a": 1.5}]), strings))
+        self.assertEqual(self.column([{"a": "x"}, {"a": "x"}]),
+                         extend(self.column([{"a": "x"}]), strings))
+        self.assertEqual(self.column([{"a": "x"}, {"a": 1.5}, {}]),
+                         extend(extend(self.column([{"a": "x"}]), doubles),
+                                nulls))
+        self.assertEqual(self.column([{}]), extend(empty, nulls))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,143 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Test the compression module."""
+
+import struct
+import unittest
+import zlib
+import sys
+sys.path[0:0] = [""]
+
+from bson.son import SON
+from pymongo import (compression,
+                     message)
+from pymongo.errors import (ConfigurationError,
+                            ConnectionFailure)
+from pymongo.uri_parser import parse_uri
+
+
+def unwrap(data):
+    """Split `data` into (operation, body) pairs, decompressing any
+    OP_COMPRESSED messages.
+    """
+    messages = []
+    position = 0
+    while position < len(data):
+        (length, _, _, operation) = struct.unpack_from("<iiii", data,
+                                                       position)
+        body = data[position + 16:position + length]
+        if operation == compression.OP_COMPRESSED:
+            operation = struct.unpack_from("<i", body)[0]
+            body = compression.decompress(body, operation)
+        messages.append((operation, body))
+        position += length
+    return messages
+
+
+class TestCompression(unittest.TestCase):
+
+    def setUp(self):
+        self.docs = [{"x": "y" * 100, "i": i} for i in range(20)]
+
+    def test_compress(self):
+        (_, data, _) = message.insert("test.coll", self.docs, False, False,
+                                      {})
+        compressed = compression.Compressor("zlib").compress(data)
+        self.assertTrue(len(compressed) < len(data))
+        self.assertEqual(compression.OP_COMPRESSED,
+                         struct.unpack_from("<i", compressed, 12)[0])
+        self.assertEqual(struct.unpack_from("<ii", data, 4),
+                         struct.unpack_from("<ii", compressed, 4))
+        self.assertEqual([(2002, data[16:])], unwrap(compressed))
+
+    def test_threshold(self):
+        (_, data, _) = message.query(0, "test.coll", 0, 0, {"x": 1})
+        compressor = compression.Compressor("zlib")
+        self.assertTrue(compressor.compress(data) is data)
+        compressor = compression.Compressor("zlib", 9, 0)
+        self.assertNotEqual(data, compressor.compress(data))
+
+        # Only the messages that are large enough are compressed
+        (_, large, _) = message.insert("test.coll", self.docs, False, False,
+                                       {})
+        compressed = compressor.compress(data + large)
+        self.assertEqual([(2004, data[16:]), (2002, large[16:])],
+                         unwrap(compressed))
+        compressor = compression.Compressor("zlib", -1, len(large))
+        compressed = compressor.compress(data + large)
+        self.assertEqual(data, compressed[:len(data)])
+
+    def test_commands(self):
+        compressor = compression.Compressor("zlib", -1, 0)
+        for command in ("ismaster", "isMaster", "saslStart", "getnonce"):
+            (_, data, _) = message.query(0, "admin.$cmd", 0, -1,
+                                         SON([(command, 1)]))
+            self.assertTrue(compressor.compress(data) is data)
+        (_, data, _) = message.query(0, "admin.$cmd", 0, -1,
+                                     SON([("count", "coll")]))
+        self.assertNotEqual(data, compressor.compress(data))
+
+    def test_decompress(self):
+        body = b"hello world"
+        compressed = struct.pack("<iiB", 1, len(body), 2) + zlib.compress(body)
+        self.assertEqual(body, compression.decompress(compressed, 1))
+        noop = struct.pack("<iiB", 1, len(body), 0) + body
+        self.assertEqual(body, compression.decompress(bytearray(noop), 1))
+
+        self.assertRaises(ConnectionFailure, compression.decompress,
+                          compressed, 2004)
+        self.assertRaises(ConnectionFailure, compression.decompress,
+                          compressed[:5], 1)
+        self.assertRaises(ConnectionFailure, compression.decompress,
+                          compressed[:-1], 1)
+        self.assertRaises(ConnectionFailure, compression.decompress,
+                          struct.pack("<iiB", 1, 5, 2) + zlib.compress(body),
+                          1)
+        self.assertRaises(ConnectionFailure, compression.decompress,
+                          struct.pack("<iiB", 1, len(body), 7) + body, 1)
+
+    def test_validate(self):
+        self.assertEqual(["zlib"],
+                         compression.validate_compressors("c", "zlib"))
+        self.assertEqual(["zlib"],
+                         compression.validate_compressors("c", ["ZLIB"]))
+        self.assertEqual([], compression.validate_compressors("c", ""))
+        self.assertRaises(ConfigurationError,
+                          compression.validate_compressors, "c", "lzma")
+        self.assertRaises(TypeError,
+                          compression.validate_compressors, "c", 1)
+        if "snappy" not in compression.available():
+            self.assertRaises(ConfigurationError,
+                              compression.validate_compressors, "c",
+                              "snappy,zlib")
+
+        self.assertEqual(5, compression.validate_zlib_level("l", "5"))
+        self.assertEqual(-1, compression.validate_zlib_level("l", -1))
+        self.assertRaises(ConfigurationError,
+                          compression.validate_zlib_level, "l", 10)
+        self.assertRaises(ConfigurationError,
+                          compression.validate_zlib_level, "l", "x")
+
+    def test_uri(self):
+        options = parse_uri("mongodb://localhost/?compressors=zlib&"
+                            "zlibCompressionLevel=6&"
+                            "compressionThreshold=0")["options"]
+        self.assertEqual({"compressors": ["zlib"],
+                          "zlibcompressionlevel": 6,
+                          "compressionthreshold": 0}, options)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -25,6 +25,7 @@ from nose.plugins.skip import SkipTest
 from bson.code import Code
 from pymongo import (ASCENDING,
                      DESCENDING)
+from pymongo import cursor as cursor_module
 from pymongo.cursor import Cursor
 from pymongo.database import Database
 from pymongo.errors import (InvalidOperation,
@@ -374,6 +375,81 @@ class TestCursor(unittest.TestCase):
             break
         self.assertEqual(c, db.command("cursorInfo")["clientCursors_size"])
 
+    def test_batches_ahead(self):
+        db = self.db
+        db.drop_collection("test")
+        db.test.insert([{"i": i} for i in range(1000)])
+
+        self.assertRaises(TypeError, db.test.find, batches_ahead="1")
+        self.assertRaises(ValueError, db.test.find, batches_ahead=-1)
+
+        def results(cursor):
+            return [doc["i"] for doc in cursor]
+
+        for ahead in (1, 3):
+            self.assertEqual(list(range(1000)),
+                             results(db.test.find(batches_ahead=ahead)
+                                     .sort("i").batch_size(7)))
+            self.assertEqual(list(range(50)),
+                             results(db.test.find(batches_ahead=ahead)
+                                     .sort("i").batch_size(7).limit(50)))
+        cursor = db.test.find(batches_ahead=2).sort("i").batch_size(10)
+        columns = cursor.to_columns(["i"])
+        self.assertEqual(list(range(1000)), columns["i"].values.tolist())
+
+        cursor = db.test.find(batches_ahead=2).sort("i").batch_size(10)
+        self.assertEqual(list(range(5)), results(cursor.clone().limit(5)))
+        self.assertEqual(list(range(1000)), results(cursor.clone()))
+
+        # Closing a cursor that reads ahead kills it on the server
+        c = db.command("cursorInfo")["clientCursors_size"]
+        cursor = db.test.find(batches_ahead=2).batch_size(10)
+        for _ in range(25):
+            next(cursor)
+        self.assertNotEqual(c, db.command("cursorInfo")["clientCursors_size"])
+        del cursor
+        self.assertEqual(c, db.command("cursorInfo")["clientCursors_size"])
+
+        cursor = db.test.find(batches_ahead=2).batch_size(10)
+        next(cursor)
+        cursor.rewind()
+        self.assertEqual(1000, len(results(cursor)))
+
+    def test_batches_ahead_failure(self):
+        db = self.db
+        db.drop_collection("test")
+        db.test.insert([{"i": i} for i in range(1000)])
+
+        fetch = cursor_module._fetch
+        failures = []
+
+        def fail_in_background(*args):
+            # The prefetcher's getmores are the only ones that aren't lazy
+            if not args[-1] and not failures:
+                failures.append(True)
+                raise OperationFailure("failed")
+            return fetch(*args)
+
+        cursor_module._fetch = fail_in_background
+        try:
+            cursor = db.test.find(batches_ahead=1).sort("i").batch_size(10)
+            # The first batch comes with the query
+            results = [next(cursor)["i"] for _ in range(101)]
+            self.assertRaises(OperationFailure, next, cursor)
+            # Once reading ahead has failed the cursor doesn't start again
+            for doc in cursor:
+                self.assertEqual(None, cursor._Cursor__prefetcher)
+                results.append(doc["i"])
+        finally:
+            cursor_module._fetch = fetch
+        self.assertEqual(list(range(1000)), results)
+
+        # but a rewound cursor reads ahead again
+        cursor.rewind()
+        next(cursor)
+        self.assertNotEqual(None, cursor._Cursor__prefetcher)
+        self.assertEqual(999, len(list(cursor)))
+
     def test_rewind(self):
         self.db.test.save({"x": 1})
         self.db.test.save({"x": 2})
@@ -753,5 +829,41 @@ self.assertFalse(c2.alive)
 """)
         self.assertTrue(c1.alive)
 
+    def test_batches_decoded_lazily(self):
+        self.db.drop_collection("test")
+        self.db.test.insert([{"x": i} for i in range(250)])
+
+        cursor = self.db.test.find().sort("x").batch_size(100)
+        self.assertEqual(0, next(cursor)["x"])
+        self.assertTrue(cursor.alive)
+        self.assertEqual(list(range(1, 250)), [doc["x"] for doc in cursor])
+        self.assertFalse(cursor.alive)
+        self.assertEqual(250, len(list(cursor.rewind())))
+    def test_to_columns(self):
+        self.db.drop_collection("test")
+        self.db.test.insert([{"x": i, "y": {"z": i * 0.5}} for i in range(250)])
+        self.db.test.insert({"x": 2 ** 40, "s": "a"})
+
+        cursor = self.db.test.find().sort("x").batch_size(100)
+        columns = cursor.to_columns(["x", "y.z", "s"])
+        self.assertEqual(["s", "x", "y.z"], sorted(columns))
+        self.assertEqual(18, columns["x"].type)
+        self.assertEqual(list(range(250)) + [2 ** 40],
+                         columns["x"].values.tolist())
+        self.assertEqual(1, columns["y.z"].type)
+        self.assertEqual([i * 0.5 for i in range(250)] + [0],
+                         columns["y.z"].values.tolist())
+        self.assertEqual([1] * 250 + [0], columns["y.z"].mask.tolist())
+        self.assertEqual([None] * 250 + ["a"], columns["s"].values)
+        self.assertFalse(cursor.alive)
+        self.assertRaises(InvalidOperation, cursor.to_columns, ["x"])
+
+        columns = self.db.test.find({"x": {"$lt": 5}}).to_columns(["x"])
+        self.assertEqual(16, columns["x"].type)
+        self.assertEqual([], self.db.test.find()[5:5]
+                         .to_columns(["x"])["x"].values)
+        self.assertRaises(ValueError, self.db.test.find().to_columns,
+                          ["y", "y.z"])
+
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,74 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Test the cursor_manager module."""
+
+import unittest
+import sys
+sys.path[0:0] = [""]
+
+from pymongo.cursor_manager import (BatchCursorManager,
+                                    CursorManager)
+from pymongo.errors import AutoReconnect
+
+
+class FakeConnection(object):
+
+    def __init__(self):
+        self.killed = []
+        self.fail = False
+
+    def kill_cursors(self, cursor_ids):
+        if self.fail:
+            raise AutoReconnect("connection closed")
+        self.killed.append(cursor_ids)
+
+
+class TestCursorManager(unittest.TestCase):
+
+    def test_close(self):
+        connection = FakeConnection()
+        manager = CursorManager(connection)
+        self.assertRaises(TypeError, manager.close, "1")
+        manager.close(1)
+        manager.close(2)
+        self.assertEqual([[1], [2]], connection.killed)
+
+    def test_retry_in_one_message(self):
+        connection = FakeConnection()
+        manager = CursorManager(connection)
+        connection.fail = True
+        self.assertRaises(AutoReconnect, manager.close, 1)
+        self.assertRaises(AutoReconnect, manager.close, 2)
+        connection.fail = False
+        manager.close(3)
+        self.assertEqual([[1, 2, 3]], connection.killed)
+        manager.flush()
+        self.assertEqual([[1, 2, 3]], connection.killed)
+
+    def test_batch(self):
+        connection = FakeConnection()
+        manager = BatchCursorManager(connection)
+        for i in range(20):
+            manager.close(i)
+        self.assertEqual([], connection.killed)
+        manager.close(20)
+        self.assertEqual([list(range(21))], connection.killed)
+        manager.close(21)
+        manager.flush()
+        self.assertEqual([list(range(21)), [21]], connection.killed)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -17,28 +17,24 @@
 """Tests for the grid_file module.
 """
 
-try:
-    from cStringIO import StringIO
-except ImportError:
-    from StringIO import StringIO
 import datetime
 import os
 import sys
 import unittest
+from io import BytesIO
 sys.path[0:0] = [""]
 
-from nose.plugins.skip import SkipTest
-
 from bson.objectid import ObjectId
 from gridfs.grid_file import (_SEEK_CUR,
                               _SEEK_END,
                               GridIn,
                               GridFile,
                               GridOut)
-from gridfs.errors import (NoFile,
+from gridfs.errors import (CorruptGridFile,
+                           NoFile,
                            UnsupportedAPI)
-from test_connection import get_connection
-import qcheck
+from test.test_connection import get_connection
+from test import qcheck
 
 
 class TestGridFile(unittest.TestCase):
@@ -50,17 +46,17 @@ class TestGridFile(unittest.TestCase):
 
     def test_basic(self):
         f = GridIn(self.db.fs, filename="test")
-        f.write("hello world")
+        f.write(b"hello world")
         f.close()
         self.assertEqual(1, self.db.fs.files.find().count())
         self.assertEqual(1, self.db.fs.chunks.find().count())
 
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual("hello world", g.read())
+        self.assertEqual(b"hello world", g.read())
 
         # make sure it's still there...
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual("hello world", g.read())
+        self.assertEqual(b"hello world", g.read())
 
         f = GridIn(self.db.fs, filename="test")
         f.close()
@@ -68,11 +64,11 @@ class TestGridFile(unittest.TestCase):
         self.assertEqual(1, self.db.fs.chunks.find().count())
 
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual("", g.read())
+        self.assertEqual(b"", g.read())
 
     def test_md5(self):
         f = GridIn(self.db.fs)
-        f.write("hello world\n")
+        f.write(b"hello world\n")
         f.close()
         self.assertEqual("6f5902ac237024bdd0c176cb93063dc4", f.md5)
 
@@ -81,14 +77,14 @@ class TestGridFile(unittest.TestCase):
         self.db.alt.chunks.remove({})
 
         f = GridIn(self.db.alt)
-        f.write("hello world")
+        f.write(b"hello world")
         f.close()
 
         self.assertEqual(1, self.db.alt.files.find().count())
         self.assertEqual(1, self.db.alt.chunks.find().count())
 
         g = GridOut(self.db.alt, f._id)
-        self.assertEqual("hello world", g.read())
+        self.assertEqual(b"hello world", g.read())
 
         # test that md5 still works...
         self.assertEqual("5eb63bbbe01eeed093cb22bb8f5acdc3", g.md5)
@@ -207,7 +203,7 @@ class TestGridFile(unittest.TestCase):
         a = GridIn(self.db.fs, _id=5, filename="my_file",
                    contentType="text/html", chunkSize=1000, aliases=["foo"],
                    metadata={"foo": 1, "bar": 2}, bar=3, baz="hello")
-        a.write("hello world")
+        a.write(b"hello world")
         a.close()
 
         b = GridOut(self.db.fs, 5)
@@ -228,20 +224,20 @@ class TestGridFile(unittest.TestCase):
 
     def test_grid_out_file_document(self):
         a = GridIn(self.db.fs)
-        a.write("foo bar")
+        a.write(b"foo bar")
         a.close()
 
         b = GridOut(self.db.fs, file_document=self.db.fs.files.find_one())
-        self.assertEqual("foo bar", b.read())
+        self.assertEqual(b"foo bar", b.read())
 
         c = GridOut(self.db.fs, 5, file_document=self.db.fs.files.find_one())
-        self.assertEqual("foo bar", c.read())
+        self.assertEqual(b"foo bar", c.read())
 
         self.assertRaises(NoFile, GridOut, self.db.fs, file_document={})
 
     def test_write_file_like(self):
         a = GridIn(self.db.fs)
-        a.write("hello world")
+        a.write(b"hello world")
         a.close()
 
         b = GridOut(self.db.fs, a._id)
@@ -251,23 +247,23 @@ class TestGridFile(unittest.TestCase):
         c.close()
 
         d = GridOut(self.db.fs, c._id)
-        self.assertEqual("hello world", d.read())
+        self.assertEqual(b"hello world", d.read())
 
         e = GridIn(self.db.fs, chunk_size=2)
-        e.write("hello")
-        buffer = StringIO(" world")
+        e.write(b"hello")
+        buffer = BytesIO(b" world")
         e.write(buffer)
-        e.write(" and mongodb")
+        e.write(b" and mongodb")
         e.close()
-        self.assertEqual("hello world and mongodb",
+        self.assertEqual(b"hello world and mongodb",
                          GridOut(self.db.fs, e._id).read())
 
     def test_write_lines(self):
         a = GridIn(self.db.fs)
-        a.writelines(["hello ", "world"])
+        a.writelines([b"hello ", b"world"])
         a.close()
 
-        self.assertEqual("hello world", GridOut(self.db.fs, a._id).read())
+        self.assertEqual(b"hello world", GridOut(self.db.fs, a._id).read())
 
     def test_close(self):
         f = GridIn(self.db.fs)
@@ -276,7 +272,7 @@ class TestGridFile(unittest.TestCase):
         f.close()
 
     def test_multi_chunk_file(self):
-        random_string = qcheck.gen_string(qcheck.lift(300000))()
+        random_string = qcheck.gen_bytes(qcheck.lift(300000))()
 
         f = GridIn(self.db.fs)
         f.write(random_string)
@@ -311,35 +307,35 @@ class TestGridFile(unittest.TestCase):
             return True
 
         qcheck.check_unittest(self, helper,
-                              qcheck.gen_string(qcheck.gen_range(0, 20)))
+                              qcheck.gen_bytes(qcheck.gen_range(0, 20)))
 
     def test_seek(self):
         f = GridIn(self.db.fs, chunkSize=3)
-        f.write("hello world")
+        f.write(b"hello world")
         f.close()
 
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual("hello world", g.read())
+        self.assertEqual(b"hello world", g.read())
         g.seek(0)
-        self.assertEqual("hello world", g.read())
+        self.assertEqual(b"hello world", g.read())
         g.seek(1)
-        self.assertEqual("ello world", g.read())
+        self.assertEqual(b"ello world", g.read())
         self.assertRaises(IOError, g.seek, -1)
 
         g.seek(-3, _SEEK_END)
-        self.assertEqual("rld", g.read())
+        self.assertEqual(b"rld", g.read())
         g.seek(0, _SEEK_END)
-        self.assertEqual("", g.read())
+        self.assertEqual(b"", g.read())
         self.assertRaises(IOError, g.seek, -100, _SEEK_END)
 
         g.seek(3)
         g.seek(3, _SEEK_CUR)
-        self.assertEqual("world", g.read())
+        self.assertEqual(b"world", g.read())
         self.assertRaises(IOError, g.seek, -100, _SEEK_CUR)
 
     def test_tell(self):
         f = GridIn(self.db.fs, chunkSize=3)
-        f.write("hello world")
+        f.write(b"hello world")
         f.close()
 
         g = GridOut(self.db.fs, f._id)
@@ -355,35 +351,35 @@ class TestGridFile(unittest.TestCase):
 
     def test_multiple_reads(self):
         f = GridIn(self.db.fs, chunkSize=3)
-        f.write("hello world")
+        f.write(b"hello world")
         f.close()
 
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual("he", g.read(2))
-        self.assertEqual("ll", g.read(2))
-        self.assertEqual("o ", g.read(2))
-        self.assertEqual("wo", g.read(2))
-        self.assertEqual("rl", g.read(2))
-        self.assertEqual("d", g.read(2))
-        self.assertEqual("", g.read(2))
+        self.assertEqual(b"he", g.read(2))
+        self.assertEqual(b"ll", g.read(2))
+        self.assertEqual(b"o ", g.read(2))
+        self.assertEqual(b"wo", g.read(2))
+        self.assertEqual(b"rl", g.read(2))
+        self.assertEqual(b"d", g.read(2))
+        self.assertEqual(b"", g.read(2))
 
     def test_readline(self):
         f = GridIn(self.db.fs, chunkSize=5)
-        f.write("""Hello world,
+        f.write(b"""Hello world,
 How are you?
 Hope all is well.
 Bye""")
         f.close()
 
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual("H", g.read(1))
-        self.assertEqual("ello world,\n", g.readline())
-        self.assertEqual("How a", g.readline(5))
-        self.assertEqual("", g.readline(0))
-        self.assertEqual("re you?\n", g.readline())
-        self.assertEqual("Hope all is well.\n", g.readline(1000))
-        self.assertEqual("Bye", g.readline())
-        self.assertEqual("", g.readline())
+        self.assertEqual(b"H", g.read(1))
+        self.assertEqual(b"ello world,\n", g.readline())
+        self.assertEqual(b"How a", g.readline(5))
+        self.assertEqual(b"", g.readline(0))
+        self.assertEqual(b"re you?\n", g.readline())
+        self.assertEqual(b"Hope all is well.\n", g.readline(1000))
+        self.assertEqual(b"Bye", g.readline())
+        self.assertEqual(b"", g.readline())
 
     def test_iterator(self):
         f = GridIn(self.db.fs)
@@ -392,29 +388,29 @@ Bye""")
         self.assertEqual([], list(g))
 
         f = GridIn(self.db.fs)
-        f.write("hello world")
+        f.write(b"hello world")
         f.close()
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual(["hello world"], list(g))
-        self.assertEqual("hello", g.read(5))
-        self.assertEqual(["hello world"], list(g))
-        self.assertEqual(" worl", g.read(5))
+        self.assertEqual([b"hello world"], list(g))
+        self.assertEqual(b"hello", g.read(5))
+        self.assertEqual([b"hello world"], list(g))
+        self.assertEqual(b" worl", g.read(5))
 
         f = GridIn(self.db.fs, chunk_size=2)
-        f.write("hello world")
+        f.write(b"hello world")
         f.close()
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual(["he", "ll", "o ", "wo", "rl", "d"], list(g))
+        self.assertEqual([b"he", b"ll", b"o ", b"wo", b"rl", b"d"], list(g))
 
     def test_read_chunks_unaligned_buffer_size(self):
-        in_data = ("This is a text that doesn't "
-                   "quite fit in a single 16-byte chunk.")
+        in_data = (b"This is a text that doesn't "
+                   b"quite fit in a single 16-byte chunk.")
         f = GridIn(self.db.fs, chunkSize=16)
         f.write(in_data)
         f.close()
 
         g = GridOut(self.db.fs, f._id)
-        out_data = ''
+        out_data = b''
         while 1:
             s = g.read(13)
             if not s:
@@ -423,23 +419,84 @@ Bye""")
 
         self.assertEqual(in_data, out_data)
 
+    def test_chunks_per_insert(self):
+        f = GridIn(self.db.fs, chunkSize=2, chunks_per_insert=4)
+        f.write(b"hello wor")
+        self.assertEqual(4, self.db.fs.chunks.find().count())
+        f.write(b"ld")
+        f.close()
+        self.assertEqual(6, self.db.fs.chunks.find().count())
+        self.assertFalse("chunks_per_insert" in
+                         self.db.fs.files.find_one({"_id": f._id}))
+        self.assertEqual(b"hello world", GridOut(self.db.fs, f._id).read())
+
+        self.assertRaises(ValueError, GridIn, self.db.fs,
+                          chunks_per_insert=0)
+        self.assertRaises(TypeError, GridIn, self.db.fs,
+                          chunks_per_insert="4")
+
+    def test_prefetch(self):
+        f = GridIn(self.db.fs, chunkSize=3)
+        f.write(b"hello world")
+        f.close()
+
+        g = GridOut(self.db.fs, f._id, prefetch=2)
+        self.assertEqual(b"hello world", g.read())
+        g.seek(4)
+        self.assertEqual(b"o w", g.read(3))
+        g.seek(1)
+        self.assertEqual(b"ello", g.read(4))
+        self.assertEqual(b" world", g.read())
+        self.assertEqual([b"hel", b"lo ", b"wor", b"ld"], list(g))
+
+        self.db.fs.chunks.remove({"files_id": f._id, "n": 2})
+        g = GridOut(self.db.fs, f._id, prefetch=4)
+        self.assertEqual(b"hello ", g.read(6))
+        self.assertRaises(CorruptGridFile, g.read)
+
+        self.assertRaises(ValueError, GridOut, self.db.fs, f._id,
+                          prefetch=-1)
+
+    def test_readinto(self):
+        f = GridIn(self.db.fs, chunkSize=3)
+        f.write(b"hello world")
+        f.close()
+
+        for prefetch in (0, 3):
+            g = GridOut(self.db.fs, f._id, prefetch=prefetch)
+            buffer = bytearray(4)
+            self.assertEqual(4, g.readinto(buffer))
+            self.assertEqual(bytearray(b"hell"), buffer)
+            self.assertEqual(b"o", g.read(1))
+            self.assertEqual(4, g.readinto(memoryview(buffer)))
+            self.assertEqual(bytearray(b" wor"), buffer)
+            self.assertEqual(2, g.readinto(buffer))
+            self.assertEqual(bytearray(b"ldor"), buffer)
+            self.assertEqual(0, g.readinto(buffer))
+            self.assertEqual(g.length, g.tell())
+
+            buffer = bytearray(20)
+            g.seek(2)
+            self.assertEqual(9, g.readinto(buffer))
+            self.assertEqual(bytearray(b"llo world"), buffer[:9])
+
     def test_write_unicode(self):
         f = GridIn(self.db.fs)
-        self.assertRaises(TypeError, f.write, u"foo")
+        self.assertRaises(TypeError, f.write, "foo")
 
         f = GridIn(self.db.fs, encoding="utf-8")
-        f.write(u"foo")
+        f.write("foo")
         f.close()
 
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual("foo", g.read())
+        self.assertEqual(b"foo", g.read())
 
         f = GridIn(self.db.fs, encoding="iso-8859-1")
-        f.write(u"aé")
+        f.write("aé")
         f.close()
 
         g = GridOut(self.db.fs, f._id)
-        self.assertEqual(u"aé".encode("iso-8859-1"), g.read())
+        self.assertEqual("aé".encode("iso-8859-1"), g.read())
 
     def test_set_after_close(self):
         f = GridIn(self.db.fs, _id="foo", bar="baz")
@@ -475,18 +532,12 @@ Bye""")
         self.assertEqual("b", f.baz)
 
     def test_context_manager(self):
-        if sys.version_info < (2, 6):
-            raise SkipTest()
+        contents = b"Imagine this is some important data..."
+        with GridIn(self.db.fs, filename="important") as infile:
+            infile.write(contents)
 
-        contents = "Imagine this is some important data..."
-        # Hack around python2.4 an 2.5 not supporting 'with' syntax
-        exec """
-with GridIn(self.db.fs, filename="important") as infile:
-    infile.write(contents)
-
-with GridOut(self.db.fs, infile._id) as outfile:
-    self.assertEqual(contents, outfile.read())
-"""
+        with GridOut(self.db.fs, infile._id) as outfile:
+            self.assertEqual(contents, outfile.read())
 
 
 if __name__ == "__main__":
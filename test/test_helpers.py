@@ -0,0 +1,183 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Test the helpers module."""
+
+import datetime
+import re
+import socket
+import struct
+import threading
+import unittest
+import zlib
+import sys
+sys.path[0:0] = [""]
+
+from bson import BSON
+from bson.code import Code
+from bson.errors import InvalidBSON
+from bson.raw_bson import RawBSONDocument
+from bson.son import SON
+from bson.tz_util import utc
+from pymongo import helpers
+from pymongo.errors import (AutoReconnect,
+                            ConnectionFailure,
+                            OperationFailure)
+
+
+def reply(documents, flags=0, cursor_id=0, starting_from=0):
+    header = struct.pack("<iqii", flags, cursor_id, starting_from,
+                         len(documents))
+    return header + b"".join(BSON.encode(doc) for doc in documents)
+
+
+class TestUnpackResponse(unittest.TestCase):
+
+    def test_unpack(self):
+        docs = [{"a": 1}, {"b": "two"}]
+        response = helpers._unpack_response(reply(docs, 0, 1234, 10))
+        self.assertEqual(1234, response["cursor_id"])
+        self.assertEqual(10, response["starting_from"])
+        self.assertEqual(2, response["number_returned"])
+        self.assertEqual(docs, response["data"])
+
+        response = helpers._unpack_response(reply([]))
+        self.assertEqual(0, response["number_returned"])
+        self.assertEqual([], response["data"])
+
+    def test_lazy(self):
+        docs = [{"a": 1}, {"b": "two"}]
+        response = helpers._unpack_response(bytearray(reply(docs, 0, 5)),
+                                            None, dict, False, True)
+        self.assertEqual(5, response["cursor_id"])
+        self.assertEqual(2, response["number_returned"])
+        self.assertFalse(isinstance(response["data"], list))
+        self.assertEqual(docs, list(response["data"]))
+
+        response = helpers._unpack_response(reply([{}])[:-1], None, dict,
+                                            False, True)
+        self.assertEqual(1, response["number_returned"])
+        self.assertRaises(InvalidBSON, list, response["data"])
+
+    def test_validate(self):
+        docs = [{"a": 1, "s": "two", "d": {"x": [1, "y", {"z": None}]}},
+                {"c": Code("f", {"g": 2.5}), "r": re.compile("^p", re.I)}]
+        for data in (reply(docs, 0, 5), bytearray(reply(docs, 0, 5))):
+            response = helpers._unpack_response(data, None, dict, False,
+                                                False, True)
+            self.assertEqual(5, response["cursor_id"])
+            self.assertEqual(docs[0], response["data"][0])
+            self.assertEqual(Code("f", {"g": 2.5}), response["data"][1]["c"])
+            self.assertEqual("^p", response["data"][1]["r"].pattern)
+
+        # Enough documents to be validated without the GIL
+        many = [{"i": i, "s": "x" * 100} for i in range(1000)]
+        response = helpers._unpack_response(reply(many), None, dict, False,
+                                            False, True)
+        self.assertEqual(many, response["data"])
+
+        # A key that isn't UTF-8 is caught before anything is decoded
+        data = reply([{"a": 1}]).replace(b"a\x00", b"\xff\x00")
+        self.assertRaises(InvalidBSON, helpers._unpack_response, data,
+                          None, dict, False, False, True)
+        # as is a document running past the end of the reply
+        self.assertRaises(InvalidBSON, helpers._unpack_response,
+                          reply([{"s": "abc"}])[:-1], None, dict, False,
+                          False, True)
+
+    def test_as_class(self):
+        date = datetime.datetime(2011, 1, 2, 3, 4, 5)
+        response = helpers._unpack_response(reply([SON([("d", date)])]),
+                                            None, SON, True)
+        self.assertTrue(isinstance(response["data"][0], SON))
+        self.assertEqual(utc, response["data"][0]["d"].tzinfo)
+
+        response = helpers._unpack_response(reply([{"x": [1, 2]}]),
+                                            None, RawBSONDocument)
+        self.assertTrue(isinstance(response["data"][0], RawBSONDocument))
+        self.assertEqual([1, 2], response["data"][0]["x"])
+
+    def test_errors(self):
+        self.assertRaises(OperationFailure, helpers._unpack_response,
+                          reply([], 1), 5)
+        self.assertRaises(OperationFailure, helpers._unpack_response,
+                          reply([{"$err": "bad query"}], 2))
+        self.assertRaises(AutoReconnect, helpers._unpack_response,
+                          reply([{"$err": "not master"}], 2))
+        self.assertRaises(AssertionError, helpers._unpack_response,
+                          reply([{}])[:-5])
+
+
+class TestGetId(unittest.TestCase):
+
+    def test_get_id(self):
+        self.assertEqual(5, helpers._get_id({"_id": 5}))
+        self.assertEqual(None, helpers._get_id({}))
+        self.assertEqual(5, helpers._get_id(BSON.encode({"x": 1, "_id": 5})))
+        self.assertEqual(None, helpers._get_id(BSON.encode({})))
+
+
+class TestReceiveMessage(unittest.TestCase):
+
+    def setUp(self):
+        (self.client, self.server) = socket.socketpair()
+
+    def tearDown(self):
+        self.client.close()
+        self.server.close()
+
+    def send(self, data, request_id=7, operation=1):
+        self.server.sendall(struct.pack("<iiii", len(data) + 16, 0,
+                                        request_id, operation) + data)
+
+    def test_receive(self):
+        self.send(b"hello")
+        self.send(b"")
+        self.assertEqual(b"hello", helpers._receive_message(self.client, 1, 7))
+        self.assertEqual(b"", helpers._receive_message(self.client, 1, 7))
+
+    def test_large(self):
+        data = bytes(range(256)) * 8192
+        sender = threading.Thread(target=self.send, args=(data,))
+        sender.start()
+        self.assertEqual(data, helpers._receive_message(self.client, 1, 7))
+        sender.join()
+
+    def test_compressed(self):
+        body = b"hello" * 100
+        self.send(struct.pack("<iiB", 1, len(body), 2) + zlib.compress(body),
+                  operation=2012)
+        self.assertEqual(body, helpers._receive_message(self.client, 1, 7))
+        self.send(struct.pack("<iiB", 2004, len(body), 2) +
+                  zlib.compress(body), operation=2012)
+        self.assertRaises(ConnectionFailure, helpers._receive_message,
+                          self.client, 1, 7)
+
+    def test_errors(self):
+        self.send(b"x", 8)
+        self.assertRaises(AssertionError, helpers._receive_message,
+                          self.client, 1, 7)
+        self.client.recv(1)
+        self.send(b"x", 7, 2004)
+        self.assertRaises(AssertionError, helpers._receive_message,
+                          self.client, 1, 7)
+        self.client.recv(1)
+        self.server.sendall(b"\x10\x00\x00\x00")
+        self.server.close()
+        self.assertRaises(ConnectionFailure, helpers._receive_message,
+                          self.client, 1, 7)
+
+
+if __name__ == "__main__":
+    unittest.main()
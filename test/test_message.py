@@ -0,0 +1,360 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Test the message module."""
+
+import struct
+import unittest
+import sys
+sys.path[0:0] = [""]
+
+from nose.plugins.skip import SkipTest
+
+import bson
+from bson import BSON
+from bson.dbref import DBRef
+from bson.errors import InvalidDocument
+from bson.son import SON
+import pymongo
+from pymongo import (helpers,
+                     message)
+from pymongo.errors import InvalidOperation
+
+
+def unpack_insert(data):
+    """Split the first message in `data` into (name, documents, rest).
+    """
+    (length, _, _, operation) = struct.unpack("<iiii", data[:16])
+    assert operation == 2002
+    end = data.index(b"\x00", 20)
+    name = data[20:end].decode("utf-8")
+    return (name, bson.decode_all(data[end + 1:length]), data[length:])
+
+
+class TestInsertBatches(unittest.TestCase):
+
+    def setUp(self):
+        self.docs = [{"_id": i, "x": "y" * 100} for i in range(50)]
+        self.size = len(BSON.encode(self.docs[0]))
+
+    def test_single_batch(self):
+        batches = message.insert_batches("db.c", self.docs, True, False, {},
+                                         4 * 1024 * 1024, 8 * 1024 * 1024)
+        self.assertEqual(1, len(batches))
+        (request_id, data) = batches[0]
+        self.assertEqual(("db.c", self.docs, b""), unpack_insert(data))
+
+    def test_split(self):
+        batches = message.insert_batches("db.c", iter(self.docs), True,
+                                         False, {}, self.size,
+                                         10 * self.size + 30)
+        self.assertEqual(5, len(batches))
+        self.assertEqual(5, len(set(id for (id, _) in batches)))
+        decoded = []
+        for (_, data) in batches:
+            self.assertTrue(len(data) <= 10 * self.size + 30)
+            (name, docs, rest) = unpack_insert(data)
+            self.assertEqual("db.c", name)
+            self.assertEqual(b"", rest)
+            decoded.extend(docs)
+        self.assertEqual(self.docs, decoded)
+
+    def test_oversized_message_limit(self):
+        # Each document still goes out, even if it is alone over the limit.
+        batches = message.insert_batches("db.c", self.docs[:3], True, False,
+                                         {}, self.size, 1)
+        self.assertEqual(3, len(batches))
+
+    def test_safe(self):
+        batches = message.insert_batches("db.c", self.docs, True, True,
+                                         {"w": 2}, self.size,
+                                         25 * self.size + 30)
+        self.assertEqual(2, len(batches))
+        for (request_id, data) in batches:
+            (_, _, rest) = unpack_insert(data)
+            (length, last_error_id, _, operation) = struct.unpack("<iiii",
+                                                                  rest[:16])
+            self.assertEqual(len(rest), length)
+            self.assertEqual(2004, operation)
+            self.assertEqual(request_id, last_error_id)
+            self.assertTrue(b"getlasterror" in rest)
+
+    def test_size_hint(self):
+        for hint in (0, 1, self.size, 100 * self.size):
+            batches = message.insert_batches("db.c", self.docs, True, False,
+                                             {}, self.size, 10 * self.size,
+                                             hint)
+            self.assertEqual(6, len(batches))
+            decoded = []
+            for (_, data) in batches:
+                decoded.extend(unpack_insert(data)[1])
+            self.assertEqual(self.docs, decoded)
+
+            (_, data, max_size) = message.insert("db.c", self.docs, True,
+                                                 False, {}, hint)
+            self.assertEqual(self.size, max_size)
+            self.assertEqual(("db.c", self.docs, b""), unpack_insert(data))
+
+    def test_pre_encoded(self):
+        encoded = [BSON.encode(doc) for doc in self.docs]
+        mixed = [encoded[0], self.docs[1]] + encoded[2:]
+        for docs in (encoded, mixed, iter(encoded)):
+            batches = message.insert_batches("db.c", docs, True, False, {},
+                                             self.size, 10 * self.size)
+            self.assertEqual(6, len(batches))
+            decoded = []
+            for (_, data) in batches:
+                decoded.extend(unpack_insert(data)[1])
+            self.assertEqual(self.docs, decoded)
+
+        (_, data, max_size) = message.insert("db.c", mixed, True, False, {})
+        self.assertEqual(self.size, max_size)
+        self.assertEqual(("db.c", self.docs, b""), unpack_insert(data))
+
+        bulk = message.bulk_buffer(self.size, 10 * self.size)
+        bulk.insert("db.c", encoded[:3], True)
+        (_, data) = bulk.finish(False, {})
+        self.assertEqual(("db.c", self.docs[:3], b""), unpack_insert(data))
+
+    def test_pre_encoded_checks(self):
+        def insert(doc, check_keys=True):
+            return message.insert("db.c", [doc], check_keys, False, {})
+
+        valid = BSON.encode({"a": 1})
+        for bad in (b"", b"\x05\x00\x00\x00", valid[:-1] + b"\x01",
+                    valid + b"\x00", b"\x06" + valid[1:]):
+            self.assertRaises(InvalidDocument, insert, bad)
+            self.assertRaises(InvalidDocument, insert, bad, False)
+            self.assertRaises(InvalidDocument, message.insert_batches,
+                              "db.c", [bad], True, False, {}, 100, 100)
+
+        for bad_key in ({"$a": 1}, {"a.b": 1}, {"a": {"$b": 1}},
+                        {"a": [{"b.c": 1}]}):
+            self.assertRaises(InvalidDocument, insert, BSON.encode(bad_key))
+            insert(BSON.encode(bad_key), False)
+        # Embedded documents are checked when key names are.
+        embedded = b"\x03b\x00\x05\x00\x00\x00\x01\x00"
+        bad = struct.pack("<i", len(embedded) + 5) + embedded
+        self.assertRaises(InvalidDocument, insert, bad)
+
+        # DBRefs are accepted, as they are in unencoded documents.
+        for doc in ({"r": DBRef("c", 5)}, {"a": [DBRef("c", 5, "db")]},
+                    {"a": {"r": DBRef("c", 5, foo={"$b": 1})}}):
+            (_, data, _) = insert(BSON.encode(doc))
+            self.assertEqual(("db.c", [doc], b""), unpack_insert(data))
+            insert(doc)
+
+    def test_errors(self):
+        self.assertRaises(InvalidOperation, message.insert_batches, "db.c",
+                          [], True, False, {}, 100, 100)
+        self.assertRaises(InvalidOperation, message.insert_batches, "db.c",
+                          5, True, False, {}, 100, 100)
+        self.assertRaises(InvalidDocument, message.insert_batches, "db.c",
+                          self.docs, True, False, {}, self.size - 1,
+                          100 * self.size)
+
+    def test_split_errors(self):
+        # The first message can't be finished when the second is split off
+        self.assertRaises(InvalidDocument, message.insert_batches, "db.c",
+                          self.docs, True, True, {"w": object()}, self.size,
+                          10 * self.size + 30)
+        # A document after the split can't be encoded
+        docs = self.docs[:15] + [{"bad": object()}]
+        self.assertRaises(InvalidDocument, message.insert_batches, "db.c",
+                          docs, True, False, {}, self.size,
+                          10 * self.size + 30)
+        self.assertEqual(5, len(message.insert_batches(
+            "db.c", self.docs, True, False, {}, self.size,
+            10 * self.size + 30)))
+
+
+def unpack_messages(data):
+    """Split `data` into a list of (operation, request_id, body) tuples.
+    """
+    messages = []
+    while data:
+        (length, request_id, _, operation) = struct.unpack("<iiii", data[:16])
+        messages.append((operation, request_id, data[16:length]))
+        data = data[length:]
+    return messages
+
+
+class TestBulkBuffer(unittest.TestCase):
+
+    def setUp(self):
+        self.buffer = message.bulk_buffer(1000, 100)
+
+    def bodies(self, safe=False, last_error_args={}):
+        (request_id, data) = self.buffer.finish(safe, last_error_args)
+        messages = unpack_messages(data)
+        self.assertEqual(request_id, messages[-1][1])
+        # The message lengths must add up, or the server would misread
+        # the messages after a wrong one.
+        position = 0
+        while position < len(data):
+            position += struct.unpack_from("<i", data, position)[0]
+        self.assertEqual(len(data), position)
+        return [(operation, body) for (operation, _, body) in messages]
+
+    def expected(self, *messages):
+        result = []
+        for (request_id, data, _) in messages:
+            result.extend((operation, body) for (operation, _, body)
+                          in unpack_messages(data))
+        return result
+
+    def test_combine_inserts(self):
+        self.assertEqual(None, self.buffer.finish(False, {}))
+        self.buffer.insert("db.c", [{"a": 1}], True)
+        self.buffer.insert("db.c", iter([{"b": 2}, {"c": 3}]), True)
+        self.assertEqual(3, self.buffer.count)
+        self.buffer.insert("db.d", [{"d": 4}], True)
+        self.buffer.update("db.c", True, False, {"a": 1}, {"$set": {"a": 2}})
+        self.buffer.insert("db.c", [{"e": 5}], True)
+        self.buffer.delete("db.d", {"d": 4})
+        self.assertEqual(7, self.buffer.count)
+        size = len(self.buffer)
+
+        expected = self.expected(
+            message.insert("db.c", [{"a": 1}, {"b": 2}, {"c": 3}], True,
+                           False, {}),
+            message.insert("db.d", [{"d": 4}], True, False, {}),
+            message.update("db.c", True, False, {"a": 1},
+                           {"$set": {"a": 2}}, False, {}),
+            message.insert("db.c", [{"e": 5}], True, False, {}),
+            message.delete("db.d", {"d": 4}, False, {}))
+        self.assertEqual(size, sum(16 + len(body) for (_, body) in expected))
+        self.assertEqual(expected, self.bodies())
+        self.assertEqual(0, self.buffer.count)
+        self.assertEqual(0, len(self.buffer))
+        self.assertEqual(None, self.buffer.finish(True, {}))
+
+    def test_split_inserts(self):
+        docs = [{"x": "y" * 20} for _ in range(10)]
+        self.buffer.insert("db.c", docs[:5], False)
+        self.buffer.insert("db.c", docs[5:], False)
+        bodies = self.bodies()
+        self.assertEqual(5, len(bodies))
+        for (operation, body) in bodies:
+            self.assertEqual(2002, operation)
+            self.assertTrue(16 + len(body) <= 100)
+            self.assertEqual(docs[:2], bson.decode_all(body[9:]))
+
+        # A document too large for a message on its own still goes out.
+        self.buffer.insert("db.c", [{"x": "y" * 200}], False)
+        self.assertEqual(1, len(self.bodies()))
+
+    def test_safe(self):
+        self.buffer.delete("db.c", {})
+        bodies = self.bodies(True, SON([("w", 2)]))
+        self.assertEqual([2006, 2004], [operation for (operation, _) in bodies])
+        self.assertTrue(b"getlasterror" in bodies[1][1])
+        self.assertTrue(b"w\x00" in bodies[1][1])
+
+    def test_errors_leave_buffer_unchanged(self):
+        self.buffer.insert("db.c", [{"a": 1}], True)
+        size = len(self.buffer)
+        self.assertRaises(InvalidDocument, self.buffer.insert, "db.c",
+                          [{"b": 1}, {"x": "y" * 1000}], True)
+        self.assertRaises(InvalidDocument, self.buffer.insert, "db.c",
+                          [{"b": 1}, {"$x": 1}], True)
+        self.assertRaises(InvalidDocument, self.buffer.update, "db.c",
+                          False, False, {}, {"x": "y" * 1000})
+        self.assertRaises(InvalidDocument, self.buffer.delete, "db.c",
+                          {"x": object()})
+        self.assertRaises(InvalidOperation, self.buffer.insert, "db.c",
+                          [], True)
+        self.assertRaises(InvalidOperation, self.buffer.insert, "db.c",
+                          5, True)
+        self.assertRaises(InvalidDocument, self.buffer.finish, True,
+                          {"w": object()})
+        self.assertEqual(1, self.buffer.count)
+        self.assertEqual(size, len(self.buffer))
+        self.buffer.insert("db.c", [{"b": 2}], True)
+        self.assertEqual(self.expected(message.insert("db.c",
+                                                      [{"a": 1}, {"b": 2}],
+                                                      True, False, {})),
+                         self.bodies())
+
+    def test_errors_restore_message_length(self):
+        # A failed insert into the open message leaves its length alone.
+        self.buffer.insert("db.c", [{"a": 1}], True)
+        self.assertRaises(InvalidDocument, self.buffer.insert, "db.c",
+                          [{"b": 2}, {"$bad": 1}], True)
+        self.assertEqual(self.expected(message.insert("db.c", [{"a": 1}],
+                                                      True, False, {})),
+                         self.bodies())
+
+        # Even if the documents before the failure split the message.
+        docs = [{"x": "y" * 20} for _ in range(3)]
+        self.buffer.insert("db.c", docs[:1], False)
+        self.assertRaises(InvalidDocument, self.buffer.insert, "db.c",
+                          docs[1:] + [{"$bad": 1}], True)
+        self.assertEqual(self.expected(message.insert("db.c", docs[:1],
+                                                      False, False, {})),
+                         self.bodies())
+
+
+class TestMessages(unittest.TestCase):
+
+    def test_delete(self):
+        (request_id, data, max_size) = message.delete("db.c", {"x": 1},
+                                                      False, {})
+        encoded = BSON.encode({"x": 1})
+        self.assertEqual(len(encoded), max_size)
+        self.assertEqual(struct.pack("<iiii", len(data), request_id, 0, 2006) +
+                         b"\x00\x00\x00\x00db.c\x00\x00\x00\x00\x00" +
+                         encoded, data)
+
+        (request_id, data, _) = message.delete("db.c", {}, True, {"w": 1})
+        (length,) = struct.unpack("<i", data[:4])
+        (_, last_error_id, _, operation) = struct.unpack("<iiii",
+                                                         data[length:][:16])
+        self.assertEqual(request_id, last_error_id)
+        self.assertEqual(2004, operation)
+
+    def test_kill_cursors(self):
+        (request_id, data) = message.kill_cursors([1, -2, 2 ** 62])
+        self.assertEqual(struct.pack("<iiiiii", 48, request_id, 0, 2007, 0, 3) +
+                         struct.pack("<qqq", 1, -2, 2 ** 62), data)
+        (_, data) = message.kill_cursors([])
+        self.assertEqual(24, len(data))
+
+    def test_stats(self):
+        if not pymongo.has_c():
+            self.assertEqual(None, message.stats())
+            raise SkipTest()
+        message.stats(True)
+        (_, insert, _) = message.insert("db.c", [{"a": 1}, {"b": 2}], True,
+                                        True, {})
+        (_, query, _) = message.query(0, "db.c", 0, 0, {})
+        bulk = message.bulk_buffer(1000, 1000)
+        bulk.delete("db.c", {})
+        bulk.update("db.c", False, False, {}, {"a": 1})
+        (_, data) = bulk.finish(False, {})
+        stats = message.stats(True)
+        self.assertEqual(3, stats["messages"])
+        self.assertEqual(len(insert) + len(query) + len(data),
+                         stats["message_bytes"])
+        self.assertEqual(0, message.stats()["messages"])
+
+        reply = struct.pack("<iqii", 0, 0, 0, 1) + BSON.encode({"a": 1})
+        helpers._unpack_response(reply)
+        stats = message.stats()
+        self.assertEqual(1, stats["replies"])
+        self.assertEqual(len(reply), stats["reply_bytes"])
+
+
+if __name__ == "__main__":
+    unittest.main()
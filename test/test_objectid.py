@@ -134,6 +134,34 @@ class TestObjectId(unittest.TestCase):
     def test_pickling(self):
         orig = ObjectId()
         self.assertEqual(orig, pickle.loads(pickle.dumps(orig)))
+        for protocol in range(pickle.HIGHEST_PROTOCOL + 1):
+            self.assertEqual(orig,
+                             pickle.loads(pickle.dumps(orig, protocol)))
+
+    def test_setstate(self):
+        oid = ObjectId()
+        oid.__setstate__(b"123456789012")
+        self.assertEqual(ObjectId(b"123456789012"), oid)
+        oid.__setstate__({"_ObjectId__id": b"210987654321"})
+        self.assertEqual(ObjectId(b"210987654321"), oid)
+        self.assertEqual(b"210987654321", oid.__getstate__())
+
+    def test_hash(self):
+        a = ObjectId()
+        self.assertEqual(hash(a), hash(ObjectId(str(a))))
+        self.assertEqual(1, {a: 1}[ObjectId(a.binary)])
+        self.assertEqual(100, len(set(ObjectId() for _ in range(100))))
+
+    def test_subclass(self):
+        class MyObjectId(ObjectId):
+            pass
+
+        a = MyObjectId()
+        self.assertTrue(isinstance(a, ObjectId))
+        self.assertEqual(a, ObjectId(a))
+        self.assertEqual(str(a), str(MyObjectId(str(a))))
+        self.assertTrue(isinstance(MyObjectId.from_datetime(
+            datetime.datetime(2010, 1, 1)), MyObjectId))
 
 ##    def test_pickle_backwards_compatability(self):
 ##        # Python3 ist nicht backwards compatible da __id jetzt ein bytes ist und kein str
@@ -16,6 +16,8 @@
 
 import os
 import random
+import select
+import socket
 import sys
 import threading
 import time
@@ -24,8 +26,9 @@ sys.path[0:0] = [""]
 
 from nose.plugins.skip import SkipTest
 
+from pymongo import connection
 from pymongo.connection import Connection, _Pool
-from pymongo.errors import ConfigurationError
+from pymongo.errors import ConfigurationError, ConnectionFailure
 from .test_connection import get_connection
 
 N = 50
@@ -290,5 +293,185 @@ class TestPooling(unittest.TestCase):
         self.assert_(abs(4 - len(c._Connection__pool.sockets)) < 4)
 
 
+class GetSocket(threading.Thread):
+
+    def __init__(self, pool, address):
+        threading.Thread.__init__(self)
+        self.pool = pool
+        self.address = address
+        self.sock = None
+        self.error = None
+
+    def run(self):
+        try:
+            self.sock = self.pool.get_socket(*self.address)[0]
+            self.pool.return_socket()
+        except ConnectionFailure as e:
+            self.error = e
+
+
+class HoldSocket(threading.Thread):
+
+    def __init__(self, pool, address):
+        threading.Thread.__init__(self)
+        self.pool = pool
+        self.address = address
+        self.checked_out = threading.Event()
+        self.release = threading.Event()
+
+    def run(self):
+        self.sock = self.pool.get_socket(*self.address)[0]
+        self.checked_out.set()
+        self.release.wait()
+        self.pool.return_socket()
+
+
+class TestPool(unittest.TestCase):
+    """Test _Pool against a socket that accepts connections but isn't
+    a server, so these tests don't need one.
+    """
+
+    def setUp(self):
+        self.listener = socket.socket()
+        self.listener.bind(("127.0.0.1", 0))
+        self.listener.listen(16)
+        self.address = self.listener.getsockname()
+
+    def tearDown(self):
+        self.listener.close()
+
+    def test_checkout_and_return(self):
+        p = _Pool(1, None)
+        (a, from_pool) = p.get_socket(*self.address)
+        self.assertFalse(from_pool)
+        self.assertEqual((a, True), p.get_socket(*self.address))
+        p.return_socket()
+        self.assertEqual([a], p.sockets)
+        self.assertEqual((a, True), p.get_socket(*self.address))
+
+        t = GetSocket(p, self.address)
+        t.start()
+        t.join()
+        b = t.sock
+        self.assertNotEqual(a, b)
+        p.return_socket()
+        # Only one idle socket is kept.
+        self.assertEqual([b], p.sockets)
+        self.assertEqual(-1, a.fileno())
+
+        stats = p.stats()
+        self.assertEqual(3, stats["checkouts"])
+        self.assertEqual(2, stats["creations"])
+        self.assertEqual(1, stats["open"])
+        self.assertEqual(1, stats["idle"])
+
+    def test_dead_socket(self):
+        p = _Pool(10, None)
+        (a, _) = p.get_socket(*self.address)
+        p.return_socket()
+        (server_side, _) = self.listener.accept()
+        server_side.close()
+        select.select([a], [], [], 1)
+
+        # Recently returned sockets aren't checked.
+        self.assertEqual(a, p.get_socket(*self.address)[0])
+        p.return_socket()
+        interval = connection._IDLE_CHECK_INTERVAL
+        connection._IDLE_CHECK_INTERVAL = 0
+        try:
+            (b, from_pool) = p.get_socket(*self.address)
+        finally:
+            connection._IDLE_CHECK_INTERVAL = interval
+        self.assertNotEqual(a, b)
+        self.assertFalse(from_pool)
+        self.assertEqual(-1, a.fileno())
+        self.assertEqual(1, p.stats()["liveness_checks"])
+        self.assertEqual(1, p.stats()["dead_sockets"])
+        self.assertEqual(1, p.stats()["open"])
+
+    def test_max_connections(self):
+        p = _Pool(10, None, 1, 0.1)
+        (a, _) = p.get_socket(*self.address)
+        t = GetSocket(p, self.address)
+        t.start()
+        t.join()
+        self.assertTrue(isinstance(t.error, ConnectionFailure))
+        self.assertEqual(1, p.stats()["waits"])
+        self.assertTrue(p.stats()["wait_time"] >= 0.1)
+
+        p = _Pool(10, None, 1)
+        (a, _) = p.get_socket(*self.address)
+        t = GetSocket(p, self.address)
+        t.start()
+        while not p.waiters:
+            time.sleep(0.01)
+        p.return_socket()
+        t.join()
+        self.assertEqual(a, t.sock)
+        self.assertEqual(1, p.stats()["creations"])
+
+        p = _Pool(10, None, 1, None, 0)
+        p.get_socket(*self.address)
+        t = GetSocket(p, self.address)
+        t.start()
+        t.join()
+        self.assertTrue(isinstance(t.error, ConnectionFailure))
+        self.assertEqual(0, p.stats()["waits"])
+
+    def test_reset(self):
+        p = _Pool(10, None)
+        (a, _) = p.get_socket(*self.address)
+        p.warm(self.address[0], self.address[1], 1)
+        idle = p.sockets[0]
+        p.reset()
+        self.assertEqual(None, p.sock)
+        self.assertEqual([], p.sockets)
+        self.assertEqual(-1, a.fileno())
+        self.assertEqual(-1, idle.fileno())
+
+        # Sockets other threads checked out aren't returned to the pool.
+        t = HoldSocket(p, self.address)
+        t.start()
+        t.checked_out.wait()
+        p.reset()
+        t.release.set()
+        t.join()
+        self.assertEqual([], p.sockets)
+        self.assertEqual(-1, t.sock.fileno())
+
+    def test_warm(self):
+        p = _Pool(4, None)
+        p.warm(self.address[0], self.address[1], 2)
+        self.assertEqual(2, len(p.sockets))
+        # Warmed sockets have to be authenticated like new ones.
+        self.assertFalse(p.get_socket(*self.address)[1])
+        p.warm(self.address[0], self.address[1], 10)
+        self.assertEqual(4, len(p.sockets))
+        self.assertEqual(5, p.stats()["open"])
+
+        p = _Pool(4, None, 2)
+        p.warm(self.address[0], self.address[1], 4)
+        self.assertEqual(2, len(p.sockets))
+
+    def test_options(self):
+        c = Connection("mongodb://localhost/?maxConnections=5&"
+                       "waitQueueTimeoutMS=500&waitQueueMultiple=2",
+                       _connect=False)
+        pool = c._Connection__pool
+        self.assertEqual(5, pool.max_connections)
+        self.assertEqual(0.5, pool.wait_queue_timeout)
+        self.assertEqual(10, pool.max_waiters)
+        pool = Connection(_connect=False, maxconnections=3)._Connection__pool
+        self.assertEqual(3, pool.max_connections)
+        self.assertEqual(None, pool.wait_queue_timeout)
+        self.assertEqual(None, pool.max_waiters)
+
+        self.assertRaises(ValueError, Connection, _connect=False,
+                          maxconnections=-1)
+        self.assertRaises(ConfigurationError, Connection,
+                          "mongodb://localhost/?minPoolSize=foo",
+                          _connect=False)
+
+
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,136 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Tests for the raw_bson module."""
+
+import collections.abc
+import datetime
+import unittest
+import sys
+sys.path[0:0] = [""]
+
+from nose.plugins.skip import SkipTest
+
+import bson
+from bson import (BSON,
+                  decode_all)
+from bson.dbref import DBRef
+from bson.errors import InvalidBSON
+from bson.objectid import ObjectId
+from bson.raw_bson import RawBSONDocument
+from bson.son import SON
+from bson.tz_util import utc
+
+
+class TestRawBSONDocument(unittest.TestCase):
+
+    def setUp(self):
+        self.doc = SON([("_id", ObjectId()),
+                        ("name", "mike"),
+                        ("sub", {"a": [1, {"b": 2}], "c": "d"}),
+                        ("date", datetime.datetime(2011, 3, 5, 10, 20, 30,
+                                                   123000)),
+                        ("ref", DBRef("coll", 5))])
+        self.bson = BSON.encode(self.doc)
+
+    def test_constructor(self):
+        self.assertRaises(TypeError, RawBSONDocument, "not bytes")
+        self.assertRaises(InvalidBSON, RawBSONDocument, b"\x05\x00\x00")
+        self.assertRaises(InvalidBSON, RawBSONDocument,
+                          b"\x05\x00\x00\x00\x01")
+        self.assertRaises(InvalidBSON, RawBSONDocument,
+                          b"\x06\x00\x00\x00\x00")
+        self.assertEqual(0, len(RawBSONDocument(b"\x05\x00\x00\x00\x00")))
+
+    def test_access(self):
+        raw = RawBSONDocument(self.bson)
+        self.assertEqual(self.bson, raw.raw)
+        self.assertEqual(self.doc["_id"], raw["_id"])
+        self.assertEqual("mike", raw["name"])
+        self.assertEqual("mike", raw.get("name"))
+        self.assertEqual(None, raw.get("missing"))
+        self.assertEqual(5, raw.get("missing", 5))
+        self.assertRaises(KeyError, lambda: raw["missing"])
+        self.assertTrue("name" in raw)
+        self.assertFalse("missing" in raw)
+        self.assertEqual(5, len(raw))
+        self.assertEqual(["_id", "name", "sub", "date", "ref"], raw.keys())
+        self.assertEqual(raw.keys(), list(raw))
+        self.assertEqual(list(zip(raw.keys(), raw.values())), raw.items())
+        self.assertEqual(DBRef("coll", 5), raw["ref"])
+        self.assertEqual(self.doc["date"], raw["date"])
+        self.assertTrue(isinstance(raw, collections.abc.Mapping))
+
+    def test_nested(self):
+        raw = RawBSONDocument(self.bson)
+        sub = raw["sub"]
+        self.assertTrue(isinstance(sub, RawBSONDocument))
+        self.assertEqual("d", sub["c"])
+        self.assertTrue(isinstance(sub["a"][1], RawBSONDocument))
+        self.assertEqual(2, sub["a"][1]["b"])
+        self.assertEqual({"a": [1, {"b": 2}], "c": "d"}, sub)
+
+    def test_nested_share_data(self):
+        if not bson.has_c():
+            raise SkipTest()
+        data = BSON.encode({"a": [{"b": 1}, {"c": [{"d": 2}]}]})
+        raw = RawBSONDocument(data)
+        refs = sys.getrefcount(data)
+        # Documents in arrays point into the parent's data, however deep
+        docs = raw["a"]
+        inner = docs[1]["c"][0]
+        self.assertEqual(refs + 3, sys.getrefcount(data))
+        self.assertEqual(2, inner["d"])
+        self.assertEqual(BSON.encode({"d": 2}), inner.raw)
+
+        # as do those decode_all returns (from immutable data)
+        docs = decode_all(data + data, RawBSONDocument)
+        self.assertEqual({"d": 2}, docs[1]["a"][1]["c"][0])
+
+    def test_equality(self):
+        raw = RawBSONDocument(self.bson)
+        self.assertEqual(RawBSONDocument(self.bson), raw)
+        self.assertEqual(dict(self.doc), raw)
+        self.assertNotEqual(RawBSONDocument(BSON.encode({"a": 1})), raw)
+        self.assertEqual(dict(self.doc), dict(raw))
+
+    def test_decode(self):
+        decoded = BSON(self.bson).decode(as_class=RawBSONDocument)
+        self.assertTrue(isinstance(decoded, RawBSONDocument))
+        self.assertEqual(self.doc, decoded)
+        self.assertEqual(self.doc, decoded.decode())
+        self.assertEqual(SON, type(decoded["sub"].decode(SON)))
+
+        docs = decode_all(self.bson + BSON.encode({"x": 1}), RawBSONDocument)
+        self.assertEqual(2, len(docs))
+        self.assertEqual(self.bson, docs[0].raw)
+        self.assertEqual(1, docs[1]["x"])
+        self.assertEqual(utc, docs[0]["date"].tzinfo)
+
+    def test_encode(self):
+        raw = RawBSONDocument(self.bson)
+        self.assertEqual(self.bson, BSON.encode(raw))
+        self.assertEqual({"wrapped": self.doc},
+                         BSON.encode({"wrapped": raw}).decode())
+
+    def test_invalid(self):
+        # The pure Python decoder doesn't check string lengths.
+        if not bson.has_c():
+            raise SkipTest()
+        raw = RawBSONDocument(b"\x0c\x00\x00\x00\x02a\x00\xff\x00\x00\x00\x00")
+        self.assertRaises(InvalidBSON, len, raw)
+
+
+if __name__ == "__main__":
+    unittest.main()
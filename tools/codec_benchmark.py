@@ -0,0 +1,270 @@
+# Copyright 2009-2010 10gen, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Server-free benchmarks for the BSON codec and the message builders.
+
+Unlike benchmark.py this doesn't need a server: it times encoding,
+decoding and building messages over a generated corpus of document
+shapes, so changes to the codec aren't hidden by network noise::
+
+  $ python tools/codec_benchmark.py --json before.json
+  $ python tools/codec_benchmark.py --compare before.json --threshold 5
+
+For each benchmark it reports the documents and megabytes (of BSON)
+handled per second in the median trial, the relative standard deviation
+of the trials, and the number of memory blocks still allocated per
+document while the results are kept (roughly, the objects decoding a
+document creates). ``--compare`` exits with status 1 if any benchmark
+got slower than ``--threshold`` allows.
+"""
+
+import argparse
+import datetime
+import json
+import platform
+import random
+import statistics
+import sys
+import time
+sys.path[0:0] = [""]
+
+import bson
+import pymongo
+from bson.objectid import ObjectId
+from pymongo import message
+
+
+def wide(rng, i):
+    """A document with many top-level fields of mixed types."""
+    doc = {"_id": i}
+    for j in range(200):
+        kind = j % 3
+        if kind == 0:
+            doc["int_%d" % j] = rng.randint(-2 ** 31, 2 ** 31 - 1)
+        elif kind == 1:
+            doc["float_%d" % j] = rng.random()
+        else:
+            doc["str_%d" % j] = "value %d" % rng.randint(0, 10 ** 6)
+    return doc
+
+
+def deep(rng, i):
+    """A document nested 50 levels deep."""
+    doc = {"leaf": rng.random()}
+    for depth in range(50):
+        doc = {"depth": depth, "name": "level %d" % depth, "child": doc}
+    doc["_id"] = i
+    return doc
+
+
+def arrays(rng, i):
+    """A document made mostly of arrays of numbers and of documents."""
+    return {"_id": i,
+            "ints": [rng.randint(0, 10 ** 6) for _ in range(100)],
+            "floats": [rng.random() for _ in range(100)],
+            "points": [{"x": rng.random(), "y": rng.random()}
+                       for _ in range(20)],
+            "tags": ["tag%d" % rng.randint(0, 100) for _ in range(20)]}
+
+
+def strings(rng, i):
+    """A document made mostly of long, partly non-ASCII, strings."""
+    doc = {"_id": i}
+    for j in range(50):
+        length = rng.randint(100, 1000)
+        text = "".join(rng.choice("abcdefghij é中") for _ in
+                       range(length))
+        doc["text_%d" % j] = text
+    return doc
+
+
+def datetimes(rng, i):
+    """A document holding 100 datetimes."""
+    start = datetime.datetime(2000, 1, 1)
+    return dict([("_id", i)] +
+                [("date_%d" % j,
+                  start + datetime.timedelta(milliseconds=rng.randint(
+                      0, 10 ** 12)))
+                 for j in range(100)])
+
+
+def objectids(rng, i):
+    """A document holding 100 ObjectIds, in fields and an array."""
+    def oid():
+        return ObjectId(bytes(rng.getrandbits(8) for _ in range(12)))
+    doc = dict(("ref_%d" % j, oid()) for j in range(50))
+    doc["_id"] = oid()
+    doc["refs"] = [oid() for _ in range(50)]
+    return doc
+
+
+SHAPES = [wide, deep, arrays, strings, datetimes, objectids]
+
+
+def build_corpus(docs, seed):
+    """Generate `docs` documents of each shape.
+
+    Returns a list of (name, documents, encoded documents) tuples.
+    """
+    corpus = []
+    for shape in SHAPES:
+        rng = random.Random(seed)
+        documents = [shape(rng, i) for i in range(docs)]
+        encoded = [bson.BSON.encode(doc) for doc in documents]
+        corpus.append((shape.__name__, documents, encoded))
+    return corpus
+
+
+def benchmarks(documents, encoded):
+    """The benchmarks for one shape, as (name, function) pairs.
+
+    Each function handles every document once and returns the results.
+    """
+    data = b"".join(encoded)
+    return [
+        ("_dict_to_bson",
+         lambda: [bson._dict_to_bson(doc, False) for doc in documents]),
+        ("_bson_to_dict",
+         lambda: [bson._bson_to_dict(doc, dict, False) for doc in encoded]),
+        ("decode_all",
+         lambda: bson.decode_all(data)),
+        ("_insert_message",
+         lambda: message.insert("bench.coll", documents, False, False, {})),
+        ("_update_message",
+         lambda: [message.update("bench.coll", False, False,
+                                 {"_id": doc["_id"]}, doc, False, {})
+                  for doc in documents]),
+        ("_query_message",
+         lambda: [message.query(0, "bench.coll", 0, 0, doc)
+                  for doc in documents]),
+    ]
+
+
+def measure(function, docs, size, repeat, min_time):
+    """Time `function`, which handles `docs` documents of `size` bytes.
+    """
+    # Run enough loops that each trial takes at least `min_time`.
+    loops = 1
+    while True:
+        start = time.perf_counter()
+        for _ in range(loops):
+            function()
+        if time.perf_counter() - start >= min_time:
+            break
+        loops *= 2
+
+    seconds = []
+    for _ in range(repeat):
+        start = time.perf_counter()
+        for _ in range(loops):
+            function()
+        seconds.append((time.perf_counter() - start) / loops)
+
+    before = sys.getallocatedblocks()
+    results = function()
+    blocks = sys.getallocatedblocks() - before
+    del results
+
+    median = statistics.median(seconds)
+    return {"docs_per_sec": docs / median,
+            "mb_per_sec": size / median / 1e6,
+            "rel_stdev": (len(seconds) > 1 and
+                          statistics.stdev(seconds) / statistics.mean(seconds)
+                          or 0.0),
+            "blocks_per_doc": float(blocks) / docs,
+            "seconds": seconds}
+
+
+def run(options):
+    corpus = build_corpus(options.docs, options.seed)
+    results = {}
+    for (shape, documents, encoded) in corpus:
+        size = sum(len(doc) for doc in encoded)
+        for (name, function) in benchmarks(documents, encoded):
+            key = "%s/%s" % (name, shape)
+            if options.filter and options.filter not in key:
+                continue
+            result = measure(function, len(documents), size, options.repeat,
+                             options.min_time)
+            results[key] = result
+            print("%-32s %12.0f docs/s %9.2f MB/s  +-%4.1f%% %8.1f blocks/doc"
+                  % (key, result["docs_per_sec"], result["mb_per_sec"],
+                     100 * result["rel_stdev"], result["blocks_per_doc"]))
+    return {"python": platform.python_version(),
+            "implementation": platform.python_implementation(),
+            "platform": platform.platform(),
+            "pymongo": pymongo.version,
+            "c_extensions": bson.has_c() and pymongo.has_c(),
+            "docs": options.docs,
+            "seed": options.seed,
+            "results": results}
+
+
+def compare(report, baseline, threshold):
+    """Print how `report` compares to `baseline`.
+
+    Returns the names of the benchmarks that are slower than
+    `threshold` percent allows.
+    """
+    if report["c_extensions"] != baseline["c_extensions"]:
+        print("warning: only one run used the C extensions")
+    slower = []
+    for (key, result) in sorted(report["results"].items()):
+        if key not in baseline["results"]:
+            continue
+        ratio = (result["docs_per_sec"] /
+                 baseline["results"][key]["docs_per_sec"])
+        flag = ""
+        if ratio < 1 - threshold / 100.0:
+            slower.append(key)
+            flag = "  SLOWER"
+        print("%-32s %6.2fx%s" % (key, ratio, flag))
+    return slower
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--docs", type=int, default=100,
+                        help="documents of each shape (default 100)")
+    parser.add_argument("--repeat", type=int, default=5,
+                        help="trials of each benchmark (default 5)")
+    parser.add_argument("--min-time", type=float, default=0.1,
+                        help="minimum seconds per trial (default 0.1)")
+    parser.add_argument("--seed", type=int, default=0,
+                        help="seed for generating the corpus (default 0)")
+    parser.add_argument("--filter",
+                        help="only run benchmarks whose name contains this")
+    parser.add_argument("--json", metavar="FILE",
+                        help="write the results to FILE as JSON")
+    parser.add_argument("--compare", metavar="FILE",
+                        help="compare to the JSON results in FILE")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="with --compare, fail if a benchmark is this "
+                        "many percent slower (default 10)")
+    options = parser.parse_args()
+
+    report = run(options)
+    if options.json:
+        with open(options.json, "w") as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+    if options.compare:
+        with open(options.compare) as f:
+            baseline = json.load(f)
+        print("")
+        if compare(report, baseline, options.threshold):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()